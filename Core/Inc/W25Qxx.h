@@ -11,13 +11,141 @@
 // Comment out for some extra debugging info
 //#define QSPIDEBUG				1
 
-#define FS_SIZE                 (1024 * 1024 * 8)                   // 8Mbyte **check the same in ios file else -5 error **
-#define FS_PAGE_SIZE            256									// Winbond W25Qxx 256 Page program
-#define FS_SECTOR_SIZE          4096								// Winbond W25Qxx minimum erase size
+// Uncomment for two W25Qxx in dual-flash mode (BK1 and BK2 pins set up in CubeMX), even bytes are
+// stored in FLASH1 and odd bytes in FLASH2. The pair is used as one device with twice the size, page,
+// sector and block size, every command goes to both dies and status polls wait for both
+//#define QSPI_DUAL_FLASH		1
+#ifdef QSPI_DUAL_FLASH
+#define QSPI_DIES				2
+#else
+#define QSPI_DIES				1
+#endif
+
+#ifndef FS_SIZE
+#define FS_SIZE                 (1024 * 1024 * 8 * QSPI_DIES)       // 8Mbyte **check the same in ios file else -5 error **
+#endif
+#define FS_PAGE_SIZE            (256 * QSPI_DIES)					// Winbond W25Qxx 256 Page program
+#define FS_SECTOR_SIZE          (4096 * QSPI_DIES)					// Winbond W25Qxx minimum erase size
+
+// Uncomment to move the data phase of QSPI reads and page programs to MDMA
+//#define QSPI_USE_DMA			1
+#define QSPI_DMA_MIN_SIZE		32									// Smaller transfers are cheaper in polling mode
+#define QSPI_DMA_BUFSIZE		(FS_SECTOR_SIZE/4)					// Bounce buffer for non cache line aligned buffers
+
+// Uncomment to serve littlefs reads from the memory mapped window, the driver only drops back to
+// indirect mode for program and erase operations
+//#define QSPI_MEMMAPPED_READ	1
+#define QSPI_MAPPED_BASE		0x90000000							// QUADSPI memory mapped window
+
+// Uncomment to let reads suspend an erase or page program in progress (0x75) and resume it (0x7A)
+// afterwards. Erases and programs then wait in a status polling loop that calls QSPI_BusyCallback(),
+// CSP_QSPI_Read calls made from this callback are served within ~tSUS instead of after the erase
+//#define QSPI_SUSPEND_RESUME	1
+#define QSPI_SUSPEND_US			20									// tSUS, suspend latency and min. resume to suspend time
+
+// Uncomment to read the JEDEC SFDP tables at init and take the flash size, erase opcodes and the fastest
+// read mode from them instead of the W25Q64JV defines below. FS_SIZE is then the largest part supported,
+// it sizes the RAM bitmaps, and a smaller part is formatted with its own size. Parts over 16Mbyte are
+// addressed with the 4-byte opcodes of the SFDP 4-byte address table, or else in 4-byte mode (0xB7)
+//#define QSPI_SFDP				1
+
+// Uncomment to switch the flash to QPI mode (4-4-4) after init, instructions then take 2 instead of 8
+// clocks and status polls, erases and page programs no longer have single line phases. Needs a part
+// with QPI support (0x38), like the W25Q64JV-IM/JM (DTR) or the W25Q64FV
+//#define QSPI_QPI_MODE			1
+#define QPI_READ_PARAMS			0x20								// 0xC0 P5-P4=10: 6 dummy clocks, up to 104MHz
+
+// Uncomment to read with Fast Read Quad I/O DTR (0xED, 0xEE with 4-byte opcodes) when the SFDP tables
+// report DTR support, or always with the W25Q64JV defaults (a -IM/-JM part). Address and data then use
+// both clock edges at QSPI_DTR_PRESCALER. Init and mount compare a DTR read of block 0 to an SDR read
+// to pick the DDR hold timing, DTR stays off when neither matches or block 0 is blank
+//#define QSPI_DTR_READ			1
+#define QSPI_DTR_PRESCALER		2									// 240MHz/3, DTR reads up to 80MHz
+#define DUMMY_CLOCK_CYCLES_READ_DTR	8								// 1 mode clock and 7 dummy clocks
+#define QSPI_DTR_CAL_SIZE		256									// Timing check read
+#define QSPI_DTR_BUSY_US		10									// Longest wait for BUSY low before CR changes
+
+// Uncomment for the non-blocking CSP_QSPI_*Async functions, they return once the transfer or erase
+// is started and report completion through a callback from QUADSPI_IRQHandler
+//#define QSPI_ASYNC			1
+#define QSPI_ASYNC_WEL_TIMEOUT_MS	2								// WEL sets when 0x06 ends, no answer fails the request
+
+// Uncomment to size the littlefs lookahead buffer for the whole device, a single filesystem
+// traversal then finds every free block instead of 256 blocks per traversal
+//#define STMLFS_FULL_LOOKAHEAD	1
+#ifdef STMLFS_FULL_LOOKAHEAD
+#define STMLFS_LOOKAHEAD_SIZE	(FS_SIZE/FS_SECTOR_SIZE/8)			// 256 bytes, one bit per block
+#else
+#define STMLFS_LOOKAHEAD_SIZE	32									// 256 blocks
+#endif
+
+// Uncomment to save the lookahead buffer at unmount so the first write after mount needs no full
+// filesystem traversal, uses user attribute types 0xfe/0xff on "/". An unmount after blocks were
+// allocated commits one page (two with STMLFS_FULL_LOOKAHEAD) to the superblock pair, which then
+// needs an erase about every 14 such unmounts
+//#define STMLFS_LOOKAHEAD_SNAPSHOT	1
+
+// stmlfs_maintain compacts metadata pairs filled beyond this in idle time, so littlefs rarely has to
+// compact one in the middle of a write. At least FS_SECTOR_SIZE/2, compacted pairs use up to about half
+#define STMLFS_COMPACT_THRESH	(FS_SECTOR_SIZE*3/4)
+
+// Uncomment to bound a littlefs metadata commit to the compaction (or split) of one metadata block
+// filled up to STMLFS_METADATA_MAX bytes. Relocating worn metadata pairs and erasing the spare block
+// of filling pairs is left to stmlfs_maintain in idle time. Without it commits still relocate a pair
+// one block_cycles cycle late
+//#define STMLFS_BOUNDED_COMMIT	1
+#define STMLFS_METADATA_MAX		(FS_SECTOR_SIZE/2)					// Multiple of FS_PAGE_SIZE
+
+// Uncomment to read a sector back before erasing it and skip the erase when it is already all 0xFF,
+// a 4K read takes ~0.1ms against ~45ms for a 4K erase
+//#define STMLFS_BLANKCHECK		1
+
+// Uncomment to detect sequential reads in stmlfs_hal_read and fetch up to STMLFS_READAHEAD_SIZE bytes
+// with a single read command, also past the end of a block. Not used with QSPI_MEMMAPPED_READ
+//#define STMLFS_READAHEAD		1
+#define STMLFS_READAHEAD_SIZE	(FS_SECTOR_SIZE*2)					// RAM buffer, largest burst
+#ifdef QSPI_MEMMAPPED_READ
+#undef STMLFS_READAHEAD												// The mapped window has its own prefetch
+#endif
+
+// Uncomment for a write-back cache of STMLFS_BCACHE_SETS x STMLFS_BCACHE_WAYS lines in front of the flash,
+// shared by metadata and all open files. Progs stay in RAM until littlefs calls sync, the dirty lines are
+// then programmed in address order. Read back verification (STMLFS_VERIFY_CRC, also used instead of
+// STMLFS_VERIFY_FULL) runs when a line is written back, so a failed data verify shows up as an
+// LFS_ERR_CORRUPT from lfs_file_sync instead of a relocation
+//#define STMLFS_BCACHE			1
+#define STMLFS_BCACHE_LINE		(FS_PAGE_SIZE*4)					// 1K, at most 8 pages
+#define STMLFS_BCACHE_WAYS		4
+#define STMLFS_BCACHE_SETS		8									// 32K of RAM
+#define STMLFS_BCACHE_ATTR		__ALIGNED(32)						// CubeIDE puts .bss in AXI SRAM (RAM_D1)
+
+// Read back verification of programmed data
+#define STMLFS_VERIFY_OFF		0									// Trust the flash, no read back
+#define STMLFS_VERIFY_CRC		1									// Read back page by page, compare CRCs
+#define STMLFS_VERIFY_FULL		2									// littlefs bulk read back + memcmp of file data
+#ifndef STMLFS_VERIFY
+#define STMLFS_VERIFY			STMLFS_VERIFY_FULL
+#endif
+#if defined(STMLFS_BCACHE) && STMLFS_VERIFY == STMLFS_VERIFY_FULL
+#undef STMLFS_VERIFY												// The littlefs read back would only see the cache
+#define STMLFS_VERIFY			STMLFS_VERIFY_CRC
+#endif
+
+// lfs_crc implementation, all three give the same littlefs CRC-32
+#define STMLFS_CRC_NIBBLE		0									// 16 entry table, smallest code
+#define STMLFS_CRC_SLICE8		1									// Slicing-by-8, 8Kbyte table built in RAM on first use
+#define STMLFS_CRC_HW			2									// STM32H7 CRC unit
+#ifndef STMLFS_CRC
+#define STMLFS_CRC				STMLFS_CRC_NIBBLE
+#endif
 
 #include "lfs_util.h"
 #include "lfs.h"
 #include "quadspi.h"
+#include "sfdp.h"
+#include "qspi_cmd.h"
+
+typedef void (*qspi_callback_t)(uint8_t status, void *context);	// HAL_OK or HAL_ERROR, IRQ context
 
 struct littlfs_fsstat_t {
     lfs_size_t block_size;
@@ -25,6 +153,40 @@ struct littlfs_fsstat_t {
     lfs_size_t blocks_used;
 };
 
+struct stmlfs_erasestat_t {
+    uint32_t sector_erases;                                         // 4K SECTOR_ERASE_CMD issued
+    uint32_t block32_erases;                                        // 32K BLOCK32_ERASE_CMD issued
+    uint32_t block64_erases;                                        // 64K BLOCK_ERASE_CMD issued
+    uint32_t skipped;                                               // littlefs erases of known erased sectors
+    uint32_t blank;                                                 // littlefs erases skipped by the blank check
+    uint32_t preerased;                                             // Sectors erased by stmlfs_preerase
+    uint32_t erase_ms;                                              // Time spent erasing
+};
+
+struct stmlfs_maintstat_t {
+    uint32_t consistent;                                            // Orphan, move or superblock cleanups
+    uint32_t checked;                                               // Metadata pairs checked
+    uint32_t compacted;                                             // Metadata pairs compacted
+    uint32_t lookahead;                                             // Lookahead buffer refills
+    uint32_t preerased;                                             // Sectors erased ahead of use
+    uint32_t elapsed_ms;                                            // Time spent
+    bool done;                                                      // Nothing left to do
+};
+
+struct stmlfs_cachestat_t {
+    uint32_t path_hits;                                             // Path components found in the path cache
+    uint32_t path_misses;                                           // Path components fetched from flash
+    uint32_t name_skips;                                            // Metadata pairs skipped by the name index
+    uint32_t name_fetches;                                          // Metadata pairs fetched by lfs_dir_find
+    uint32_t ctz_hits;                                              // File block lookups started at a cached block
+    uint32_t ctz_misses;                                            // File block lookups started at the file head
+    uint32_t ra_hits;                                               // Driver reads served from the readahead buffer
+    uint32_t ra_bursts;                                             // Readahead fetches from the flash
+    uint32_t bc_hits;                                               // Line reads served from the block cache
+    uint32_t bc_misses;                                             // Line reads that went to the flash
+    uint32_t bc_writebacks;                                         // Dirty lines programmed
+};
+
 
 #ifdef QSPIDEBUG
 	#define qprintf(...)    printf(__VA_ARGS__)		                // Debug messages on UART0
@@ -33,11 +195,12 @@ struct littlfs_fsstat_t {
 #endif
 
 
-/*W25Q64JV memory parameters*/
-#define MEMORY_FLASH_SIZE				0x800000 /* 64Mbit =>8Mbyte */
-#define MEMORY_BLOCK_SIZE				0x10000   /* 128 blocks of 64KBytes */
-#define MEMORY_SECTOR_SIZE				0x1000    /* 4kBytes */
-#define MEMORY_PAGE_SIZE				0x100     /* 256 bytes */
+/*W25Q64JV memory parameters, both dies in dual-flash mode */
+#define MEMORY_FLASH_SIZE				(0x800000 * QSPI_DIES) /* 64Mbit =>8Mbyte */
+#define MEMORY_BLOCK_SIZE				(0x10000 * QSPI_DIES)  /* 128 blocks of 64KBytes */
+#define MEMORY_BLOCK32_SIZE				(0x8000 * QSPI_DIES)   /* 32KBytes half block */
+#define MEMORY_SECTOR_SIZE				(0x1000 * QSPI_DIES)   /* 4kBytes */
+#define MEMORY_PAGE_SIZE				(0x100 * QSPI_DIES)    /* 256 bytes */
 
 
 /*W25Q64JV commands */
@@ -51,6 +214,8 @@ struct littlfs_fsstat_t {
 #define WRITE_STATUS_REG3_CMD       	0x11
 #define SECTOR_ERASE_CMD 				0x20
 #define BLOCK_ERASE_CMD 				0xD8
+#define BLOCK32_ERASE_CMD 				0x52
+#define FAST_READ_CMD					0x0B
 #define QUAD_IN_FAST_PROG_CMD 			0x32
 #define FAST_PROG_CMD 					0x02
 #define QUAD_OUT_FAST_READ_CMD 			0x6B
@@ -61,6 +226,26 @@ struct littlfs_fsstat_t {
 #define READ_JEDEC_ID_CMD 				0x9F
 #define READ_UNIQUE_ID_CMD 				0x4B
 #define READ_SFDP_CMD					0x5A
+#define ERASE_PROG_SUSPEND_CMD			0x75
+#define ERASE_PROG_RESUME_CMD			0x7A
+#define ENTER_QPI_CMD					0x38
+#define EXIT_QPI_CMD					0xFF
+#define SET_READ_PARAM_CMD				0xC0
+#define ENTER_4BYTE_ADDR_CMD			0xB7
+#define FAST_READ_4B_CMD				0x0C
+#define DUAL_OUT_FAST_READ_4B_CMD		0x3C
+#define DUAL_IN_OUT_FAST_READ_4B_CMD	0xBC
+#define QUAD_OUT_FAST_READ_4B_CMD		0x6C
+#define QUAD_IN_OUT_FAST_READ_4B_CMD	0xEC
+#define FAST_PROG_4B_CMD				0x12
+#define QUAD_IN_FAST_PROG_4B_CMD		0x34
+#define QUAD_IN_OUT_DTR_READ_CMD		0xED
+#define QUAD_IN_OUT_DTR_READ_4B_CMD		0xEE
+
+/*W25Q64JV status register bits */
+#define SR1_BUSY						0x01
+#define SR1_WEL							0x02
+#define SR2_SUS							0x80
 
 
 int stmlfs_mount(bool format);
@@ -90,6 +275,11 @@ int stmlfs_removeattr(const char* path, uint8_t type);
 int stmlfs_opencfg(lfs_file_t *file, const char* path, int flags, const struct lfs_file_config* config);
 lfs_soff_t stmlfs_size(lfs_file_t *file);
 int stmlfs_mkdir(const char* path);
+int stmlfs_trim(void);
+int stmlfs_preerase(uint32_t max_erases);
+int stmlfs_maintain(uint32_t budget_ms, struct stmlfs_maintstat_t* stat);
+void stmlfs_erasestat(struct stmlfs_erasestat_t* stat);
+void stmlfs_cachestat(struct stmlfs_cachestat_t* stat);
 const char* stmlfs_errmsg(int err);
 void dump_dir(void);
 
@@ -103,6 +293,7 @@ int stmlfs_hal_sync(const struct lfs_config *c);
 uint8_t CSP_QUADSPI_Init(void);
 uint8_t CSP_QSPI_EraseSector(uint32_t EraseStartAddress ,uint32_t EraseEndAddress);
 uint8_t CSP_QSPI_EraseBlock(uint32_t flash_address);
+uint8_t CSP_QSPI_EraseBlock32(uint32_t flash_address);
 uint8_t CSP_QSPI_WriteMemory(uint8_t* buffer, uint32_t address, uint32_t buffer_size);
 uint8_t CSP_QSPI_EnableMemoryMappedMode(void);
 uint8_t CSP_QSPI_EnableMemoryMappedMode2(void);
@@ -113,5 +304,11 @@ uint8_t QSPI_ReadID(uint32_t *id);
 //uint8_t QSPI_ResetChip(void);
 uint8_t QSPI_ReadUniqueID(uint8_t *pData);
 uint8_t QSPI_ReadSFDP(uint8_t *sfdp);
+const struct sfdp_flash_t* QSPI_FlashInfo(void);
+void QSPI_BusyCallback(void);
+uint8_t CSP_QSPI_ReadAsync(uint8_t* pData, uint32_t ReadAddr, uint32_t Size, qspi_callback_t callback, void *context);
+uint8_t CSP_QSPI_WriteAsync(uint8_t* buffer, uint32_t address, uint32_t buffer_size, qspi_callback_t callback, void *context);
+uint8_t CSP_QSPI_EraseSectorAsync(uint32_t address, qspi_callback_t callback, void *context);
+bool CSP_QSPI_AsyncBusy(void);
 
 #endif /* INC_W25QXX_H_ */
@@ -58,6 +58,50 @@ typedef uint32_t lfs_block_t;
 #define LFS_FILE_MAX 2147483647
 #endif
 
+// Number of directory entries remembered by the path lookup cache in
+// lfs_dir_find, uncomment so repeated opens of the same paths skip the
+// metadata fetches. Entries with names longer than LFS_PATHCACHE_NAME_MAX are
+// not cached. Any metadata commit empties the cache.
+//#define LFS_PATHCACHE_SIZE 8
+#ifndef LFS_PATHCACHE_NAME_MAX
+#define LFS_PATHCACHE_NAME_MAX 32
+#endif
+
+// Number of metadata pairs the name index keeps a filter of name hashes for,
+// uncomment so lfs_dir_find skips the metadata pairs of a large directory that
+// never held the name it looks for instead of fetching and comparing each
+// entry. Should cover the metadata pairs of the largest directory, ~100 bytes
+// each. RAM only, the on-disk format is unchanged.
+//#define LFS_NAMEINDEX_SIZE 32
+#ifndef LFS_NAMEINDEX_BITS
+#define LFS_NAMEINDEX_BITS 512
+#endif
+
+// Default number of entries in the CTZ position cache of a file, uncomment so
+// seeks in large files start the skip-list walk at the nearest block the file
+// handle already found instead of at the file head. Can be changed per file
+// with lfs_file_config.ctz_cache_size, 12 bytes per entry.
+//#define LFS_CTZCACHE_SIZE 16
+
+// Uncomment to keep a count of the blocks in use, lfs_fs_size then only
+// traverses the filesystem once after mount (not at all when the lookahead
+// snapshot holds the count) and returns the count after that. The count is
+// updated by metadata pair allocation, file syncs and removals, and covers
+// committed data only.
+//#define LFS_USAGE_COUNTER 1
+
+// Number of spare blocks lfs_fs_gcstep remembers erasing (with
+// bounded_commit), so a walk restarted by a commit does not erase them again
+#ifndef LFS_GC_ERASED
+#define LFS_GC_ERASED 4
+#endif
+
+// User attribute types reserved for the lookahead snapshot, see
+// lookahead_snapshot in lfs_config
+#ifndef LFS_SNAPSHOT_ATTR
+#define LFS_SNAPSHOT_ATTR 0xfe
+#endif
+
 // Maximum size of custom attributes in bytes, may be redefined, but there is
 // no real benefit to using a smaller LFS_ATTR_MAX. Limited to <= 1022. Stored
 // in superblock and must be respected by other littlefs drivers.
@@ -152,6 +196,15 @@ enum lfs_whence_flags {
     LFS_SEEK_END = 2,   // Seek relative to the end of the file
 };
 
+// Work done by lfs_fs_gcstep
+enum lfs_gcstep {
+    LFS_GC_DONE       = 0, // Nothing left to do
+    LFS_GC_CONSISTENT = 1, // Removed orphans, finished a move or updated the superblock
+    LFS_GC_CHECKED    = 2, // Checked a metadata pair, no compaction needed
+    LFS_GC_COMPACTED  = 3, // Compacted a metadata pair
+    LFS_GC_LOOKAHEAD  = 4, // Populated the lookahead buffer
+};
+
 
 // Configuration provided during initialization of the littlefs
 struct lfs_config {
@@ -235,7 +288,8 @@ struct lfs_config {
     // in the future.
     //
     // Note this only affects lfs_fs_gc. Normal compactions still only occur
-    // when full.
+    // when full. With metadata_max set the threshold is scaled down by
+    // metadata_max/block_size.
     //
     // Set to -1 to disable metadata compaction during lfs_fs_gc.
     lfs_size_t compact_thresh;
@@ -283,6 +337,36 @@ struct lfs_config {
     // Set to -1 to disable inlined files.
     lfs_size_t inline_max;
 
+    // Optionally skip the read-back comparison of programmed file data.
+    // Useful when the block device already verifies its own programs or the
+    // extra reads are not wanted. Metadata commits are still checked through
+    // their CRC. Defaults to validating when false.
+    bool no_validate;
+
+    // Save the lookahead buffer at unmount and reload it at mount, so the
+    // first allocation after mount does not need a full filesystem
+    // traversal. The snapshot is stored as two user attributes on the
+    // superblock (LFS_SNAPSHOT_ATTR and LFS_SNAPSHOT_ATTR+1, shared with
+    // the root directory) and is only trusted when no metadata pair has
+    // been written since. Otherwise mount falls back to a normal scan.
+    // Unmount only commits a snapshot when the lookahead changed since
+    // mount or the last snapshot, writes that allocate no blocks (inline
+    // files, attributes) leave the old one stale and cost a scan later.
+    bool lookahead_snapshot;
+
+    // Bound the work a metadata commit can do to the compaction, or split,
+    // of the metadata pair it writes to, use with a small metadata_max.
+    // Commits then no longer relocate worn metadata pairs (block_cycles) or
+    // expand the superblock, as both update other metadata pairs as well.
+    // lfs_fs_gcstep does this instead, for any pair in the last quarter of
+    // its block_cycles cycle. A pair gcstep has not relocated one cycle
+    // later is relocated (the superblock expanded) by the commit as before,
+    // so wear leveling does not depend on gcstep. gcstep also erases the
+    // spare block of pairs filled beyond half, so their next compaction
+    // finds it erased. This assumes the block device skips the erase of a
+    // block which is still erased.
+    bool bounded_commit;
+
 #ifdef LFS_MULTIVERSION
     // On-disk version to use when writing in the form of 16-bit major version
     // + 16-bit minor version. This limiting metadata to what is supported by
@@ -342,6 +426,15 @@ struct lfs_attr {
     lfs_size_t size;
 };
 
+#ifdef LFS_CTZCACHE_SIZE
+// Entry of the CTZ position cache, block number of a skip-list index
+struct lfs_ctzpos {
+    lfs_off_t index;
+    lfs_block_t block;
+    uint32_t lru;
+};
+#endif
+
 // Optional configuration provided during lfs_file_opencfg
 struct lfs_file_config {
     // Optional statically allocated file buffer. Must be cache_size.
@@ -363,6 +456,15 @@ struct lfs_file_config {
 
     // Number of custom attributes in the list
     lfs_size_t attr_count;
+
+#ifdef LFS_CTZCACHE_SIZE
+    // Optional number of CTZ position cache entries, 0 uses LFS_CTZCACHE_SIZE
+    lfs_size_t ctz_cache_size;
+
+    // Optional statically allocated CTZ position cache. Must be ctz_cache_size
+    // entries. By default lfs_malloc is used to allocate this buffer.
+    struct lfs_ctzpos *ctz_cache;
+#endif
 };
 
 
@@ -414,6 +516,14 @@ typedef struct lfs_file {
     lfs_off_t off;
     lfs_cache_t cache;
 
+#ifdef LFS_CTZCACHE_SIZE
+    struct lfs_ctzcache {
+        struct lfs_ctzpos *entries;
+        lfs_size_t size;
+        uint32_t tick;
+    } ctzcache;
+#endif
+
     const struct lfs_file_config *cfg;
 } lfs_file_t;
 
@@ -455,8 +565,61 @@ typedef struct lfs {
         lfs_block_t next;
         lfs_block_t ckpoint;
         uint8_t *buffer;
+        bool changed;   // since mount or the last lookahead snapshot
     } lookahead;
 
+#ifdef LFS_PATHCACHE_SIZE
+    struct lfs_pathcache {
+        uint32_t tick;
+        uint32_t hits;
+        uint32_t misses;
+        struct lfs_pathcache_entry {
+            lfs_block_t parent[2];
+            lfs_mdir_t dir;
+            uint32_t tag;
+            uint32_t lru;
+            uint8_t namelen;
+            char name[LFS_PATHCACHE_NAME_MAX];
+        } entries[LFS_PATHCACHE_SIZE];
+    } pathcache;
+#endif
+
+#ifdef LFS_NAMEINDEX_SIZE
+    struct lfs_nameindex {
+        uint32_t tick;
+        uint32_t skips;
+        uint32_t fetches;
+        struct lfs_nameindex_entry {
+            lfs_mdir_t dir;
+            uint32_t lru;
+            uint32_t filter[LFS_NAMEINDEX_BITS/32];
+        } entries[LFS_NAMEINDEX_SIZE];
+    } nameindex;
+#endif
+
+#ifdef LFS_CTZCACHE_SIZE
+    struct {
+        uint32_t hits;
+        uint32_t misses;
+    } ctzcache;
+#endif
+
+#ifdef LFS_USAGE_COUNTER
+    struct {
+        bool valid;
+        lfs_size_t blocks;
+    } usage;
+#endif
+
+#ifndef LFS_READONLY
+    struct {
+        lfs_block_t tail[2];
+        bool relocating;
+        lfs_block_t erased[LFS_GC_ERASED];  // by block % LFS_GC_ERASED,
+                                            // not programmed since
+    } gc;
+#endif
+
     const struct lfs_config *cfg;
     lfs_size_t block_count;
     lfs_size_t name_max;
@@ -723,6 +886,17 @@ int lfs_fs_stat(lfs_t *lfs, struct lfs_fsinfo *fsinfo);
 // Returns the number of allocated blocks, or a negative error code on failure.
 lfs_ssize_t lfs_fs_size(lfs_t *lfs);
 
+#ifdef LFS_USAGE_COUNTER
+// Compares the used block count against a filesystem traversal
+//
+// Meant for tests, open files must not hold unsynced data. The count is set
+// to the traversal result either way.
+//
+// Returns LFS_ERR_CORRUPT if the count was wrong, a negative error code on
+// failure, 0 otherwise.
+int lfs_fs_usagecheck(lfs_t *lfs);
+#endif
+
 // Traverse through all blocks in use by the filesystem
 //
 // The provided callback will be called with each block address that is
@@ -760,6 +934,20 @@ int lfs_fs_mkconsistent(lfs_t *lfs);
 // Returns a negative error code on failure. Accomplishing nothing is not
 // an error.
 int lfs_fs_gc(lfs_t *lfs);
+
+// Do one step of the work of lfs_fs_gc
+//
+// A step either makes the filesystem consistent, checks one metadata pair and
+// compacts it if it exceeds compact_thresh, or populates the lookahead buffer,
+// so a single call takes at most about one compaction or one traversal. The
+// metadata pairs are checked once after every change to the metadata, the
+// lookahead buffer is populated again when less than a quarter of it is left.
+// With bounded_commit a step also relocates a worn metadata pair or erases the
+// spare block of a metadata pair, see lfs_config.
+//
+// Returns one of enum lfs_gcstep, LFS_GC_DONE when there is nothing left to
+// do, or a negative error code on failure.
+int lfs_fs_gcstep(lfs_t *lfs);
 #endif
 
 #ifndef LFS_READONLY
@@ -772,6 +960,18 @@ int lfs_fs_gc(lfs_t *lfs);
 int lfs_fs_grow(lfs_t *lfs, lfs_size_t block_count);
 #endif
 
+#ifndef LFS_READONLY
+// Iterate over the free blocks in the current lookahead window
+//
+// The callback is called for each block the block allocator knows to be
+// free and has not handed out yet, in the order they will be allocated.
+// This does not scan the filesystem, nothing is reported if the lookahead
+// buffer is empty (lfs_fs_gc populates it). The callback must not call
+// back into littlefs. A non-zero return from the callback stops the
+// iteration and is returned.
+int lfs_fs_lookahead(lfs_t *lfs, int (*cb)(void*, lfs_block_t), void *data);
+#endif
+
 #ifndef LFS_READONLY
 #ifdef LFS_MIGRATE
 // Attempts to migrate a previous version of littlefs
@@ -0,0 +1,28 @@
+/*
+ * qspi_cmd.h
+ *
+ *  Phase layout of the flash read commands, no HAL dependencies
+ */
+
+#ifndef INC_QSPI_CMD_H_
+#define INC_QSPI_CMD_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "sfdp.h"
+
+struct qspi_cmd_t {
+	uint8_t instruction;
+	uint8_t instruction_lines;										// 1, 2 or 4, always SDR
+	uint8_t address_lines;
+	uint8_t address_bytes;											// 3 or 4
+	uint8_t mode;													// Mode clocks, M7-0 on the address lines
+	uint8_t dummy;													// Wait states after the mode clocks
+	uint8_t data_lines;
+	bool dtr;														// Address and data on both clock edges
+};
+
+void qspi_cmd_read(struct qspi_cmd_t *cmd, const struct sfdp_read_t *read, enum sfdp_readmode mode, uint8_t address_bytes);
+uint32_t qspi_cmd_clocks(const struct qspi_cmd_t *cmd, uint32_t size);
+
+#endif /* INC_QSPI_CMD_H_ */
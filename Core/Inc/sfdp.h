@@ -0,0 +1,94 @@
+/*
+ * sfdp.h
+ *
+ *  JEDEC JESD216 Serial Flash Discoverable Parameters parser, no HAL dependencies
+ */
+
+#ifndef INC_SFDP_H_
+#define INC_SFDP_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define SFDP_SIGNATURE			0x50444653							// "SFDP", little endian
+#define SFDP_BFPT_ID			0xFF00								// Basic Flash Parameter Table
+#define SFDP_4BAIT_ID			0xFF84								// 4-byte Address Instruction Table
+#define SFDP_ERASE_TYPES		4
+
+#define SFDP_OK					0
+#define SFDP_ERR_SIGNATURE		-1									// No "SFDP" at address 0
+#define SFDP_ERR_TABLE			-2									// No BFPT, or it lies outside the buffer
+#define SFDP_ERR_GEOMETRY		-3									// Density, page or erase sizes unusable
+
+// Address bytes, BFPT DWORD1 bits 18:17
+#define SFDP_ADDR_3				0
+#define SFDP_ADDR_3OR4			1
+#define SFDP_ADDR_4				2
+
+// Enter 4-byte addressing methods, BFPT DWORD16 bits 31:24
+#define SFDP_ENTER4_B7			0x01								// Issue 0xB7
+#define SFDP_ENTER4_WREN_B7		0x02								// Issue 0x06, then 0xB7
+#define SFDP_ENTER4_EAR			0x04								// Extended address register
+#define SFDP_ENTER4_BANK		0x08								// Bank register (0x17)
+#define SFDP_ENTER4_NVCR		0x10								// Nonvolatile configuration register
+#define SFDP_ENTER4_OPCODES		0x20								// Dedicated 4-byte instruction set
+#define SFDP_ENTER4_ALWAYS		0x40								// Always in 4-byte mode
+
+// Supported commands, 4BAIT DWORD1
+#define SFDP_4B_READ_111		0x0001								// 0x13
+#define SFDP_4B_FAST_READ_111	0x0002								// 0x0C
+#define SFDP_4B_READ_112		0x0004								// 0x3C
+#define SFDP_4B_READ_122		0x0008								// 0xBC
+#define SFDP_4B_READ_114		0x0010								// 0x6C
+#define SFDP_4B_READ_144		0x0020								// 0xEC
+#define SFDP_4B_PROG_111		0x0040								// 0x12
+#define SFDP_4B_PROG_114		0x0080								// 0x34
+#define SFDP_4B_PROG_144		0x0100								// 0x3E
+#define SFDP_4B_DTR_READ_144	0x8000								// 0xEE
+
+// Read modes, instruction-address-data lines
+enum sfdp_readmode {
+	SFDP_READ_111,													// 0x0B, always supported
+	SFDP_READ_112,
+	SFDP_READ_122,
+	SFDP_READ_114,
+	SFDP_READ_144,
+	SFDP_READ_222,
+	SFDP_READ_444,
+	SFDP_READ_144_DTR,												// 0xED, the BFPT only has the dtr bit
+	SFDP_READ_MODES
+};
+
+struct sfdp_read_t {
+	uint8_t cmd;													// 0 when not supported
+	uint8_t dummy;													// Wait states plus mode clocks
+	uint8_t mode;													// Mode clocks, part of dummy
+};
+
+struct sfdp_erase_t {
+	uint32_t size;													// Bytes, 0 when not supported
+	uint8_t cmd;
+	uint8_t cmd4;													// 4-byte address opcode, 0 when unknown
+	uint32_t typ_ms;												// Typical erase time
+	uint32_t max_ms;												// 0 when the BFPT has no timings
+};
+
+struct sfdp_flash_t {
+	uint8_t major, minor;											// BFPT revision
+	uint32_t size;													// Bytes
+	uint32_t page_size;
+	uint8_t addr_bytes;												// SFDP_ADDR_*
+	uint8_t enter4;													// SFDP_ENTER4_*
+	uint16_t cmds4;													// SFDP_4B_*, 4BAIT present
+	bool dtr;														// DTR clocking supported
+	struct sfdp_read_t read[SFDP_READ_MODES];
+	struct sfdp_erase_t erase[SFDP_ERASE_TYPES];					// Smallest first
+	uint32_t prog_typ_us;											// Page program, 0 when unknown
+	uint32_t prog_max_us;
+};
+
+int sfdp_parse(const uint8_t *sfdp, uint32_t size, struct sfdp_flash_t *flash);
+const struct sfdp_erase_t* sfdp_erase_find(const struct sfdp_flash_t *flash, uint32_t size);
+enum sfdp_readmode sfdp_fastest_read(const struct sfdp_flash_t *flash);
+
+#endif /* INC_SFDP_H_ */
@@ -58,7 +58,7 @@ void SysTick_Handler(void);
 void TIM4_IRQHandler(void);
 void QUADSPI_IRQHandler(void);
 /* USER CODE BEGIN EFP */
-
+void MDMA_IRQHandler(void);
 /* USER CODE END EFP */
 
 #ifdef __cplusplus
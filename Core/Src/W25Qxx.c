@@ -11,15 +11,177 @@
 extern QSPI_HandleTypeDef hqspi;
 #define W25Q_SPI hqspi
 
+#define QSPI_ADDR_3BYTE			0									// 24 bit addresses, first 16Mbyte
+#define QSPI_ADDR_4BYTE_OPCODES	1									// 4-byte opcodes, 0x6B/0xEB stay 24 bit
+#define QSPI_ADDR_4BYTE_MODE	2									// 0xB7, every command takes 32 bits
+static uint8_t qspi_addr4 = QSPI_ADDR_3BYTE;
+static uint8_t qspi_prog_cmd = QUAD_IN_FAST_PROG_CMD;
+#ifdef QSPI_QPI_MODE
+static uint8_t qspi_prog_qpi_cmd = FAST_PROG_CMD;					// 0x32 is SPI only
+#endif
+#define W25Q_ADDRESS_SIZE		(qspi_addr4 != QSPI_ADDR_3BYTE ? QSPI_ADDRESS_32_BITS : QSPI_ADDRESS_24_BITS)
+#define W25Q_FIXED_ADDRESS_SIZE	(qspi_addr4 == QSPI_ADDR_4BYTE_MODE ? QSPI_ADDRESS_32_BITS : QSPI_ADDRESS_24_BITS)
+
+#ifdef QSPI_QPI_MODE
+static bool qspi_qpi = false;										// Flash in QPI (4-4-4) mode
+#define W25Q_INSTRUCTION_LINES	(qspi_qpi ? QSPI_INSTRUCTION_4_LINES : QSPI_INSTRUCTION_1_LINE)
+#define W25Q_ADDRESS_LINES		(qspi_qpi ? QSPI_ADDRESS_4_LINES : QSPI_ADDRESS_1_LINE)
+#define W25Q_DATA_LINES			(qspi_qpi ? QSPI_DATA_4_LINES : QSPI_DATA_1_LINE)
+#define W25Q_PROG_CMD			(qspi_qpi ? qspi_prog_qpi_cmd : qspi_prog_cmd)
+#else
+#define W25Q_INSTRUCTION_LINES	QSPI_INSTRUCTION_1_LINE
+#define W25Q_ADDRESS_LINES		QSPI_ADDRESS_1_LINE
+#define W25Q_DATA_LINES			QSPI_DATA_1_LINE
+#define W25Q_PROG_CMD			qspi_prog_cmd
+#endif
+#ifdef QSPI_DUAL_FLASH
+#define W25Q_STATUS(bits)		((bits) | ((bits) << 8))			// Both dies, FLASH1 in the low byte
+#else
+#define W25Q_STATUS(bits)		(bits)
+#endif
+
+static struct sfdp_flash_t qspi_flash = {							// W25Q64JV, QSPI_SFDP replaces it at init
+	.size = MEMORY_FLASH_SIZE,
+	.page_size = MEMORY_PAGE_SIZE,
+	.read = {
+		[SFDP_READ_111] = { FAST_READ_CMD, 8, 0 },
+		[SFDP_READ_114] = { QUAD_OUT_FAST_READ_CMD, DUMMY_CLOCK_CYCLES_READ_QUAD, 0 },
+		[SFDP_READ_144] = { QUAD_IN_OUT_FAST_READ_CMD, 6, 2 },
+#ifdef QSPI_DTR_READ
+		[SFDP_READ_144_DTR] = { QUAD_IN_OUT_DTR_READ_CMD, DUMMY_CLOCK_CYCLES_READ_DTR, 1 },
+#endif
+	},
+	.erase = {
+		{ MEMORY_SECTOR_SIZE, SECTOR_ERASE_CMD, 0, 45, 400 },
+		{ MEMORY_BLOCK32_SIZE, BLOCK32_ERASE_CMD, 0, 120, 1600 },
+		{ MEMORY_BLOCK_SIZE, BLOCK_ERASE_CMD, 0, 150, 2000 },
+	},
+#ifdef QSPI_DTR_READ
+	.dtr = true,
+#endif
+};
+static enum sfdp_readmode qspi_readmode = SFDP_READ_144;
+static const struct {
+	uint32_t instruction, address, alternate, data;
+} qspi_lines[5] = {													// HAL modes for qspi_cmd_t line counts
+	[1] = { QSPI_INSTRUCTION_1_LINE, QSPI_ADDRESS_1_LINE, QSPI_ALTERNATE_BYTES_1_LINE, QSPI_DATA_1_LINE },
+	[2] = { QSPI_INSTRUCTION_2_LINES, QSPI_ADDRESS_2_LINES, QSPI_ALTERNATE_BYTES_2_LINES, QSPI_DATA_2_LINES },
+	[4] = { QSPI_INSTRUCTION_4_LINES, QSPI_ADDRESS_4_LINES, QSPI_ALTERNATE_BYTES_4_LINES, QSPI_DATA_4_LINES },
+};
+#ifdef QSPI_DTR_READ
+#ifdef QSPI_QPI_MODE
+#error "QSPI_DTR_READ reads in SPI mode, it does not combine with QSPI_QPI_MODE"
+#endif
+static uint32_t qspi_dtr_hold = QSPI_DDR_HHC_HALF_CLK_DELAY;		// Set by QSPI_CalibrateDTR
+#endif
+#ifdef QSPI_SFDP
+static const struct {
+	uint16_t cmds4;													// SFDP_4B_* bit
+	uint8_t cmd;
+} qspi_read4[SFDP_READ_MODES] = {
+	[SFDP_READ_111] = { SFDP_4B_FAST_READ_111, FAST_READ_4B_CMD },
+	[SFDP_READ_112] = { SFDP_4B_READ_112, DUAL_OUT_FAST_READ_4B_CMD },
+	[SFDP_READ_122] = { SFDP_4B_READ_122, DUAL_IN_OUT_FAST_READ_4B_CMD },
+	[SFDP_READ_114] = { SFDP_4B_READ_114, QUAD_OUT_FAST_READ_4B_CMD },
+	[SFDP_READ_144] = { SFDP_4B_READ_144, QUAD_IN_OUT_FAST_READ_4B_CMD },
+	[SFDP_READ_144_DTR] = { SFDP_4B_DTR_READ_144, QUAD_IN_OUT_DTR_READ_4B_CMD },
+};
+#endif
+
 static lfs_t lfs;													// Littlefs
+static uint8_t stmlfs_erased[FS_SIZE/FS_SECTOR_SIZE/8];			// Sectors known to be erased, RAM only
+static struct stmlfs_erasestat_t erasestat;
+static uint8_t stmlfs_lookahead[STMLFS_LOOKAHEAD_SIZE] __ALIGNED(4);	// Free block bitmap
+#ifdef STMLFS_READAHEAD
+static struct {
+	uint32_t start, end;											// Flash range held in buf
+	uint32_t pos;													// End of the last read served from buf
+	uint32_t next;													// A read here starts a new stream
+	uint32_t window;												// Size of the next burst
+	bool span;														// Bursts may cross a block end
+	uint32_t hits, bursts;
+	uint8_t buf[STMLFS_READAHEAD_SIZE] __ALIGNED(32);				// Cache line aligned, no DMA bounce
+} stmlfs_ra;
+#endif
+#ifdef STMLFS_BCACHE
+#if STMLFS_BCACHE_LINE/FS_PAGE_SIZE > 8
+#error "STMLFS_BCACHE_LINE holds at most 8 pages"
+#endif
+struct stmlfs_bline_t {
+	uint32_t address;												// Line aligned flash address
+	uint32_t lru;													// Last use, 0 for a free line
+	uint8_t valid;													// Bit per page, data in RAM
+	uint8_t dirty;													// Bit per page, not programmed yet
+};
+static struct {
+	struct stmlfs_bline_t line[STMLFS_BCACHE_SETS][STMLFS_BCACHE_WAYS];
+	uint32_t tick;
+	uint32_t hits, misses, writebacks;
+	uint8_t data[STMLFS_BCACHE_SETS][STMLFS_BCACHE_WAYS][STMLFS_BCACHE_LINE] STMLFS_BCACHE_ATTR;
+} stmlfs_bc;
+#endif
 
 static uint8_t QSPI_WriteEnable(void);
 uint8_t QSPI_AutoPollingMemReady(void);
 static uint8_t QSPI_Configuration(void);
 static uint8_t QSPI_ResetChip(void);
-
-
-const struct lfs_config stmconfig = {
+static uint8_t QSPI_Erase(uint32_t instruction, uint32_t flash_address, uint32_t size);
+static uint8_t QSPI_WaitBusy(uint32_t address, uint32_t size);
+static uint8_t QSPI_ReadData(uint8_t *pData, uint32_t ReadAddr, uint32_t Size);
+static void QSPI_ReadCommand(QSPI_CommandTypeDef *sCommand, uint32_t ReadAddr, uint32_t Size);
+static int stmlfs_erase_sectors(lfs_block_t sector, lfs_size_t count);
+static int stmlfs_flash_read(uint32_t p, void* buffer, lfs_size_t size);
+static int stmlfs_flash_prog(uint32_t p, const void* buffer, lfs_size_t size);
+#ifdef STMLFS_BLANKCHECK
+static int stmlfs_blankcheck(uint32_t address, uint32_t size);
+#endif
+#if STMLFS_VERIFY == STMLFS_VERIFY_CRC
+static int stmlfs_hal_verify(uint32_t address, const void* buffer, lfs_size_t size);
+#endif
+#ifdef STMLFS_READAHEAD
+static int stmlfs_readahead(uint32_t address, uint8_t *buffer, uint32_t size);
+static void stmlfs_readahead_drop(uint32_t address, uint32_t size);
+#endif
+#ifdef STMLFS_BCACHE
+static int stmlfs_bcache_read(uint32_t address, uint8_t *buffer, uint32_t size);
+static int stmlfs_bcache_prog(uint32_t address, const uint8_t *buffer, uint32_t size);
+static int stmlfs_bcache_flush(void);
+static void stmlfs_bcache_drop(uint32_t address, uint32_t size);
+#endif
+#ifdef QSPI_MEMMAPPED_READ
+static uint8_t QSPI_EnterMappedMode(void);
+static uint8_t QSPI_ExitMappedMode(void);
+static void QSPI_InvalidateMapped(uint32_t address, uint32_t size);
+#endif
+#ifdef QSPI_SUSPEND_RESUME
+static uint8_t QSPI_Suspend(uint32_t address, uint32_t size, bool *suspended);
+static uint8_t QSPI_Resume(void);
+#endif
+#ifdef QSPI_ASYNC
+static bool QSPI_AsyncEvent(uint8_t status);
+#endif
+#ifdef QSPI_SFDP
+static uint8_t QSPI_ReadFlashInfo(void);
+static bool QSPI_Use4ByteOpcodes(struct sfdp_flash_t *flash);
+static uint8_t QSPI_Enter4ByteMode(uint8_t enter4);
+#endif
+#ifdef QSPI_QPI_MODE
+static uint8_t QSPI_EnterQPI(void);
+static uint8_t QSPI_ExitQPI(void);
+#endif
+#ifdef QSPI_DTR_READ
+static uint8_t QSPI_DtrTiming(bool dtr);
+static uint8_t QSPI_CalibrateDTR(void);
+#endif
+static uint8_t QSPI_ReadTransfer(uint8_t *pData, uint32_t ReadAddr, uint32_t Size);
+#ifdef QSPI_USE_DMA
+static uint8_t QSPI_ReadDMA(QSPI_CommandTypeDef *sCommand, uint8_t *pData, uint32_t Size);
+static uint8_t QSPI_TransmitDMA(uint8_t *pData);
+static void QSPI_CleanDCache(const void *p, uint32_t size);
+#endif
+
+
+struct lfs_config stmconfig = {
     // block device operations
     .read  = stmlfs_hal_read,
     .prog  = stmlfs_hal_prog,
@@ -30,10 +192,20 @@ const struct lfs_config stmconfig = {
     .read_size      = FS_PAGE_SIZE,
     .prog_size      = FS_PAGE_SIZE,
     .block_size     = FS_SECTOR_SIZE,
-    .block_count    = FS_SIZE/FS_SECTOR_SIZE,
+    .block_count    = FS_SIZE/FS_SECTOR_SIZE,                      // Set from the flash size at mount
     .cache_size     = FS_SECTOR_SIZE/4,
-    .lookahead_size = 32,                                           // must be multiple of 8
+    .lookahead_size = STMLFS_LOOKAHEAD_SIZE,                        // must be multiple of 8
+    .lookahead_buffer = stmlfs_lookahead,
     .block_cycles   = 100,                                          // 100(better wear levelling)-1000(better performance)
+    .compact_thresh = STMLFS_COMPACT_THRESH,                        // Only used by lfs_fs_gc/lfs_fs_gcstep
+    .no_validate    = (STMLFS_VERIFY != STMLFS_VERIFY_FULL),          // Only FULL uses the littlefs read back
+	#ifdef STMLFS_LOOKAHEAD_SNAPSHOT
+    .lookahead_snapshot = true,
+	#endif
+	#ifdef STMLFS_BOUNDED_COMMIT
+    .metadata_max   = STMLFS_METADATA_MAX,
+    .bounded_commit = true,
+	#endif
 };
 
 int save_and_disable_interrupts(void) {								// Not used
@@ -49,19 +221,29 @@ void restore_interrupts(int mask) {									// Not used
 int stmlfs_hal_sync(const struct lfs_config *c)
 {
     UNUSED(*c);
+	#ifdef STMLFS_BCACHE
+    return stmlfs_bcache_flush();
+	#else
     return LFS_ERR_OK;
+	#endif
 }
 
 int stmlfs_mount(bool format)
 {
 	int err=-1;
 
-	assert(FS_SIZE<16777216);										// Chip < 16Mbyte, change R/W to 32bits address
+	stmconfig.block_count = lfs_min(qspi_flash.size, FS_SIZE)/FS_SECTOR_SIZE;
 
     if (format) {
     	err=lfs_format(&lfs,&stmconfig);
     	printf("lfs_format - returned: %d\n",err);
     }
+	#ifdef QSPI_DTR_READ
+	#ifdef QSPI_MEMMAPPED_READ
+    QSPI_ExitMappedMode();
+	#endif
+    QSPI_CalibrateDTR();											// Block 0 may have been blank at init
+	#endif
     err=lfs_mount(&lfs,&stmconfig);                              	// mount the filesystem
     printf("lfs_mount  - returned: %d\n",err);
     return err;
@@ -76,9 +258,30 @@ int stmlfs_hal_read(const struct lfs_config *c, lfs_block_t block, lfs_off_t off
 
     qprintf("stmlfs_hal_read(block=%ld off=%ld size=%ld), addr=0x%08lx\n",block,off,size,p);
 
+	#ifdef STMLFS_BCACHE
+    return stmlfs_bcache_read(p, buffer, size);
+	#else
+    return stmlfs_flash_read(p, buffer, size);
+	#endif
+}
+
+//-------------------------------------------------------------------------------------------------
+// Read from the flash, through the memory mapped window or the readahead buffer when enabled
+//-------------------------------------------------------------------------------------------------
+static int stmlfs_flash_read(uint32_t p, void* buffer, lfs_size_t size)
+{
+	#ifdef QSPI_MEMMAPPED_READ
+    if (QSPI_EnterMappedMode() != HAL_OK) {							// No-op unless a prog/erase came first
+    	return LFS_ERR_IO;
+    }
+    memcpy(buffer, (const uint8_t *)QSPI_MAPPED_BASE + p, size);
+	#elif defined(STMLFS_READAHEAD)
+    return stmlfs_readahead(p, buffer, size);
+	#else
     if (CSP_QSPI_Read(buffer, p, size) != HAL_OK) {
     	return LFS_ERR_IO;
     }
+	#endif
 
     return LFS_ERR_OK;
 }
@@ -90,10 +293,45 @@ int stmlfs_hal_prog(const struct lfs_config *c, lfs_block_t block, lfs_off_t off
 
     qprintf("stmlfs_hal_prog(block=%ld off=%ld size=%ld), addr=0x%08lx\n",block,off,size,p);
 
-    if (CSP_QSPI_WriteMemory(((uint8_t *)buffer), p, size) != HAL_OK) {
+    stmlfs_erased[block/8] &= ~(1U << (block%8));					// Not blank anymore, even if the prog fails
+
+	#ifdef STMLFS_BCACHE
+    return stmlfs_bcache_prog(p, buffer, size);
+	#else
+    return stmlfs_flash_prog(p, buffer, size);
+	#endif
+}
+
+//-------------------------------------------------------------------------------------------------
+// Program the flash, followed by the read back verification when enabled
+//-------------------------------------------------------------------------------------------------
+static int stmlfs_flash_prog(uint32_t p, const void* buffer, lfs_size_t size)
+{
+	#ifdef QSPI_MEMMAPPED_READ
+    if (QSPI_ExitMappedMode() != HAL_OK) {
+    	return LFS_ERR_IO;
+    }
+	#endif
+
+    uint8_t ret = CSP_QSPI_WriteMemory(((uint8_t *)buffer), p, size);
+	#ifdef STMLFS_READAHEAD
+    stmlfs_readahead_drop(p, size);									// After the prog, reads may run while busy
+	#endif
+    if (ret != HAL_OK) {
     	return LFS_ERR_IO;
     }
 
+	#ifdef QSPI_MEMMAPPED_READ
+    QSPI_InvalidateMapped(p, size);
+	#endif
+
+	#if STMLFS_VERIFY == STMLFS_VERIFY_CRC
+    int err = stmlfs_hal_verify(p, buffer, size);
+    if (err) {
+    	return err;
+    }
+	#endif
+
 	#ifdef QSPIDEBUG
     uint8_t localbuf[FS_SECTOR_SIZE]={0};
     printf("Read back and compare\n");
@@ -109,15 +347,62 @@ int stmlfs_hal_prog(const struct lfs_config *c, lfs_block_t block, lfs_off_t off
     return LFS_ERR_OK;
 }
 
+#if STMLFS_VERIFY == STMLFS_VERIFY_CRC
+//-------------------------------------------------------------------------------------------------
+// Read back a programmed range one page at a time and compare its CRC against the source buffer,
+// a mismatch returns LFS_ERR_CORRUPT so littlefs relocates the block. Covers metadata as well as
+// file data and only needs a page sized buffer. Reads stay in indirect mode as more progs follow.
+//-------------------------------------------------------------------------------------------------
+static int stmlfs_hal_verify(uint32_t address, const void* buffer, lfs_size_t size)
+{
+	uint8_t page[FS_PAGE_SIZE];
+	uint32_t crc_prog = lfs_crc(0xffffffff, buffer, size);
+	uint32_t crc_read = 0xffffffff;
+
+	for (lfs_size_t i = 0; i < size; i += FS_PAGE_SIZE) {
+		lfs_size_t n = lfs_min(size-i, FS_PAGE_SIZE);
+		if (CSP_QSPI_Read(page, address+i, n) != HAL_OK) {
+			return LFS_ERR_IO;
+		}
+		crc_read = lfs_crc(crc_read, page, n);
+	}
+
+	return (crc_read == crc_prog) ? LFS_ERR_OK : LFS_ERR_CORRUPT;
+}
+#endif
+
 int stmlfs_hal_erase(const struct lfs_config *c, lfs_block_t block)
 {
 	assert(block < c->block_count);
 	uint32_t p = block * c->block_size;
 
     qprintf("stmlfs_hal_erase(block=%ld), start_address=%lx end_address=%lx\n",block,p,p+c->block_size-1);
+    UNUSED(p);
 
-    if (CSP_QSPI_EraseSector(p,p+c->block_size-1) != HAL_OK){
-    	return LFS_ERR_IO;
+	#ifdef STMLFS_BCACHE
+    stmlfs_bcache_drop(p, c->block_size);							// Also unwritten progs, the erase supersedes them
+	#endif
+
+    if (stmlfs_erased[block/8] & (1U << (block%8))) {				// Erased by trim/preerase, not programmed since
+    	erasestat.skipped++;
+    	return LFS_ERR_OK;
+    }
+
+	#ifdef STMLFS_BLANKCHECK
+    int blank = stmlfs_blankcheck(p, c->block_size);
+    if (blank < 0) {
+    	return blank;
+    }
+    if (blank) {
+    	stmlfs_erased[block/8] |= 1U << (block%8);
+    	erasestat.blank++;
+    	return LFS_ERR_OK;
+    }
+	#endif
+
+    int err = stmlfs_erase_sectors(block, 1);
+    if (err) {
+    	return err;
     }
 
 	#ifdef QSPIDEBUG
@@ -136,6 +421,584 @@ int stmlfs_hal_erase(const struct lfs_config *c, lfs_block_t block)
 }
 
 
+#ifdef STMLFS_BLANKCHECK
+//-------------------------------------------------------------------------------------------------
+// Returns 1 if the range reads all 0xFF, 0 if not and a negative error if the read fails. Compares
+// a word at a time and stops at the first programmed word, so a used sector normally costs a
+// single page read. Note a sector whose erase was cut short by a power loss can read blank with
+// poor margin, littlefs still catches this with its CRCs (or read back verification).
+//-------------------------------------------------------------------------------------------------
+static int stmlfs_blankcheck(uint32_t address, uint32_t size)
+{
+	#ifdef QSPI_MEMMAPPED_READ
+	if (QSPI_EnterMappedMode() != HAL_OK) {
+		return LFS_ERR_IO;
+	}
+	const uint32_t *w = (const uint32_t *)(QSPI_MAPPED_BASE + address);
+	for (uint32_t i = 0; i < size/4; i++) {
+		if (w[i] != 0xFFFFFFFF) {
+			return 0;
+		}
+	}
+	#else
+	uint32_t page[FS_PAGE_SIZE/4] __ALIGNED(32);					// Cache line aligned, no DMA bounce
+	for (uint32_t i = 0; i < size; i += FS_PAGE_SIZE) {
+		if (CSP_QSPI_Read((uint8_t *)page, address+i, FS_PAGE_SIZE) != HAL_OK) {
+			return LFS_ERR_IO;
+		}
+		for (uint32_t j = 0; j < FS_PAGE_SIZE/4; j++) {
+			if (page[j] != 0xFFFFFFFF) {
+				return 0;
+			}
+		}
+	}
+	#endif
+	return 1;
+}
+#endif
+
+#ifdef STMLFS_READAHEAD
+//-------------------------------------------------------------------------------------------------
+// A read that starts where the previous read outside the buffer ended starts a stream, which fetches
+// twice the read size with a single QUAD_IN_OUT_FAST_READ. Every read that continues past the
+// buffered range, after using it up to its end, doubles the next burst, up to STMLFS_READAHEAD_SIZE.
+// Other reads, like the skip-list pointer reads between two file blocks, go straight to the flash
+// and leave the stream alone. littlefs normally allocates the blocks of a file written in one go
+// back to back, once a stream continued at the start of the next block its bursts also run past the
+// end of a block.
+//-------------------------------------------------------------------------------------------------
+static int stmlfs_readahead(uint32_t address, uint8_t *buffer, uint32_t size)
+{
+	if (address >= stmlfs_ra.start && address < stmlfs_ra.end) {
+		uint32_t n = lfs_min(size, stmlfs_ra.end - address);
+		memcpy(buffer, &stmlfs_ra.buf[address - stmlfs_ra.start], n);
+		stmlfs_ra.pos = address + n;
+		stmlfs_ra.hits++;
+		if (n == size) {
+			return LFS_ERR_OK;
+		}
+		address += n;												// Rest continues the stream
+		buffer += n;
+		size -= n;
+	}
+
+	if (address == stmlfs_ra.end && address == stmlfs_ra.pos) {	// Buffer used up to its end
+		stmlfs_ra.window = lfs_min(2*lfs_max(stmlfs_ra.window, size), STMLFS_READAHEAD_SIZE);
+		if (address % FS_SECTOR_SIZE == 0) {						// File continues in the next block
+			stmlfs_ra.span = true;
+		}
+	} else if (address == stmlfs_ra.next) {
+		stmlfs_ra.window = lfs_min(2*size, STMLFS_READAHEAD_SIZE);
+		stmlfs_ra.span = false;
+	} else {
+		stmlfs_ra.next = address + size;
+		return (CSP_QSPI_Read(buffer, address, size) == HAL_OK) ? LFS_ERR_OK : LFS_ERR_IO;
+	}
+
+	stmlfs_ra.start = stmlfs_ra.end = stmlfs_ra.pos = address + size;	// Empty until the burst succeeds
+	if (size >= STMLFS_READAHEAD_SIZE) {							// No gain from a copy
+		return (CSP_QSPI_Read(buffer, address, size) == HAL_OK) ? LFS_ERR_OK : LFS_ERR_IO;
+	}
+
+	uint32_t n = lfs_max(stmlfs_ra.window, size);
+	if (!stmlfs_ra.span) {
+		n = lfs_min(n, FS_SECTOR_SIZE - address % FS_SECTOR_SIZE);
+	}
+	n = lfs_min(n, stmconfig.block_count*FS_SECTOR_SIZE - address);
+	if (CSP_QSPI_Read(stmlfs_ra.buf, address, n) != HAL_OK) {
+		return LFS_ERR_IO;
+	}
+	stmlfs_ra.start = address;
+	stmlfs_ra.end = address + n;
+	stmlfs_ra.bursts++;
+	memcpy(buffer, stmlfs_ra.buf, size);
+	return LFS_ERR_OK;
+}
+
+//-------------------------------------------------------------------------------------------------
+// Empty the readahead buffer when a prog or erase overlaps it, the stream itself continues
+//-------------------------------------------------------------------------------------------------
+static void stmlfs_readahead_drop(uint32_t address, uint32_t size)
+{
+	if (address < stmlfs_ra.end && address + size > stmlfs_ra.start) {
+		stmlfs_ra.start = stmlfs_ra.end;
+	}
+}
+#endif
+
+#ifdef STMLFS_BCACHE
+//-------------------------------------------------------------------------------------------------
+// Set associative write-back cache, a flash address maps to set (address/STMLFS_BCACHE_LINE) %
+// STMLFS_BCACHE_SETS and the least recently used way of the set is replaced. Lines keep a valid
+// and a dirty bit per page, littlefs reads and progs are page aligned. A read miss fills all
+// missing pages of the line, reads covering whole lines which are not cached go straight to the
+// flash so a large file read does not flush the metadata out of the cache. Prog misses allocate a
+// line without reading it.
+//-------------------------------------------------------------------------------------------------
+static uint8_t stmlfs_bcache_pages(uint32_t off, uint32_t size)
+{
+	return (uint8_t)(((1U << (size/FS_PAGE_SIZE)) - 1) << (off/FS_PAGE_SIZE));
+}
+
+static uint8_t *stmlfs_bcache_data(const struct stmlfs_bline_t *line)
+{
+	uint32_t i = line - &stmlfs_bc.line[0][0];
+	return stmlfs_bc.data[i/STMLFS_BCACHE_WAYS][i%STMLFS_BCACHE_WAYS];
+}
+
+//-------------------------------------------------------------------------------------------------
+// Program the dirty pages of a line, one CSP_QSPI_WriteMemory per run of consecutive pages. Pages
+// of a run that failed to program or verify are no longer valid, so littlefs reads back what the
+// flash holds instead of the data it meant to write
+//-------------------------------------------------------------------------------------------------
+static int stmlfs_bcache_writeback(struct stmlfs_bline_t *line)
+{
+	uint8_t *data = stmlfs_bcache_data(line);
+	int err = LFS_ERR_OK;
+
+	for (uint32_t i = 0; i < STMLFS_BCACHE_LINE/FS_PAGE_SIZE; ) {
+		if (!(line->dirty & (1U << i))) {
+			i++;
+			continue;
+		}
+		uint32_t j = i;
+		while (j < STMLFS_BCACHE_LINE/FS_PAGE_SIZE && (line->dirty & (1U << j))) {
+			j++;
+		}
+		int res = stmlfs_flash_prog(line->address + i*FS_PAGE_SIZE, &data[i*FS_PAGE_SIZE], (j-i)*FS_PAGE_SIZE);
+		if (res) {
+			line->valid &= ~stmlfs_bcache_pages(i*FS_PAGE_SIZE, (j-i)*FS_PAGE_SIZE);	// Reads see the flash
+			if (!err) {
+				err = res;
+			}
+		}
+		i = j;
+	}
+
+	line->dirty = 0;												// Not retried, littlefs handles the error
+	stmlfs_bc.writebacks++;
+	return err;
+}
+
+//-------------------------------------------------------------------------------------------------
+// Find the line holding address, with alloc set a missing line replaces the least recently used
+// way of its set, which is written back first when dirty
+//-------------------------------------------------------------------------------------------------
+static struct stmlfs_bline_t *stmlfs_bcache_find(uint32_t address, bool alloc, int *err)
+{
+	struct stmlfs_bline_t *set = stmlfs_bc.line[(address/STMLFS_BCACHE_LINE) % STMLFS_BCACHE_SETS];
+	struct stmlfs_bline_t *victim = &set[0];
+
+	*err = LFS_ERR_OK;
+	for (int i = 0; i < STMLFS_BCACHE_WAYS; i++) {
+		if (set[i].lru && set[i].address == address) {
+			set[i].lru = ++stmlfs_bc.tick;
+			return &set[i];
+		}
+		if (set[i].lru < victim->lru) {
+			victim = &set[i];
+		}
+	}
+
+	if (!alloc) {
+		return NULL;
+	}
+
+	if (victim->dirty) {
+		*err = stmlfs_bcache_writeback(victim);
+		if (*err) {
+			return NULL;
+		}
+	}
+	victim->address = address;
+	victim->lru = ++stmlfs_bc.tick;
+	victim->valid = 0;
+	return victim;
+}
+
+static int stmlfs_bcache_read(uint32_t address, uint8_t *buffer, uint32_t size)
+{
+	assert(address % FS_PAGE_SIZE == 0 && size % FS_PAGE_SIZE == 0);
+
+	while (size > 0) {
+		uint32_t off = address % STMLFS_BCACHE_LINE;
+		uint32_t n = lfs_min(size, STMLFS_BCACHE_LINE - off);
+		int err;
+
+		struct stmlfs_bline_t *line = stmlfs_bcache_find(address - off, false, &err);
+		if (!line && n == STMLFS_BCACHE_LINE) {
+			err = stmlfs_flash_read(address, buffer, n);
+			stmlfs_bc.misses++;
+		} else {
+			if (!line) {
+				line = stmlfs_bcache_find(address - off, true, &err);
+				if (!line) {
+					return err;
+				}
+			}
+
+			uint8_t *data = stmlfs_bcache_data(line);
+			if ((line->valid & stmlfs_bcache_pages(off, n)) != stmlfs_bcache_pages(off, n)) {
+				for (uint32_t i = 0; i < STMLFS_BCACHE_LINE/FS_PAGE_SIZE; ) {	// Fill all missing pages
+					if (line->valid & (1U << i)) {
+						i++;
+						continue;
+					}
+					uint32_t j = i;
+					while (j < STMLFS_BCACHE_LINE/FS_PAGE_SIZE && !(line->valid & (1U << j))) {
+						j++;
+					}
+					err = stmlfs_flash_read(line->address + i*FS_PAGE_SIZE, &data[i*FS_PAGE_SIZE], (j-i)*FS_PAGE_SIZE);
+					if (err) {
+						return err;
+					}
+					line->valid |= stmlfs_bcache_pages(i*FS_PAGE_SIZE, (j-i)*FS_PAGE_SIZE);
+					i = j;
+				}
+				stmlfs_bc.misses++;
+			} else {
+				stmlfs_bc.hits++;
+			}
+			memcpy(buffer, &data[off], n);
+		}
+		if (err) {
+			return err;
+		}
+
+		address += n;
+		buffer += n;
+		size -= n;
+	}
+
+	return LFS_ERR_OK;
+}
+
+static int stmlfs_bcache_prog(uint32_t address, const uint8_t *buffer, uint32_t size)
+{
+	assert(address % FS_PAGE_SIZE == 0 && size % FS_PAGE_SIZE == 0);
+
+	while (size > 0) {
+		uint32_t off = address % STMLFS_BCACHE_LINE;
+		uint32_t n = lfs_min(size, STMLFS_BCACHE_LINE - off);
+		int err;
+
+		struct stmlfs_bline_t *line = stmlfs_bcache_find(address - off, true, &err);
+		if (!line) {
+			return err;
+		}
+		memcpy(&stmlfs_bcache_data(line)[off], buffer, n);
+		line->valid |= stmlfs_bcache_pages(off, n);
+		line->dirty |= stmlfs_bcache_pages(off, n);
+
+		address += n;
+		buffer += n;
+		size -= n;
+	}
+
+	return LFS_ERR_OK;
+}
+
+//-------------------------------------------------------------------------------------------------
+// Write back all dirty lines in address order, littlefs calls sync before a metadata commit that
+// refers to new file data and after the commit, so both reach the flash in the order littlefs
+// expects. The first error is returned after all lines were written back.
+//-------------------------------------------------------------------------------------------------
+static int stmlfs_bcache_flush(void)
+{
+	int err = LFS_ERR_OK;
+
+	while (true) {
+		struct stmlfs_bline_t *next = NULL;
+		for (int i = 0; i < STMLFS_BCACHE_SETS*STMLFS_BCACHE_WAYS; i++) {
+			struct stmlfs_bline_t *line = &stmlfs_bc.line[0][0] + i;
+			if (line->dirty && (!next || line->address < next->address)) {
+				next = line;
+			}
+		}
+		if (!next) {
+			return err;
+		}
+
+		int res = stmlfs_bcache_writeback(next);
+		if (res && !err) {
+			err = res;
+		}
+	}
+}
+
+//-------------------------------------------------------------------------------------------------
+// Free the lines overlapping an erased range, dirty or not
+//-------------------------------------------------------------------------------------------------
+static void stmlfs_bcache_drop(uint32_t address, uint32_t size)
+{
+	for (int i = 0; i < STMLFS_BCACHE_SETS*STMLFS_BCACHE_WAYS; i++) {
+		struct stmlfs_bline_t *line = &stmlfs_bc.line[0][0] + i;
+		if (line->lru && line->address < address + size && line->address + STMLFS_BCACHE_LINE > address) {
+			line->lru = 0;
+			line->valid = 0;
+			line->dirty = 0;
+		}
+	}
+}
+#endif
+
+//-------------------------------------------------------------------------------------------------
+// Erase count sectors starting at sector with a single instruction, count must be 1 or a whole
+// aligned 32K/64K block. The sectors are marked as known erased.
+//-------------------------------------------------------------------------------------------------
+static int stmlfs_erase_sectors(lfs_block_t sector, lfs_size_t count)
+{
+	uint32_t p = sector * FS_SECTOR_SIZE;
+	uint32_t starttime = HAL_GetTick();
+	uint8_t ret;
+
+	#ifdef QSPI_MEMMAPPED_READ
+	if (QSPI_ExitMappedMode() != HAL_OK) {
+		return LFS_ERR_IO;
+	}
+	#endif
+
+	if (count == MEMORY_BLOCK_SIZE/FS_SECTOR_SIZE) {
+		ret = CSP_QSPI_EraseBlock(p);
+		erasestat.block64_erases++;
+	} else if (count == MEMORY_BLOCK32_SIZE/FS_SECTOR_SIZE) {
+		ret = CSP_QSPI_EraseBlock32(p);
+		erasestat.block32_erases++;
+	} else {
+		ret = CSP_QSPI_EraseSector(p, p+FS_SECTOR_SIZE-1);
+		erasestat.sector_erases++;
+	}
+	erasestat.erase_ms += HAL_GetTick() - starttime;
+	#ifdef STMLFS_READAHEAD
+	stmlfs_readahead_drop(p, count*FS_SECTOR_SIZE);
+	#endif
+	#ifdef STMLFS_BCACHE
+	stmlfs_bcache_drop(p, count*FS_SECTOR_SIZE);
+	#endif
+
+	if (ret != HAL_OK) {
+		return LFS_ERR_IO;
+	}
+
+	#ifdef QSPI_MEMMAPPED_READ
+	QSPI_InvalidateMapped(p, count*FS_SECTOR_SIZE);
+	#endif
+
+	for (lfs_size_t i = 0; i < count; i++) {
+		stmlfs_erased[(sector+i)/8] |= 1U << ((sector+i)%8);
+	}
+	return LFS_ERR_OK;
+}
+
+static int stmlfs_trim_used(void *data, lfs_block_t block)
+{
+	uint8_t *used = data;
+	used[block/8] |= 1U << (block%8);
+	return 0;
+}
+
+//-------------------------------------------------------------------------------------------------
+// Erase all free sectors which are not known to be erased, using one 64K or 32K block erase where
+// a whole aligned block is free. Later littlefs erases of these sectors are skipped until they are
+// programmed again. The known erased state lives in RAM only, after a reset littlefs simply erases
+// again. Run this after a format or a bulk delete, when there is time to spare.
+//-------------------------------------------------------------------------------------------------
+int stmlfs_trim(void)
+{
+	uint8_t used[FS_SIZE/FS_SECTOR_SIZE/8] = {0};
+	const lfs_size_t per64 = MEMORY_BLOCK_SIZE/FS_SECTOR_SIZE;
+	const lfs_size_t per32 = MEMORY_BLOCK32_SIZE/FS_SECTOR_SIZE;
+
+	int err = lfs_fs_traverse(&lfs, stmlfs_trim_used, used);		// Includes blocks of open files
+	if (err) {
+		return err;
+	}
+
+	for (lfs_block_t sector = 0; sector < stmconfig.block_count; ) {
+		lfs_size_t count = 1;
+
+		for (lfs_size_t n = per64; n >= per32; n /= 2) {			// Largest free aligned block first
+			if (sector % n != 0 || sector+n > stmconfig.block_count) {
+				continue;
+			}
+			lfs_size_t i;
+			for (i = 0; i < n; i++) {
+				if (used[(sector+i)/8] & (1U << ((sector+i)%8))) break;
+			}
+			if (i == n) {
+				count = n;
+				break;
+			}
+		}
+
+		bool todo = false;											// Anything in the range not erased yet?
+		for (lfs_size_t i = 0; i < count; i++) {
+			if (!(used[(sector+i)/8] & (1U << ((sector+i)%8))) &&
+					!(stmlfs_erased[(sector+i)/8] & (1U << ((sector+i)%8)))) {
+				todo = true;
+			}
+		}
+
+		if (todo) {
+			err = stmlfs_erase_sectors(sector, count);
+			if (err) {
+				return err;
+			}
+		}
+		sector += count;
+	}
+	return LFS_ERR_OK;
+}
+
+struct stmlfs_preerase_t {
+	lfs_block_t blocks[MEMORY_BLOCK_SIZE/FS_SECTOR_SIZE];
+	lfs_size_t count;
+};
+
+static int stmlfs_preerase_next(void *data, lfs_block_t block)
+{
+	struct stmlfs_preerase_t *next = data;
+
+	if (stmlfs_erased[block/8] & (1U << (block%8))) {
+		return 0;
+	}
+	next->blocks[next->count++] = block;
+	return (next->count == MEMORY_BLOCK_SIZE/FS_SECTOR_SIZE);		// Stop when we have enough for a 64K erase
+}
+
+// Do the first n candidates form a whole aligned block? Allocation order is ascending within the
+// lookahead window so checking the first and last block is enough.
+static bool stmlfs_preerase_run(const struct stmlfs_preerase_t *next, lfs_size_t n)
+{
+	return next->count >= n && next->blocks[0] % n == 0 && next->blocks[n-1] == next->blocks[0]+n-1;
+}
+
+//-------------------------------------------------------------------------------------------------
+// Idle time pre-erase. Erases the free blocks littlefs will allocate next, taken from the lookahead
+// window in allocation order, so the erase callback is a no-op when they are used. Each call issues
+// at most max_erases erase instructions (~45ms per sector, ~150ms for a 64K block). A run of free
+// sectors covering a whole aligned 32K/64K block is erased with one instruction.
+// Nothing is persisted, after a power cut the known erased state is simply lost and littlefs erases
+// the block itself. Returns the number of sectors erased or a negative error code.
+//-------------------------------------------------------------------------------------------------
+int stmlfs_preerase(uint32_t max_erases)
+{
+	int erased = 0;
+
+	while (max_erases-- > 0) {
+		struct stmlfs_preerase_t next = {.count = 0};
+
+		int err = lfs_fs_lookahead(&lfs, stmlfs_preerase_next, &next);
+		if (err < 0) {
+			return err;
+		}
+		if (next.count == 0) {
+			break;													// Nothing left, lfs_fs_gc refills the lookahead
+		}
+
+		lfs_size_t count = 1;
+		if (stmlfs_preerase_run(&next, MEMORY_BLOCK_SIZE/FS_SECTOR_SIZE)) {
+			count = MEMORY_BLOCK_SIZE/FS_SECTOR_SIZE;
+		} else if (stmlfs_preerase_run(&next, MEMORY_BLOCK32_SIZE/FS_SECTOR_SIZE)) {
+			count = MEMORY_BLOCK32_SIZE/FS_SECTOR_SIZE;
+		}
+
+		err = stmlfs_erase_sectors(next.blocks[0], count);
+		if (err) {
+			return err;
+		}
+		erasestat.preerased += count;
+		erased += count;
+	}
+	return erased;
+}
+
+//-------------------------------------------------------------------------------------------------
+// Idle time maintenance, call it when the application has nothing else to do. Runs lfs_fs_gcstep
+// (orphan cleanup, compaction of metadata pairs above STMLFS_COMPACT_THRESH, lookahead refills) and
+// then stmlfs_preerase one erase at a time until budget_ms is used up or nothing is left to do.
+// With STMLFS_BOUNDED_COMMIT the steps also relocate worn metadata pairs and erase spare blocks.
+// A step is not interrupted, so a call can overrun the budget by one compaction or erase (~150ms
+// worst case for a 64K block erase). Returns 0 or a negative error code, stat may be NULL.
+//-------------------------------------------------------------------------------------------------
+int stmlfs_maintain(uint32_t budget_ms, struct stmlfs_maintstat_t* stat)
+{
+	struct stmlfs_maintstat_t local;
+	uint32_t starttime = HAL_GetTick();
+	int err = LFS_ERR_OK;
+
+	if (!stat) {
+		stat = &local;
+	}
+	memset(stat, 0, sizeof(*stat));
+
+	while (HAL_GetTick() - starttime < budget_ms) {
+		int res = lfs_fs_gcstep(&lfs);
+		if (res < 0) {
+			err = res;
+			break;
+		}
+
+		if (res == LFS_GC_CONSISTENT) {
+			stat->consistent++;
+		} else if (res == LFS_GC_CHECKED) {
+			stat->checked++;
+		} else if (res == LFS_GC_COMPACTED) {
+			stat->checked++;
+			stat->compacted++;
+		} else if (res == LFS_GC_LOOKAHEAD) {
+			stat->lookahead++;
+		} else {
+			res = stmlfs_preerase(1);
+			if (res < 0) {
+				err = res;
+				break;
+			}
+			if (res == 0) {
+				stat->done = true;
+				break;
+			}
+			stat->preerased += res;
+		}
+	}
+
+	stat->elapsed_ms = HAL_GetTick() - starttime;
+	return err;
+}
+
+void stmlfs_erasestat(struct stmlfs_erasestat_t* stat)
+{
+	*stat = erasestat;
+}
+
+//-------------------------------------------------------------------------------------------------
+// littlefs and driver cache statistics, counters of caches which are not enabled stay 0
+//-------------------------------------------------------------------------------------------------
+void stmlfs_cachestat(struct stmlfs_cachestat_t* stat)
+{
+	memset(stat, 0, sizeof(*stat));
+	#ifdef LFS_PATHCACHE_SIZE
+	stat->path_hits = lfs.pathcache.hits;
+	stat->path_misses = lfs.pathcache.misses;
+	#endif
+	#ifdef LFS_NAMEINDEX_SIZE
+	stat->name_skips = lfs.nameindex.skips;
+	stat->name_fetches = lfs.nameindex.fetches;
+	#endif
+	#ifdef LFS_CTZCACHE_SIZE
+	stat->ctz_hits = lfs.ctzcache.hits;
+	stat->ctz_misses = lfs.ctzcache.misses;
+	#endif
+	#ifdef STMLFS_READAHEAD
+	stat->ra_hits = stmlfs_ra.hits;
+	stat->ra_bursts = stmlfs_ra.bursts;
+	#endif
+	#ifdef STMLFS_BCACHE
+	stat->bc_hits = stmlfs_bc.hits;
+	stat->bc_misses = stmlfs_bc.misses;
+	stat->bc_writebacks = stmlfs_bc.writebacks;
+	#endif
+}
 
 int stmlfs_file_open(lfs_file_t *file, const char *path, int flags)
 {
@@ -164,7 +1027,21 @@ int stmlfs_file_close(lfs_file_t *file)
 
 int stmlfs_unmount(void)
 {
-    return lfs_unmount(&lfs);
+    int err = lfs_unmount(&lfs);
+
+	#ifdef STMLFS_BCACHE
+    int res = stmlfs_bcache_flush();								// littlefs syncs every commit, this is a no-op
+    if (res && !err) {
+    	err = res;
+    }
+	#endif
+
+	#ifdef QSPI_MEMMAPPED_READ
+    if (QSPI_ExitMappedMode() != HAL_OK) {							// Leave the driver in indirect mode
+    	return LFS_ERR_IO;
+    }
+	#endif
+    return err;
 }
 
 int stmlfs_remove(const char* path)
@@ -346,23 +1223,100 @@ void dump_dir(void)
 
 }
 
-// Software CRC implementation with small lookup table
+#if STMLFS_CRC == STMLFS_CRC_HW
+//-------------------------------------------------------------------------------------------------
+// CRC-32 on the STM32H7 CRC unit. littlefs uses the reflected 0x04C11DB7 polynomial without final
+// xor, so input bytes are bit reversed by the unit, the output is reversed back and the running
+// value is bit reversed on the way in. Words are byte swapped as the unit eats the MSB first.
+//-------------------------------------------------------------------------------------------------
 uint32_t lfs_crc(uint32_t crc, const void* buffer, size_t size) {
-    static const uint32_t rtable[16] = {
-        0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac, 0x76dc4190, 0x6b6b51f4,
-        0x4db26158, 0x5005713c, 0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c,
-        0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c,
-    };
-
+    static bool crc_init = false;
     const uint8_t* data = buffer;
 
-    for (size_t i = 0; i < size; i++) {
+    if (!crc_init) {
+        __HAL_RCC_CRC_CLK_ENABLE();
+        CRC->POL = 0x04C11DB7;
+        CRC->CR = CRC_CR_REV_IN_0 | CRC_CR_REV_OUT;                 // 32 bit polynomial, reverse by byte
+        crc_init = true;
+    }
+
+    CRC->INIT = __RBIT(crc);
+    CRC->CR |= CRC_CR_RESET;                                        // Load INIT into DR
+
+    for (; size >= 4; size -= 4, data += 4) {
+        uint32_t word;
+        memcpy(&word, data, 4);                                     // littlefs buffers need not be aligned
+        CRC->DR = __REV(word);
+    }
+    for (; size > 0; size--) {
+        *(__IO uint8_t *)&CRC->DR = *data++;
+    }
+
+    return CRC->DR;
+}
+
+#elif STMLFS_CRC == STMLFS_CRC_SLICE8
+//-------------------------------------------------------------------------------------------------
+// Slicing-by-8 CRC-32, processes 8 bytes per step using 8 tables of 256 entries
+//-------------------------------------------------------------------------------------------------
+uint32_t lfs_crc(uint32_t crc, const void* buffer, size_t size) {
+    static uint32_t table[8][256];
+    static bool table_init = false;
+    const uint8_t* data = buffer;
+
+    if (!table_init) {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int j = 0; j < 8; j++) {
+                c = (c >> 1) ^ ((c & 1) ? 0xedb88320 : 0);
+            }
+            table[0][i] = c;
+        }
+        for (uint32_t i = 0; i < 256; i++) {
+            for (int k = 1; k < 8; k++) {
+                table[k][i] = (table[k-1][i] >> 8) ^ table[0][table[k-1][i] & 0xff];
+            }
+        }
+        table_init = true;
+    }
+
+    for (; size >= 8; size -= 8, data += 8) {
+        uint32_t one, two;
+        memcpy(&one, &data[0], 4);
+        memcpy(&two, &data[4], 4);
+        one = lfs_fromle32(one) ^ crc;
+        two = lfs_fromle32(two);
+        crc = table[7][(one >>  0) & 0xff] ^ table[6][(one >>  8) & 0xff] ^
+              table[5][(one >> 16) & 0xff] ^ table[4][(one >> 24) & 0xff] ^
+              table[3][(two >>  0) & 0xff] ^ table[2][(two >>  8) & 0xff] ^
+              table[1][(two >> 16) & 0xff] ^ table[0][(two >> 24) & 0xff];
+    }
+    for (; size > 0; size--) {
+        crc = (crc >> 8) ^ table[0][(crc ^ *data++) & 0xff];
+    }
+
+    return crc;
+}
+
+#else
+// Software CRC implementation with small lookup table
+uint32_t lfs_crc(uint32_t crc, const void* buffer, size_t size) {
+    static const uint32_t rtable[16] = {
+        0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac, 0x76dc4190, 0x6b6b51f4,
+        0x4db26158, 0x5005713c, 0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c,
+        0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c,
+    };
+
+    const uint8_t* data = buffer;
+
+    for (size_t i = 0; i < size; i++) {
         crc = (crc >> 4) ^ rtable[(crc ^ (data[i] >> 0)) & 0xf];
         crc = (crc >> 4) ^ rtable[(crc ^ (data[i] >> 4)) & 0xf];
     }
 
     return crc;
 }
+#endif
 
 //*************************************************************************************************
 // Boring_tech QSPI driver
@@ -380,6 +1334,13 @@ uint8_t CSP_QUADSPI_Init(void) {
 
 	MX_QUADSPI_Init();
 
+#ifdef QSPI_DUAL_FLASH
+	hqspi.Init.DualFlash = QSPI_DUALFLASH_ENABLE;					// CubeMX leaves it off, BK2 pins are its job
+	if (HAL_QSPI_Init(&hqspi) != HAL_OK) {
+		return HAL_ERROR;
+	}
+#endif
+
 	if (QSPI_ResetChip() != HAL_OK) {
 		return HAL_ERROR;
 	}
@@ -399,6 +1360,32 @@ uint8_t CSP_QUADSPI_Init(void) {
 		return HAL_ERROR;
 	}
 
+#ifdef QSPI_SFDP
+	if (QSPI_ReadFlashInfo() != HAL_OK) {							// SPI mode, before QPI
+		return HAL_ERROR;
+	}
+#endif
+	hqspi.Init.FlashSize = POSITION_VAL(qspi_flash.size) - 1;		// 2^(FlashSize+1) bytes, for mapped mode
+	MODIFY_REG(hqspi.Instance->DCR, QUADSPI_DCR_FSIZE, hqspi.Init.FlashSize << QUADSPI_DCR_FSIZE_Pos);
+
+#if defined(QSPI_SUSPEND_RESUME) || defined(QSPI_DTR_READ)
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;					// DWT cycle counter times tSUS and CR waits
+	DWT->LAR = 0xC5ACCE55;
+	DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+#endif
+
+#ifdef QSPI_DTR_READ
+	if (QSPI_CalibrateDTR() != HAL_OK) {
+		return HAL_ERROR;
+	}
+#endif
+
+#ifdef QSPI_QPI_MODE
+	if (QSPI_EnterQPI() != HAL_OK) {								// Needs QE=1 from QSPI_Configuration
+		return HAL_ERROR;
+	}
+#endif
+
 	return HAL_OK;
 
 }
@@ -412,7 +1399,7 @@ uint8_t CSP_QSPI_Erase_Chip(void) {
 	}
 
 	/* Erasing Sequence --------------------------------- */
-	sCommand.InstructionMode = QSPI_INSTRUCTION_1_LINE;
+	sCommand.InstructionMode = W25Q_INSTRUCTION_LINES;
 	sCommand.Instruction = CHIP_ERASE_CMD;
 	sCommand.AddressMode = QSPI_ADDRESS_NONE;
 	sCommand.AlternateByteMode = QSPI_ALTERNATE_BYTES_NONE;
@@ -441,20 +1428,20 @@ uint8_t QSPI_AutoPollingMemReady(void) {
 	HAL_StatusTypeDef ret;
 
 	/* Configure automatic polling mode to wait for memory ready ------ */
-	sCommand.InstructionMode = QSPI_INSTRUCTION_1_LINE;
+	sCommand.InstructionMode = W25Q_INSTRUCTION_LINES;
 	sCommand.Instruction = READ_STATUS_REG_CMD;
 	sCommand.AddressMode = QSPI_ADDRESS_NONE;
 	sCommand.AlternateByteMode = QSPI_ALTERNATE_BYTES_NONE;
-	sCommand.DataMode = QSPI_DATA_1_LINE;
+	sCommand.DataMode = W25Q_DATA_LINES;
 	sCommand.DummyCycles = 0;
 	sCommand.DdrMode = QSPI_DDR_MODE_DISABLE;
 	sCommand.DdrHoldHalfCycle = QSPI_DDR_HHC_ANALOG_DELAY;
 	sCommand.SIOOMode = QSPI_SIOO_INST_EVERY_CMD;
 
 	sConfig.Match = 0x00;
-	sConfig.Mask = 0x01;
+	sConfig.Mask = W25Q_STATUS(SR1_BUSY);
 	sConfig.MatchMode = QSPI_MATCH_MODE_AND;
-	sConfig.StatusBytesSize = 1;
+	sConfig.StatusBytesSize = QSPI_DIES;
 	sConfig.Interval = 0x10;
 	sConfig.AutomaticStop = QSPI_AUTOMATIC_STOP_ENABLE;
 	if ((ret = HAL_QSPI_AutoPolling(&hqspi, &sCommand, &sConfig,
@@ -470,7 +1457,7 @@ static uint8_t QSPI_WriteEnable(void) {
 	HAL_StatusTypeDef ret;
 
 	/* Enable write operations ------------------------------------------ */
-	sCommand.InstructionMode = QSPI_INSTRUCTION_1_LINE;
+	sCommand.InstructionMode = W25Q_INSTRUCTION_LINES;
 	sCommand.Instruction = WRITE_ENABLE_CMD;
 	sCommand.AddressMode = QSPI_ADDRESS_NONE;
 	sCommand.AlternateByteMode = QSPI_ALTERNATE_BYTES_NONE;
@@ -485,15 +1472,15 @@ static uint8_t QSPI_WriteEnable(void) {
 	}
 
 	/* Configure automatic polling mode to wait for write enabling ---- */
-	sConfig.Match = 0x02;
-	sConfig.Mask = 0x02;
+	sConfig.Match = W25Q_STATUS(SR1_WEL);
+	sConfig.Mask = W25Q_STATUS(SR1_WEL);
 	sConfig.MatchMode = QSPI_MATCH_MODE_AND;
-	sConfig.StatusBytesSize = 1;
+	sConfig.StatusBytesSize = QSPI_DIES;
 	sConfig.Interval = 0x10;
 	sConfig.AutomaticStop = QSPI_AUTOMATIC_STOP_ENABLE;
 
 	sCommand.Instruction = READ_STATUS_REG_CMD;
-	sCommand.DataMode = QSPI_DATA_1_LINE;
+	sCommand.DataMode = W25Q_DATA_LINES;
 
 	if ((ret = HAL_QSPI_AutoPolling(&hqspi, &sCommand, &sConfig,HAL_QPSI_TIMEOUT_DEFAULT_VALUE)) != HAL_OK) {
 		return ret;
@@ -505,7 +1492,7 @@ static uint8_t QSPI_WriteEnable(void) {
 uint8_t QSPI_Configuration(void) {
 
 	QSPI_CommandTypeDef sCommand = { 0 };
-	uint8_t reg;
+	uint8_t reg[QSPI_DIES];											// One per die in dual-flash mode
 	HAL_StatusTypeDef ret;
 
 	/* Read Volatile Configuration register 2 --------------------------- */
@@ -518,14 +1505,14 @@ uint8_t QSPI_Configuration(void) {
 	sCommand.DdrMode = QSPI_DDR_MODE_DISABLE;
 	sCommand.DdrHoldHalfCycle = QSPI_DDR_HHC_ANALOG_DELAY;
 	sCommand.SIOOMode = QSPI_SIOO_INST_EVERY_CMD;
-	sCommand.NbData = 1;
+	sCommand.NbData = QSPI_DIES;
 
 	if ((ret = HAL_QSPI_Command(&hqspi, &sCommand,
 			HAL_QPSI_TIMEOUT_DEFAULT_VALUE)) != HAL_OK) {
 		return ret;
 	}
 
-	if ((ret = HAL_QSPI_Receive(&hqspi, &reg, HAL_QPSI_TIMEOUT_DEFAULT_VALUE))
+	if ((ret = HAL_QSPI_Receive(&hqspi, reg, HAL_QPSI_TIMEOUT_DEFAULT_VALUE))
 			!= HAL_OK) {
 		return ret;
 	}
@@ -542,14 +1529,16 @@ uint8_t QSPI_Configuration(void) {
 	/* Write Volatile Configuration register 2 (QE = 1) -- */
 	sCommand.DataMode = QSPI_DATA_1_LINE;
 	sCommand.Instruction = WRITE_STATUS_REG2_CMD;
-	reg |= 2; // QE bit
+	for (int i = 0; i < QSPI_DIES; i++) {
+		reg[i] |= 2; // QE bit
+	}
 
 	if (HAL_QSPI_Command(&hqspi, &sCommand, HAL_QPSI_TIMEOUT_DEFAULT_VALUE)
 			!= HAL_OK) {
 		return ret;
 	}
 
-	if (HAL_QSPI_Transmit(&hqspi, &reg, HAL_QPSI_TIMEOUT_DEFAULT_VALUE)
+	if (HAL_QSPI_Transmit(&hqspi, reg, HAL_QPSI_TIMEOUT_DEFAULT_VALUE)
 			!= HAL_OK) {
 		return ret;
 	}
@@ -564,28 +1553,30 @@ uint8_t QSPI_Configuration(void) {
 	sCommand.DdrMode = QSPI_DDR_MODE_DISABLE;
 	sCommand.DdrHoldHalfCycle = QSPI_DDR_HHC_ANALOG_DELAY;
 	sCommand.SIOOMode = QSPI_SIOO_INST_EVERY_CMD;
-	sCommand.NbData = 1;
+	sCommand.NbData = QSPI_DIES;
 
 	if ((ret = HAL_QSPI_Command(&hqspi, &sCommand,
 			HAL_QPSI_TIMEOUT_DEFAULT_VALUE)) != HAL_OK) {
 		return ret;
 	}
 
-	if ((ret = HAL_QSPI_Receive(&hqspi, &reg, HAL_QPSI_TIMEOUT_DEFAULT_VALUE))
+	if ((ret = HAL_QSPI_Receive(&hqspi, reg, HAL_QPSI_TIMEOUT_DEFAULT_VALUE))
 			!= HAL_OK) {
 		return ret;
 	}
 
 	/* Write Volatile Configuration register 2 (DRV1:2 = 00) -- */
 	sCommand.Instruction = WRITE_STATUS_REG3_CMD;
-	reg &= 0x9f; // DRV1:2 bit
+	for (int i = 0; i < QSPI_DIES; i++) {
+		reg[i] &= 0x9f; // DRV1:2 bit
+	}
 
 	if (HAL_QSPI_Command(&hqspi, &sCommand, HAL_QPSI_TIMEOUT_DEFAULT_VALUE)
 			!= HAL_OK) {
 		return ret;
 	}
 
-	if (HAL_QSPI_Transmit(&hqspi, &reg, HAL_QPSI_TIMEOUT_DEFAULT_VALUE)
+	if (HAL_QSPI_Transmit(&hqspi, reg, HAL_QPSI_TIMEOUT_DEFAULT_VALUE)
 			!= HAL_OK) {
 		return ret;
 	}
@@ -594,12 +1585,29 @@ uint8_t QSPI_Configuration(void) {
 }
 
 uint8_t CSP_QSPI_EraseBlock(uint32_t flash_address) { // 64KB
+	const struct sfdp_erase_t *erase = sfdp_erase_find(&qspi_flash, MEMORY_BLOCK_SIZE);
+
+	if (erase == NULL) {											// Part without 64K erase
+		return CSP_QSPI_EraseSector(flash_address, flash_address + MEMORY_BLOCK_SIZE - 1);
+	}
+	return QSPI_Erase(erase->cmd, flash_address, MEMORY_BLOCK_SIZE);
+}
+
+uint8_t CSP_QSPI_EraseBlock32(uint32_t flash_address) { // 32KB
+	const struct sfdp_erase_t *erase = sfdp_erase_find(&qspi_flash, MEMORY_BLOCK32_SIZE);
+
+	if (erase == NULL) {
+		return CSP_QSPI_EraseSector(flash_address, flash_address + MEMORY_BLOCK32_SIZE - 1);
+	}
+	return QSPI_Erase(erase->cmd, flash_address, MEMORY_BLOCK32_SIZE);
+}
+
+static uint8_t QSPI_Erase(uint32_t instruction, uint32_t flash_address, uint32_t size) {
 	QSPI_CommandTypeDef sCommand = { 0 };
-	QSPI_AutoPollingTypeDef sConfig = { 0 };
 	HAL_StatusTypeDef ret;
 
-	sCommand.InstructionMode = QSPI_INSTRUCTION_1_LINE;
-	sCommand.AddressSize = QSPI_ADDRESS_24_BITS;
+	sCommand.InstructionMode = W25Q_INSTRUCTION_LINES;
+	sCommand.AddressSize = W25Q_ADDRESS_SIZE;
 	sCommand.AlternateByteMode = QSPI_ALTERNATE_BYTES_NONE;
 	sCommand.DdrMode = QSPI_DDR_MODE_DISABLE;
 	sCommand.DdrHoldHalfCycle = QSPI_DDR_HHC_ANALOG_DELAY;
@@ -611,8 +1619,8 @@ uint8_t CSP_QSPI_EraseBlock(uint32_t flash_address) { // 64KB
 	}
 
 	/* Erasing Sequence -------------------------------------------------- */
-	sCommand.Instruction = BLOCK_ERASE_CMD;
-	sCommand.AddressMode = QSPI_ADDRESS_1_LINE;
+	sCommand.Instruction = instruction;
+	sCommand.AddressMode = W25Q_ADDRESS_LINES;
 	sCommand.Address = flash_address;
 	sCommand.DataMode = QSPI_DATA_NONE;
 	sCommand.DummyCycles = 0;
@@ -622,21 +1630,8 @@ uint8_t CSP_QSPI_EraseBlock(uint32_t flash_address) { // 64KB
 	}
 
 
-	/* Configure automatic polling mode to wait for Busy to go low ---- */
-	sConfig.Match = 0x00;
-	sConfig.Mask = 0x01;
-	sConfig.MatchMode = QSPI_MATCH_MODE_AND;
-	sConfig.StatusBytesSize = 1;
-	sConfig.Interval = 0x10;
-	sConfig.AutomaticStop = QSPI_AUTOMATIC_STOP_ENABLE;
-	sCommand.Instruction = READ_STATUS_REG_CMD;
-	sCommand.DataMode = QSPI_DATA_1_LINE;
-
-	if ((ret = HAL_QSPI_AutoPolling(&hqspi, &sCommand, &sConfig,HAL_QPSI_TIMEOUT_DEFAULT_VALUE)) != HAL_OK) {
-		return ret;
-	}
-
-	return HAL_OK;
+	/* Wait for Busy to go low ---------------------------------------- */
+	return QSPI_WaitBusy(flash_address, size);
 }
 
 uint8_t CSP_QSPI_EraseSector(uint32_t EraseStartAddress, uint32_t EraseEndAddress) {
@@ -647,10 +1642,10 @@ uint8_t CSP_QSPI_EraseSector(uint32_t EraseStartAddress, uint32_t EraseEndAddres
 			- EraseStartAddress % MEMORY_SECTOR_SIZE;
 
 	/* Erasing Sequence -------------------------------------------------- */
-	sCommand.InstructionMode = QSPI_INSTRUCTION_1_LINE;
-	sCommand.Instruction = SECTOR_ERASE_CMD;
-	sCommand.AddressMode = QSPI_ADDRESS_1_LINE;
-	sCommand.AddressSize = QSPI_ADDRESS_24_BITS;
+	sCommand.InstructionMode = W25Q_INSTRUCTION_LINES;
+	sCommand.Instruction = qspi_flash.erase[0].cmd;
+	sCommand.AddressMode = W25Q_ADDRESS_LINES;
+	sCommand.AddressSize = W25Q_ADDRESS_SIZE;
 	sCommand.AlternateByteMode = QSPI_ALTERNATE_BYTES_NONE;
 	sCommand.DdrMode = QSPI_DDR_MODE_DISABLE;
 	sCommand.DdrHoldHalfCycle = QSPI_DDR_HHC_ANALOG_DELAY;
@@ -660,7 +1655,7 @@ uint8_t CSP_QSPI_EraseSector(uint32_t EraseStartAddress, uint32_t EraseEndAddres
 	sCommand.DummyCycles = 0;
 
 	while (EraseEndAddress >= EraseStartAddress) {
-		sCommand.Address = (EraseStartAddress & 0x0FFFFFFF);
+		sCommand.Address = EraseStartAddress;
 
 		if (QSPI_WriteEnable() != HAL_OK) {
 			return HAL_ERROR;
@@ -669,11 +1664,10 @@ uint8_t CSP_QSPI_EraseSector(uint32_t EraseStartAddress, uint32_t EraseEndAddres
 		if (HAL_QSPI_Command(&hqspi, &sCommand, HAL_QPSI_TIMEOUT_DEFAULT_VALUE)	!= HAL_OK) {
 			return HAL_ERROR;
 		}
-		EraseStartAddress += MEMORY_SECTOR_SIZE;
-
-		if (QSPI_AutoPollingMemReady() != HAL_OK) {
+		if (QSPI_WaitBusy(EraseStartAddress, MEMORY_SECTOR_SIZE) != HAL_OK) {
 			return HAL_ERROR;
 		}
+		EraseStartAddress += MEMORY_SECTOR_SIZE;
 	}
 
 	return HAL_OK;
@@ -684,6 +1678,9 @@ uint8_t CSP_QSPI_WriteMemory(uint8_t *buffer, uint32_t address,	uint32_t buffer_
 	QSPI_CommandTypeDef sCommand;
 	uint32_t end_addr, current_size, current_addr;
 
+#ifdef QSPI_DUAL_FLASH
+	assert(address % QSPI_DIES == 0 && buffer_size % QSPI_DIES == 0);	// Whole byte pairs only
+#endif
 	/* Calculation of the size between the write address and the end of the page */
 	current_addr = 0;
 
@@ -702,10 +1699,10 @@ uint8_t CSP_QSPI_WriteMemory(uint8_t *buffer, uint32_t address,	uint32_t buffer_
 	current_addr = address;
 	end_addr = address + buffer_size;
 
-	sCommand.InstructionMode = QSPI_INSTRUCTION_1_LINE;
-	sCommand.Instruction = QUAD_IN_FAST_PROG_CMD;
-	sCommand.AddressMode = QSPI_ADDRESS_1_LINE;
-	sCommand.AddressSize = QSPI_ADDRESS_24_BITS;
+	sCommand.InstructionMode = W25Q_INSTRUCTION_LINES;
+	sCommand.Instruction = W25Q_PROG_CMD;
+	sCommand.AddressMode = W25Q_ADDRESS_LINES;
+	sCommand.AddressSize = W25Q_ADDRESS_SIZE;
 	sCommand.AlternateByteMode = QSPI_ALTERNATE_BYTES_NONE;
 	sCommand.DdrMode = QSPI_DDR_MODE_DISABLE;
 	sCommand.DdrHoldHalfCycle = QSPI_DDR_HHC_ANALOG_DELAY;
@@ -715,6 +1712,10 @@ uint8_t CSP_QSPI_WriteMemory(uint8_t *buffer, uint32_t address,	uint32_t buffer_
 	sCommand.Address = address;
 	sCommand.DummyCycles = 0;
 
+#ifdef QSPI_USE_DMA
+	QSPI_CleanDCache(buffer, buffer_size);							// MDMA reads SRAM, not the D-Cache
+#endif
+
 	/* Perform the write page by page */
 	do {
 		sCommand.Address = current_addr;
@@ -733,12 +1734,19 @@ uint8_t CSP_QSPI_WriteMemory(uint8_t *buffer, uint32_t address,	uint32_t buffer_
 		}
 
 		/* Transmission of the data */
+#ifdef QSPI_USE_DMA
+		if (current_size >= QSPI_DMA_MIN_SIZE) {
+			if (QSPI_TransmitDMA(buffer) != HAL_OK) {
+				return HAL_ERROR;
+			}
+		} else
+#endif
 		if (HAL_QSPI_Transmit(&hqspi, buffer, HAL_QPSI_TIMEOUT_DEFAULT_VALUE)!= HAL_OK) {
 			return HAL_ERROR;
 		}
 
-		/* Configure automatic polling mode to wait for end of program */
-		if (QSPI_AutoPollingMemReady() != HAL_OK) {
+		/* Wait for end of program */
+		if (QSPI_WaitBusy(current_addr, current_size) != HAL_OK) {
 			return HAL_ERROR;
 		}
 
@@ -758,11 +1766,17 @@ uint8_t CSP_QSPI_EnableMemoryMappedMode(void) {
 	QSPI_CommandTypeDef sCommand;
 	QSPI_MemoryMappedTypeDef sMemMappedCfg;
 
+#ifdef QSPI_QPI_MODE
+	if (qspi_qpi) {
+		return CSP_QSPI_EnableMemoryMappedMode2();					// No 0x6B in QPI mode
+	}
+#endif
+
 	/* Enable Memory-Mapped mode-------------------------------------------------- */
 
 	sCommand.InstructionMode = QSPI_INSTRUCTION_1_LINE;
 	sCommand.Instruction = QUAD_OUT_FAST_READ_CMD;
-	sCommand.AddressSize = QSPI_ADDRESS_24_BITS;
+	sCommand.AddressSize = W25Q_FIXED_ADDRESS_SIZE;
 	sCommand.AddressMode = QSPI_ADDRESS_1_LINE;
 	sCommand.Address = 0;
 	sCommand.AlternateByteMode = QSPI_ALTERNATE_BYTES_NONE;
@@ -792,14 +1806,14 @@ uint8_t CSP_QSPI_EnableMemoryMappedMode2(void) {
 
 	/* Enable Memory-Mapped mode-------------------------------------------------- */
 
-	sCommand.InstructionMode = QSPI_INSTRUCTION_1_LINE;
+	sCommand.InstructionMode = W25Q_INSTRUCTION_LINES;
 	sCommand.Instruction = QUAD_IN_OUT_FAST_READ_CMD;
-	sCommand.AddressSize = QSPI_ADDRESS_24_BITS;
+	sCommand.AddressSize = W25Q_FIXED_ADDRESS_SIZE;
 	sCommand.AddressMode = QSPI_ADDRESS_4_LINES;
 	sCommand.Address = 0;
 	sCommand.AlternateByteMode = QSPI_ALTERNATE_BYTES_4_LINES;
 	sCommand.AlternateBytes = 0xFF;
-	sCommand.AlternateBytesSize = 1;
+	sCommand.AlternateBytesSize = QSPI_ALTERNATE_BYTES_8_BITS;
 	sCommand.DdrMode = QSPI_DDR_MODE_DISABLE;
 	sCommand.DdrHoldHalfCycle = QSPI_DDR_HHC_ANALOG_DELAY;
 	sCommand.SIOOMode = QSPI_SIOO_INST_EVERY_CMD;
@@ -816,11 +1830,96 @@ uint8_t CSP_QSPI_EnableMemoryMappedMode2(void) {
 	return HAL_OK;
 }
 
+#ifdef QSPI_MEMMAPPED_READ
+//-------------------------------------------------------------------------------------------------
+// Memory mapped read mode. Switching costs an abort plus a new read command setup, so the mode is
+// only changed when the type of access changes. A run of reads stays in memory mapped mode and a
+// run of progs/erases stays in indirect mode.
+//-------------------------------------------------------------------------------------------------
+static bool qspi_mapped = false;
+
+static uint8_t QSPI_EnterMappedMode(void) {
+	QSPI_CommandTypeDef sCommand;
+	QSPI_MemoryMappedTypeDef sMemMappedCfg;
+
+	if (!qspi_mapped) {
+		QSPI_ReadCommand(&sCommand, 0, 0);							// Fastest read of the part
+		sMemMappedCfg.TimeOutActivation = QSPI_TIMEOUT_COUNTER_DISABLE;
+		sMemMappedCfg.TimeOutPeriod = 0;
+#ifdef QSPI_DTR_READ
+		if (QSPI_DtrTiming(true) != HAL_OK) {
+			return HAL_ERROR;
+		}
+#endif
+
+		if (HAL_QSPI_MemoryMapped(&hqspi, &sCommand, &sMemMappedCfg) != HAL_OK) {
+			return HAL_ERROR;
+		}
+		qspi_mapped = true;
+	}
+	return HAL_OK;
+}
+
+static uint8_t QSPI_ExitMappedMode(void) {
+	if (qspi_mapped) {
+		if (HAL_QSPI_Abort(&hqspi) != HAL_OK) {						// Abort ends memory mapped mode
+			return HAL_ERROR;
+		}
+		qspi_mapped = false;
+#ifdef QSPI_DTR_READ
+		if (QSPI_DtrTiming(false) != HAL_OK) {
+			return HAL_ERROR;
+		}
+#endif
+	}
+	return HAL_OK;
+}
+
+// The mapped window is cacheable, drop any lines holding the old flash contents
+static void QSPI_InvalidateMapped(uint32_t address, uint32_t size) {
+	uint32_t start = (QSPI_MAPPED_BASE + address) & ~31UL;
+	uint32_t end = (QSPI_MAPPED_BASE + address + size + 31) & ~31UL;
+
+	SCB_InvalidateDCache_by_Addr((uint32_t *)start, end-start);
+}
+#endif
+
 uint8_t QSPI_ResetChip(void) {
 	QSPI_CommandTypeDef sCommand = { 0 };
 	uint32_t temp = 0;
 	HAL_StatusTypeDef ret;
 
+#ifdef QSPI_QPI_MODE
+	/* A reset of the MCU alone leaves the flash in QPI mode, reset it with 4 line
+	   instructions first. In SPI mode the flash sees only 2 clocks and ignores them */
+	sCommand.InstructionMode = QSPI_INSTRUCTION_4_LINES;
+	sCommand.Instruction = RESET_ENABLE_CMD;
+	sCommand.AddressMode = QSPI_ADDRESS_NONE;
+	sCommand.AlternateByteMode = QSPI_ALTERNATE_BYTES_NONE;
+	sCommand.DataMode = QSPI_DATA_NONE;
+	sCommand.DummyCycles = 0;
+	sCommand.DdrMode = QSPI_DDR_MODE_DISABLE;
+	sCommand.DdrHoldHalfCycle = QSPI_DDR_HHC_ANALOG_DELAY;
+	sCommand.SIOOMode = QSPI_SIOO_INST_EVERY_CMD;
+
+	if ((ret = HAL_QSPI_Command(&hqspi, &sCommand,
+			HAL_QPSI_TIMEOUT_DEFAULT_VALUE)) != HAL_OK) {
+		return ret;
+	}
+
+	sCommand.Instruction = RESET_EXECUTE_CMD;
+
+	if ((ret = HAL_QSPI_Command(&hqspi, &sCommand,
+			HAL_QPSI_TIMEOUT_DEFAULT_VALUE)) != HAL_OK) {
+		return ret;
+	}
+
+	for (temp = 0; temp < 500000; temp++) {							// tRST
+		__NOP();
+	}
+	qspi_qpi = false;												// Back to SPI mode
+#endif
+
 	/* Enable Reset --------------------------- */
 	sCommand.InstructionMode = QSPI_INSTRUCTION_1_LINE;
 	sCommand.Instruction = RESET_ENABLE_CMD;
@@ -863,16 +1962,16 @@ uint8_t QSPI_ResetChip(void) {
 
 uint8_t QSPI_ReadID(uint32_t *id) {
 	QSPI_CommandTypeDef sCommand = { 0 };
-	uint8_t pData[3]={0};
+	uint8_t pData[3*QSPI_DIES]={0};
 	HAL_StatusTypeDef ret;
 
-	sCommand.InstructionMode = QSPI_INSTRUCTION_1_LINE;
+	sCommand.InstructionMode = W25Q_INSTRUCTION_LINES;
 	sCommand.Instruction = READ_JEDEC_ID_CMD;
 	sCommand.AddressMode = QSPI_ADDRESS_NONE;
 	sCommand.AlternateByteMode = QSPI_ALTERNATE_BYTES_NONE;
-	sCommand.DataMode = QSPI_DATA_1_LINE;
+	sCommand.DataMode = W25Q_DATA_LINES;
 	sCommand.DummyCycles = 0;
-	sCommand.NbData = 3;
+	sCommand.NbData = 3*QSPI_DIES;
 	sCommand.DdrMode = QSPI_DDR_MODE_DISABLE;
 	sCommand.DdrHoldHalfCycle = QSPI_DDR_HHC_ANALOG_DELAY;
 	sCommand.SIOOMode = QSPI_SIOO_INST_EVERY_CMD;
@@ -885,6 +1984,13 @@ uint8_t QSPI_ReadID(uint32_t *id) {
 		return HAL_ERROR;
 	}
 
+#ifdef QSPI_DUAL_FLASH
+	if (pData[0] != pData[1] || pData[2] != pData[3] || pData[4] != pData[5]) {
+		return HAL_ERROR;											// Both dies must be the same part
+	}
+	pData[1] = pData[2];
+	pData[2] = pData[4];
+#endif
 	*id=((uint32_t)pData[0]<<16)|((uint32_t)pData[1]<<8)|(uint32_t)pData[2];
 
 	return HAL_OK;
@@ -895,6 +2001,19 @@ uint8_t QSPI_ReadUniqueID(uint8_t *pData)
 	QSPI_CommandTypeDef sCommand = { 0 };
 	HAL_StatusTypeDef ret;
 
+#ifdef QSPI_QPI_MODE
+	if (qspi_qpi) {													// 0x4B is SPI only
+		if (QSPI_ExitQPI() != HAL_OK) {
+			return HAL_ERROR;
+		}
+		ret = QSPI_ReadUniqueID(pData);
+		if (QSPI_EnterQPI() != HAL_OK) {
+			return HAL_ERROR;
+		}
+		return ret;
+	}
+#endif
+
 	sCommand.InstructionMode = QSPI_INSTRUCTION_1_LINE;
 	sCommand.Instruction = READ_UNIQUE_ID_CMD;
 	sCommand.AddressMode = QSPI_ADDRESS_1_LINE;
@@ -902,8 +2021,8 @@ uint8_t QSPI_ReadUniqueID(uint8_t *pData)
 	sCommand.Address = 0;
 	sCommand.AlternateByteMode = QSPI_ALTERNATE_BYTES_NONE;
 	sCommand.DataMode = QSPI_DATA_1_LINE;
-	sCommand.DummyCycles = 0;
-	sCommand.NbData = 8;
+	sCommand.DummyCycles = (qspi_addr4 == QSPI_ADDR_4BYTE_MODE) ? 8 : 0;	// 4 or 5 dummy bytes
+	sCommand.NbData = 8*QSPI_DIES;
 	sCommand.DdrMode = QSPI_DDR_MODE_DISABLE;
 	sCommand.DdrHoldHalfCycle = QSPI_DDR_HHC_ANALOG_DELAY;
 	sCommand.SIOOMode = QSPI_SIOO_INST_EVERY_CMD;
@@ -912,33 +2031,80 @@ uint8_t QSPI_ReadUniqueID(uint8_t *pData)
 		return ret;
 	}
 
+#ifdef QSPI_DUAL_FLASH
+	uint8_t uid[8*QSPI_DIES];
+
+	if (HAL_QSPI_Receive(&hqspi, uid, HAL_QPSI_TIMEOUT_DEFAULT_VALUE) != HAL_OK) {
+		return HAL_ERROR;
+	}
+	for (int i = 0; i < 8; i++) {									// FLASH1 ID, the even bytes
+		pData[i] = uid[QSPI_DIES*i];
+	}
+#else
 	if (HAL_QSPI_Receive(&hqspi, pData, HAL_QPSI_TIMEOUT_DEFAULT_VALUE)	!= HAL_OK) {
 		return HAL_ERROR;
 	}
+#endif
 
 	return HAL_OK;
 }
 
 
 uint8_t CSP_QSPI_Read(uint8_t *pData, uint32_t ReadAddr, uint32_t Size) {
-	QSPI_CommandTypeDef sCommand;
-
 
 	qprintf(" CSP_QSPI_Read(0x%lx,%d)\n",ReadAddr,Size);
+#ifdef QSPI_DUAL_FLASH
+	assert(ReadAddr % QSPI_DIES == 0 && Size % QSPI_DIES == 0);		// Whole byte pairs only
+#endif
+#ifdef QSPI_MEMMAPPED_READ
+	if (QSPI_ExitMappedMode() != HAL_OK) {							// littlefs reads may have left it mapped
+		return HAL_ERROR;
+	}
+#endif
+
+#ifdef QSPI_SUSPEND_RESUME
+	bool suspended;
+	if (QSPI_Suspend(ReadAddr, Size, &suspended) != HAL_OK) {
+		return HAL_ERROR;
+	}
+	if (suspended) {
+		uint8_t ret = QSPI_ReadData(pData, ReadAddr, Size);
+		if (QSPI_Resume() != HAL_OK) {
+			return HAL_ERROR;
+		}
+		return ret;
+	}
+#endif
+
+	return QSPI_ReadData(pData, ReadAddr, Size);
+}
+
+static uint8_t QSPI_ReadData(uint8_t *pData, uint32_t ReadAddr, uint32_t Size) {
+#ifdef QSPI_DTR_READ
+	if (QSPI_DtrTiming(true) != HAL_OK) {
+		return HAL_ERROR;
+	}
+	uint8_t ret = QSPI_ReadTransfer(pData, ReadAddr, Size);
+	if (QSPI_DtrTiming(false) != HAL_OK) {
+		return HAL_ERROR;
+	}
+	return ret;
+#else
+	return QSPI_ReadTransfer(pData, ReadAddr, Size);
+#endif
+}
+
+static uint8_t QSPI_ReadTransfer(uint8_t *pData, uint32_t ReadAddr, uint32_t Size) {
+	QSPI_CommandTypeDef sCommand;
 
 	/* Initialize the read command */
-	sCommand.InstructionMode = QSPI_INSTRUCTION_1_LINE;
-	sCommand.Instruction = QUAD_IN_OUT_FAST_READ_CMD;
-	sCommand.AddressMode = QSPI_ADDRESS_4_LINES;
-	sCommand.AddressSize = QSPI_ADDRESS_24_BITS;
-	sCommand.Address = ReadAddr;
-	sCommand.AlternateByteMode = QSPI_ALTERNATE_BYTES_NONE;
-	sCommand.DataMode = QSPI_DATA_4_LINES;
-	sCommand.DummyCycles = 6U;
-	sCommand.NbData = Size;
-	sCommand.DdrMode = QSPI_DDR_MODE_DISABLE;
-	sCommand.DdrHoldHalfCycle = QSPI_DDR_HHC_ANALOG_DELAY;
-	sCommand.SIOOMode = QSPI_SIOO_INST_EVERY_CMD;
+	QSPI_ReadCommand(&sCommand, ReadAddr, Size);
+
+#ifdef QSPI_USE_DMA
+	if (Size >= QSPI_DMA_MIN_SIZE) {
+		return QSPI_ReadDMA(&sCommand, pData, Size);
+	}
+#endif
 
 	/* Configure the command */
 	if (HAL_QSPI_Command(&hqspi, &sCommand, HAL_QPSI_TIMEOUT_DEFAULT_VALUE)!= HAL_OK) {
@@ -959,11 +2125,148 @@ uint8_t CSP_QSPI_Read(uint8_t *pData, uint32_t ReadAddr, uint32_t Size) {
 	return HAL_OK;
 }
 
+//-------------------------------------------------------------------------------------------------
+// Read command for the read mode taken from the flash descriptor, used for indirect, async and
+// memory mapped reads. qspi_cmd_read lays out the phases, this only maps them to the HAL fields.
+// The mode clocks carry M7-0 = 0xFF as an alternate byte on the address lines, left undriven M5-4
+// could read as 10 and put the flash in continuous read mode. QPI mode always reads with 0xEB and
+// the dummy clocks set by QPI_READ_PARAMS.
+//-------------------------------------------------------------------------------------------------
+static void QSPI_ReadCommand(QSPI_CommandTypeDef *sCommand, uint32_t ReadAddr, uint32_t Size) {
+	struct qspi_cmd_t cmd;
+	uint8_t address_bytes = (qspi_addr4 != QSPI_ADDR_3BYTE) ? 4 : 3;
+
+	qspi_cmd_read(&cmd, &qspi_flash.read[qspi_readmode], qspi_readmode, address_bytes);
+#ifdef QSPI_QPI_MODE
+	if (qspi_qpi) {
+		static const struct sfdp_read_t qpi_read[2] = {
+			{ QUAD_IN_OUT_FAST_READ_CMD, 6, 2 },					// QPI_READ_PARAMS
+			{ QUAD_IN_OUT_FAST_READ_4B_CMD, 6, 2 },
+		};
+		qspi_cmd_read(&cmd, &qpi_read[qspi_addr4 == QSPI_ADDR_4BYTE_OPCODES], SFDP_READ_444, address_bytes);
+	}
+#endif
+
+	sCommand->InstructionMode = qspi_lines[cmd.instruction_lines].instruction;
+	sCommand->Instruction = cmd.instruction;
+	sCommand->AddressMode = qspi_lines[cmd.address_lines].address;
+	sCommand->AddressSize = (cmd.address_bytes == 4) ? QSPI_ADDRESS_32_BITS : QSPI_ADDRESS_24_BITS;
+	sCommand->Address = ReadAddr;
+	sCommand->AlternateByteMode = QSPI_ALTERNATE_BYTES_NONE;
+	sCommand->AlternateBytes = 0;
+	sCommand->AlternateBytesSize = 0;
+	if (cmd.mode) {													// One mode byte in every read mode
+		sCommand->AlternateByteMode = qspi_lines[cmd.address_lines].alternate;
+		sCommand->AlternateBytes = 0xFF;
+		sCommand->AlternateBytesSize = QSPI_ALTERNATE_BYTES_8_BITS;
+	}
+	sCommand->DataMode = qspi_lines[cmd.data_lines].data;
+	sCommand->DummyCycles = cmd.dummy;
+	sCommand->NbData = Size;
+	sCommand->DdrMode = QSPI_DDR_MODE_DISABLE;
+	sCommand->DdrHoldHalfCycle = QSPI_DDR_HHC_ANALOG_DELAY;
+	sCommand->SIOOMode = QSPI_SIOO_INST_EVERY_CMD;
+
+#ifdef QSPI_DTR_READ
+	if (cmd.dtr) {
+		sCommand->DdrMode = QSPI_DDR_MODE_ENABLE;
+		sCommand->DdrHoldHalfCycle = qspi_dtr_hold;
+	}
+#endif
+}
+
+#ifdef QSPI_DTR_READ
+//-------------------------------------------------------------------------------------------------
+// Fast Read Quad I/O DTR (0xED) sends the address, mode clock and data on both clock edges, the
+// instruction stays SDR. The W25Q64JV runs DTR reads up to 80MHz and RM0433 requires SSHIFT=0 in
+// DDR mode, so the prescaler and sample shift in CR are switched for every DTR read and kept while
+// memory mapped. CR can only be written while the QUADSPI is not busy. The wait for that is timed
+// with the DWT cycle counter as it also runs in the QUADSPI interrupt, where the tick stands still,
+// and CR is left unchanged with HAL_TIMEOUT when BUSY stays set for QSPI_DTR_BUSY_US.
+//-------------------------------------------------------------------------------------------------
+static uint8_t QSPI_DtrTiming(bool dtr) {
+	uint32_t cr = dtr ? (QSPI_DTR_PRESCALER << QUADSPI_CR_PRESCALER_Pos) | QSPI_SAMPLE_SHIFTING_NONE
+			: (hqspi.Init.ClockPrescaler << QUADSPI_CR_PRESCALER_Pos) | hqspi.Init.SampleShifting;
+	uint32_t start;
+
+	if (qspi_readmode != SFDP_READ_144_DTR) {
+		return HAL_OK;
+	}
+	start = DWT->CYCCNT;
+	while (READ_BIT(hqspi.Instance->SR, QUADSPI_SR_BUSY)) {
+		if (DWT->CYCCNT - start > QSPI_DTR_BUSY_US * (SystemCoreClock / 1000000)) {
+			return HAL_TIMEOUT;
+		}
+	}
+	MODIFY_REG(hqspi.Instance->CR, QUADSPI_CR_PRESCALER | QUADSPI_CR_SSHIFT, cr);
+	return HAL_OK;
+}
+
+// Use DTR reads with the first DDR hold timing for which a DTR read of block 0 returns the same
+// data as an SDR read. A blank block 0 cannot tell, DTR then stays off until the next mount.
+static uint8_t QSPI_CalibrateDTR(void) {
+	static const uint32_t hold[] = { QSPI_DDR_HHC_HALF_CLK_DELAY, QSPI_DDR_HHC_ANALOG_DELAY };
+	uint8_t ref[QSPI_DTR_CAL_SIZE], data[QSPI_DTR_CAL_SIZE];
+	uint32_t i;
+
+	if (qspi_readmode == SFDP_READ_144_DTR) {
+		qspi_readmode = sfdp_fastest_read(&qspi_flash);
+	}
+	if (!qspi_flash.dtr || qspi_flash.read[SFDP_READ_144_DTR].cmd == 0) {
+		return HAL_OK;
+	}
+	enum sfdp_readmode sdr = qspi_readmode;
+
+	if (QSPI_ReadData(ref, 0, sizeof(ref)) != HAL_OK) {
+		return HAL_ERROR;
+	}
+	for (i = 1; i < sizeof(ref) && ref[i] == ref[0]; i++) {
+	}
+	if (i == sizeof(ref)) {
+		qprintf("DTR not calibrated, block 0 is blank\n");
+		return HAL_OK;
+	}
+
+	for (i = 0; i < sizeof(hold)/sizeof(hold[0]); i++) {
+		qspi_readmode = SFDP_READ_144_DTR;
+		qspi_dtr_hold = hold[i];
+		uint8_t ret = QSPI_ReadData(data, 0, sizeof(data));
+		qspi_readmode = sdr;
+		if (ret != HAL_OK) {
+			return HAL_ERROR;
+		}
+		if (memcmp(data, ref, sizeof(ref)) == 0) {
+			qspi_readmode = SFDP_READ_144_DTR;
+			return HAL_OK;
+		}
+	}
+	qprintf("DTR reads do not match, SDR reads used\n");
+	return HAL_OK;
+}
+#endif
+
+const struct sfdp_flash_t* QSPI_FlashInfo(void) {
+	return &qspi_flash;
+}
+
 
 uint8_t QSPI_ReadSFDP(uint8_t *sfdp)
 {
 	QSPI_CommandTypeDef sCommand;
 
+#ifdef QSPI_QPI_MODE
+	if (qspi_qpi) {													// 0x5A is SPI only
+		if (QSPI_ExitQPI() != HAL_OK) {
+			return HAL_ERROR;
+		}
+		uint8_t ret = QSPI_ReadSFDP(sfdp);
+		if (QSPI_EnterQPI() != HAL_OK) {
+			return HAL_ERROR;
+		}
+		return ret;
+	}
+#endif
+
 	sCommand.InstructionMode = QSPI_INSTRUCTION_1_LINE;
 	sCommand.Instruction = READ_SFDP_CMD;
 
@@ -974,7 +2277,7 @@ uint8_t QSPI_ReadSFDP(uint8_t *sfdp)
 	sCommand.AlternateByteMode = QSPI_ALTERNATE_BYTES_NONE;
 	sCommand.DataMode = QSPI_DATA_1_LINE;
 	sCommand.DummyCycles = 0;
-	sCommand.NbData = 256;
+	sCommand.NbData = 256*QSPI_DIES;
 	sCommand.DdrMode = QSPI_DDR_MODE_DISABLE;
 	sCommand.DdrHoldHalfCycle = QSPI_DDR_HHC_ANALOG_DELAY;
 	sCommand.SIOOMode = QSPI_SIOO_INST_EVERY_CMD;
@@ -988,9 +2291,20 @@ uint8_t QSPI_ReadSFDP(uint8_t *sfdp)
 	MODIFY_REG(hqspi.Instance->DCR, QUADSPI_DCR_CSHT,QSPI_CS_HIGH_TIME_5_CYCLE);
 
 	/* Reception of the data */
+#ifdef QSPI_DUAL_FLASH
+	uint8_t both[256*QSPI_DIES];
+
+	if (HAL_QSPI_Receive(&hqspi, both, HAL_QPSI_TIMEOUT_DEFAULT_VALUE)!= HAL_OK) {
+		return HAL_ERROR;
+	}
+	for (int i = 0; i < 256; i++) {									// FLASH1 tables, the even bytes
+		sfdp[i] = both[QSPI_DIES*i];
+	}
+#else
 	if (HAL_QSPI_Receive(&hqspi, sfdp, HAL_QPSI_TIMEOUT_DEFAULT_VALUE)!= HAL_OK) {
 		return HAL_ERROR;
 	}
+#endif
 
 	/* Restore S# timing for nonRead commands */
 	MODIFY_REG(hqspi.Instance->DCR, QUADSPI_DCR_CSHT,QSPI_CS_HIGH_TIME_6_CYCLE);
@@ -998,3 +2312,804 @@ uint8_t QSPI_ReadSFDP(uint8_t *sfdp)
 	return HAL_OK;
 }
 
+
+
+#ifdef QSPI_SFDP
+//-------------------------------------------------------------------------------------------------
+// Replace the W25Q64JV defaults in qspi_flash with the SFDP tables of the part. Without SFDP, or
+// when the smallest erase or the page size differ from FS_SECTOR_SIZE/FS_PAGE_SIZE, the defaults
+// stay. A part over 16Mbyte uses the 4-byte opcodes when it has them for the read, program and
+// every erase, or else 4-byte mode (0xB7). Without either only the first 16Mbyte is used. In
+// dual-flash mode the tables are those of FLASH1 and the sizes are doubled for the pair.
+//-------------------------------------------------------------------------------------------------
+static uint8_t QSPI_ReadFlashInfo(void) {
+	uint8_t sfdp[256];
+	struct sfdp_flash_t flash;
+
+	qspi_addr4 = QSPI_ADDR_3BYTE;									// After QSPI_ResetChip
+	qspi_prog_cmd = QUAD_IN_FAST_PROG_CMD;
+#ifdef QSPI_QPI_MODE
+	qspi_prog_qpi_cmd = FAST_PROG_CMD;
+#endif
+
+	if (QSPI_ReadSFDP(sfdp) != HAL_OK) {
+		return HAL_ERROR;
+	}
+
+	int err = sfdp_parse(sfdp, sizeof(sfdp), &flash);
+	if (err != SFDP_OK || flash.erase[0].size*QSPI_DIES != FS_SECTOR_SIZE || flash.page_size*QSPI_DIES != FS_PAGE_SIZE) {
+		qprintf("SFDP not used (%d), W25Q64JV defaults\n", err);
+		return HAL_OK;
+	}
+#ifdef QSPI_DTR_READ
+	if (flash.dtr && flash.read[SFDP_READ_144].cmd != 0) {			// 0xED opcode and clocks are not in the BFPT
+		flash.read[SFDP_READ_144_DTR] = (struct sfdp_read_t){ QUAD_IN_OUT_DTR_READ_CMD, DUMMY_CLOCK_CYCLES_READ_DTR, 1 };
+	}
+#endif
+	if (flash.size > 0x1000000) {
+		if (QSPI_Use4ByteOpcodes(&flash)) {
+			qspi_addr4 = QSPI_ADDR_4BYTE_OPCODES;
+		} else if (flash.enter4 & (SFDP_ENTER4_B7 | SFDP_ENTER4_WREN_B7)) {
+			if (QSPI_Enter4ByteMode(flash.enter4) != HAL_OK) {
+				return HAL_ERROR;
+			}
+			qspi_addr4 = QSPI_ADDR_4BYTE_MODE;
+		} else {
+			flash.size = 0x1000000;
+		}
+	}
+#ifdef QSPI_DUAL_FLASH
+	flash.size *= QSPI_DIES;										// The tables describe one die
+	flash.page_size *= QSPI_DIES;
+	for (int i = 0; i < SFDP_ERASE_TYPES; i++) {
+		flash.erase[i].size *= QSPI_DIES;
+	}
+#endif
+
+	qspi_flash = flash;
+	qspi_readmode = sfdp_fastest_read(&flash);
+	return HAL_OK;
+}
+
+// Swap the read, program and erase opcodes for their 4-byte address versions, false when the
+// 4-byte address table lacks one of them
+static bool QSPI_Use4ByteOpcodes(struct sfdp_flash_t *flash) {
+	uint16_t needed = SFDP_4B_FAST_READ_111 | SFDP_4B_PROG_114;		// 0x0C is the fallback read
+
+#ifdef QSPI_QPI_MODE
+	needed |= SFDP_4B_PROG_111 | SFDP_4B_READ_144;					// 0x12 and 0xEC in QPI mode
+#endif
+	if ((flash->cmds4 & needed) != needed) {
+		return false;
+	}
+	for (int i = 0; i < SFDP_ERASE_TYPES; i++) {
+		if (flash->erase[i].size != 0 && flash->erase[i].cmd4 == 0) {
+			return false;
+		}
+	}
+
+	for (int i = 0; i < SFDP_ERASE_TYPES; i++) {
+		flash->erase[i].cmd = flash->erase[i].cmd4;
+	}
+	for (int i = 0; i < SFDP_READ_MODES; i++) {
+		if (qspi_read4[i].cmds4 == 0 || !(flash->cmds4 & qspi_read4[i].cmds4)) {
+			flash->read[i].cmd = 0;
+		} else if (flash->read[i].cmd != 0 || i == SFDP_READ_111) {
+			flash->read[i].cmd = qspi_read4[i].cmd;
+		}
+	}
+	qspi_prog_cmd = QUAD_IN_FAST_PROG_4B_CMD;
+#ifdef QSPI_QPI_MODE
+	qspi_prog_qpi_cmd = FAST_PROG_4B_CMD;
+#endif
+	return true;
+}
+
+static uint8_t QSPI_Enter4ByteMode(uint8_t enter4) {
+	QSPI_CommandTypeDef sCommand = { 0 };
+
+	if (!(enter4 & SFDP_ENTER4_B7) && QSPI_WriteEnable() != HAL_OK) {
+		return HAL_ERROR;
+	}
+
+	sCommand.InstructionMode = QSPI_INSTRUCTION_1_LINE;
+	sCommand.Instruction = ENTER_4BYTE_ADDR_CMD;
+	sCommand.AddressMode = QSPI_ADDRESS_NONE;
+	sCommand.AlternateByteMode = QSPI_ALTERNATE_BYTES_NONE;
+	sCommand.DataMode = QSPI_DATA_NONE;
+	sCommand.DummyCycles = 0;
+	sCommand.DdrMode = QSPI_DDR_MODE_DISABLE;
+	sCommand.DdrHoldHalfCycle = QSPI_DDR_HHC_ANALOG_DELAY;
+	sCommand.SIOOMode = QSPI_SIOO_INST_EVERY_CMD;
+
+	return HAL_QSPI_Command(&hqspi, &sCommand, HAL_QPSI_TIMEOUT_DEFAULT_VALUE);
+}
+#endif
+
+#ifdef QSPI_QPI_MODE
+//-------------------------------------------------------------------------------------------------
+// QPI mode (0x38) sends every instruction, address and data byte over 4 lines, a command then
+// costs 2 clocks instead of 8 and status polls, page programs and erases lose their single line
+// phases too. Set Read Parameters (0xC0) gives 0x0B/0xEB the same 6 dummy clocks as in SPI mode.
+// Unique ID and SFDP reads are SPI only, they leave QPI mode (0xFF) for the duration. A reset of
+// the flash (QSPI_ResetChip, power up) always returns it to SPI mode.
+//-------------------------------------------------------------------------------------------------
+static uint8_t QSPI_EnterQPI(void) {
+	QSPI_CommandTypeDef sCommand = { 0 };
+	uint8_t params[QSPI_DIES];
+
+	memset(params, QPI_READ_PARAMS, sizeof(params));
+
+	sCommand.InstructionMode = QSPI_INSTRUCTION_1_LINE;
+	sCommand.Instruction = ENTER_QPI_CMD;
+	sCommand.AddressMode = QSPI_ADDRESS_NONE;
+	sCommand.AlternateByteMode = QSPI_ALTERNATE_BYTES_NONE;
+	sCommand.DataMode = QSPI_DATA_NONE;
+	sCommand.DummyCycles = 0;
+	sCommand.DdrMode = QSPI_DDR_MODE_DISABLE;
+	sCommand.DdrHoldHalfCycle = QSPI_DDR_HHC_ANALOG_DELAY;
+	sCommand.SIOOMode = QSPI_SIOO_INST_EVERY_CMD;
+
+	if (HAL_QSPI_Command(&hqspi, &sCommand, HAL_QPSI_TIMEOUT_DEFAULT_VALUE) != HAL_OK) {
+		return HAL_ERROR;
+	}
+	qspi_qpi = true;
+
+	sCommand.InstructionMode = QSPI_INSTRUCTION_4_LINES;
+	sCommand.Instruction = SET_READ_PARAM_CMD;
+	sCommand.DataMode = QSPI_DATA_4_LINES;
+	sCommand.NbData = QSPI_DIES;
+
+	if (HAL_QSPI_Command(&hqspi, &sCommand, HAL_QPSI_TIMEOUT_DEFAULT_VALUE) != HAL_OK) {
+		return HAL_ERROR;
+	}
+	if (HAL_QSPI_Transmit(&hqspi, params, HAL_QPSI_TIMEOUT_DEFAULT_VALUE) != HAL_OK) {
+		return HAL_ERROR;
+	}
+	return HAL_OK;
+}
+
+static uint8_t QSPI_ExitQPI(void) {
+	QSPI_CommandTypeDef sCommand = { 0 };
+
+	sCommand.InstructionMode = QSPI_INSTRUCTION_4_LINES;
+	sCommand.Instruction = EXIT_QPI_CMD;
+	sCommand.AddressMode = QSPI_ADDRESS_NONE;
+	sCommand.AlternateByteMode = QSPI_ALTERNATE_BYTES_NONE;
+	sCommand.DataMode = QSPI_DATA_NONE;
+	sCommand.DummyCycles = 0;
+	sCommand.DdrMode = QSPI_DDR_MODE_DISABLE;
+	sCommand.DdrHoldHalfCycle = QSPI_DDR_HHC_ANALOG_DELAY;
+	sCommand.SIOOMode = QSPI_SIOO_INST_EVERY_CMD;
+
+	if (HAL_QSPI_Command(&hqspi, &sCommand, HAL_QPSI_TIMEOUT_DEFAULT_VALUE) != HAL_OK) {
+		return HAL_ERROR;
+	}
+	qspi_qpi = false;
+	return HAL_OK;
+}
+#endif
+#ifdef QSPI_SUSPEND_RESUME
+//-------------------------------------------------------------------------------------------------
+// Erase/Program Suspend (0x75) and Resume (0x7A). The HAL QSPI driver is not reentrant, so reads
+// can only be issued from QSPI_BusyCallback() and not from interrupts. Mapped mode is not used
+// while an erase or program is pending. The W25Q64JV needs tSUS between a resume and the next
+// suspend, this is timed with the DWT cycle counter. Without that gap a steady stream of reads
+// would stop the erase from making progress.
+//-------------------------------------------------------------------------------------------------
+static bool qspi_suspendable = false;								// Erase/program in flight
+static uint32_t qspi_busy_start, qspi_busy_end;						// Range being erased/programmed
+static uint32_t qspi_resumed;										// DWT->CYCCNT at the last resume
+
+// Called while waiting for an erase or page program, override to serve latency critical reads
+__weak void QSPI_BusyCallback(void) {
+}
+
+// In dual-flash mode *reg is the OR of both dies, busy or suspended when either die is
+static uint8_t QSPI_ReadStatusReg(uint32_t instruction, uint8_t *reg) {
+	QSPI_CommandTypeDef sCommand = { 0 };
+	uint8_t sr[QSPI_DIES];
+
+	sCommand.InstructionMode = W25Q_INSTRUCTION_LINES;
+	sCommand.Instruction = instruction;
+	sCommand.AddressMode = QSPI_ADDRESS_NONE;
+	sCommand.AlternateByteMode = QSPI_ALTERNATE_BYTES_NONE;
+	sCommand.DataMode = W25Q_DATA_LINES;
+	sCommand.DummyCycles = 0;
+	sCommand.DdrMode = QSPI_DDR_MODE_DISABLE;
+	sCommand.DdrHoldHalfCycle = QSPI_DDR_HHC_ANALOG_DELAY;
+	sCommand.SIOOMode = QSPI_SIOO_INST_EVERY_CMD;
+	sCommand.NbData = QSPI_DIES;
+
+	if (HAL_QSPI_Command(&hqspi, &sCommand, HAL_QPSI_TIMEOUT_DEFAULT_VALUE) != HAL_OK) {
+		return HAL_ERROR;
+	}
+	if (HAL_QSPI_Receive(&hqspi, sr, HAL_QPSI_TIMEOUT_DEFAULT_VALUE) != HAL_OK) {
+		return HAL_ERROR;
+	}
+	*reg = 0;
+	for (int i = 0; i < QSPI_DIES; i++) {
+		*reg |= sr[i];
+	}
+	return HAL_OK;
+}
+
+static uint8_t QSPI_SendCommand(uint32_t instruction) {
+	QSPI_CommandTypeDef sCommand = { 0 };
+
+	sCommand.InstructionMode = W25Q_INSTRUCTION_LINES;
+	sCommand.Instruction = instruction;
+	sCommand.AddressMode = QSPI_ADDRESS_NONE;
+	sCommand.AlternateByteMode = QSPI_ALTERNATE_BYTES_NONE;
+	sCommand.DataMode = QSPI_DATA_NONE;
+	sCommand.DummyCycles = 0;
+	sCommand.DdrMode = QSPI_DDR_MODE_DISABLE;
+	sCommand.DdrHoldHalfCycle = QSPI_DDR_HHC_ANALOG_DELAY;
+	sCommand.SIOOMode = QSPI_SIOO_INST_EVERY_CMD;
+
+	return HAL_QSPI_Command(&hqspi, &sCommand, HAL_QPSI_TIMEOUT_DEFAULT_VALUE);
+}
+
+static uint8_t QSPI_Suspend(uint32_t address, uint32_t size, bool *suspended) {
+	uint8_t sr2;
+
+	*suspended = false;
+	if (!qspi_suspendable) {
+		return HAL_OK;
+	}
+
+	if (address < qspi_busy_end && address + size > qspi_busy_start) {
+		qspi_suspendable = false;									// Reading the range being changed,
+		return QSPI_AutoPollingMemReady();							// wait for it to complete instead
+	}
+
+	while (DWT->CYCCNT - qspi_resumed < QSPI_SUSPEND_US * (SystemCoreClock / 1000000)) {
+	}
+
+	if (QSPI_SendCommand(ERASE_PROG_SUSPEND_CMD) != HAL_OK) {
+		return HAL_ERROR;
+	}
+	if (QSPI_AutoPollingMemReady() != HAL_OK) {						// Busy clears within tSUS
+		return HAL_ERROR;
+	}
+	if (QSPI_ReadStatusReg(READ_STATUS_REG2_CMD, &sr2) != HAL_OK) {
+		return HAL_ERROR;
+	}
+	*suspended = (sr2 & SR2_SUS) != 0;								// Clear if it completed just before
+	return HAL_OK;
+}
+
+static uint8_t QSPI_Resume(void) {
+	if (QSPI_SendCommand(ERASE_PROG_RESUME_CMD) != HAL_OK) {
+		return HAL_ERROR;
+	}
+	qspi_resumed = DWT->CYCCNT;
+	return HAL_OK;
+}
+#endif
+
+//-------------------------------------------------------------------------------------------------
+// Wait for the erase or page program of address..address+size-1 to finish. Without suspend/resume
+// the QUADSPI auto polling mode does the waiting. With QSPI_SUSPEND_RESUME the status register is
+// polled by software and QSPI_BusyCallback() runs between polls. Reads it issues through
+// CSP_QSPI_Read suspend the operation, outside the range being changed only.
+//-------------------------------------------------------------------------------------------------
+static uint8_t QSPI_WaitBusy(uint32_t address, uint32_t size) {
+#ifdef QSPI_SUSPEND_RESUME
+	uint32_t starttime = HAL_GetTick();
+	uint8_t sr;
+	uint8_t ret = HAL_ERROR;
+
+	qspi_busy_start = address;
+	qspi_busy_end = address + size;
+	qspi_suspendable = true;
+	while (QSPI_ReadStatusReg(READ_STATUS_REG_CMD, &sr) == HAL_OK) {
+		if (!(sr & SR1_BUSY)) {
+			ret = HAL_OK;
+			break;
+		}
+		if (HAL_GetTick() - starttime > HAL_QPSI_TIMEOUT_DEFAULT_VALUE) {
+			break;
+		}
+		QSPI_BusyCallback();
+	}
+	qspi_suspendable = false;
+	return ret;
+#else
+	UNUSED(address);
+	UNUSED(size);
+	return QSPI_AutoPollingMemReady();
+#endif
+}
+
+#ifdef QSPI_USE_DMA
+//*************************************************************************************************
+// MDMA data transfers
+// The QSPI interrupt signals the end of the transfer through the HAL callbacks, the caller sleeps
+// in WFI until then. D-Cache maintenance works on whole 32 byte cache lines so a littlefs buffer
+// which is not line aligned is bounced through qspi_dmabuf for reads. Program data only needs to
+// be cleaned to SRAM, this is done for the whole buffer before the page loop.
+//*************************************************************************************************
+#define DCACHE_LINE_SIZE		32
+
+static volatile uint8_t qspi_dma_done;
+static volatile uint8_t qspi_dma_error;
+static uint8_t qspi_dmabuf[QSPI_DMA_BUFSIZE] __ALIGNED(DCACHE_LINE_SIZE);
+
+void HAL_QSPI_RxCpltCallback(QSPI_HandleTypeDef *hqspi)
+{
+	UNUSED(hqspi);
+	#ifdef QSPI_ASYNC
+	if (QSPI_AsyncEvent(HAL_OK)) return;								// Async request, not a DMA transfer
+	#endif
+	qspi_dma_done = 1;
+}
+
+void HAL_QSPI_TxCpltCallback(QSPI_HandleTypeDef *hqspi)
+{
+	UNUSED(hqspi);
+	#ifdef QSPI_ASYNC
+	if (QSPI_AsyncEvent(HAL_OK)) return;								// Async request, not a DMA transfer
+	#endif
+	qspi_dma_done = 1;
+}
+
+void HAL_QSPI_ErrorCallback(QSPI_HandleTypeDef *hqspi)
+{
+	UNUSED(hqspi);
+	#ifdef QSPI_ASYNC
+	if (QSPI_AsyncEvent(HAL_ERROR)) return;
+	#endif
+	qspi_dma_error = 1;
+}
+
+static void QSPI_CleanDCache(const void *p, uint32_t size)
+{
+	uint32_t start = (uint32_t)p & ~(DCACHE_LINE_SIZE-1);
+	uint32_t end = ((uint32_t)p + size + DCACHE_LINE_SIZE-1) & ~(DCACHE_LINE_SIZE-1);
+
+	SCB_CleanDCache_by_Addr((uint32_t *)start, end-start);
+}
+
+static uint8_t QSPI_WaitDMA(void)
+{
+	uint32_t tickstart = HAL_GetTick();
+
+	while (!qspi_dma_done) {
+		if (qspi_dma_error || (HAL_GetTick()-tickstart) > HAL_QPSI_TIMEOUT_DEFAULT_VALUE) {
+			HAL_QSPI_Abort(&hqspi);
+			return HAL_ERROR;
+		}
+		__WFI();													// Woken by the QSPI IRQ or SysTick
+	}
+	return HAL_OK;
+}
+
+static uint8_t QSPI_TransmitDMA(uint8_t *pData)
+{
+	qspi_dma_done = 0;
+	qspi_dma_error = 0;
+
+	if (HAL_QSPI_Transmit_DMA(&hqspi, pData) != HAL_OK) {
+		return HAL_ERROR;
+	}
+	return QSPI_WaitDMA();
+}
+
+static uint8_t QSPI_ReceiveDMA(uint8_t *pData, uint32_t Size)
+{
+	uint32_t lines = lfs_alignup(Size, DCACHE_LINE_SIZE);			// pData is line aligned
+	uint8_t ret;
+
+	qspi_dma_done = 0;
+	qspi_dma_error = 0;
+
+	SCB_InvalidateDCache_by_Addr((uint32_t *)pData, lines);		// No dirty lines may be evicted on top of the data
+
+	/* Set S# timing for Read command */
+	MODIFY_REG(hqspi.Instance->DCR, QUADSPI_DCR_CSHT, QSPI_CS_HIGH_TIME_5_CYCLE);
+
+	if (HAL_QSPI_Receive_DMA(&hqspi, pData) != HAL_OK) {
+		ret = HAL_ERROR;
+	} else {
+		ret = QSPI_WaitDMA();
+	}
+
+	/* Restore S# timing for nonRead commands */
+	MODIFY_REG(hqspi.Instance->DCR, QUADSPI_DCR_CSHT,QSPI_CS_HIGH_TIME_6_CYCLE);
+
+	SCB_InvalidateDCache_by_Addr((uint32_t *)pData, lines);		// Drop lines speculatively loaded during the transfer
+	return ret;
+}
+
+static uint8_t QSPI_ReadDMA(QSPI_CommandTypeDef *sCommand, uint8_t *pData, uint32_t Size)
+{
+	bool bounce = ((uint32_t)pData % DCACHE_LINE_SIZE) != 0 || (Size % DCACHE_LINE_SIZE) != 0;
+
+	while (Size > 0) {
+		uint32_t chunk = bounce ? lfs_min(Size, QSPI_DMA_BUFSIZE) : Size;
+
+		sCommand->NbData = chunk;
+		if (HAL_QSPI_Command(&hqspi, sCommand, HAL_QPSI_TIMEOUT_DEFAULT_VALUE)!= HAL_OK) {
+			return HAL_ERROR;
+		}
+
+		if (bounce) {
+			if (QSPI_ReceiveDMA(qspi_dmabuf, chunk) != HAL_OK) {
+				return HAL_ERROR;
+			}
+			memcpy(pData, qspi_dmabuf, chunk);
+		} else {
+			if (QSPI_ReceiveDMA(pData, chunk) != HAL_OK) {
+				return HAL_ERROR;
+			}
+		}
+
+		sCommand->Address += chunk;
+		pData += chunk;
+		Size -= chunk;
+	}
+	return HAL_OK;
+}
+#endif
+
+#ifdef QSPI_ASYNC
+//*************************************************************************************************
+// Non-blocking driver
+// One request at a time is driven by a small state machine from the QUADSPI interrupt. The data
+// phase uses HAL_QSPI_Receive_IT/Transmit_IT, the waits for WEL after a write enable and for the
+// end of a page program or erase use HAL_QSPI_AutoPolling_IT so the status match interrupt starts
+// the next step. Only the instruction phases run blocking, they wait for the QUADSPI and never for
+// the flash. The callback is called from the interrupt with HAL_OK or HAL_ERROR, or with HAL_ERROR
+// from CSP_QSPI_AsyncBusy() when WEL did not set within QSPI_ASYNC_WEL_TIMEOUT_MS: the status
+// match never comes then and the tick does not advance in the interrupt. The blocking CSP_QSPI_*
+// functions and memory mapped mode can not be used while CSP_QSPI_AsyncBusy() returns true. With QSPI_MEMMAPPED_READ a request first
+// leaves memory mapped mode, which littlefs reads leave on, and a program or erase drops the window
+// lines of the range it changed when it ends, also when it fails.
+//*************************************************************************************************
+typedef enum {
+	QSPI_ASYNC_IDLE,
+	QSPI_ASYNC_READ,												// Waiting for RxCplt
+	QSPI_ASYNC_PROG_WEL,											// Waiting for WEL before a page program
+	QSPI_ASYNC_PROG,												// Waiting for TxCplt of a page
+	QSPI_ASYNC_PROG_WAIT,											// Waiting for the page program to finish
+	QSPI_ASYNC_ERASE_WEL,											// Waiting for WEL before the erase
+	QSPI_ASYNC_ERASE_WAIT											// Waiting for the erase to finish
+} qspi_async_state_t;
+
+static struct {
+	volatile qspi_async_state_t state;
+	uint8_t *buffer;
+	uint32_t start;													// Range being changed
+	uint32_t address;												// Next page to program
+	uint32_t end;
+	uint32_t wel_tick;												// HAL_GetTick() at the write enable
+	qspi_callback_t callback;
+	void *context;
+} qspi_async;
+
+static void QSPI_AsyncDone(uint8_t status) {
+#ifdef QSPI_MEMMAPPED_READ
+	if (qspi_async.state != QSPI_ASYNC_READ) {
+		QSPI_InvalidateMapped(qspi_async.start, qspi_async.end - qspi_async.start);
+	}
+#endif
+	qspi_async.state = QSPI_ASYNC_IDLE;
+	if (qspi_async.callback) {
+		qspi_async.callback(status, qspi_async.context);
+	}
+}
+
+// Also fails a request whose write enable was not followed by WEL in time
+bool CSP_QSPI_AsyncBusy(void) {
+	qspi_async_state_t state = qspi_async.state;
+
+	if ((state == QSPI_ASYNC_PROG_WEL || state == QSPI_ASYNC_ERASE_WEL)
+			&& HAL_GetTick() - qspi_async.wel_tick > QSPI_ASYNC_WEL_TIMEOUT_MS) {
+		uint32_t primask = __get_PRIMASK();
+		bool timeout;
+
+		__disable_irq();
+		timeout = (qspi_async.state == state);						// No status match in between
+		if (timeout) {
+			HAL_QSPI_Abort(&hqspi);									// Stops the polling
+		}
+		__set_PRIMASK(primask);
+		if (timeout) {
+			QSPI_AsyncDone(HAL_ERROR);
+		}
+	}
+	return qspi_async.state != QSPI_ASYNC_IDLE;
+}
+
+static uint8_t QSPI_AsyncPollReady(void) {
+	QSPI_CommandTypeDef sCommand = { 0 };
+	QSPI_AutoPollingTypeDef sConfig = { 0 };
+
+	sCommand.InstructionMode = W25Q_INSTRUCTION_LINES;
+	sCommand.Instruction = READ_STATUS_REG_CMD;
+	sCommand.AddressMode = QSPI_ADDRESS_NONE;
+	sCommand.AlternateByteMode = QSPI_ALTERNATE_BYTES_NONE;
+	sCommand.DataMode = W25Q_DATA_LINES;
+	sCommand.DummyCycles = 0;
+	sCommand.DdrMode = QSPI_DDR_MODE_DISABLE;
+	sCommand.DdrHoldHalfCycle = QSPI_DDR_HHC_ANALOG_DELAY;
+	sCommand.SIOOMode = QSPI_SIOO_INST_EVERY_CMD;
+
+	sConfig.Match = 0x00;
+	sConfig.Mask = W25Q_STATUS(SR1_BUSY);
+	sConfig.MatchMode = QSPI_MATCH_MODE_AND;
+	sConfig.StatusBytesSize = QSPI_DIES;
+	sConfig.Interval = 0x10;
+	sConfig.AutomaticStop = QSPI_AUTOMATIC_STOP_ENABLE;
+
+	return HAL_QSPI_AutoPolling_IT(&hqspi, &sCommand, &sConfig);
+}
+
+// Write enable, the status match on WEL moves on to the given state
+static uint8_t QSPI_AsyncWriteEnable(qspi_async_state_t state) {
+	QSPI_CommandTypeDef sCommand = { 0 };
+	QSPI_AutoPollingTypeDef sConfig = { 0 };
+
+	sCommand.InstructionMode = W25Q_INSTRUCTION_LINES;
+	sCommand.Instruction = WRITE_ENABLE_CMD;
+	sCommand.AddressMode = QSPI_ADDRESS_NONE;
+	sCommand.AlternateByteMode = QSPI_ALTERNATE_BYTES_NONE;
+	sCommand.DataMode = QSPI_DATA_NONE;
+	sCommand.DummyCycles = 0;
+	sCommand.DdrMode = QSPI_DDR_MODE_DISABLE;
+	sCommand.DdrHoldHalfCycle = QSPI_DDR_HHC_ANALOG_DELAY;
+	sCommand.SIOOMode = QSPI_SIOO_INST_EVERY_CMD;
+
+	if (HAL_QSPI_Command(&hqspi, &sCommand, HAL_QPSI_TIMEOUT_DEFAULT_VALUE) != HAL_OK) {
+		return HAL_ERROR;
+	}
+
+	sCommand.Instruction = READ_STATUS_REG_CMD;
+	sCommand.DataMode = W25Q_DATA_LINES;
+
+	sConfig.Match = W25Q_STATUS(SR1_WEL);
+	sConfig.Mask = W25Q_STATUS(SR1_WEL);
+	sConfig.MatchMode = QSPI_MATCH_MODE_AND;
+	sConfig.StatusBytesSize = QSPI_DIES;
+	sConfig.Interval = 0x10;
+	sConfig.AutomaticStop = QSPI_AUTOMATIC_STOP_ENABLE;
+
+	qspi_async.state = state;
+	qspi_async.wel_tick = HAL_GetTick();
+	return HAL_QSPI_AutoPolling_IT(&hqspi, &sCommand, &sConfig);
+}
+
+static uint8_t QSPI_AsyncProgPage(void) {
+	QSPI_CommandTypeDef sCommand = { 0 };
+	uint32_t size = MEMORY_PAGE_SIZE - (qspi_async.address % MEMORY_PAGE_SIZE);
+
+	if (size > qspi_async.end - qspi_async.address) {
+		size = qspi_async.end - qspi_async.address;
+	}
+
+	sCommand.InstructionMode = W25Q_INSTRUCTION_LINES;
+	sCommand.Instruction = W25Q_PROG_CMD;
+	sCommand.AddressMode = W25Q_ADDRESS_LINES;
+	sCommand.AddressSize = W25Q_ADDRESS_SIZE;
+	sCommand.Address = qspi_async.address;
+	sCommand.AlternateByteMode = QSPI_ALTERNATE_BYTES_NONE;
+	sCommand.DataMode = QSPI_DATA_4_LINES;
+	sCommand.NbData = size;
+	sCommand.DummyCycles = 0;
+	sCommand.DdrMode = QSPI_DDR_MODE_DISABLE;
+	sCommand.DdrHoldHalfCycle = QSPI_DDR_HHC_ANALOG_DELAY;
+	sCommand.SIOOMode = QSPI_SIOO_INST_EVERY_CMD;
+
+	if (HAL_QSPI_Command(&hqspi, &sCommand, HAL_QPSI_TIMEOUT_DEFAULT_VALUE) != HAL_OK) {
+		return HAL_ERROR;
+	}
+
+	uint8_t *data = qspi_async.buffer;
+	qspi_async.address += size;										// Before the interrupt can fire
+	qspi_async.buffer += size;
+	qspi_async.state = QSPI_ASYNC_PROG;
+	return HAL_QSPI_Transmit_IT(&hqspi, data);
+}
+
+static uint8_t QSPI_AsyncErase(void) {
+	QSPI_CommandTypeDef sCommand = { 0 };
+
+	sCommand.InstructionMode = W25Q_INSTRUCTION_LINES;
+	sCommand.Instruction = qspi_flash.erase[0].cmd;
+	sCommand.AddressMode = W25Q_ADDRESS_LINES;
+	sCommand.AddressSize = W25Q_ADDRESS_SIZE;
+	sCommand.Address = qspi_async.start;
+	sCommand.AlternateByteMode = QSPI_ALTERNATE_BYTES_NONE;
+	sCommand.DataMode = QSPI_DATA_NONE;
+	sCommand.DummyCycles = 0;
+	sCommand.DdrMode = QSPI_DDR_MODE_DISABLE;
+	sCommand.DdrHoldHalfCycle = QSPI_DDR_HHC_ANALOG_DELAY;
+	sCommand.SIOOMode = QSPI_SIOO_INST_EVERY_CMD;
+
+	if (HAL_QSPI_Command(&hqspi, &sCommand, HAL_QPSI_TIMEOUT_DEFAULT_VALUE) != HAL_OK) {
+		return HAL_ERROR;
+	}
+
+	qspi_async.state = QSPI_ASYNC_ERASE_WAIT;
+	return QSPI_AsyncPollReady();
+}
+
+//-------------------------------------------------------------------------------------------------
+// Advance the state machine on a QSPI interrupt callback, returns false if no request is active
+//-------------------------------------------------------------------------------------------------
+static bool QSPI_AsyncEvent(uint8_t status) {
+	if (qspi_async.state == QSPI_ASYNC_IDLE) {
+		return false;
+	}
+
+	if (status != HAL_OK) {
+		HAL_QSPI_Abort(&hqspi);										// BUSY may stay set after a transfer error
+		MODIFY_REG(hqspi.Instance->DCR, QUADSPI_DCR_CSHT, QSPI_CS_HIGH_TIME_6_CYCLE);
+#ifdef QSPI_DTR_READ
+		QSPI_DtrTiming(false);										// Failing anyway
+#endif
+		QSPI_AsyncDone(HAL_ERROR);
+		return true;
+	}
+
+	switch (qspi_async.state) {
+	case QSPI_ASYNC_READ:
+		MODIFY_REG(hqspi.Instance->DCR, QUADSPI_DCR_CSHT, QSPI_CS_HIGH_TIME_6_CYCLE);
+#ifdef QSPI_DTR_READ
+		if (QSPI_DtrTiming(false) != HAL_OK) {
+			QSPI_AsyncDone(HAL_ERROR);
+			break;
+		}
+#endif
+		QSPI_AsyncDone(HAL_OK);
+		break;
+
+	case QSPI_ASYNC_PROG_WEL:
+		if (QSPI_AsyncProgPage() != HAL_OK) {
+			QSPI_AsyncDone(HAL_ERROR);
+		}
+		break;
+
+	case QSPI_ASYNC_PROG:											// Page sent, wait for Busy low
+		qspi_async.state = QSPI_ASYNC_PROG_WAIT;
+		if (QSPI_AsyncPollReady() != HAL_OK) {
+			QSPI_AsyncDone(HAL_ERROR);
+		}
+		break;
+
+	case QSPI_ASYNC_PROG_WAIT:
+		if (qspi_async.address >= qspi_async.end) {
+			QSPI_AsyncDone(HAL_OK);
+		} else if (QSPI_AsyncWriteEnable(QSPI_ASYNC_PROG_WEL) != HAL_OK) {
+			QSPI_AsyncDone(HAL_ERROR);
+		}
+		break;
+
+	case QSPI_ASYNC_ERASE_WEL:
+		if (QSPI_AsyncErase() != HAL_OK) {
+			QSPI_AsyncDone(HAL_ERROR);
+		}
+		break;
+
+	default:
+		QSPI_AsyncDone(HAL_OK);
+		break;
+	}
+	return true;
+}
+
+#ifndef QSPI_USE_DMA
+void HAL_QSPI_RxCpltCallback(QSPI_HandleTypeDef *hqspi)
+{
+	UNUSED(hqspi);
+	QSPI_AsyncEvent(HAL_OK);
+}
+
+void HAL_QSPI_TxCpltCallback(QSPI_HandleTypeDef *hqspi)
+{
+	UNUSED(hqspi);
+	QSPI_AsyncEvent(HAL_OK);
+}
+
+void HAL_QSPI_ErrorCallback(QSPI_HandleTypeDef *hqspi)
+{
+	UNUSED(hqspi);
+	QSPI_AsyncEvent(HAL_ERROR);
+}
+#endif
+
+void HAL_QSPI_StatusMatchCallback(QSPI_HandleTypeDef *hqspi)
+{
+	UNUSED(hqspi);
+	QSPI_AsyncEvent(HAL_OK);
+}
+
+uint8_t CSP_QSPI_ReadAsync(uint8_t *pData, uint32_t ReadAddr, uint32_t Size, qspi_callback_t callback, void *context) {
+	QSPI_CommandTypeDef sCommand = { 0 };
+
+	if (qspi_async.state != QSPI_ASYNC_IDLE) {
+		return HAL_BUSY;
+	}
+#ifdef QSPI_MEMMAPPED_READ
+	if (QSPI_ExitMappedMode() != HAL_OK) {
+		return HAL_ERROR;
+	}
+#endif
+	qspi_async.callback = callback;
+	qspi_async.context = context;
+
+	QSPI_ReadCommand(&sCommand, ReadAddr, Size);
+#ifdef QSPI_DTR_READ
+	if (QSPI_DtrTiming(true) != HAL_OK) {							// QSPI_AsyncEvent restores it
+		return HAL_ERROR;
+	}
+#endif
+
+	if (HAL_QSPI_Command(&hqspi, &sCommand, HAL_QPSI_TIMEOUT_DEFAULT_VALUE) != HAL_OK) {
+#ifdef QSPI_DTR_READ
+		QSPI_DtrTiming(false);
+#endif
+		return HAL_ERROR;
+	}
+
+	MODIFY_REG(hqspi.Instance->DCR, QUADSPI_DCR_CSHT, QSPI_CS_HIGH_TIME_5_CYCLE);
+	qspi_async.state = QSPI_ASYNC_READ;
+	if (HAL_QSPI_Receive_IT(&hqspi, pData) != HAL_OK) {
+		qspi_async.state = QSPI_ASYNC_IDLE;
+		MODIFY_REG(hqspi.Instance->DCR, QUADSPI_DCR_CSHT, QSPI_CS_HIGH_TIME_6_CYCLE);
+#ifdef QSPI_DTR_READ
+		QSPI_DtrTiming(false);
+#endif
+		return HAL_ERROR;
+	}
+	return HAL_OK;
+}
+
+uint8_t CSP_QSPI_WriteAsync(uint8_t *buffer, uint32_t address, uint32_t buffer_size, qspi_callback_t callback, void *context) {
+	if (qspi_async.state != QSPI_ASYNC_IDLE) {
+		return HAL_BUSY;
+	}
+	if (buffer_size == 0) {
+		return HAL_ERROR;
+	}
+#ifdef QSPI_MEMMAPPED_READ
+	if (QSPI_ExitMappedMode() != HAL_OK) {
+		return HAL_ERROR;
+	}
+#endif
+	qspi_async.callback = callback;
+	qspi_async.context = context;
+	qspi_async.buffer = buffer;
+	qspi_async.start = address;
+	qspi_async.address = address;
+	qspi_async.end = address + buffer_size;
+
+	if (QSPI_AsyncWriteEnable(QSPI_ASYNC_PROG_WEL) != HAL_OK) {
+		qspi_async.state = QSPI_ASYNC_IDLE;
+		return HAL_ERROR;
+	}
+	return HAL_OK;
+}
+
+uint8_t CSP_QSPI_EraseSectorAsync(uint32_t address, qspi_callback_t callback, void *context) {
+	if (qspi_async.state != QSPI_ASYNC_IDLE) {
+		return HAL_BUSY;
+	}
+#ifdef QSPI_MEMMAPPED_READ
+	if (QSPI_ExitMappedMode() != HAL_OK) {
+		return HAL_ERROR;
+	}
+#endif
+	qspi_async.callback = callback;
+	qspi_async.context = context;
+	qspi_async.start = address - address % MEMORY_SECTOR_SIZE;
+	qspi_async.end = qspi_async.start + MEMORY_SECTOR_SIZE;
+
+	if (QSPI_AsyncWriteEnable(QSPI_ASYNC_ERASE_WEL) != HAL_OK) {
+		qspi_async.state = QSPI_ASYNC_IDLE;
+		return HAL_ERROR;
+	}
+	return HAL_OK;
+}
+#endif
@@ -124,6 +124,61 @@ static int lfs_bd_read(lfs_t *lfs,
     return 0;
 }
 
+// find the cached span holding off, loading rcache if needed, so callers
+// can work on cache memory directly instead of copying it out first
+static int lfs_bd_peek(lfs_t *lfs,
+        const lfs_cache_t *pcache, lfs_cache_t *rcache, lfs_size_t hint,
+        lfs_block_t block, lfs_off_t off, lfs_size_t size,
+        const uint8_t **data, lfs_size_t *diff) {
+    if (off+size > lfs->cfg->block_size
+            || (lfs->block_count && block >= lfs->block_count)) {
+        return LFS_ERR_CORRUPT;
+    }
+
+    while (true) {
+        lfs_size_t avail = size;
+
+        if (pcache && block == pcache->block &&
+                off < pcache->off + pcache->size) {
+            if (off >= pcache->off) {
+                // is already in pcache?
+                *data = &pcache->buffer[off-pcache->off];
+                *diff = lfs_min(avail, pcache->size - (off-pcache->off));
+                return 0;
+            }
+
+            // pcache takes priority
+            avail = lfs_min(avail, pcache->off-off);
+        }
+
+        if (block == rcache->block &&
+                off >= rcache->off &&
+                off < rcache->off + rcache->size) {
+            // is already in rcache?
+            *data = &rcache->buffer[off-rcache->off];
+            *diff = lfs_min(avail, rcache->size - (off-rcache->off));
+            return 0;
+        }
+
+        // load to cache, first condition can no longer fail
+        LFS_ASSERT(!lfs->block_count || block < lfs->block_count);
+        rcache->block = block;
+        rcache->off = lfs_aligndown(off, lfs->cfg->read_size);
+        rcache->size = lfs_min(
+                lfs_min(
+                    lfs_alignup(off+hint, lfs->cfg->read_size),
+                    lfs->cfg->block_size)
+                - rcache->off,
+                lfs->cfg->cache_size);
+        int err = lfs->cfg->read(lfs->cfg, rcache->block,
+                rcache->off, rcache->buffer, rcache->size);
+        LFS_ASSERT(err <= 0);
+        if (err) {
+            return err;
+        }
+    }
+}
+
 static int lfs_bd_cmp(lfs_t *lfs,
         const lfs_cache_t *pcache, lfs_cache_t *rcache, lfs_size_t hint,
         lfs_block_t block, lfs_off_t off,
@@ -132,12 +187,10 @@ static int lfs_bd_cmp(lfs_t *lfs,
     lfs_size_t diff = 0;
 
     for (lfs_off_t i = 0; i < size; i += diff) {
-        uint8_t dat[8];
-
-        diff = lfs_min(size-i, sizeof(dat));
-        int err = lfs_bd_read(lfs,
+        const uint8_t *dat;
+        int err = lfs_bd_peek(lfs,
                 pcache, rcache, hint-i,
-                block, off+i, &dat, diff);
+                block, off+i, size-i, &dat, &diff);
         if (err) {
             return err;
         }
@@ -157,16 +210,15 @@ static int lfs_bd_crc(lfs_t *lfs,
     lfs_size_t diff = 0;
 
     for (lfs_off_t i = 0; i < size; i += diff) {
-        uint8_t dat[8];
-        diff = lfs_min(size-i, sizeof(dat));
-        int err = lfs_bd_read(lfs,
+        const uint8_t *dat;
+        int err = lfs_bd_peek(lfs,
                 pcache, rcache, hint-i,
-                block, off+i, &dat, diff);
+                block, off+i, size-i, &dat, &diff);
         if (err) {
             return err;
         }
 
-        *crc = lfs_crc(*crc, &dat, diff);
+        *crc = lfs_crc(*crc, dat, diff);
     }
 
     return 0;
@@ -177,6 +229,10 @@ static int lfs_bd_flush(lfs_t *lfs,
         lfs_cache_t *pcache, lfs_cache_t *rcache, bool validate) {
     if (pcache->block != LFS_BLOCK_NULL && pcache->block != LFS_BLOCK_INLINE) {
         LFS_ASSERT(pcache->block < lfs->block_count);
+        if (lfs->gc.erased[pcache->block % LFS_GC_ERASED] == pcache->block) {
+            lfs->gc.erased[pcache->block % LFS_GC_ERASED] = LFS_BLOCK_NULL;
+        }
+
         lfs_size_t diff = lfs_alignup(pcache->size, lfs->cfg->prog_size);
         int err = lfs->cfg->prog(lfs->cfg, pcache->block,
                 pcache->off, pcache->buffer, diff);
@@ -185,18 +241,37 @@ static int lfs_bd_flush(lfs_t *lfs,
             return err;
         }
 
-        if (validate) {
+        if (validate && !lfs->cfg->no_validate) {
             // check data on disk
             lfs_cache_drop(lfs, rcache);
-            int res = lfs_bd_cmp(lfs,
-                    NULL, rcache, diff,
-                    pcache->block, pcache->off, pcache->buffer, diff);
-            if (res < 0) {
-                return res;
-            }
+            if (pcache->off % lfs->cfg->read_size == 0
+                    && diff % lfs->cfg->read_size == 0) {
+                // fits in rcache, read back in one go, rcache then holds
+                // what is really on disk either way
+                err = lfs->cfg->read(lfs->cfg, pcache->block,
+                        pcache->off, rcache->buffer, diff);
+                LFS_ASSERT(err <= 0);
+                if (err) {
+                    return err;
+                }
+
+                rcache->block = pcache->block;
+                rcache->off = pcache->off;
+                rcache->size = diff;
+                if (memcmp(rcache->buffer, pcache->buffer, diff) != 0) {
+                    return LFS_ERR_CORRUPT;
+                }
+            } else {
+                int res = lfs_bd_cmp(lfs,
+                        NULL, rcache, diff,
+                        pcache->block, pcache->off, pcache->buffer, diff);
+                if (res < 0) {
+                    return res;
+                }
 
-            if (res != LFS_CMP_EQ) {
-                return LFS_ERR_CORRUPT;
+                if (res != LFS_CMP_EQ) {
+                    return LFS_ERR_CORRUPT;
+                }
             }
         }
 
@@ -584,6 +659,9 @@ static int lfs_file_close_(lfs_t *lfs, lfs_file_t *file);
 static lfs_soff_t lfs_file_size_(lfs_t *lfs, lfs_file_t *file);
 
 static lfs_ssize_t lfs_fs_size_(lfs_t *lfs);
+#ifdef LFS_USAGE_COUNTER
+static int lfs_ctz_index(lfs_t *lfs, lfs_off_t *off);
+#endif
 static int lfs_fs_traverse_(lfs_t *lfs,
         int (*cb)(void *data, lfs_block_t block), void *data,
         bool includeorphans);
@@ -644,6 +722,7 @@ static int lfs_alloc_scan(lfs_t *lfs) {
         lfs_alloc_drop(lfs);
         return err;
     }
+    lfs->lookahead.changed = true;
 
     return 0;
 }
@@ -654,11 +733,22 @@ static int lfs_alloc(lfs_t *lfs, lfs_block_t *block) {
     while (true) {
         // scan our lookahead buffer for free blocks
         while (lfs->lookahead.next < lfs->lookahead.size) {
+            // skip a byte of in-use blocks at a time, this matters with a
+            // whole-device lookahead buffer on a nearly full filesystem
+            if (lfs->lookahead.next % 8 == 0
+                    && lfs->lookahead.next + 8 <= lfs->lookahead.size
+                    && lfs->lookahead.buffer[lfs->lookahead.next / 8] == 0xff) {
+                lfs->lookahead.next += 8;
+                lfs->lookahead.ckpoint -= 8;
+                continue;
+            }
+
             if (!(lfs->lookahead.buffer[lfs->lookahead.next / 8]
                     & (1U << (lfs->lookahead.next % 8)))) {
                 // found a free block
                 *block = (lfs->lookahead.start + lfs->lookahead.next)
                         % lfs->block_count;
+                lfs->lookahead.changed = true;
 
                 // eagerly find next free block to maximize how many blocks
                 // lfs_alloc_ckpoint makes available for scanning
@@ -1461,6 +1551,166 @@ static int lfs_dir_find_match(void *data,
     return LFS_CMP_EQ;
 }
 
+#ifdef LFS_PATHCACHE_SIZE
+// path lookup cache, maps a name in a directory to the metadata pair and tag
+// lfs_dir_find found it at. Metadata pairs only change through commits, so
+// lfs_dir_relocatingcommit simply empties the whole cache
+static void lfs_pathcache_drop(lfs_t *lfs) {
+    for (int i = 0; i < LFS_PATHCACHE_SIZE; i++) {
+        lfs->pathcache.entries[i].namelen = 0;
+    }
+}
+
+static lfs_stag_t lfs_pathcache_get(lfs_t *lfs, const lfs_block_t parent[2],
+        const char *name, lfs_size_t namelen, lfs_mdir_t *dir) {
+    for (int i = 0; i < LFS_PATHCACHE_SIZE; i++) {
+        struct lfs_pathcache_entry *e = &lfs->pathcache.entries[i];
+        if (e->namelen == namelen
+                && e->parent[0] == parent[0]
+                && e->parent[1] == parent[1]
+                && memcmp(e->name, name, namelen) == 0) {
+            e->lru = ++lfs->pathcache.tick;
+            lfs->pathcache.hits += 1;
+            *dir = e->dir;
+            return e->tag;
+        }
+    }
+
+    lfs->pathcache.misses += 1;
+    return 0;
+}
+
+static void lfs_pathcache_put(lfs_t *lfs, const lfs_block_t parent[2],
+        const char *name, lfs_size_t namelen,
+        const lfs_mdir_t *dir, lfs_stag_t tag) {
+    if (namelen == 0 || namelen > LFS_PATHCACHE_NAME_MAX) {
+        return;
+    }
+
+    // replace an unused or the least recently used entry
+    struct lfs_pathcache_entry *e = &lfs->pathcache.entries[0];
+    for (int i = 1; i < LFS_PATHCACHE_SIZE && e->namelen; i++) {
+        if (!lfs->pathcache.entries[i].namelen
+                || lfs->pathcache.entries[i].lru < e->lru) {
+            e = &lfs->pathcache.entries[i];
+        }
+    }
+
+    e->parent[0] = parent[0];
+    e->parent[1] = parent[1];
+    e->dir = *dir;
+    e->tag = tag;
+    e->lru = ++lfs->pathcache.tick;
+    e->namelen = namelen;
+    memcpy(e->name, name, namelen);
+}
+#endif
+
+#ifdef LFS_NAMEINDEX_SIZE
+// name index, a filter of the hashes of every name a metadata pair has held
+// since lfs_dir_find last fetched it. A name missing from the filter is not in
+// the metadata pair, so the fetch can be skipped. Entries are dropped by any
+// commit to their metadata pair and when its blocks are allocated again
+static void lfs_nameindex_drop(lfs_t *lfs, const lfs_block_t pair[2]) {
+    for (int i = 0; i < LFS_NAMEINDEX_SIZE; i++) {
+        struct lfs_nameindex_entry *e = &lfs->nameindex.entries[i];
+        if (!pair || (e->lru && lfs_pair_cmp(e->dir.pair, pair) == 0)) {
+            e->lru = 0;
+        }
+    }
+}
+
+static void lfs_nameindex_add(uint32_t *filter, uint32_t hash) {
+    uint32_t a = hash % LFS_NAMEINDEX_BITS;
+    uint32_t b = (hash >> 16) % LFS_NAMEINDEX_BITS;
+    filter[a / 32] |= 1U << (a % 32);
+    filter[b / 32] |= 1U << (b % 32);
+}
+
+static bool lfs_nameindex_has(const uint32_t *filter, uint32_t hash) {
+    uint32_t a = hash % LFS_NAMEINDEX_BITS;
+    uint32_t b = (hash >> 16) % LFS_NAMEINDEX_BITS;
+    return (filter[a / 32] & (1U << (a % 32)))
+            && (filter[b / 32] & (1U << (b % 32)));
+}
+
+static struct lfs_nameindex_entry *lfs_nameindex_get(lfs_t *lfs,
+        const lfs_block_t pair[2]) {
+    for (int i = 0; i < LFS_NAMEINDEX_SIZE; i++) {
+        struct lfs_nameindex_entry *e = &lfs->nameindex.entries[i];
+        if (e->lru && lfs_pair_cmp(e->dir.pair, pair) == 0) {
+            e->lru = ++lfs->nameindex.tick;
+            return e;
+        }
+    }
+
+    return NULL;
+}
+
+static void lfs_nameindex_put(lfs_t *lfs,
+        const lfs_mdir_t *dir, const uint32_t *filter) {
+    // replace an unused or the least recently used entry
+    struct lfs_nameindex_entry *e = &lfs->nameindex.entries[0];
+    for (int i = 1; i < LFS_NAMEINDEX_SIZE && e->lru; i++) {
+        if (!lfs->nameindex.entries[i].lru
+                || lfs->nameindex.entries[i].lru < e->lru) {
+            e = &lfs->nameindex.entries[i];
+        }
+    }
+
+    e->dir = *dir;
+    e->lru = ++lfs->nameindex.tick;
+    memcpy(e->filter, filter, sizeof(e->filter));
+}
+
+struct lfs_dir_find_hashmatch {
+    struct lfs_dir_find_match name;
+    uint32_t *filter;
+};
+
+// same result as lfs_dir_find_match, but reads every name completely to add
+// its hash to the filter being built
+static int lfs_dir_find_hashmatch(void *data,
+        lfs_tag_t tag, const void *buffer) {
+    struct lfs_dir_find_hashmatch *match = data;
+    const struct lfs_dir_find_match *name = &match->name;
+    lfs_t *lfs = name->lfs;
+    const struct lfs_diskoff *disk = buffer;
+    lfs_size_t size = lfs_tag_size(tag);
+
+    uint32_t hash = 0xffffffff;
+    int res = LFS_CMP_EQ;
+    lfs_size_t diff = 0;
+    for (lfs_off_t i = 0; i < size; i += diff) {
+        uint8_t dat[8];
+        diff = lfs_min(size-i, sizeof(dat));
+        int err = lfs_bd_read(lfs,
+                NULL, &lfs->rcache, size-i,
+                disk->block, disk->off+i, &dat, diff);
+        if (err) {
+            return err;
+        }
+
+        hash = lfs_crc(hash, dat, diff);
+        if (res == LFS_CMP_EQ && i < name->size) {
+            int cmp = memcmp(dat, (const uint8_t*)name->name + i,
+                    lfs_min(diff, name->size-i));
+            if (cmp) {
+                res = (cmp < 0) ? LFS_CMP_LT : LFS_CMP_GT;
+            }
+        }
+    }
+    lfs_nameindex_add(match->filter, hash);
+
+    // only equal if our size is still the same
+    if (res == LFS_CMP_EQ && name->size != size) {
+        return (name->size < size) ? LFS_CMP_LT : LFS_CMP_GT;
+    }
+
+    return res;
+}
+#endif
+
 static lfs_stag_t lfs_dir_find(lfs_t *lfs, lfs_mdir_t *dir,
         const char **path, uint16_t *id) {
     // we reduce path to a single name if we can find it
@@ -1534,6 +1784,76 @@ nextname:
             lfs_pair_fromle32(dir->tail);
         }
 
+#ifdef LFS_PATHCACHE_SIZE
+        // seen this name in this directory before?
+        lfs_block_t parent[2] = {dir->tail[0], dir->tail[1]};
+        tag = lfs_pathcache_get(lfs, parent, name, namelen, dir);
+        if (tag) {
+            if (id && strchr(name, '/') == NULL) {
+                *id = lfs_tag_id(tag);
+            }
+            name += namelen;
+            continue;
+        }
+#endif
+
+#ifdef LFS_NAMEINDEX_SIZE
+        // find entry matching name, skipping metadata pairs that never held
+        // it. Entries are sorted over all metadata pairs of a directory and a
+        // missing entry gets the id of the first greater name, so a lookup
+        // that skipped pairs is repeated without skipping when the caller
+        // needs that id to create the entry
+        bool last = (strchr(name, '/') == NULL);
+        uint32_t hash = lfs_crc(0xffffffff, name, namelen);
+        const lfs_block_t head[2] = {dir->tail[0], dir->tail[1]};
+        bool skip = true;
+        bool skipped = false;
+        while (true) {
+            struct lfs_nameindex_entry *e = lfs_nameindex_get(lfs, dir->tail);
+            if (skip && e && !lfs_nameindex_has(e->filter, hash)) {
+                lfs->nameindex.skips += 1;
+                skipped = true;
+                *dir = e->dir;
+                tag = 0;
+            } else {
+                uint32_t filter[LFS_NAMEINDEX_BITS/32] = {0};
+                struct lfs_dir_find_hashmatch match = {
+                        {lfs, name, namelen}, filter};
+                lfs->nameindex.fetches += 1;
+                tag = lfs_dir_fetchmatch(lfs, dir, dir->tail,
+                        LFS_MKTAG(0x780, 0, 0),
+                        LFS_MKTAG(LFS_TYPE_NAME, 0, namelen),
+                        (last) ? id : NULL,
+                        (e) ? lfs_dir_find_match : lfs_dir_find_hashmatch,
+                        &match);
+                if (tag < 0 && tag != LFS_ERR_NOENT) {
+                    return tag;
+                }
+
+                if (!e) {
+                    lfs_nameindex_put(lfs, dir, filter);
+                }
+
+                if (tag > 0) {
+                    break;
+                }
+            }
+
+            if (tag == 0 && dir->split) {
+                continue;
+            }
+
+            if (skipped && last && id) {
+                skip = false;
+                skipped = false;
+                dir->tail[0] = head[0];
+                dir->tail[1] = head[1];
+                continue;
+            }
+
+            return LFS_ERR_NOENT;
+        }
+#else
         // find entry matching name
         while (true) {
             tag = lfs_dir_fetchmatch(lfs, dir, dir->tail,
@@ -1555,6 +1875,11 @@ nextname:
                 return LFS_ERR_NOENT;
             }
         }
+#endif
+
+#ifdef LFS_PATHCACHE_SIZE
+        lfs_pathcache_put(lfs, parent, name, namelen, dir, tag);
+#endif
 
         // to next name
         name += namelen;
@@ -1783,6 +2108,39 @@ static int lfs_dir_commitcrc(lfs_t *lfs, struct lfs_commit *commit) {
 }
 #endif
 
+#if defined(LFS_USAGE_COUNTER) && !defined(LFS_READONLY)
+// used block count, only valid after a traversal or a snapshot load. Metadata
+// pairs are counted when allocated and dropped, file data when the file's
+// struct is committed or the file is removed. A failed commit may leave
+// blocks allocated or not, so it invalidates the count
+static void lfs_usage_add(lfs_t *lfs, lfs_ssize_t blocks) {
+    lfs->usage.blocks += blocks;
+}
+
+// blocks used by the data of an entry, 0 for inline files and directories,
+// not looked up while there is no valid count to update
+static lfs_ssize_t lfs_usage_entry(lfs_t *lfs,
+        const lfs_mdir_t *dir, uint16_t id) {
+    if (!lfs->usage.valid) {
+        return 0;
+    }
+
+    struct lfs_ctz ctz;
+    lfs_stag_t tag = lfs_dir_get(lfs, dir, LFS_MKTAG(0x700, 0x3ff, 0),
+            LFS_MKTAG(LFS_TYPE_STRUCT, id, sizeof(ctz)), &ctz);
+    if (tag < 0) {
+        return (tag == LFS_ERR_NOENT) ? 0 : tag;
+    }
+
+    lfs_ctz_fromle32(&ctz);
+    if (lfs_tag_type3(tag) != LFS_TYPE_CTZSTRUCT || ctz.size == 0) {
+        return 0;
+    }
+
+    return lfs_ctz_index(lfs, &(lfs_off_t){ctz.size-1}) + 1;
+}
+#endif
+
 #ifndef LFS_READONLY
 static int lfs_dir_alloc(lfs_t *lfs, lfs_mdir_t *dir) {
     // allocate pair of dir blocks (backwards, so we write block 1 first)
@@ -1793,6 +2151,11 @@ static int lfs_dir_alloc(lfs_t *lfs, lfs_mdir_t *dir) {
         }
     }
 
+#ifdef LFS_NAMEINDEX_SIZE
+    // blocks may have been a metadata pair before
+    lfs_nameindex_drop(lfs, dir->pair);
+#endif
+
     // zero for reproducibility in case initial block is unreadable
     dir->rev = 0;
 
@@ -1806,11 +2169,15 @@ static int lfs_dir_alloc(lfs_t *lfs, lfs_mdir_t *dir) {
         return err;
     }
 
+#ifdef LFS_USAGE_COUNTER
+    lfs_usage_add(lfs, 2);
+#endif
+
     // to make sure we don't immediately evict, align the new revision count
     // to our block_cycles modulus, see lfs_dir_compact for why our modulus
     // is tweaked this way
     if (lfs->cfg->block_cycles > 0) {
-        dir->rev = lfs_alignup(dir->rev, ((lfs->cfg->block_cycles+1)|1));
+        dir->rev = lfs_alignup(dir->rev, 2*((lfs->cfg->block_cycles+1)|1));
     }
 
     // set defaults
@@ -1844,6 +2211,9 @@ static int lfs_dir_drop(lfs_t *lfs, lfs_mdir_t *dir, lfs_mdir_t *tail) {
         return err;
     }
 
+#ifdef LFS_USAGE_COUNTER
+    lfs_usage_add(lfs, -2);
+#endif
     return 0;
 }
 #endif
@@ -1915,6 +2285,22 @@ static bool lfs_dir_needsrelocation(lfs_t *lfs, lfs_mdir_t *dir) {
     // 1. block_cycles = 1, which would prevent relocations from terminating
     // 2. block_cycles = 2n, which, due to aliasing, would only ever relocate
     //    one metadata block in the pair, effectively making this useless
+    if (lfs->cfg->bounded_commit) {
+        // bounded commits leave relocations to lfs_fs_gcstep, which may not
+        // run at the exact revision, so it takes the last quarter of the
+        // cycle, lfs_dir_compact then restarts at a multiple of two cycles.
+        // A pair still not relocated a whole cycle later is relocated by the
+        // commit as without bounded commits, wear leveling must not depend
+        // on gcstep running. That is one compaction short of two cycles, an
+        // odd count, so relocations alternate between the blocks of the pair
+        lfs_size_t cycles = ((lfs->cfg->block_cycles+1)|1);
+        lfs_size_t left = cycles - (dir->rev + 1) % cycles;
+        return (lfs->cfg->block_cycles > 0
+                && ((lfs->gc.relocating
+                        && (left == cycles || left <= cycles/4))
+                    || (dir->rev + 2) % (2*cycles) == 0));
+    }
+
     return (lfs->cfg->block_cycles > 0
             && ((dir->rev + 1) % ((lfs->cfg->block_cycles+1)|1) == 0));
 }
@@ -1930,6 +2316,9 @@ static int lfs_dir_compact(lfs_t *lfs,
 
     // increment revision count
     dir->rev += 1;
+    if (tired && lfs->cfg->bounded_commit) {
+        dir->rev = lfs_alignup(dir->rev, 2*((lfs->cfg->block_cycles+1)|1));
+    }
 
     // do not proactively relocate blocks during migrations, this
     // can cause a number of failure states such: clobbering the
@@ -2056,6 +2445,9 @@ static int lfs_dir_compact(lfs_t *lfs,
             dir->count = end - begin;
             dir->off = commit.off;
             dir->etag = commit.ptag;
+            // the rest of the block was just erased, so the next commit can
+            // append instead of compacting again, as after a fetch
+            dir->erased = true;
             // update gstate
             lfs->gdelta = (lfs_gstate_t){0};
             if (!relocated) {
@@ -2084,6 +2476,9 @@ relocate:
         if (err && (err != LFS_ERR_NOSPC || !tired)) {
             return err;
         }
+#ifdef LFS_NAMEINDEX_SIZE
+        lfs_nameindex_drop(lfs, dir->pair);
+#endif
 
         tired = false;
         continue;
@@ -2208,6 +2603,13 @@ static int lfs_dir_relocatingcommit(lfs_t *lfs, lfs_mdir_t *dir,
         lfs_mdir_t *pdir) {
     int state = 0;
 
+#ifdef LFS_PATHCACHE_SIZE
+    lfs_pathcache_drop(lfs);
+#endif
+#ifdef LFS_NAMEINDEX_SIZE
+    lfs_nameindex_drop(lfs, dir->pair);
+#endif
+
     // calculate changes to the directory
     bool hasdelete = false;
     for (int i = 0; i < attrcount; i++) {
@@ -2377,6 +2779,10 @@ fixmlist:;
 #ifndef LFS_READONLY
 static int lfs_dir_orphaningcommit(lfs_t *lfs, lfs_mdir_t *dir,
         const struct lfs_mattr *attrs, int attrcount) {
+    // metadata changes, lfs_fs_gcstep needs to check all mdirs again
+    lfs->gc.tail[0] = 0;
+    lfs->gc.tail[1] = 1;
+
     // check for any inline files that aren't RAM backed and
     // forcefully evict them, needed for filesystem consistency
     for (lfs_file_t *f = (lfs_file_t*)lfs->mlist; f; f = f->next) {
@@ -2572,6 +2978,9 @@ static int lfs_dir_commit(lfs_t *lfs, lfs_mdir_t *dir,
         const struct lfs_mattr *attrs, int attrcount) {
     int orphans = lfs_dir_orphaningcommit(lfs, dir, attrs, attrcount);
     if (orphans < 0) {
+#ifdef LFS_USAGE_COUNTER
+        lfs->usage.valid = false;
+#endif
         return orphans;
     }
 
@@ -2887,6 +3296,119 @@ static int lfs_ctz_find(lfs_t *lfs,
     return 0;
 }
 
+#ifdef LFS_CTZCACHE_SIZE
+// CTZ position cache, remembers the blocks of the skip-list indexes a file
+// handle walked through. Blocks of a CTZ skip-list are never changed in place,
+// a write builds new blocks from some index onward, so only the entries from
+// that index on are dropped
+static void lfs_ctzcache_drop(lfs_file_t *file, lfs_off_t index) {
+    for (lfs_size_t i = 0; i < file->ctzcache.size; i++) {
+        if (file->ctzcache.entries[i].index >= index) {
+            file->ctzcache.entries[i].lru = 0;
+        }
+    }
+}
+
+// number of pointer reads to walk the skip-list from index current to target
+static lfs_size_t lfs_ctzcache_hops(lfs_off_t current, lfs_off_t target) {
+    lfs_size_t hops = 0;
+    while (current > target) {
+        current -= 1 << lfs_min(
+                lfs_npw2(current-target+1) - 1,
+                lfs_ctz(current));
+        hops += 1;
+    }
+
+    return hops;
+}
+
+static void lfs_ctzcache_put(lfs_file_t *file,
+        lfs_off_t index, lfs_block_t block) {
+    // replace the entry of this index, an unused or the least recently used
+    // entry
+    struct lfs_ctzpos *e = NULL;
+    for (lfs_size_t i = 0; i < file->ctzcache.size; i++) {
+        struct lfs_ctzpos *f = &file->ctzcache.entries[i];
+        if (f->lru && f->index == index) {
+            e = f;
+            break;
+        }
+
+        if (!e || (e->lru && (!f->lru || f->lru < e->lru))) {
+            e = f;
+        }
+    }
+
+    e->index = index;
+    e->block = block;
+    e->lru = ++file->ctzcache.tick;
+}
+#endif
+
+// lfs_ctz_find for the skip-list of an open file, starts at the nearest block
+// in the position cache if the file has one
+static int lfs_file_ctzfind(lfs_t *lfs, lfs_file_t *file,
+        lfs_size_t pos, lfs_block_t *block, lfs_off_t *off) {
+#ifdef LFS_CTZCACHE_SIZE
+    if (file->ctz.size == 0 || file->ctzcache.size == 0) {
+        return lfs_ctz_find(lfs, NULL, &file->cache,
+                file->ctz.head, file->ctz.size, pos, block, off);
+    }
+
+    lfs_block_t head = file->ctz.head;
+    lfs_off_t current = lfs_ctz_index(lfs, &(lfs_off_t){file->ctz.size-1});
+    lfs_off_t target = lfs_ctz_index(lfs, &pos);
+
+    // known block at or after the target with the shortest walk, entries
+    // past the current head are left over from a truncate
+    struct lfs_ctzpos *start = NULL;
+    lfs_size_t hops = lfs_ctzcache_hops(current, target);
+    for (lfs_size_t i = 0; i < file->ctzcache.size && hops > 0; i++) {
+        struct lfs_ctzpos *e = &file->ctzcache.entries[i];
+        if (e->lru && e->index >= target && e->index < current) {
+            lfs_size_t ehops = lfs_ctzcache_hops(e->index, target);
+            if (ehops < hops) {
+                start = e;
+                hops = ehops;
+            }
+        }
+    }
+
+    if (start) {
+        start->lru = ++file->ctzcache.tick;
+        current = start->index;
+        head = start->block;
+        lfs->ctzcache.hits += 1;
+    } else {
+        lfs->ctzcache.misses += 1;
+    }
+
+    while (current > target) {
+        lfs_size_t skip = lfs_min(
+                lfs_npw2(current-target+1) - 1,
+                lfs_ctz(current));
+
+        int err = lfs_bd_read(lfs,
+                NULL, &file->cache, sizeof(head),
+                head, 4*skip, &head, sizeof(head));
+        head = lfs_fromle32(head);
+        if (err) {
+            return err;
+        }
+
+        current -= 1 << skip;
+        lfs_ctzcache_put(file, current, head);
+    }
+
+    *block = head;
+    *off = pos;
+    return 0;
+#else
+    return lfs_ctz_find(lfs, NULL, &file->cache,
+            file->ctz.head, file->ctz.size, pos, block, off);
+#endif
+}
+
 #ifndef LFS_READONLY
 static int lfs_ctz_extend(lfs_t *lfs,
         lfs_cache_t *pcache, lfs_cache_t *rcache,
@@ -3054,6 +3576,10 @@ static int lfs_file_opencfg_(lfs_t *lfs, lfs_file_t *file,
     file->pos = 0;
     file->off = 0;
     file->cache.buffer = NULL;
+#ifdef LFS_CTZCACHE_SIZE
+    file->ctzcache.entries = NULL;
+    file->ctzcache.size = 0;
+#endif
 
     // allocate entry for file if it doesn't exist
     lfs_stag_t tag = lfs_dir_find(lfs, &file->m, &path, &file->id);
@@ -3164,6 +3690,25 @@ static int lfs_file_opencfg_(lfs_t *lfs, lfs_file_t *file,
     // zero to avoid information leak
     lfs_cache_zero(lfs, &file->cache);
 
+#ifdef LFS_CTZCACHE_SIZE
+    // allocate CTZ position cache, without memory for it we just walk the
+    // skip-list from the head
+    lfs_size_t ctz_cache_size = (file->cfg->ctz_cache_size)
+            ? file->cfg->ctz_cache_size
+            : LFS_CTZCACHE_SIZE;
+    if (file->cfg->ctz_cache) {
+        file->ctzcache.entries = file->cfg->ctz_cache;
+    } else {
+        file->ctzcache.entries = lfs_malloc(
+                ctz_cache_size*sizeof(struct lfs_ctzpos));
+    }
+    if (file->ctzcache.entries) {
+        file->ctzcache.size = ctz_cache_size;
+        file->ctzcache.tick = 0;
+        lfs_ctzcache_drop(file, 0);
+    }
+#endif
+
     if (lfs_tag_type3(tag) == LFS_TYPE_INLINESTRUCT) {
         // load inline files
         file->ctz.head = LFS_BLOCK_INLINE;
@@ -3221,6 +3766,11 @@ static int lfs_file_close_(lfs_t *lfs, lfs_file_t *file) {
     if (!file->cfg->buffer) {
         lfs_free(file->cache.buffer);
     }
+#ifdef LFS_CTZCACHE_SIZE
+    if (!file->cfg->ctz_cache) {
+        lfs_free(file->ctzcache.entries);
+    }
+#endif
 
     return err;
 }
@@ -3436,6 +3986,18 @@ static int lfs_file_sync_(lfs_t *lfs, lfs_file_t *file) {
             size = sizeof(ctz);
         }
 
+#ifdef LFS_USAGE_COUNTER
+        // blocks of the committed version of the file are freed, this also
+        // holds if both versions share blocks
+        lfs_ssize_t used = lfs_usage_entry(lfs, &file->m, file->id);
+        if (used < 0) {
+            return used;
+        }
+        if (!(file->flags & LFS_F_INLINE) && file->ctz.size > 0) {
+            used -= lfs_ctz_index(lfs, &(lfs_off_t){file->ctz.size-1}) + 1;
+        }
+#endif
+
         // commit file data and attributes
         err = lfs_dir_commit(lfs, &file->m, LFS_MKATTRS(
                 {LFS_MKTAG(type, file->id, size), buffer},
@@ -3446,6 +4008,10 @@ static int lfs_file_sync_(lfs_t *lfs, lfs_file_t *file) {
             return err;
         }
 
+#ifdef LFS_USAGE_COUNTER
+        lfs_usage_add(lfs, -used);
+#endif
+
         file->flags &= ~LFS_F_DIRTY;
     }
 
@@ -3471,8 +4037,7 @@ static lfs_ssize_t lfs_file_flushedread(lfs_t *lfs, lfs_file_t *file,
         if (!(file->flags & LFS_F_READING) ||
                 file->off == lfs->cfg->block_size) {
             if (!(file->flags & LFS_F_INLINE)) {
-                int err = lfs_ctz_find(lfs, NULL, &file->cache,
-                        file->ctz.head, file->ctz.size,
+                int err = lfs_file_ctzfind(lfs, file,
                         file->pos, &file->block, &file->off);
                 if (err) {
                     return err;
@@ -3555,8 +4120,7 @@ static lfs_ssize_t lfs_file_flushedwrite(lfs_t *lfs, lfs_file_t *file,
             if (!(file->flags & LFS_F_INLINE)) {
                 if (!(file->flags & LFS_F_WRITING) && file->pos > 0) {
                     // find out which block we're extending from
-                    int err = lfs_ctz_find(lfs, NULL, &file->cache,
-                            file->ctz.head, file->ctz.size,
+                    int err = lfs_file_ctzfind(lfs, file,
                             file->pos-1, &file->block, &(lfs_off_t){0});
                     if (err) {
                         file->flags |= LFS_F_ERRED;
@@ -3567,6 +4131,13 @@ static lfs_ssize_t lfs_file_flushedwrite(lfs_t *lfs, lfs_file_t *file,
                     lfs_cache_zero(lfs, &file->cache);
                 }
 
+#ifdef LFS_CTZCACHE_SIZE
+                // blocks from here on are rebuilt
+                lfs_ctzcache_drop(file, (file->pos > 0)
+                        ? lfs_ctz_index(lfs, &(lfs_off_t){file->pos-1})
+                        : 0);
+#endif
+
                 // extend file with new blocks
                 lfs_alloc_ckpoint(lfs);
                 int err = lfs_ctz_extend(lfs, &file->cache, &lfs->rcache,
@@ -3754,6 +4325,9 @@ static int lfs_file_truncate_(lfs_t *lfs, lfs_file_t *file, lfs_off_t size) {
             file->ctz.head = LFS_BLOCK_INLINE;
             file->ctz.size = size;
             file->flags |= LFS_F_DIRTY | LFS_F_READING | LFS_F_INLINE;
+#ifdef LFS_CTZCACHE_SIZE
+            lfs_ctzcache_drop(file, 0);
+#endif
             file->cache.block = file->ctz.head;
             file->cache.off = 0;
             file->cache.size = lfs->cfg->cache_size;
@@ -3767,8 +4341,7 @@ static int lfs_file_truncate_(lfs_t *lfs, lfs_file_t *file, lfs_off_t size) {
             }
 
             // lookup new head in ctz skip list
-            err = lfs_ctz_find(lfs, NULL, &file->cache,
-                    file->ctz.head, file->ctz.size,
+            err = lfs_file_ctzfind(lfs, file,
                     size-1, &file->block, &(lfs_off_t){0});
             if (err) {
                 return err;
@@ -3893,6 +4466,14 @@ static int lfs_remove_(lfs_t *lfs, const char *path) {
         lfs->mlist = &dir;
     }
 
+#ifdef LFS_USAGE_COUNTER
+    lfs_ssize_t used = lfs_usage_entry(lfs, &cwd, lfs_tag_id(tag));
+    if (used < 0) {
+        lfs->mlist = dir.next;
+        return used;
+    }
+#endif
+
     // delete the entry
     err = lfs_dir_commit(lfs, &cwd, LFS_MKATTRS(
             {LFS_MKTAG(LFS_TYPE_DELETE, lfs_tag_id(tag), 0), NULL}));
@@ -3901,6 +4482,10 @@ static int lfs_remove_(lfs_t *lfs, const char *path) {
         return err;
     }
 
+#ifdef LFS_USAGE_COUNTER
+    lfs_usage_add(lfs, -used);
+#endif
+
     lfs->mlist = dir.next;
     if (lfs_tag_type3(tag) == LFS_TYPE_DIR) {
         // fix orphan
@@ -4007,6 +4592,18 @@ static int lfs_rename_(lfs_t *lfs, const char *oldpath, const char *newpath) {
         lfs->mlist = &prevdir;
     }
 
+#ifdef LFS_USAGE_COUNTER
+    // a file we replace frees its blocks
+    lfs_ssize_t used = 0;
+    if (prevtag != LFS_ERR_NOENT) {
+        used = lfs_usage_entry(lfs, &newcwd, newid);
+        if (used < 0) {
+            lfs->mlist = prevdir.next;
+            return used;
+        }
+    }
+#endif
+
     if (!samepair) {
         lfs_fs_prepmove(lfs, newoldid, oldcwd.pair);
     }
@@ -4025,6 +4622,10 @@ static int lfs_rename_(lfs_t *lfs, const char *oldpath, const char *newpath) {
         return err;
     }
 
+#ifdef LFS_USAGE_COUNTER
+    lfs_usage_add(lfs, -used);
+#endif
+
     // let commit clean up after move (if we're different! otherwise move
     // logic already fixed it for us)
     if (!samepair && lfs_gstate_hasmove(&lfs->gstate)) {
@@ -4158,6 +4759,35 @@ static int lfs_init(lfs_t *lfs, const struct lfs_config *cfg) {
     lfs->block_count = cfg->block_count;  // May be 0
     int err = 0;
 
+#ifdef LFS_PATHCACHE_SIZE
+    lfs->pathcache.tick = 0;
+    lfs->pathcache.hits = 0;
+    lfs->pathcache.misses = 0;
+    lfs_pathcache_drop(lfs);
+#endif
+#ifdef LFS_NAMEINDEX_SIZE
+    lfs->nameindex.tick = 0;
+    lfs->nameindex.skips = 0;
+    lfs->nameindex.fetches = 0;
+    lfs_nameindex_drop(lfs, NULL);
+#endif
+#ifdef LFS_CTZCACHE_SIZE
+    lfs->ctzcache.hits = 0;
+    lfs->ctzcache.misses = 0;
+#endif
+#ifdef LFS_USAGE_COUNTER
+    lfs->usage.valid = false;
+    lfs->usage.blocks = 0;
+#endif
+#ifndef LFS_READONLY
+    lfs->gc.tail[0] = 0;
+    lfs->gc.tail[1] = 1;
+    lfs->gc.relocating = false;
+    for (int i = 0; i < LFS_GC_ERASED; i++) {
+        lfs->gc.erased[i] = LFS_BLOCK_NULL;
+    }
+#endif
+
 #ifdef LFS_MULTIVERSION
     // this driver only supports minor version < current minor version
     LFS_ASSERT(!lfs->cfg->disk_version || (
@@ -4396,6 +5026,192 @@ cleanup:
 }
 #endif
 
+#ifndef LFS_READONLY
+// lookahead snapshot, written to the superblock pair at unmount so mount can
+// skip the first lfs_alloc_scan
+//
+// the snapshot is only valid if no metadata pair changed since it was
+// written, so it carries a fingerprint of every pair's revision and commit
+// offset. The superblock pair itself is covered by its revision plus a check
+// that the snapshot commit is still the last commit in it
+typedef struct lfs_snapshot {
+    uint32_t fingerprint;
+    lfs_off_t off;
+    lfs_block_t start;
+    lfs_block_t next;
+    lfs_block_t size;
+    lfs_block_t used;
+} lfs_snapshot_t;
+
+static uint32_t lfs_snapshot_fingerprint(uint32_t crc, const lfs_mdir_t *dir) {
+    bool super = lfs_pair_cmp(dir->pair, (const lfs_block_t[2]){0, 1}) == 0;
+    uint32_t data[4] = {
+        lfs_tole32(dir->pair[0]),
+        lfs_tole32(dir->pair[1]),
+        lfs_tole32(dir->rev),
+        lfs_tole32(super ? 0 : dir->off),
+    };
+    return lfs_crc(crc, data, sizeof(data));
+}
+
+// where the superblock pair's last commit ends if it only holds the snapshot
+static lfs_off_t lfs_snapshot_end(lfs_t *lfs, lfs_off_t off) {
+    return lfs_alignup(
+            lfs_min(off + 2*sizeof(lfs_tag_t) + sizeof(lfs_snapshot_t)
+                + lfs->cfg->lookahead_size + 5*sizeof(uint32_t),
+            lfs->cfg->block_size),
+            lfs->cfg->prog_size);
+}
+
+static void lfs_snapshot_tole32(lfs_snapshot_t *snap) {
+    snap->fingerprint = lfs_tole32(snap->fingerprint);
+    snap->off         = lfs_tole32(snap->off);
+    snap->start       = lfs_tole32(snap->start);
+    snap->next        = lfs_tole32(snap->next);
+    snap->size        = lfs_tole32(snap->size);
+    snap->used        = lfs_tole32(snap->used);
+}
+
+static void lfs_snapshot_fromle32(lfs_snapshot_t *snap) {
+    lfs_snapshot_tole32(snap);
+}
+
+static int lfs_snapshot_load(lfs_t *lfs, lfs_mdir_t *super,
+        uint32_t fingerprint) {
+    lfs_snapshot_t snap;
+    lfs_stag_t tag = lfs_dir_get(lfs, super, LFS_MKTAG(0x7ff, 0x3ff, 0),
+            LFS_MKTAG(LFS_TYPE_USERATTR + LFS_SNAPSHOT_ATTR, 0, sizeof(snap)),
+            &snap);
+    if (tag < 0) {
+        return (tag == LFS_ERR_NOENT) ? 0 : tag;
+    }
+    lfs_snapshot_fromle32(&snap);
+
+    if (lfs_tag_size(tag) != sizeof(snap)
+            || snap.fingerprint != fingerprint
+            || super->off != lfs_snapshot_end(lfs, snap.off)
+            || snap.start >= lfs->block_count
+            || snap.size > lfs_min(8*lfs->cfg->lookahead_size, lfs->block_count)
+            || snap.next > snap.size) {
+        LFS_DEBUG("Stale lookahead snapshot");
+        return 0;
+    }
+
+    tag = lfs_dir_get(lfs, super, LFS_MKTAG(0x7ff, 0x3ff, 0),
+            LFS_MKTAG(LFS_TYPE_USERATTR + LFS_SNAPSHOT_ATTR+1, 0,
+                lfs->cfg->lookahead_size),
+            lfs->lookahead.buffer);
+    if (tag < 0) {
+        return (tag == LFS_ERR_NOENT) ? 0 : tag;
+    }
+    if (lfs_tag_size(tag) != lfs->cfg->lookahead_size) {
+        return 0;
+    }
+
+    lfs->lookahead.start = snap.start;
+    lfs->lookahead.next = snap.next;
+    lfs->lookahead.size = snap.size;
+#ifdef LFS_USAGE_COUNTER
+    if (snap.used <= lfs->block_count) {
+        lfs->usage.blocks = snap.used;
+        lfs->usage.valid = true;
+    }
+#endif
+    return 0;
+}
+
+static int lfs_snapshot_commit(lfs_t *lfs, bool *compacted) {
+    uint32_t fingerprint = 0xffffffff;
+    lfs_mdir_t super;
+    lfs_mdir_t dir = {.tail = {0, 1}};
+    lfs_block_t cycle = 0;
+    while (!lfs_pair_isnull(dir.tail)) {
+        if (cycle >= lfs->block_count/2) {
+            // loop detected
+            return LFS_ERR_CORRUPT;
+        }
+        cycle += 1;
+
+        int err = lfs_dir_fetch(lfs, &dir, dir.tail);
+        if (err) {
+            return err;
+        }
+
+        if (cycle == 1) {
+            super = dir;
+        }
+        fingerprint = lfs_snapshot_fingerprint(fingerprint, &dir);
+    }
+
+    lfs_snapshot_t snap = {
+        .fingerprint = fingerprint,
+        .off         = super.off,
+        .start       = lfs->lookahead.start,
+        .next        = lfs->lookahead.next,
+        .size        = lfs->lookahead.size,
+        .used        = LFS_BLOCK_NULL,
+    };
+#ifdef LFS_USAGE_COUNTER
+    if (lfs->usage.valid) {
+        snap.used = lfs->usage.blocks;
+    }
+#endif
+
+    // skip the commit if the snapshot on disk already says the same
+    lfs_snapshot_t disk;
+    lfs_stag_t tag = lfs_dir_get(lfs, &super, LFS_MKTAG(0x7ff, 0x3ff, 0),
+            LFS_MKTAG(LFS_TYPE_USERATTR + LFS_SNAPSHOT_ATTR, 0, sizeof(disk)),
+            &disk);
+    if (tag >= 0) {
+        lfs_snapshot_fromle32(&disk);
+        if (lfs_tag_size(tag) == sizeof(disk)
+                && disk.fingerprint == snap.fingerprint
+                && super.off == lfs_snapshot_end(lfs, disk.off)
+                && disk.start == snap.start
+                && disk.next == snap.next
+                && disk.size == snap.size
+                && disk.used == snap.used) {
+            return 0;
+        }
+    }
+
+    uint32_t rev = super.rev;
+    lfs_snapshot_tole32(&snap);
+    int err = lfs_dir_commit(lfs, &super, LFS_MKATTRS(
+            {LFS_MKTAG(LFS_TYPE_USERATTR + LFS_SNAPSHOT_ATTR, 0,
+                sizeof(snap)), &snap},
+            {LFS_MKTAG(LFS_TYPE_USERATTR + LFS_SNAPSHOT_ATTR+1, 0,
+                lfs->cfg->lookahead_size), lfs->lookahead.buffer}));
+    if (err) {
+        return err;
+    }
+
+    *compacted = (super.rev != rev);
+    return 0;
+}
+
+static int lfs_snapshot_save(lfs_t *lfs) {
+    // nothing scanned or allocated since mount or the last save? then any
+    // earlier snapshot is either still valid or will be rejected by its
+    // fingerprint, and a commit would only wear the superblock pair
+    if (lfs->lookahead.size == 0 || !lfs->lookahead.changed) {
+        return 0;
+    }
+
+    // a commit that compacts the superblock pair changes its revision and
+    // so invalidates the snapshot it carries, the second commit fits
+    bool compacted = false;
+    int err = lfs_snapshot_commit(lfs, &compacted);
+    if (!err && compacted) {
+        err = lfs_snapshot_commit(lfs, &compacted);
+    }
+    if (!err) {
+        lfs->lookahead.changed = false;
+    }
+    return err;
+}
+#endif
+
 static int lfs_mount_(lfs_t *lfs, const struct lfs_config *cfg) {
     int err = lfs_init(lfs, cfg);
     if (err) {
@@ -4404,6 +5220,10 @@ static int lfs_mount_(lfs_t *lfs, const struct lfs_config *cfg) {
 
     // scan directory blocks for superblock and any global updates
     lfs_mdir_t dir = {.tail = {0, 1}};
+#ifndef LFS_READONLY
+    lfs_mdir_t super = {.pair = {LFS_BLOCK_NULL, LFS_BLOCK_NULL}};
+    uint32_t fingerprint = 0xffffffff;
+#endif
     lfs_block_t tortoise[2] = {LFS_BLOCK_NULL, LFS_BLOCK_NULL};
     lfs_size_t tortoise_i = 1;
     lfs_size_t tortoise_period = 1;
@@ -4434,6 +5254,13 @@ static int lfs_mount_(lfs_t *lfs, const struct lfs_config *cfg) {
             goto cleanup;
         }
 
+#ifndef LFS_READONLY
+        if (lfs_pair_isnull(super.pair)) {
+            super = dir;
+        }
+        fingerprint = lfs_snapshot_fingerprint(fingerprint, &dir);
+#endif
+
         // has superblock?
         if (tag && !lfs_tag_isdelete(tag)) {
             // update root
@@ -4560,15 +5387,36 @@ static int lfs_mount_(lfs_t *lfs, const struct lfs_config *cfg) {
     // boots, we start the allocator at a random location
     lfs->lookahead.start = lfs->seed % lfs->block_count;
     lfs_alloc_drop(lfs);
+    lfs->lookahead.changed = false;
+
+#ifndef LFS_READONLY
+    // or pick up where the last unmount left off
+    if (lfs->cfg->lookahead_snapshot) {
+        err = lfs_snapshot_load(lfs, &super, fingerprint);
+        if (err) {
+            goto cleanup;
+        }
+    }
+#endif
 
     return 0;
 
 cleanup:
-    lfs_unmount_(lfs);
+    lfs_deinit(lfs);
     return err;
 }
 
 static int lfs_unmount_(lfs_t *lfs) {
+#ifndef LFS_READONLY
+    if (lfs->cfg->lookahead_snapshot) {
+        // a missing snapshot only costs a scan at the next mount
+        int err = lfs_snapshot_save(lfs);
+        if (err) {
+            LFS_WARN("Failed to save lookahead snapshot (%d)", err);
+        }
+    }
+#endif
+
     return lfs_deinit(lfs);
 }
 
@@ -5115,17 +5963,85 @@ static int lfs_fs_size_count(void *p, lfs_block_t block) {
     return 0;
 }
 
+#ifdef LFS_USAGE_COUNTER
+// does the traversal count blocks of open files that are not committed yet?
+static bool lfs_fs_hasunsynced(lfs_t *lfs) {
+#ifndef LFS_READONLY
+    for (lfs_file_t *f = (lfs_file_t*)lfs->mlist; f; f = f->next) {
+        if (f->type == LFS_TYPE_REG && !(f->flags & LFS_F_INLINE) &&
+                (f->flags & (LFS_F_DIRTY | LFS_F_WRITING))) {
+            return true;
+        }
+    }
+#else
+    (void)lfs;
+#endif
+
+    return false;
+}
+#endif
+
 static lfs_ssize_t lfs_fs_size_(lfs_t *lfs) {
+#ifdef LFS_USAGE_COUNTER
+    if (lfs->usage.valid) {
+        return lfs->usage.blocks;
+    }
+#endif
+
     lfs_size_t size = 0;
     int err = lfs_fs_traverse_(lfs, lfs_fs_size_count, &size, false);
     if (err) {
         return err;
     }
 
+#ifdef LFS_USAGE_COUNTER
+    // keep counting from here if the traversal saw committed blocks only
+    if (!lfs_fs_hasunsynced(lfs)) {
+        lfs->usage.blocks = size;
+        lfs->usage.valid = true;
+    }
+#endif
     return size;
 }
 
+#ifdef LFS_USAGE_COUNTER
+static int lfs_fs_usagecheck_(lfs_t *lfs) {
+    bool valid = lfs->usage.valid;
+    lfs_size_t blocks = lfs->usage.blocks;
+    lfs->usage.valid = false;
+    lfs_ssize_t size = lfs_fs_size_(lfs);
+    if (size < 0) {
+        return size;
+    }
+
+    if (valid && blocks != (lfs_size_t)size) {
+        LFS_ERROR("Used block count %"PRIu32" != %"PRIu32" traversed",
+                blocks, (lfs_size_t)size);
+        return LFS_ERR_CORRUPT;
+    }
+
+    return 0;
+}
+#endif
+
 // explicit garbage collection
+#ifndef LFS_READONLY
+static bool lfs_fs_needscompaction(lfs_t *lfs, const lfs_mdir_t *mdir) {
+    if (!mdir->erased) {
+        return true;
+    }
+
+    // a metadata block never fills beyond metadata_max, scale the threshold
+    lfs_size_t end = (lfs->cfg->metadata_max
+            ? lfs->cfg->metadata_max
+            : lfs->cfg->block_size);
+    lfs_size_t thresh = (lfs->cfg->compact_thresh == 0)
+            ? end - end/8
+            : (uint64_t)lfs->cfg->compact_thresh * end / lfs->cfg->block_size;
+    return mdir->off > thresh;
+}
+#endif
+
 #ifndef LFS_READONLY
 static int lfs_fs_gc_(lfs_t *lfs) {
     // force consistency, even if we're not necessarily going to write,
@@ -5150,9 +6066,7 @@ static int lfs_fs_gc_(lfs_t *lfs) {
             }
 
             // not erased? exceeds our compaction threshold?
-            if (!mdir.erased || ((lfs->cfg->compact_thresh == 0)
-                    ? mdir.off > lfs->cfg->block_size - lfs->cfg->block_size/8
-                    : mdir.off > lfs->cfg->compact_thresh)) {
+            if (lfs_fs_needscompaction(lfs, &mdir)) {
                 // the easiest way to trigger a compaction is to mark
                 // the mdir as unerased and add an empty commit
                 mdir.erased = false;
@@ -5176,6 +6090,121 @@ static int lfs_fs_gc_(lfs_t *lfs) {
 }
 #endif
 
+#ifndef LFS_READONLY
+static int lfs_fs_gcstep_(lfs_t *lfs) {
+    // anything left over from a power loss or an interrupted operation?
+    if (lfs_gstate_needssuperblock(&lfs->gstate)
+            || lfs_gstate_hasmove(&lfs->gdisk)
+            || lfs_gstate_hasorphans(&lfs->gstate)) {
+        int err = lfs_fs_forceconsistency(lfs);
+        if (err) {
+            return err;
+        }
+
+        return LFS_GC_CONSISTENT;
+    }
+
+    // check the next mdir, same rules as lfs_fs_gc
+    if (lfs->cfg->compact_thresh
+            >= lfs->cfg->block_size - lfs->cfg->prog_size) {
+        lfs->gc.tail[0] = LFS_BLOCK_NULL;
+        lfs->gc.tail[1] = LFS_BLOCK_NULL;
+    }
+
+    if (!lfs_pair_isnull(lfs->gc.tail)) {
+        lfs_mdir_t mdir;
+        int err = lfs_dir_fetch(lfs, &mdir, lfs->gc.tail);
+        if (err) {
+            return err;
+        }
+
+        // worn metadata pairs are relocated here with bounded commits
+        int res = LFS_GC_CHECKED;
+        lfs->gc.relocating = true;
+        if (lfs_fs_needscompaction(lfs, &mdir)
+                || lfs_dir_needsrelocation(lfs, &mdir)) {
+            mdir.erased = false;
+            err = lfs_dir_commit(lfs, &mdir, NULL, 0);
+            if (err) {
+                lfs->gc.relocating = false;
+                return err;
+            }
+
+            res = LFS_GC_COMPACTED;
+        }
+        lfs->gc.relocating = false;
+
+        // erase the spare block of a pair filled beyond half, so the
+        // compaction a commit runs into does not have to wait for the erase,
+        // once, the walk restarts after every commit
+        lfs_block_t *erased = &lfs->gc.erased[mdir.pair[1] % LFS_GC_ERASED];
+        if (lfs->cfg->bounded_commit && *erased != mdir.pair[1]
+                && mdir.off > (lfs->cfg->metadata_max
+                    ? lfs->cfg->metadata_max
+                    : lfs->cfg->block_size)/2) {
+            if (lfs->rcache.block == mdir.pair[1]) {
+                lfs_cache_drop(lfs, &lfs->rcache);
+            }
+
+            err = lfs_bd_erase(lfs, mdir.pair[1]);
+            if (err) {
+                return err;
+            }
+
+            *erased = mdir.pair[1];
+        }
+
+        // the commit restarted the walk, continue behind the compacted
+        // mdir instead so an mdir that stays above compact_thresh is not
+        // compacted over and over
+        lfs->gc.tail[0] = mdir.tail[0];
+        lfs->gc.tail[1] = mdir.tail[1];
+        return res;
+    }
+
+    // populate the lookahead buffer if empty, short, or mostly used, but
+    // only once per allocation so a full filesystem does not rescan forever
+    lfs_size_t left = 0;
+    for (lfs_block_t off = lfs->lookahead.next;
+            off < lfs->lookahead.size; off++) {
+        if (!(lfs->lookahead.buffer[off / 8] & (1U << (off % 8)))) {
+            left += 1;
+        }
+    }
+
+    if (lfs->lookahead.size == 0 || (lfs->lookahead.next > 0
+            && (lfs->lookahead.size < 8*lfs->cfg->lookahead_size
+                || left < lfs->lookahead.size/4))) {
+        int err = lfs_alloc_scan(lfs);
+        if (err) {
+            return err;
+        }
+
+        return LFS_GC_LOOKAHEAD;
+    }
+
+    return LFS_GC_DONE;
+}
+#endif
+
+#ifndef LFS_READONLY
+static int lfs_fs_lookahead_(lfs_t *lfs,
+        int (*cb)(void *data, lfs_block_t block), void *data) {
+    for (lfs_block_t off = lfs->lookahead.next;
+            off < lfs->lookahead.size; off++) {
+        if (!(lfs->lookahead.buffer[off / 8] & (1U << (off % 8)))) {
+            int err = cb(data,
+                    (lfs->lookahead.start + off) % lfs->block_count);
+            if (err) {
+                return err;
+            }
+        }
+    }
+
+    return 0;
+}
+#endif
+
 #ifndef LFS_READONLY
 static int lfs_fs_grow_(lfs_t *lfs, lfs_size_t block_count) {
     // shrinking is not supported
@@ -6364,6 +7393,22 @@ lfs_ssize_t lfs_fs_size(lfs_t *lfs) {
     return res;
 }
 
+#ifdef LFS_USAGE_COUNTER
+int lfs_fs_usagecheck(lfs_t *lfs) {
+    int err = LFS_LOCK(lfs->cfg);
+    if (err) {
+        return err;
+    }
+    LFS_TRACE("lfs_fs_usagecheck(%p)", (void*)lfs);
+
+    err = lfs_fs_usagecheck_(lfs);
+
+    LFS_TRACE("lfs_fs_usagecheck -> %d", err);
+    LFS_UNLOCK(lfs->cfg);
+    return err;
+}
+#endif
+
 int lfs_fs_traverse(lfs_t *lfs, int (*cb)(void *, lfs_block_t), void *data) {
     int err = LFS_LOCK(lfs->cfg);
     if (err) {
@@ -6411,6 +7456,39 @@ int lfs_fs_gc(lfs_t *lfs) {
 }
 #endif
 
+#ifndef LFS_READONLY
+int lfs_fs_gcstep(lfs_t *lfs) {
+    int err = LFS_LOCK(lfs->cfg);
+    if (err) {
+        return err;
+    }
+    LFS_TRACE("lfs_fs_gcstep(%p)", (void*)lfs);
+
+    err = lfs_fs_gcstep_(lfs);
+
+    LFS_TRACE("lfs_fs_gcstep -> %d", err);
+    LFS_UNLOCK(lfs->cfg);
+    return err;
+}
+#endif
+
+#ifndef LFS_READONLY
+int lfs_fs_lookahead(lfs_t *lfs, int (*cb)(void *, lfs_block_t), void *data) {
+    int err = LFS_LOCK(lfs->cfg);
+    if (err) {
+        return err;
+    }
+    LFS_TRACE("lfs_fs_lookahead(%p, %p, %p)",
+            (void*)lfs, (void*)(uintptr_t)cb, data);
+
+    err = lfs_fs_lookahead_(lfs, cb, data);
+
+    LFS_TRACE("lfs_fs_lookahead -> %d", err);
+    LFS_UNLOCK(lfs->cfg);
+    return err;
+}
+#endif
+
 #ifndef LFS_READONLY
 int lfs_fs_grow(lfs_t *lfs, lfs_size_t block_count) {
     int err = LFS_LOCK(lfs->cfg);
@@ -45,6 +45,7 @@
 #define NUMBER_OF_FILES		8   									// max 32
 #define FILE_SIZE			8192
 #define FILE_DEBUG			1										// Show test file messages, disable for benchmark
+//#define SUSPEND_LATENCY_TEST	1									// Read latency during erases, needs QSPI_SUSPEND_RESUME
 
 #ifdef FILE_DEBUG
 	#define dprintf(...)    printf(__VA_ARGS__)		                // Debug messages on UART0
@@ -75,7 +76,48 @@ void SystemClock_Config(void);
 
 /* Private user code ---------------------------------------------------------*/
 /* USER CODE BEGIN 0 */
+#ifdef SUSPEND_LATENCY_TEST
+#define LATENCY_BINS		16										// 10us bins, last bin collects the rest
+static uint32_t latency_hist[LATENCY_BINS];
+static uint32_t latency_max;
+static uint32_t latency_tick;
+
+//-------------------------------------------------------------------------------------------------
+// Stand-in for a control loop, reads 16 bytes once per ms while the driver waits for an erase
+// and records how long each read took
+//-------------------------------------------------------------------------------------------------
+void QSPI_BusyCallback(void)
+{
+	uint8_t data[16];
+
+	if (HAL_GetTick() == latency_tick) return;
+	latency_tick = HAL_GetTick();
+
+	uint32_t start = DWT->CYCCNT;
+	CSP_QSPI_Read(data, 0, sizeof(data));
+	uint32_t us = (DWT->CYCCNT - start) / (SystemCoreClock / 1000000);
 
+	latency_hist[(us/10 < LATENCY_BINS) ? us/10 : LATENCY_BINS-1]++;
+	if (us > latency_max) latency_max = us;
+}
+
+static void suspend_latency_test(void)
+{
+	uint32_t starttime = HAL_GetTick();
+
+	for (uint32_t i = 0; i < 16; i++) {								// Erase the top 1Mbyte, 4K and 64K erases
+		uint32_t addr = QSPI_FlashInfo()->size - (i+1) * MEMORY_BLOCK_SIZE;
+		CSP_QSPI_EraseSector(addr, addr);
+		CSP_QSPI_EraseBlock(addr);
+	}
+
+	printf("Read latency while erasing, %lu ms total\n", HAL_GetTick() - starttime);
+	for (int i = 0; i < LATENCY_BINS; i++) {
+		printf("%3d..%3d us : %lu\n", i*10, (i == LATENCY_BINS-1) ? 999 : (i+1)*10-1, latency_hist[i]);
+	}
+	printf("max %lu us\n\n", latency_max);
+}
+#endif
 /* USER CODE END 0 */
 
 /**
@@ -156,6 +198,11 @@ int main(void)
   }
   printf("\n\n");
 
+  const struct sfdp_flash_t *flash = QSPI_FlashInfo();
+  printf("Flash size        = %lu Kbyte, page %lu, erase",flash->size/1024,flash->page_size);
+  for (int i=0;i<SFDP_ERASE_TYPES && flash->erase[i].size;i++) printf(" %luK=0x%02x",flash->erase[i].size/1024,flash->erase[i].cmd);
+  printf("\n\n");
+
 
 //  printf("Erasing Chip.....\n");
 //  if (CSP_QSPI_Erase_Chip() != HAL_OK) {
@@ -172,6 +219,10 @@ int main(void)
     if (((timer4_count-starttime)*10) != 500) printf("Timer clock incorrect? expected 500 got %lu\n",runtime);
 
 
+	#ifdef SUSPEND_LATENCY_TEST
+		suspend_latency_test();										// Before the format, it erases flash
+	#endif
+
     printf("\n\nMount littlefs and start timer\n\n");
     starttime = timer4_count;										// Start benchmark timer
 
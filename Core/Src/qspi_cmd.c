@@ -0,0 +1,45 @@
+/*
+ * qspi_cmd.c
+ *
+ *  Builds the phase layout of a read command from a read mode and the opcode and dummy clocks of
+ *  the flash descriptor. W25Qxx.c turns it into a QSPI_CommandTypeDef. Uses no HAL functions,
+ *  tests/test_qspi_cmd.c checks the layouts and clock counts on a host.
+ */
+
+#include "qspi_cmd.h"
+
+// Instruction, address and data lines per read mode
+static const uint8_t qspi_cmd_lines[SFDP_READ_MODES][3] = {
+	[SFDP_READ_111] = { 1, 1, 1 },
+	[SFDP_READ_112] = { 1, 1, 2 },
+	[SFDP_READ_122] = { 1, 2, 2 },
+	[SFDP_READ_114] = { 1, 1, 4 },
+	[SFDP_READ_144] = { 1, 4, 4 },
+	[SFDP_READ_222] = { 2, 2, 2 },
+	[SFDP_READ_444] = { 4, 4, 4 },
+	[SFDP_READ_144_DTR] = { 1, 4, 4 },
+};
+
+// The mode byte takes 8 bits on the address lines whatever the descriptor counts as mode clocks
+// (the W25Q64JV BFPT gives 0xBB 2 mode and 2 wait clocks, M7-0 on 2 lines takes 4), the rest of
+// the clocks before the data are dummy clocks
+void qspi_cmd_read(struct qspi_cmd_t *cmd, const struct sfdp_read_t *read, enum sfdp_readmode mode, uint8_t address_bytes) {
+	cmd->instruction = read->cmd;
+	cmd->instruction_lines = qspi_cmd_lines[mode][0];
+	cmd->address_lines = qspi_cmd_lines[mode][1];
+	cmd->address_bytes = address_bytes;
+	cmd->dtr = (mode == SFDP_READ_144_DTR);
+	cmd->mode = read->mode ? 8 / (cmd->address_lines * (cmd->dtr ? 2 : 1)) : 0;
+	cmd->dummy = read->dummy > cmd->mode ? read->dummy - cmd->mode : 0;
+	cmd->data_lines = qspi_cmd_lines[mode][2];
+}
+
+// Clocks from chip select low to the last data byte
+uint32_t qspi_cmd_clocks(const struct qspi_cmd_t *cmd, uint32_t size) {
+	uint32_t edges = cmd->dtr ? 2 : 1;
+
+	return 8 / cmd->instruction_lines
+		+ 8 * cmd->address_bytes / (cmd->address_lines * edges)
+		+ cmd->mode + cmd->dummy
+		+ (8 * size + cmd->data_lines * edges - 1) / (cmd->data_lines * edges);
+}
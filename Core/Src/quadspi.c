@@ -21,7 +21,9 @@
 #include "quadspi.h"
 
 /* USER CODE BEGIN 0 */
-
+#ifdef QSPI_USE_DMA
+MDMA_HandleTypeDef hmdma_quadspi_fifo_th;
+#endif
 /* USER CODE END 0 */
 
 QSPI_HandleTypeDef hqspi;
@@ -124,6 +126,35 @@ void HAL_QSPI_MspInit(QSPI_HandleTypeDef* qspiHandle)
     HAL_NVIC_SetPriority(QUADSPI_IRQn, 0, 0);
     HAL_NVIC_EnableIRQ(QUADSPI_IRQn);
   /* USER CODE BEGIN QUADSPI_MspInit 1 */
+#ifdef QSPI_USE_DMA
+    /* QUADSPI MDMA Init, SourceInc/DestinationInc are set by the HAL per transfer direction */
+    __HAL_RCC_MDMA_CLK_ENABLE();
+
+    hmdma_quadspi_fifo_th.Instance = MDMA_Channel0;
+    hmdma_quadspi_fifo_th.Init.Request = MDMA_REQUEST_QUADSPI_FIFO_TH;
+    hmdma_quadspi_fifo_th.Init.TransferTriggerMode = MDMA_BUFFER_TRANSFER;
+    hmdma_quadspi_fifo_th.Init.Priority = MDMA_PRIORITY_HIGH;
+    hmdma_quadspi_fifo_th.Init.Endianness = MDMA_LITTLE_ENDIANNESS_PRESERVE;
+    hmdma_quadspi_fifo_th.Init.SourceInc = MDMA_SRC_INC_BYTE;
+    hmdma_quadspi_fifo_th.Init.DestinationInc = MDMA_DEST_INC_DISABLE;
+    hmdma_quadspi_fifo_th.Init.SourceDataSize = MDMA_SRC_DATASIZE_BYTE;
+    hmdma_quadspi_fifo_th.Init.DestDataSize = MDMA_DEST_DATASIZE_BYTE;
+    hmdma_quadspi_fifo_th.Init.DataAlignment = MDMA_DATAALIGN_PACKENABLE;
+    hmdma_quadspi_fifo_th.Init.BufferTransferLength = 1;
+    hmdma_quadspi_fifo_th.Init.SourceBurst = MDMA_SOURCE_BURST_SINGLE;
+    hmdma_quadspi_fifo_th.Init.DestBurst = MDMA_DEST_BURST_SINGLE;
+    hmdma_quadspi_fifo_th.Init.SourceBlockAddressOffset = 0;
+    hmdma_quadspi_fifo_th.Init.DestBlockAddressOffset = 0;
+    if (HAL_MDMA_Init(&hmdma_quadspi_fifo_th) != HAL_OK)
+    {
+      Error_Handler();
+    }
+
+    __HAL_LINKDMA(qspiHandle,hmdma,hmdma_quadspi_fifo_th);
+
+    HAL_NVIC_SetPriority(MDMA_IRQn, 0, 0);
+    HAL_NVIC_EnableIRQ(MDMA_IRQn);
+#endif
 
   /* USER CODE END QUADSPI_MspInit 1 */
   }
@@ -157,6 +188,9 @@ void HAL_QSPI_MspDeInit(QSPI_HandleTypeDef* qspiHandle)
     /* QUADSPI interrupt Deinit */
     HAL_NVIC_DisableIRQ(QUADSPI_IRQn);
   /* USER CODE BEGIN QUADSPI_MspDeInit 1 */
+#ifdef QSPI_USE_DMA
+    HAL_MDMA_DeInit(qspiHandle->hmdma);
+#endif
 
   /* USER CODE END QUADSPI_MspDeInit 1 */
   }
@@ -0,0 +1,200 @@
+/*
+ * sfdp.c
+ *
+ *  JEDEC JESD216 Serial Flash Discoverable Parameters parser. Takes the SFDP area as read with
+ *  QSPI_ReadSFDP (0x5A from address 0) and fills a flash descriptor, tables outside the buffer
+ *  are ignored. Uses no HAL functions, tests/test_sfdp.c runs it on a host.
+ */
+
+#include <string.h>
+#include "sfdp.h"
+
+static uint32_t sfdp_dword(const uint8_t *p, uint32_t n) {
+	p += 4*n;
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+// 8 bit fast read field: bits 4:0 wait states, bits 7:5 mode clocks, bits 15:8 opcode
+static void sfdp_readfield(struct sfdp_read_t *read, uint32_t field) {
+	read->mode = (field >> 5) & 0x07;
+	read->dummy = (field & 0x1f) + read->mode;
+	read->cmd = (field >> 8) & 0xff;
+}
+
+// Erase time, a 5 bit count and 2 bit unit of 1ms, 16ms, 128ms or 1s
+static uint32_t sfdp_erasetime(uint32_t field) {
+	static const uint16_t unit[4] = { 1, 16, 128, 1000 };
+
+	return ((field & 0x1f) + 1) * unit[(field >> 5) & 0x03];
+}
+
+//-------------------------------------------------------------------------------------------------
+// Find the parameter header with the given ID and the highest major revision 1 minor revision
+// that fits in the buffer. Returns the table offset, its length in DWORDs in *len, 0 if none.
+//-------------------------------------------------------------------------------------------------
+static uint32_t sfdp_table(const uint8_t *sfdp, uint32_t size, uint16_t id, uint32_t *len, uint8_t *minor) {
+	uint32_t headers = sfdp[6] + 1;
+	uint32_t best = 0;
+
+	for (uint32_t i = 0; i < headers && 16 + 8*i <= size; i++) {
+		const uint8_t *h = sfdp + 8 + 8*i;
+		uint32_t ptr = h[4] | (h[5] << 8) | (h[6] << 16);
+		uint32_t n = h[3];
+
+		if ((h[0] | (h[7] << 8)) != id || h[2] != 1 || n == 0) {
+			continue;
+		}
+		if ((ptr & 3) || ptr + 4*n > size) {
+			continue;
+		}
+		if (best == 0 || h[1] > *minor) {
+			best = ptr;
+			*len = n;
+			*minor = h[1];
+		}
+	}
+	return best;
+}
+
+int sfdp_parse(const uint8_t *sfdp, uint32_t size, struct sfdp_flash_t *flash) {
+	uint32_t len = 0, ptr, dw;
+	uint8_t minor = 0;
+
+	memset(flash, 0, sizeof(*flash));
+
+	if (size < 16 || sfdp_dword(sfdp, 0) != SFDP_SIGNATURE || sfdp[5] != 1) {
+		return SFDP_ERR_SIGNATURE;
+	}
+	if ((ptr = sfdp_table(sfdp, size, SFDP_BFPT_ID, &len, &minor)) == 0 || len < 9) {
+		return SFDP_ERR_TABLE;
+	}
+	const uint8_t *bfpt = sfdp + ptr;
+	flash->major = 1;
+	flash->minor = minor;
+
+	dw = sfdp_dword(bfpt, 0);										// DWORD1, modes and address bytes
+	flash->addr_bytes = (dw >> 17) & 0x03;
+	flash->dtr = (dw >> 19) & 1;
+	flash->read[SFDP_READ_111].cmd = 0x0B;
+	flash->read[SFDP_READ_111].dummy = 8;
+	if (dw & (1 << 16)) {
+		sfdp_readfield(&flash->read[SFDP_READ_112], sfdp_dword(bfpt, 3));
+	}
+	if (dw & (1 << 20)) {
+		sfdp_readfield(&flash->read[SFDP_READ_122], sfdp_dword(bfpt, 3) >> 16);
+	}
+	if (dw & (1 << 21)) {
+		sfdp_readfield(&flash->read[SFDP_READ_144], sfdp_dword(bfpt, 2));
+	}
+	if (dw & (1 << 22)) {
+		sfdp_readfield(&flash->read[SFDP_READ_114], sfdp_dword(bfpt, 2) >> 16);
+	}
+	uint32_t erase4k = ((dw & 0x03) == 0x01) ? (dw >> 8) & 0xff : 0;
+
+	dw = sfdp_dword(bfpt, 1);										// DWORD2, density
+	if (dw & 0x80000000) {
+		if ((dw & 0x7fffffff) < 3 || (dw & 0x7fffffff) > 34) {
+			return SFDP_ERR_GEOMETRY;
+		}
+		flash->size = 1UL << ((dw & 0x7fffffff) - 3);
+	} else {
+		flash->size = (dw >> 3) + 1;								// Bits - 1
+	}
+
+	dw = sfdp_dword(bfpt, 4);										// DWORD5, 2-2-2 and 4-4-4
+	if (dw & (1 << 0)) {
+		sfdp_readfield(&flash->read[SFDP_READ_222], sfdp_dword(bfpt, 5) >> 16);
+	}
+	if (dw & (1 << 4)) {
+		sfdp_readfield(&flash->read[SFDP_READ_444], sfdp_dword(bfpt, 6) >> 16);
+	}
+
+	for (int i = 0; i < SFDP_ERASE_TYPES; i++) {					// DWORD8-9, erase types
+		uint32_t field = sfdp_dword(bfpt, 7 + i/2) >> (16 * (i & 1));
+		uint32_t n = field & 0xff;
+
+		if (n != 0) {
+			if (n > 31) {
+				return SFDP_ERR_GEOMETRY;
+			}
+			flash->erase[i].size = 1UL << n;
+			flash->erase[i].cmd = (field >> 8) & 0xff;
+		}
+	}
+
+	flash->page_size = 256;											// JESD216 rev 1.0 has no page size
+	if (len >= 11) {
+		dw = sfdp_dword(bfpt, 9);									// DWORD10, erase times
+		uint32_t mult = 2 * ((dw & 0x0f) + 1);
+		for (int i = 0; i < SFDP_ERASE_TYPES; i++) {
+			if (flash->erase[i].size != 0) {
+				flash->erase[i].typ_ms = sfdp_erasetime(dw >> (4 + 7*i));
+				flash->erase[i].max_ms = flash->erase[i].typ_ms * mult;
+			}
+		}
+
+		dw = sfdp_dword(bfpt, 10);									// DWORD11, page size and program time
+		flash->page_size = 1UL << ((dw >> 4) & 0x0f);
+		flash->prog_typ_us = (((dw >> 8) & 0x1f) + 1) * ((dw & (1 << 13)) ? 64 : 8);
+		flash->prog_max_us = flash->prog_typ_us * 2 * ((dw & 0x0f) + 1);
+	}
+	if (len >= 16) {
+		flash->enter4 = (sfdp_dword(bfpt, 15) >> 24) & 0x7f;		// DWORD16
+	}
+
+	if ((ptr = sfdp_table(sfdp, size, SFDP_4BAIT_ID, &len, &minor)) != 0 && len >= 2) {
+		dw = sfdp_dword(sfdp + ptr, 0);
+		flash->cmds4 = dw & 0xffff;
+		for (int i = 0; i < SFDP_ERASE_TYPES; i++) {
+			if (dw & (1 << (9 + i))) {
+				flash->erase[i].cmd4 = sfdp_dword(sfdp + ptr, 1) >> (8*i);
+			}
+		}
+	}
+
+	if (flash->erase[0].size == 0 && flash->erase[1].size == 0 && flash->erase[2].size == 0
+			&& flash->erase[3].size == 0 && erase4k != 0) {
+		flash->erase[0].size = 4096;								// Only the legacy DWORD1 4K erase
+		flash->erase[0].cmd = erase4k;
+	}
+
+	for (int i = 1; i < SFDP_ERASE_TYPES; i++) {					// Smallest first, unused last
+		for (int j = i; j > 0; j--) {
+			struct sfdp_erase_t *a = &flash->erase[j-1], *b = &flash->erase[j];
+			if (a->size != 0 && (b->size == 0 || a->size <= b->size)) {
+				break;
+			}
+			struct sfdp_erase_t t = *a;
+			*a = *b;
+			*b = t;
+		}
+	}
+
+	if (flash->size < 4096 || flash->erase[0].size == 0 || flash->erase[0].size > flash->size
+			|| flash->page_size == 0 || flash->page_size > flash->erase[0].size) {
+		return SFDP_ERR_GEOMETRY;
+	}
+	return SFDP_OK;
+}
+
+// Erase type of exactly the given size, NULL if the part has none
+const struct sfdp_erase_t* sfdp_erase_find(const struct sfdp_flash_t *flash, uint32_t size) {
+	for (int i = 0; i < SFDP_ERASE_TYPES; i++) {
+		if (flash->erase[i].size == size) {
+			return &flash->erase[i];
+		}
+	}
+	return NULL;
+}
+
+// Fastest read that needs no QPI/DPI mode, fewest clocks for a short read first
+enum sfdp_readmode sfdp_fastest_read(const struct sfdp_flash_t *flash) {
+	static const enum sfdp_readmode order[] = { SFDP_READ_144, SFDP_READ_114, SFDP_READ_122, SFDP_READ_112 };
+
+	for (unsigned i = 0; i < sizeof(order)/sizeof(order[0]); i++) {
+		if (flash->read[order[i]].cmd != 0) {
+			return order[i];
+		}
+	}
+	return SFDP_READ_111;
+}
@@ -60,7 +60,9 @@ uint32_t timer4_count=0;
 extern QSPI_HandleTypeDef hqspi;
 extern TIM_HandleTypeDef htim4;
 /* USER CODE BEGIN EV */
-
+#ifdef QSPI_USE_DMA
+extern MDMA_HandleTypeDef hmdma_quadspi_fifo_th;
+#endif
 /* USER CODE END EV */
 
 /******************************************************************************/
@@ -231,5 +233,13 @@ void QUADSPI_IRQHandler(void)
 }
 
 /* USER CODE BEGIN 1 */
-
+#ifdef QSPI_USE_DMA
+/**
+  * @brief This function handles MDMA global interrupt (QSPI data transfers).
+  */
+void MDMA_IRQHandler(void)
+{
+  HAL_MDMA_IRQHandler(&hmdma_quadspi_fifo_th);
+}
+#endif
 /* USER CODE END 1 */
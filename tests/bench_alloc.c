@@ -0,0 +1,91 @@
+/*
+ * bench_alloc.c
+ *
+ *  Allocation cost on a nearly full flash, for the lookahead the program is built with (bench_alloc
+ *  with the default 256 block lookahead, bench_alloc_full with STMLFS_FULL_LOOKAHEAD). 270 files of
+ *  24Kbyte fill 93% of the blocks, then 300 times a random file is removed and written again.
+ *  Each rewrite has to find 7 free blocks. The time is split into the flash busy time of programs
+ *  and erases, which is the same for both builds, and the rest: bus transfers, metadata reads and
+ *  the traversals of the lookahead scans.
+ */
+
+#include <stdlib.h>
+#include "main.h"
+#include "fake_hal.h"
+#include "test.h"
+
+#define FILES			270
+#define FILE_SIZE		(24*1024)
+#define REWRITES		300
+
+static uint8_t data[FILE_SIZE];
+static double other_us[REWRITES];
+static uint32_t seed = 1;
+
+static uint32_t next_random(void) {
+	seed ^= seed << 13;
+	seed ^= seed >> 17;
+	seed ^= seed << 5;
+	return seed;
+}
+
+static void write_file(int f) {
+	lfs_file_t file;
+	char name[16];
+
+	sprintf(name, "f%03d", f);
+	CHECK_EQ(stmlfs_file_open(&file, name, LFS_O_WRONLY | LFS_O_CREAT | LFS_O_TRUNC), 0);
+	CHECK_EQ(stmlfs_file_write(&file, data, FILE_SIZE), FILE_SIZE);
+	CHECK_EQ(stmlfs_file_close(&file), 0);
+}
+
+static int cmp(const void *a, const void *b) {
+	double x = *(const double *)a, y = *(const double *)b;
+	return x < y ? -1 : x > y;
+}
+
+int test_main(int argc, char **argv) {
+	struct littlfs_fsstat_t info;
+	struct fake_stat before;
+	double start, elapsed, busy, sum = 0;
+	char name[16];
+
+	(void)argc;
+	(void)argv;
+	for (int i = 0; i < FILE_SIZE; i++) {
+		data[i] = (uint8_t)(i*11);
+	}
+	CHECK_EQ(CSP_QUADSPI_Init(), HAL_OK);
+	test_quiet(true);
+	CHECK_EQ(stmlfs_mount(true), 0);
+	test_quiet(false);
+	for (int f = 0; f < FILES; f++) {
+		write_file(f);
+	}
+	CHECK_EQ(stmlfs_fsstat(&info), 0);
+
+	before = fake_stat;
+	start = fake_time_us();
+	for (int i = 0; i < REWRITES; i++) {
+		double t = fake_time_us(), b = fake_stat.busy_us;
+		int f = next_random() % FILES;
+
+		sprintf(name, "f%03d", f);
+		CHECK_EQ(stmlfs_remove(name), 0);
+		write_file(f);
+		other_us[i] = (fake_time_us() - t) - (fake_stat.busy_us - b);
+		sum += other_us[i];
+	}
+	elapsed = fake_time_us() - start;
+	busy = fake_stat.busy_us - before.busy_us;
+	CHECK_EQ(stmlfs_unmount(), 0);
+	CHECK_FAKE();
+
+	qsort(other_us, REWRITES, sizeof(other_us[0]), cmp);
+	printf("lookahead %4u blocks, %u of %u blocks used: %u rewrites %7.0f ms, flash busy %7.0f ms, rest %6.0f ms "
+			"(mean %5.2f ms, 99%% %6.2f ms, max %6.2f ms), %9llu bytes read\n",
+			(unsigned)(STMLFS_LOOKAHEAD_SIZE*8), (unsigned)info.blocks_used, (unsigned)info.block_count, REWRITES,
+			elapsed/1000, busy/1000, (elapsed - busy)/1000, sum/REWRITES/1000, other_us[REWRITES*99/100]/1000,
+			other_us[REWRITES-1]/1000, (unsigned long long)(fake_stat.read_bytes - before.read_bytes));
+	return test_done("bench_alloc");
+}
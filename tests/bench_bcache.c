@@ -0,0 +1,90 @@
+/*
+ * bench_bcache.c
+ *
+ *  Read commands of small interleaved writes on the flash model, with STMLFS_BCACHE (bench_bcache)
+ *  and without (bench_bcache_off), each with its default read back: STMLFS_VERIFY_FULL without the
+ *  cache, the CRC read back at write back with it. 4000 records of 64 bytes are appended to 4 files
+ *  in turns with a sync of every file after its 8th record, then 8 small files are rewritten 400
+ *  times with a stat in between. Counts the read commands and page programs of each part, the
+ *  simulated time and the hit ratio of the cache.
+ */
+
+#include "main.h"
+#include "fake_hal.h"
+#include "test.h"
+
+#define RECORDS			4000
+#define REWRITES		400
+
+static uint8_t data[1024];
+
+static void report(const char *what, struct fake_stat *before, double start) {
+	printf("  %-28s %6u read commands, %6u page programs, %7.0f ms", what, (unsigned)(fake_stat.reads - before->reads),
+			(unsigned)(fake_stat.progs - before->progs), (fake_time_us() - start)/1000);
+	#ifdef STMLFS_BCACHE
+	struct stmlfs_cachestat_t cs;
+	static struct stmlfs_cachestat_t last;
+
+	stmlfs_cachestat(&cs);
+	uint32_t hits = cs.bc_hits - last.bc_hits, misses = cs.bc_misses - last.bc_misses;
+	printf(", hit ratio %5.1f%%", 100.0*hits/(hits + misses));
+	last = cs;
+	#endif
+	printf("\n");
+	*before = fake_stat;
+}
+
+int test_main(int argc, char **argv) {
+	struct fake_stat before;
+	struct lfs_info info;
+	lfs_file_t file[4];
+	char name[16];
+	double start;
+
+	(void)argc;
+	(void)argv;
+	for (uint32_t i = 0; i < sizeof(data); i++) {
+		data[i] = (uint8_t)(i*13 + 5);
+	}
+	CHECK_EQ(CSP_QUADSPI_Init(), HAL_OK);
+	test_quiet(true);
+	CHECK_EQ(stmlfs_mount(true), 0);
+	test_quiet(false);
+
+	#ifdef STMLFS_BCACHE
+	printf("STMLFS_BCACHE %dx%d lines of %d bytes:\n", STMLFS_BCACHE_SETS, STMLFS_BCACHE_WAYS, STMLFS_BCACHE_LINE);
+	#else
+	printf("no block cache:\n");
+	#endif
+	before = fake_stat;
+	start = fake_time_us();
+	for (int f = 0; f < 4; f++) {
+		sprintf(name, "log%d", f);
+		CHECK_EQ(stmlfs_file_open(&file[f], name, LFS_O_WRONLY | LFS_O_CREAT | LFS_O_APPEND), 0);
+	}
+	for (int i = 0; i < RECORDS; i++) {
+		CHECK_EQ(stmlfs_file_write(&file[i % 4], data + (i*64) % sizeof(data), 64), 64);
+		if (i % 32 >= 28) {													// Every file after 8 of its records
+			CHECK_EQ(stmlfs_fflush(&file[i % 4]), 0);
+		}
+	}
+	for (int f = 0; f < 4; f++) {
+		CHECK_EQ(stmlfs_file_close(&file[f]), 0);
+	}
+	report("4 logs, 4000 records:", &before, start);
+
+	start = fake_time_us();
+	for (int i = 0; i < REWRITES; i++) {
+		sprintf(name, "cfg%d", i % 8);
+		CHECK_EQ(stmlfs_file_open(&file[0], name, LFS_O_WRONLY | LFS_O_CREAT | LFS_O_TRUNC), 0);
+		CHECK_EQ(stmlfs_file_write(&file[0], data, 100 + i % 50), 100 + i % 50);
+		CHECK_EQ(stmlfs_file_close(&file[0]), 0);
+		sprintf(name, "cfg%d", (i + 3) % 8);
+		CHECK(stmlfs_stat(name, &info) == 0 || i < 8);
+	}
+	report("8 files, 400 rewrites + stat:", &before, start);
+	CHECK_EQ(stmlfs_unmount(), 0);
+	CHECK_FAKE();
+
+	return test_done("bench_bcache");
+}
@@ -0,0 +1,211 @@
+/*
+ * bench_bdread.c
+ *
+ *  lfs_bd_crc and lfs_bd_cmp work on cache memory in spans of up to a cache line (lfs_bd_peek)
+ *  instead of copying 8 bytes at a time through lfs_bd_read. The benchmark populates an 8Mbyte RAM
+ *  image with 1000 files, then measures a mount and a CRC plus compare pass over every metadata
+ *  block, once with lfs.c as it is and once with the former 8 byte loops kept below for reference.
+ *  lfs.c is included so its static functions can be called.
+ *
+ *  bench_bdread reports host CPU time, bench_bdread_calls is built with -finstrument-functions and
+ *  reports the number of lfs_bd_read and lfs_bd_peek calls instead.
+ */
+
+#include <time.h>
+#include "../Core/Src/lfs.c"
+#include "ramdisk.h"
+#include "test.h"
+
+#define NO_INSTRUMENT	__attribute__((no_instrument_function))
+
+static unsigned long calls_read, calls_peek;
+
+#ifdef BENCH_CALLS
+NO_INSTRUMENT void __cyg_profile_func_enter(void *fn, void *site) {
+	(void)site;
+	if (fn == (void *)lfs_bd_read) {
+		calls_read++;
+	} else if (fn == (void *)lfs_bd_peek) {
+		calls_peek++;
+	}
+}
+
+NO_INSTRUMENT void __cyg_profile_func_exit(void *fn, void *site) {
+	(void)fn;
+	(void)site;
+}
+#endif
+
+// lfs_bd_crc and lfs_bd_cmp before the change
+NO_INSTRUMENT static int bd_cmp_8(lfs_t *lfs, const lfs_cache_t *pcache, lfs_cache_t *rcache, lfs_size_t hint,
+		lfs_block_t block, lfs_off_t off, const void *buffer, lfs_size_t size) {
+	const uint8_t *data = buffer;
+	lfs_size_t diff = 0;
+
+	for (lfs_off_t i = 0; i < size; i += diff) {
+		uint8_t dat[8];
+
+		diff = lfs_min(size-i, sizeof(dat));
+		int err = lfs_bd_read(lfs, pcache, rcache, hint-i, block, off+i, &dat, diff);
+		if (err) {
+			return err;
+		}
+		int res = memcmp(dat, data + i, diff);
+		if (res) {
+			return res < 0 ? LFS_CMP_LT : LFS_CMP_GT;
+		}
+	}
+	return LFS_CMP_EQ;
+}
+
+NO_INSTRUMENT static int bd_crc_8(lfs_t *lfs, const lfs_cache_t *pcache, lfs_cache_t *rcache, lfs_size_t hint,
+		lfs_block_t block, lfs_off_t off, lfs_size_t size, uint32_t *crc) {
+	lfs_size_t diff = 0;
+
+	for (lfs_off_t i = 0; i < size; i += diff) {
+		uint8_t dat[8];
+
+		diff = lfs_min(size-i, sizeof(dat));
+		int err = lfs_bd_read(lfs, pcache, rcache, hint-i, block, off+i, &dat, diff);
+		if (err) {
+			return err;
+		}
+		*crc = lfs_crc(*crc, &dat, diff);
+	}
+	return 0;
+}
+
+static lfs_t lfs;
+static struct lfs_config cfg;
+static uint8_t blocks_meta[RAMDISK_BLOCK_COUNT/8];
+static uint8_t reference[RAMDISK_BLOCK_SIZE];
+
+NO_INSTRUMENT static double now_ms(void) {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec*1e3 + t.tv_nsec/1e6;
+}
+
+NO_INSTRUMENT static double best(double ms, double start) {
+	double t = now_ms() - start;
+	return t < ms ? t : ms;
+}
+
+NO_INSTRUMENT static void populate(void) {
+	lfs_file_t file;
+	char name[32];
+	uint8_t data[300];
+
+	memset(data, 0x3C, sizeof(data));
+	CHECK_EQ(lfs_format(&lfs, &cfg), 0);
+	CHECK_EQ(lfs_mount(&lfs, &cfg), 0);
+	for (int d = 0; d < 10; d++) {
+		sprintf(name, "dir%d", d);
+		CHECK_EQ(lfs_mkdir(&lfs, name), 0);
+		for (int f = 0; f < 100; f++) {
+			sprintf(name, "dir%d/file%03d", d, f);
+			CHECK_EQ(lfs_file_open(&lfs, &file, name, LFS_O_WRONLY | LFS_O_CREAT), 0);
+			CHECK_EQ(lfs_file_write(&lfs, &file, data, 1 + (d*100 + f) % sizeof(data)), 1 + (d*100 + f) % sizeof(data));
+			CHECK_EQ(lfs_file_close(&lfs, &file), 0);
+		}
+	}
+	CHECK_EQ(lfs_unmount(&lfs), 0);
+}
+
+// Both blocks of every metadata pair, found by walking the tail list
+NO_INSTRUMENT static void find_meta(void) {
+	lfs_mdir_t dir = { .tail = { 0, 1 } };
+
+	CHECK_EQ(lfs_mount(&lfs, &cfg), 0);
+	while (!lfs_pair_isnull(dir.tail)) {
+		lfs_block_t pair[2] = { dir.tail[0], dir.tail[1] };
+		for (int i = 0; i < 2; i++) {
+			blocks_meta[pair[i]/8] |= 1U << (pair[i]%8);
+		}
+		CHECK_EQ(lfs_dir_fetch(&lfs, &dir, pair), 0);
+	}
+	CHECK_EQ(lfs_unmount(&lfs), 0);
+}
+
+// CRC and compare every metadata block with the current or the 8 byte functions
+NO_INSTRUMENT static uint32_t meta_pass(bool old) {
+	uint32_t crc = 0xffffffff;
+
+	CHECK_EQ(lfs_mount(&lfs, &cfg), 0);
+	for (lfs_block_t b = 0; b < cfg.block_count; b++) {
+		if (!(blocks_meta[b/8] & (1U << (b%8)))) {
+			continue;
+		}
+		memcpy(reference, ramdisk + b*RAMDISK_BLOCK_SIZE, RAMDISK_BLOCK_SIZE);
+		lfs_cache_drop(&lfs, &lfs.rcache);
+		if (old) {
+			CHECK_EQ(bd_crc_8(&lfs, NULL, &lfs.rcache, cfg.block_size, b, 0, cfg.block_size, &crc), 0);
+			CHECK_EQ(bd_cmp_8(&lfs, NULL, &lfs.rcache, cfg.block_size, b, 0, reference, cfg.block_size), LFS_CMP_EQ);
+		} else {
+			CHECK_EQ(lfs_bd_crc(&lfs, NULL, &lfs.rcache, cfg.block_size, b, 0, cfg.block_size, &crc), 0);
+			CHECK_EQ(lfs_bd_cmp(&lfs, NULL, &lfs.rcache, cfg.block_size, b, 0, reference, cfg.block_size), LFS_CMP_EQ);
+		}
+	}
+	CHECK_EQ(lfs_unmount(&lfs), 0);
+	return crc;
+}
+
+NO_INSTRUMENT int main(void) {
+	const int runs = 20;
+	double t, mount_ms = 1e9, old_ms = 1e9, new_ms = 1e9;
+	uint32_t reads, blocks = 0;
+	unsigned long mount_read, mount_peek, old_read, new_peek;
+
+	ramdisk_init(&cfg, 256);
+	populate();
+	find_meta();
+	for (int i = 0; i < RAMDISK_BLOCK_COUNT; i++) {
+		blocks += (blocks_meta[i/8] >> (i%8)) & 1;
+	}
+
+	CHECK_EQ(meta_pass(true), meta_pass(false));						// Same CRC either way
+
+	// Best of several runs, the host is not idle
+	reads = ramdisk_stat.reads;
+	calls_read = calls_peek = 0;
+	for (int i = 0; i < runs; i++) {
+		t = now_ms();
+		CHECK_EQ(lfs_mount(&lfs, &cfg), 0);
+		mount_ms = best(mount_ms, t);
+		CHECK_EQ(lfs_unmount(&lfs), 0);
+	}
+	reads = (ramdisk_stat.reads - reads)/runs;
+	mount_read = calls_read/runs;
+	mount_peek = calls_peek/runs;
+
+	calls_read = calls_peek = 0;
+	for (int i = 0; i < runs; i++) {
+		t = now_ms();
+		meta_pass(true);
+		old_ms = best(old_ms, t);
+	}
+	old_read = calls_read/runs;
+	calls_read = calls_peek = 0;
+	for (int i = 0; i < runs; i++) {
+		t = now_ms();
+		meta_pass(false);
+		new_ms = best(new_ms, t);
+	}
+	new_peek = calls_peek/runs;
+
+#ifdef BENCH_CALLS
+	printf("mount, 1000 files:           %6lu lfs_bd_read, %5lu lfs_bd_peek calls, %u block device reads\n",
+			mount_read, mount_peek, (unsigned)reads);
+	printf("CRC+cmp of %3u meta blocks:  %6lu lfs_bd_read calls (8 byte loops), %lu lfs_bd_peek calls (cache spans)\n",
+			(unsigned)blocks, old_read, new_peek);
+#else
+	(void)mount_read;
+	(void)mount_peek;
+	(void)old_read;
+	(void)new_peek;
+	printf("mount, 1000 files:           %7.3f ms host CPU, %u block device reads\n", mount_ms, (unsigned)reads);
+	printf("CRC+cmp of %3u meta blocks:  %7.3f ms with 8 byte loops, %7.3f ms with cache spans\n",
+			(unsigned)blocks, old_ms, new_ms);
+#endif
+	return test_done("bench_bdread");
+}
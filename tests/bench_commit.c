@@ -0,0 +1,91 @@
+/*
+ * bench_commit.c
+ *
+ *  Sync latency on the flash model (45 ms sector erase, 0.4 ms page program) with STMLFS_BOUNDED_COMMIT
+ *  (bench_commit) and without (bench_commit_off). 20000 writes on a fresh format: 16 byte appends with
+ *  a sync to one of 4 open files, every 16th write replaced by the rewrite of one of 8 small files.
+ *  Run without maintenance, with stmlfs_maintain(5) after every write and with stmlfs_maintain(200)
+ *  after every 8th. The time spent in stmlfs_maintain is not part of the latency.
+ */
+
+#include <stdlib.h>
+#include "main.h"
+#include "fake_hal.h"
+#include "test.h"
+
+#define WRITES			20000
+
+static uint8_t data[512];
+static double latency[WRITES];
+
+static int cmp(const void *a, const void *b) {
+	double x = *(const double *)a, y = *(const double *)b;
+	return x < y ? -1 : x > y;
+}
+
+static void run(const char *what, uint32_t budget_ms, int every) {
+	struct stmlfs_maintstat_t stat;
+	uint32_t compacted = 0, preerased = 0;
+	lfs_file_t log[4], file;
+	char name[16];
+
+	fake_reset(NULL);
+	CHECK_EQ(CSP_QUADSPI_Init(), HAL_OK);
+	test_quiet(true);
+	CHECK_EQ(stmlfs_mount(true), 0);
+	test_quiet(false);
+	for (int f = 0; f < 4; f++) {
+		sprintf(name, "log%d", f);
+		CHECK_EQ(stmlfs_file_open(&log[f], name, LFS_O_WRONLY | LFS_O_CREAT | LFS_O_APPEND), 0);
+	}
+
+	for (int i = 0; i < WRITES; i++) {
+		double start = fake_time_us();
+
+		if (i % 16 != 15) {
+			lfs_file_t *f = &log[i % 4];
+			CHECK_EQ(stmlfs_file_write(f, data + i % 256, 16), 16);
+			CHECK_EQ(stmlfs_fflush(f), 0);
+		} else {
+			sprintf(name, "small%d", (i/16) % 8);
+			CHECK_EQ(stmlfs_file_open(&file, name, LFS_O_WRONLY | LFS_O_CREAT | LFS_O_TRUNC), 0);
+			CHECK_EQ(stmlfs_file_write(&file, data, 50 + i % 200), 50 + i % 200);
+			CHECK_EQ(stmlfs_file_close(&file), 0);
+		}
+		latency[i] = fake_time_us() - start;
+
+		if (budget_ms && i % every == every - 1) {
+			CHECK_EQ(stmlfs_maintain(budget_ms, &stat), 0);
+			compacted += stat.compacted;
+			preerased += stat.preerased;
+		}
+	}
+	for (int f = 0; f < 4; f++) {
+		CHECK_EQ(stmlfs_file_close(&log[f]), 0);
+	}
+	CHECK_EQ(stmlfs_unmount(), 0);
+	CHECK_FAKE();
+
+	qsort(latency, WRITES, sizeof(latency[0]), cmp);
+	printf("  %-38s p50 %5.1f ms, p99 %5.1f ms, p99.9 %5.1f ms, max %6.1f ms (%u compactions, %u pre-erases)\n",
+			what, latency[WRITES/2]/1000, latency[WRITES*99/100]/1000, latency[WRITES*999/1000]/1000,
+			latency[WRITES-1]/1000, (unsigned)compacted, (unsigned)preerased);
+}
+
+int test_main(int argc, char **argv) {
+	(void)argc;
+	(void)argv;
+	for (uint32_t i = 0; i < sizeof(data); i++) {
+		data[i] = (uint8_t)(i*11 + 3);
+	}
+	#ifdef STMLFS_BOUNDED_COMMIT
+	printf("STMLFS_BOUNDED_COMMIT, metadata_max %d:\n", STMLFS_METADATA_MAX);
+	#else
+	printf("no bounded commits:\n");
+	#endif
+	run("no maintenance:", 0, 1);
+	run("stmlfs_maintain(5) every write:", 5, 1);
+	run("stmlfs_maintain(200) every 8th write:", 200, 8);
+
+	return test_done("bench_commit");
+}
@@ -0,0 +1,145 @@
+/*
+ * bench_ctzcache.c
+ *
+ *  Seeks in a 4Mbyte file on a RAM image, for the LFS_CTZCACHE_SIZE the program is built with
+ *  (bench_ctzcache with 16 entries, bench_ctzcache_off without the cache). Measures the block reads
+ *  of 2000 random 64 byte reads over the whole file, 2000 within a 64Kbyte window and a sequential
+ *  read of the file in 4Kbyte reads. Then cuts the file to 1Mbyte and overwrites, truncates and
+ *  appends on the same handle between random reads, and shrinks it to an inline file and grows it
+ *  again, checking every byte read.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lfs.h"
+#include "ramdisk.h"
+#include "test.h"
+
+#define FILE_SIZE		(4*1024*1024)
+#define READS			2000
+
+static lfs_t lfs;
+static struct lfs_config cfg;
+static uint8_t shadow[FILE_SIZE + 400000];							// File contents
+static uint32_t seed = 1;
+
+static uint32_t next_random(void) {
+	seed ^= seed << 13;
+	seed ^= seed >> 17;
+	seed ^= seed << 5;
+	return seed;
+}
+
+static void read_at(lfs_file_t *file, lfs_off_t off, lfs_size_t size) {
+	uint8_t buf[4096];
+
+	CHECK_EQ(lfs_file_seek(&lfs, file, off, LFS_SEEK_SET), off);
+	CHECK_EQ(lfs_file_read(&lfs, file, buf, size), size);
+	CHECK(memcmp(buf, shadow + off, size) == 0);
+}
+
+static void read_random(lfs_file_t *file, lfs_size_t file_size, int n, lfs_size_t size) {
+	for (int i = 0; i < n; i++) {
+		read_at(file, next_random() % (file_size - size), size);
+	}
+}
+
+static void fill(lfs_off_t off, lfs_size_t size) {
+	for (lfs_size_t i = 0; i < size; i++) {
+		shadow[off + i] = (uint8_t)next_random();
+	}
+}
+
+int main(void) {
+	uint32_t random, window, sequential, reads;
+	lfs_size_t size = FILE_SIZE;
+	lfs_file_t file;
+
+	fill(0, FILE_SIZE);
+	ramdisk_init(&cfg, 32);
+	CHECK_EQ(lfs_format(&lfs, &cfg), 0);
+	CHECK_EQ(lfs_mount(&lfs, &cfg), 0);
+	CHECK_EQ(lfs_file_open(&lfs, &file, "big", LFS_O_WRONLY | LFS_O_CREAT), 0);
+	for (lfs_off_t off = 0; off < FILE_SIZE; off += 4096) {
+		CHECK_EQ(lfs_file_write(&lfs, &file, shadow + off, 4096), 4096);
+	}
+	CHECK_EQ(lfs_file_close(&lfs, &file), 0);
+
+	CHECK_EQ(lfs_file_open(&lfs, &file, "big", LFS_O_RDONLY), 0);
+	reads = ramdisk_stat.reads;
+	read_random(&file, FILE_SIZE, READS, 64);
+	random = ramdisk_stat.reads - reads;
+	reads = ramdisk_stat.reads;
+	for (int i = 0; i < READS; i++) {
+		read_at(&file, FILE_SIZE/3 + next_random() % 65536, 64);
+	}
+	window = ramdisk_stat.reads - reads;
+	reads = ramdisk_stat.reads;
+	CHECK_EQ(lfs_file_rewind(&lfs, &file), 0);
+	for (lfs_off_t off = 0; off < FILE_SIZE; off += 4096) {
+		read_at(&file, off, 4096);
+	}
+	sequential = ramdisk_stat.reads - reads;
+	CHECK_EQ(lfs_file_close(&lfs, &file), 0);
+
+	#ifdef LFS_CTZCACHE_SIZE
+	printf("LFS_CTZCACHE_SIZE %d: ", LFS_CTZCACHE_SIZE);
+	#else
+	printf("no CTZ cache:        ");
+	#endif
+	printf("4Mbyte file, %d random reads %6u, %d in 64Kbyte %6u, sequential %6u block reads",
+			READS, (unsigned)random, READS, (unsigned)window, (unsigned)sequential);
+	#ifdef LFS_CTZCACHE_SIZE
+	printf(", %u hits, %u misses", (unsigned)lfs.ctzcache.hits, (unsigned)lfs.ctzcache.misses);
+	#endif
+	printf("\n");
+
+	// Overwrite, truncate and append on one handle, the cached positions must follow. An overwrite
+	// copies the rest of the file, so a 1Mbyte file leaves room for that
+	CHECK_EQ(lfs_file_open(&lfs, &file, "big", LFS_O_RDWR), 0);
+	size = 1024*1024;
+	CHECK_EQ(lfs_file_truncate(&lfs, &file, size), 0);
+	for (int round = 0; round < 6; round++) {
+		lfs_off_t off = next_random() % (size - 5000);
+		lfs_size_t n = 1 + next_random() % 5000;
+
+		read_random(&file, size, 200, 100);
+		fill(off, n);
+		CHECK_EQ(lfs_file_seek(&lfs, &file, off, LFS_SEEK_SET), off);
+		CHECK_EQ(lfs_file_write(&lfs, &file, shadow + off, n), n);
+		read_random(&file, size, 200, 100);
+		size -= next_random() % 20000;
+		CHECK_EQ(lfs_file_truncate(&lfs, &file, size), 0);
+		read_random(&file, size, 200, 100);
+		n = next_random() % 15000;
+		fill(size, n);
+		CHECK_EQ(lfs_file_seek(&lfs, &file, 0, LFS_SEEK_END), size);
+		CHECK_EQ(lfs_file_write(&lfs, &file, shadow + size, n), n);
+		size += n;
+		read_random(&file, size, 200, 100);
+		if (round == 3) {
+			CHECK_EQ(lfs_file_sync(&lfs, &file), 0);
+		}
+	}
+	CHECK_EQ(lfs_file_close(&lfs, &file), 0);
+	CHECK_EQ(lfs_file_open(&lfs, &file, "big", LFS_O_RDONLY), 0);
+	CHECK_EQ(lfs_file_size(&lfs, &file), size);
+	read_random(&file, size, 500, 200);
+	CHECK_EQ(lfs_file_close(&lfs, &file), 0);
+
+	// Down to an inline file and back to a skip-list
+	CHECK_EQ(lfs_file_open(&lfs, &file, "big", LFS_O_RDWR), 0);
+	read_random(&file, size, 50, 100);
+	size = 50;
+	CHECK_EQ(lfs_file_truncate(&lfs, &file, size), 0);
+	fill(size, 300000);
+	CHECK_EQ(lfs_file_seek(&lfs, &file, 0, LFS_SEEK_END), size);
+	CHECK_EQ(lfs_file_write(&lfs, &file, shadow + size, 300000), 300000);
+	size += 300000;
+	read_random(&file, size, 300, 100);
+	CHECK_EQ(lfs_file_close(&lfs, &file), 0);
+	CHECK_EQ(lfs_unmount(&lfs), 0);
+
+	return test_done("bench_ctzcache");
+}
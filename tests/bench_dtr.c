@@ -0,0 +1,66 @@
+/*
+ * bench_dtr.c
+ *
+ *  File read time with DTR quad I/O reads at 80MHz (bench_dtr, QSPI_DTR_READ) against SDR quad I/O
+ *  reads at 120MHz (bench_dtr_off) on the flash model. 16 files of 50000 bytes are written on a
+ *  fresh format, then read back 4 times after a remount, the times are simulated.
+ */
+
+#include "main.h"
+#include "fake_hal.h"
+#include "test.h"
+
+#define FILES			16
+#define FILE_SIZE		50000
+#define PASSES			4
+
+static uint8_t data[FILE_SIZE];
+static uint8_t buf[FILE_SIZE];
+
+int test_main(int argc, char **argv) {
+	lfs_file_t file;
+	char name[16];
+	double start;
+
+	(void)argc;
+	(void)argv;
+	for (int i = 0; i < FILE_SIZE; i++) {
+		data[i] = (uint8_t)(i*17 + (i >> 8));
+	}
+	#ifdef QSPI_DTR_READ
+	printf("QSPI_DTR_READ, 0xED at 80MHz:\n");
+	#else
+	printf("SDR, 0xEB at 120MHz:\n");
+	#endif
+	fake_reset(NULL);
+	CHECK_EQ(CSP_QUADSPI_Init(), HAL_OK);
+	test_quiet(true);
+	CHECK_EQ(stmlfs_mount(true), 0);
+	test_quiet(false);
+	for (int f = 0; f < FILES; f++) {
+		sprintf(name, "f%d", f);
+		CHECK_EQ(stmlfs_file_open(&file, name, LFS_O_WRONLY | LFS_O_CREAT), 0);
+		CHECK_EQ(stmlfs_file_write(&file, data, FILE_SIZE), FILE_SIZE);
+		CHECK_EQ(stmlfs_file_close(&file), 0);
+	}
+	CHECK_EQ(stmlfs_unmount(), 0);
+	test_quiet(true);
+	CHECK_EQ(stmlfs_mount(false), 0);
+	test_quiet(false);
+
+	start = fake_time_us();
+	for (int p = 0; p < PASSES; p++) {
+		for (int f = 0; f < FILES; f++) {
+			sprintf(name, "f%d", f);
+			CHECK_EQ(stmlfs_file_open(&file, name, LFS_O_RDONLY), 0);
+			CHECK_EQ(stmlfs_file_read(&file, buf, FILE_SIZE), FILE_SIZE);
+			CHECK(memcmp(buf, data, FILE_SIZE) == 0);
+			CHECK_EQ(stmlfs_file_close(&file), 0);
+		}
+	}
+	printf("  read 16 x 50000 x 4: %5.1f ms\n", (fake_time_us() - start)/1000);
+	CHECK_EQ(stmlfs_unmount(), 0);
+	CHECK_FAKE();
+
+	return test_done("bench_dtr");
+}
@@ -0,0 +1,65 @@
+/*
+ * bench_dual.c
+ *
+ *  Write and read time of littlefs on one W25Q64JV (bench_dual_off) and on two in dual-flash mode
+ *  (bench_dual, QSPI_DUAL_FLASH) with FLASH2 the slower part, its busy times 1.25 times those of
+ *  FLASH1 (0.5 ms page program, 56 ms sector erase). 24 files of 100000 bytes are written on a
+ *  fresh format and read back once, the times are simulated.
+ */
+
+#include "main.h"
+#include "fake_hal.h"
+#include "test.h"
+
+#define FILES			24
+#define FILE_SIZE		100000
+
+static uint8_t data[FILE_SIZE];
+static uint8_t buf[FILE_SIZE];
+
+int test_main(int argc, char **argv) {
+	struct fake_part part = *fake_w25q64jv();
+	lfs_file_t file;
+	char name[16];
+	double start;
+
+	(void)argc;
+	(void)argv;
+	for (int i = 0; i < FILE_SIZE; i++) {
+		data[i] = (uint8_t)(i*11 + (i >> 10));
+	}
+	#ifdef QSPI_DUAL_FLASH
+	part.slow[1] = 1.25;
+	printf("QSPI_DUAL_FLASH, FLASH2 1.25 times slower:\n");
+	#else
+	printf("one flash:\n");
+	#endif
+	fake_reset(&part);
+	CHECK_EQ(CSP_QUADSPI_Init(), HAL_OK);
+	test_quiet(true);
+	CHECK_EQ(stmlfs_mount(true), 0);
+	test_quiet(false);
+
+	start = fake_time_us();
+	for (int f = 0; f < FILES; f++) {
+		sprintf(name, "f%d", f);
+		CHECK_EQ(stmlfs_file_open(&file, name, LFS_O_WRONLY | LFS_O_CREAT), 0);
+		CHECK_EQ(stmlfs_file_write(&file, data, FILE_SIZE), FILE_SIZE);
+		CHECK_EQ(stmlfs_file_close(&file), 0);
+	}
+	printf("  write 24 x 100000: %6.2f s, %5u page programs\n", (fake_time_us() - start)/1e6, (unsigned)fake_stat.progs);
+
+	start = fake_time_us();
+	for (int f = 0; f < FILES; f++) {
+		sprintf(name, "f%d", f);
+		CHECK_EQ(stmlfs_file_open(&file, name, LFS_O_RDONLY), 0);
+		CHECK_EQ(stmlfs_file_read(&file, buf, FILE_SIZE), FILE_SIZE);
+		CHECK(memcmp(buf, data, FILE_SIZE) == 0);
+		CHECK_EQ(stmlfs_file_close(&file), 0);
+	}
+	printf("  read 24 x 100000:  %6.1f ms\n", (fake_time_us() - start)/1000);
+	CHECK_EQ(stmlfs_unmount(), 0);
+	CHECK_FAKE();
+
+	return test_done("bench_dual");
+}
@@ -0,0 +1,82 @@
+/*
+ * bench_erase.c
+ *
+ *  Erase coalescing: writes 6Mbyte of 64K files on a fresh format, once letting littlefs erase
+ *  every 4K sector as it allocates it and once after stmlfs_trim(), which erases all free space
+ *  with 64K and 32K block erases first. A third run deletes every other file and trims the
+ *  fragmented free space. Erase counts come from stmlfs_erasestat(), times are simulated with the
+ *  W25Q64JV typical erase times (45 ms 4K, 120 ms 32K, 150 ms 64K).
+ */
+
+#include "main.h"
+#include "fake_hal.h"
+#include "test.h"
+
+#define FILES			96
+#define FILE_SIZE		65536
+
+static uint8_t data[FILE_SIZE];
+
+static void report(const char *what, const struct stmlfs_erasestat_t *a, const struct stmlfs_erasestat_t *b, double us) {
+	printf("%-26s %5u x 4K, %3u x 32K, %3u x 64K erases, %5u skipped, erase %6.2f s, total %6.2f s\n", what,
+			(unsigned)(b->sector_erases - a->sector_erases), (unsigned)(b->block32_erases - a->block32_erases),
+			(unsigned)(b->block64_erases - a->block64_erases), (unsigned)(b->skipped - a->skipped),
+			(b->erase_ms - a->erase_ms)/1000.0, us/1e6);
+}
+
+static void write_files(void) {
+	lfs_file_t file;
+	char name[16];
+
+	for (int f = 0; f < FILES; f++) {
+		sprintf(name, "file%d", f);
+		CHECK_EQ(stmlfs_file_open(&file, name, LFS_O_WRONLY | LFS_O_CREAT), 0);
+		CHECK_EQ(stmlfs_file_write(&file, data, FILE_SIZE), FILE_SIZE);
+		CHECK_EQ(stmlfs_file_close(&file), 0);
+	}
+}
+
+static void run(bool trim) {
+	struct stmlfs_erasestat_t a, b;
+	double start;
+
+	fake_reset(NULL);
+	CHECK_EQ(CSP_QUADSPI_Init(), HAL_OK);
+	CHECK_EQ(stmlfs_mount(true), 0);
+
+	stmlfs_erasestat(&a);
+	start = fake_time_us();
+	if (trim) {
+		CHECK_EQ(stmlfs_trim(), 0);
+	}
+	write_files();
+	stmlfs_erasestat(&b);
+	report(trim ? "stmlfs_trim + write 6M:" : "write 6M:", &a, &b, fake_time_us() - start);
+
+	if (trim) {
+		char name[16];
+
+		for (int f = 0; f < FILES; f += 2) {
+			sprintf(name, "file%d", f);
+			CHECK_EQ(stmlfs_remove(name), 0);
+		}
+		stmlfs_erasestat(&a);
+		start = fake_time_us();
+		CHECK_EQ(stmlfs_trim(), 0);
+		stmlfs_erasestat(&b);
+		report("delete half + stmlfs_trim:", &a, &b, fake_time_us() - start);
+	}
+	CHECK_EQ(stmlfs_unmount(), 0);
+	CHECK_FAKE();
+}
+
+int test_main(int argc, char **argv) {
+	(void)argc;
+	(void)argv;
+	for (int i = 0; i < FILE_SIZE; i++) {
+		data[i] = (uint8_t)(i*3);
+	}
+	run(false);
+	run(true);
+	return test_done("bench_erase");
+}
@@ -0,0 +1,90 @@
+/*
+ * bench_gc.c
+ *
+ *  Write latency on the flash model (45 ms sector erase, 0.4 ms page program) with and without
+ *  idle time maintenance. 6000 operations on a fresh format: 3 appends of 64 bytes with a sync to
+ *  one of 4 open log files for every rewrite of one of 16 small files. Run without maintenance, with
+ *  stmlfs_maintain(5) after every operation and with stmlfs_maintain(50) after every 8th. The time
+ *  spent in stmlfs_maintain is not part of the write latency.
+ */
+
+#include <stdlib.h>
+#include "main.h"
+#include "fake_hal.h"
+#include "test.h"
+
+#define OPERATIONS		6000
+
+static uint8_t data[512];
+static double latency[OPERATIONS];
+
+static int cmp(const void *a, const void *b) {
+	double x = *(const double *)a, y = *(const double *)b;
+	return x < y ? -1 : x > y;
+}
+
+static void run(const char *what, uint32_t budget_ms, int every) {
+	struct stmlfs_maintstat_t stat;
+	uint32_t compacted = 0, preerased = 0;
+	double maintain_us = 0;
+	lfs_file_t log[4], file;
+	char name[16];
+
+	fake_reset(NULL);
+	CHECK_EQ(CSP_QUADSPI_Init(), HAL_OK);
+	test_quiet(true);
+	CHECK_EQ(stmlfs_mount(true), 0);
+	test_quiet(false);
+	for (int f = 0; f < 4; f++) {
+		sprintf(name, "log%d", f);
+		CHECK_EQ(stmlfs_file_open(&log[f], name, LFS_O_WRONLY | LFS_O_CREAT | LFS_O_APPEND), 0);
+	}
+
+	for (int i = 0; i < OPERATIONS; i++) {
+		double start = fake_time_us();
+
+		if (i % 4 < 3) {
+			lfs_file_t *f = &log[(i/4 + i%4) % 4];
+			CHECK_EQ(stmlfs_file_write(f, data, 64), 64);
+			CHECK_EQ(stmlfs_fflush(f), 0);
+		} else {
+			sprintf(name, "small%d", (i/4) % 16);
+			CHECK_EQ(stmlfs_file_open(&file, name, LFS_O_WRONLY | LFS_O_CREAT | LFS_O_TRUNC), 0);
+			CHECK_EQ(stmlfs_file_write(&file, data, 100 + i % 300), 100 + i % 300);
+			CHECK_EQ(stmlfs_file_close(&file), 0);
+		}
+		latency[i] = fake_time_us() - start;
+
+		if (budget_ms && i % every == every - 1) {
+			start = fake_time_us();
+			CHECK_EQ(stmlfs_maintain(budget_ms, &stat), 0);
+			maintain_us += fake_time_us() - start;
+			compacted += stat.compacted;
+			preerased += stat.preerased;
+		}
+	}
+	for (int f = 0; f < 4; f++) {
+		CHECK_EQ(stmlfs_file_close(&log[f]), 0);
+	}
+	CHECK_EQ(stmlfs_unmount(), 0);
+	CHECK_FAKE();
+
+	qsort(latency, OPERATIONS, sizeof(latency[0]), cmp);
+	printf("  %-38s write median %5.1f ms, 99%% %6.1f ms, max %6.1f ms, maintenance %6.0f ms (%u compactions, %u pre-erases)\n",
+			what, latency[OPERATIONS/2]/1000, latency[OPERATIONS*99/100]/1000, latency[OPERATIONS-1]/1000,
+			maintain_us/1000, (unsigned)compacted, (unsigned)preerased);
+}
+
+int test_main(int argc, char **argv) {
+	(void)argc;
+	(void)argv;
+	for (uint32_t i = 0; i < sizeof(data); i++) {
+		data[i] = (uint8_t)(i*5 + 1);
+	}
+	printf("%d operations, 3 log appends per small file rewrite:\n", OPERATIONS);
+	run("no maintenance:", 0, 1);
+	run("stmlfs_maintain(5) every write:", 5, 1);
+	run("stmlfs_maintain(50) every 8th write:", 50, 8);
+
+	return test_done("bench_gc");
+}
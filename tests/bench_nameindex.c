@@ -0,0 +1,131 @@
+/*
+ * bench_nameindex.c
+ *
+ *  Open by name in directories of 10, 100, 300 and 1000 log files on a RAM image, for the
+ *  LFS_NAMEINDEX_SIZE the program is built with (bench_nameindex with 32 entries, bench_nameindex_off
+ *  without the index). Measures the block reads of 1000 opens and reads of files spread over each
+ *  directory, and the metadata pairs skipped and fetched. Then checks that creates, removes and
+ *  renames, which split and compact the pairs, never hide an existing name, and that the directory
+ *  lists every name once.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lfs.h"
+#include "ramdisk.h"
+#include "test.h"
+
+#define OPENS			1000
+
+static lfs_t lfs;
+static struct lfs_config cfg;
+
+static void write_file(const char *name) {
+	lfs_file_t file;
+
+	CHECK_EQ(lfs_file_open(&lfs, &file, name, LFS_O_WRONLY | LFS_O_CREAT | LFS_O_TRUNC), 0);
+	CHECK_EQ(lfs_file_write(&lfs, &file, name, strlen(name)), (lfs_ssize_t)strlen(name));
+	CHECK_EQ(lfs_file_close(&lfs, &file), 0);
+}
+
+// The file holds the name it was written with
+static void check_content(const char *name, const char *content) {
+	lfs_file_t file;
+	char buf[64];
+
+	CHECK_EQ(lfs_file_open(&lfs, &file, name, LFS_O_RDONLY), 0);
+	CHECK_EQ(lfs_file_read(&lfs, &file, buf, sizeof(buf)), (lfs_ssize_t)strlen(content));
+	CHECK(memcmp(buf, content, strlen(content)) == 0);
+	CHECK_EQ(lfs_file_close(&lfs, &file), 0);
+}
+
+static void check_file(const char *name) {
+	check_content(name, name);
+}
+
+int main(void) {
+	static const int entries[] = { 10, 100, 300, 1000 };
+	struct lfs_info info;
+	char name[64], moved[64];
+	lfs_dir_t dir;
+
+	ramdisk_init(&cfg, 32);
+	CHECK_EQ(lfs_format(&lfs, &cfg), 0);
+	CHECK_EQ(lfs_mount(&lfs, &cfg), 0);
+	for (int d = 0; d < 4; d++) {
+		sprintf(name, "/d%d", entries[d]);
+		CHECK_EQ(lfs_mkdir(&lfs, name), 0);
+		for (int i = 0; i < entries[d]; i++) {
+			sprintf(name, "/d%d/log%05d.txt", entries[d], i);
+			write_file(name);
+		}
+	}
+
+	#ifdef LFS_NAMEINDEX_SIZE
+	printf("LFS_NAMEINDEX_SIZE %d:\n", LFS_NAMEINDEX_SIZE);
+	#else
+	printf("no name index:\n");
+	#endif
+	for (int d = 0; d < 4; d++) {
+		uint32_t reads = ramdisk_stat.reads;
+		#ifdef LFS_NAMEINDEX_SIZE
+		uint32_t skips = lfs.nameindex.skips, fetches = lfs.nameindex.fetches;
+		#endif
+
+		for (int i = 0; i < OPENS; i++) {
+			sprintf(name, "/d%d/log%05d.txt", entries[d], (i*7919) % entries[d]);
+			check_file(name);
+		}
+		printf("  %4d entries: %d opens %6u block reads", entries[d], OPENS, (unsigned)(ramdisk_stat.reads - reads));
+		#ifdef LFS_NAMEINDEX_SIZE
+		printf(", %6u pairs skipped, %6u fetched", (unsigned)(lfs.nameindex.skips - skips),
+				(unsigned)(lfs.nameindex.fetches - fetches));
+		#endif
+		printf("\n");
+	}
+
+	// Names added, removed and moved away while the pairs of /d300 split and compact
+	for (int i = 0; i < 400; i++) {
+		sprintf(name, "/d300/new%d", i);
+		CHECK_EQ(lfs_stat(&lfs, name, &info), LFS_ERR_NOENT);
+		write_file(name);
+		sprintf(name, "/d300/log%05d.txt", i % 300);
+		if (i < 300 && i % 3 == 0) {
+			CHECK_EQ(lfs_remove(&lfs, name), 0);
+			CHECK_EQ(lfs_stat(&lfs, name, &info), LFS_ERR_NOENT);
+		} else if (i < 300 && i % 3 == 1) {
+			sprintf(moved, "/d1000/moved%d", i);
+			CHECK_EQ(lfs_rename(&lfs, name, moved), 0);
+			CHECK_EQ(lfs_stat(&lfs, name, &info), LFS_ERR_NOENT);
+			check_content(moved, name);
+		}
+		for (int j = 0; j <= i; j += 7) {
+			sprintf(name, "/d300/new%d", j);
+			check_file(name);
+		}
+	}
+	CHECK_EQ(lfs_unmount(&lfs), 0);
+	CHECK_EQ(lfs_mount(&lfs, &cfg), 0);
+	for (int i = 0; i < 400; i++) {
+		sprintf(name, "/d300/new%d", i);
+		check_file(name);
+	}
+	for (int i = 2; i < 300; i += 3) {
+		sprintf(name, "/d300/log%05d.txt", i);
+		check_file(name);
+	}
+
+	int news = 0, logs = 0;
+	CHECK_EQ(lfs_dir_open(&lfs, &dir, "/d300"), 0);
+	while (lfs_dir_read(&lfs, &dir, &info) > 0) {
+		news += strncmp(info.name, "new", 3) == 0;
+		logs += strncmp(info.name, "log", 3) == 0;
+	}
+	CHECK_EQ(lfs_dir_close(&lfs, &dir), 0);
+	CHECK_EQ(news, 400);
+	CHECK_EQ(logs, 100);
+	CHECK_EQ(lfs_unmount(&lfs), 0);
+
+	return test_done("bench_nameindex");
+}
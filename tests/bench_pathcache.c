@@ -0,0 +1,107 @@
+/*
+ * bench_pathcache.c
+ *
+ *  Path lookups on a RAM image with a directory tree 6 levels deep, 20 files per level, for the
+ *  LFS_PATHCACHE_SIZE the program is built with (bench_pathcache with 8 entries, bench_pathcache_off
+ *  without the cache). Measures the block reads of 1000 rounds of stat, open and read of 4 files at
+ *  depths 3 to 6, and the hit and miss counts. Then checks that renames, removes and the creates of
+ *  300 files, which split and compact the metadata pairs, never leave a stale entry behind.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lfs.h"
+#include "ramdisk.h"
+#include "test.h"
+
+#define DEPTH			6
+#define FILES			20
+#define ROUNDS			1000
+
+static lfs_t lfs;
+static struct lfs_config cfg;
+
+static void write_file(const char *name) {
+	lfs_file_t file;
+
+	CHECK_EQ(lfs_file_open(&lfs, &file, name, LFS_O_WRONLY | LFS_O_CREAT | LFS_O_TRUNC), 0);
+	CHECK_EQ(lfs_file_write(&lfs, &file, name, strlen(name)), (lfs_ssize_t)strlen(name));
+	CHECK_EQ(lfs_file_close(&lfs, &file), 0);
+}
+
+// The file holds its own name
+static void check_file(const char *name) {
+	struct lfs_info info;
+	lfs_file_t file;
+	char buf[64];
+
+	CHECK_EQ(lfs_stat(&lfs, name, &info), 0);
+	CHECK_EQ(info.size, strlen(name));
+	CHECK_EQ(lfs_file_open(&lfs, &file, name, LFS_O_RDONLY), 0);
+	CHECK_EQ(lfs_file_read(&lfs, &file, buf, sizeof(buf)), (lfs_ssize_t)strlen(name));
+	CHECK(memcmp(buf, name, strlen(name)) == 0);
+	CHECK_EQ(lfs_file_close(&lfs, &file), 0);
+}
+
+int main(void) {
+	static const char *hot[] = { "/l0/l1/l2/f3", "/l0/l1/l2/l3/f17", "/l0/l1/l2/l3/l4/f8", "/l0/l1/l2/l3/l4/l5/f11" };
+	struct lfs_info info;
+	char path[64], name[64];
+	uint32_t reads;
+
+	ramdisk_init(&cfg, 32);
+	CHECK_EQ(lfs_format(&lfs, &cfg), 0);
+	CHECK_EQ(lfs_mount(&lfs, &cfg), 0);
+	path[0] = 0;
+	for (int d = 0; d < DEPTH; d++) {
+		sprintf(path + strlen(path), "/l%d", d);
+		CHECK_EQ(lfs_mkdir(&lfs, path), 0);
+		for (int i = 0; i < FILES; i++) {
+			sprintf(name, "%s/f%d", path, i);
+			write_file(name);
+		}
+	}
+
+	reads = ramdisk_stat.reads;
+	for (int i = 0; i < ROUNDS; i++) {
+		check_file(hot[i % 4]);
+	}
+	reads = ramdisk_stat.reads - reads;
+	#ifdef LFS_PATHCACHE_SIZE
+	printf("LFS_PATHCACHE_SIZE %d: ", LFS_PATHCACHE_SIZE);
+	#else
+	printf("no path cache:        ");
+	#endif
+	printf("%d rounds of stat, open and read at depth 3 to 6: %u block reads", ROUNDS, (unsigned)reads);
+	#ifdef LFS_PATHCACHE_SIZE
+	printf(", %u hits, %u misses", (unsigned)lfs.pathcache.hits, (unsigned)lfs.pathcache.misses);
+	#endif
+	printf("\n");
+
+	// A rename or remove is a commit, the old name must not be found afterwards
+	CHECK_EQ(lfs_rename(&lfs, hot[3], "/l0/l1/l2/l3/l4/l5/moved"), 0);
+	CHECK_EQ(lfs_stat(&lfs, hot[3], &info), LFS_ERR_NOENT);
+	CHECK_EQ(lfs_stat(&lfs, "/l0/l1/l2/l3/l4/l5/moved", &info), 0);
+	CHECK_EQ(lfs_remove(&lfs, "/l0/l1/l2/l3/l4/l5/moved"), 0);
+	CHECK_EQ(lfs_stat(&lfs, "/l0/l1/l2/l3/l4/l5/moved", &info), LFS_ERR_NOENT);
+	write_file(hot[3]);
+
+	// Lookups between creates that split and compact /l0 and move its entries around
+	for (int i = 0; i < 300; i++) {
+		sprintf(name, "/l0/g%d", i);
+		write_file(name);
+		sprintf(name, "/l0/g%d", i/2);
+		check_file(name);
+		check_file(hot[i % 4]);
+	}
+	CHECK_EQ(lfs_unmount(&lfs), 0);
+	CHECK_EQ(lfs_mount(&lfs, &cfg), 0);
+	for (int i = 0; i < 300; i++) {
+		sprintf(name, "/l0/g%d", i);
+		check_file(name);
+	}
+	CHECK_EQ(lfs_unmount(&lfs), 0);
+
+	return test_done("bench_pathcache");
+}
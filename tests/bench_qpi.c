@@ -0,0 +1,90 @@
+/*
+ * bench_qpi.c
+ *
+ *  Command overhead on the flash model with QSPI_QPI_MODE (bench_qpi) and without (bench_qpi_off).
+ *  64 files of 3000 bytes are written, 2000 records of 16 bytes appended to 4 logs in turns with a
+ *  sync of every 8th, and the files read back 4 times. Counts the commands and their instruction,
+ *  address, mode and dummy clocks, and the bus time of all clocks at the 120MHz of the model.
+ */
+
+#include "main.h"
+#include "fake_hal.h"
+#include "test.h"
+
+#define FILES			64
+#define FILE_SIZE		3000
+#define RECORDS			2000
+
+static uint8_t data[FILE_SIZE];
+
+static void report(const char *what, const struct fake_stat *before) {
+	uint32_t commands = fake_stat.commands - before->commands;
+
+	printf("  %-24s %6u commands, %4.1f command clocks each, bus time %6.1f ms\n", what, (unsigned)commands,
+			(double)(fake_stat.command_clocks - before->command_clocks)/commands,
+			(fake_stat.clocks - before->clocks)/(FAKE_CLOCK_MHZ/2)/1000);
+}
+
+int test_main(int argc, char **argv) {
+	struct fake_stat before, start;
+	uint8_t buf[FILE_SIZE];
+	lfs_file_t file[4];
+	char name[16];
+
+	(void)argc;
+	(void)argv;
+	for (uint32_t i = 0; i < sizeof(data); i++) {
+		data[i] = (uint8_t)(i*9 + (i >> 8) + 7);
+	}
+	CHECK_EQ(CSP_QUADSPI_Init(), HAL_OK);
+	test_quiet(true);
+	CHECK_EQ(stmlfs_mount(true), 0);
+	test_quiet(false);
+
+	#ifdef QSPI_QPI_MODE
+	printf("QSPI_QPI_MODE:\n");
+	#else
+	printf("SPI mode:\n");
+	#endif
+	before = start = fake_stat;
+	for (int f = 0; f < FILES; f++) {
+		sprintf(name, "file%d", f);
+		CHECK_EQ(stmlfs_file_open(&file[0], name, LFS_O_WRONLY | LFS_O_CREAT | LFS_O_TRUNC), 0);
+		CHECK_EQ(stmlfs_file_write(&file[0], data, FILE_SIZE), FILE_SIZE);
+		CHECK_EQ(stmlfs_file_close(&file[0]), 0);
+	}
+	report("write 64 x 3000:", &before);
+
+	before = fake_stat;
+	for (int f = 0; f < 4; f++) {
+		sprintf(name, "log%d", f);
+		CHECK_EQ(stmlfs_file_open(&file[f], name, LFS_O_WRONLY | LFS_O_CREAT | LFS_O_APPEND), 0);
+	}
+	for (int i = 0; i < RECORDS; i++) {
+		CHECK_EQ(stmlfs_file_write(&file[i % 4], data + i % 256, 16), 16);
+		if (i % 8 == 7) {
+			CHECK_EQ(stmlfs_fflush(&file[i % 4]), 0);
+		}
+	}
+	for (int f = 0; f < 4; f++) {
+		CHECK_EQ(stmlfs_file_close(&file[f]), 0);
+	}
+	report("2000 log appends:", &before);
+
+	before = fake_stat;
+	for (int pass = 0; pass < 4; pass++) {
+		for (int f = 0; f < FILES; f++) {
+			sprintf(name, "file%d", f);
+			CHECK_EQ(stmlfs_file_open(&file[0], name, LFS_O_RDONLY), 0);
+			CHECK_EQ(stmlfs_file_read(&file[0], buf, FILE_SIZE), FILE_SIZE);
+			CHECK(memcmp(buf, data, FILE_SIZE) == 0);
+			CHECK_EQ(stmlfs_file_close(&file[0]), 0);
+		}
+	}
+	report("read 64 files 4 times:", &before);
+	report("total:", &start);
+	CHECK_EQ(stmlfs_unmount(), 0);
+	CHECK_FAKE();
+
+	return test_done("bench_qpi");
+}
@@ -0,0 +1,107 @@
+/*
+ * bench_readahead.c
+ *
+ *  Sequential file reads on the flash model for the STMLFS_READAHEAD and LFS_CTZCACHE_SIZE options
+ *  the program is built with (bench_readahead_off, bench_readahead and the _ctz builds with a 16
+ *  entry CTZ cache). Files of 8K, 64K, 256K and 1Mbyte are read in 512 byte application reads, and
+ *  two files written in alternating 4Kbyte chunks are read one after the other. The throughput is
+ *  file bytes per simulated time: bus clocks at 120MHz plus the HAL call and interrupt costs of the
+ *  model, the CPU time of the memcpy from the readahead buffer is not included.
+ */
+
+#include "main.h"
+#include "fake_hal.h"
+#include "test.h"
+
+#define MAX_FILE		(1024*1024)
+#define APP_READ		512
+#define PASSES			4
+
+static uint8_t data[MAX_FILE];
+
+static void write_file(const char *name, uint32_t size) {
+	lfs_file_t file;
+
+	CHECK_EQ(stmlfs_file_open(&file, name, LFS_O_WRONLY | LFS_O_CREAT | LFS_O_TRUNC), 0);
+	CHECK_EQ(stmlfs_file_write(&file, data, size), size);
+	CHECK_EQ(stmlfs_file_close(&file), 0);
+}
+
+static void read_file(const char *name, uint32_t size) {
+	uint8_t buf[APP_READ];
+	lfs_file_t file;
+
+	CHECK_EQ(stmlfs_file_open(&file, name, LFS_O_RDONLY), 0);
+	for (uint32_t off = 0; off < size; off += APP_READ) {
+		uint32_t n = (size - off < APP_READ) ? size - off : APP_READ;
+		CHECK_EQ(stmlfs_file_read(&file, buf, n), n);
+		CHECK(memcmp(buf, data + off, n) == 0);
+	}
+	CHECK_EQ(stmlfs_file_close(&file), 0);
+}
+
+// File bytes per simulated us, which is Mbyte/s
+static double read_rate(const char *name, uint32_t size, uint32_t *commands) {
+	uint32_t before = fake_stat.commands;
+	double start = fake_time_us();
+
+	for (int i = 0; i < PASSES; i++) {
+		read_file(name, size);
+	}
+	*commands = (fake_stat.commands - before)/PASSES;
+	return (double)size*PASSES/(fake_time_us() - start);
+}
+
+int test_main(int argc, char **argv) {
+	static const uint32_t sizes[] = { 8*1024, 64*1024, 256*1024, 1024*1024 };
+	uint32_t commands;
+	lfs_file_t a, b;
+	char name[16];
+
+	(void)argc;
+	(void)argv;
+	for (uint32_t i = 0; i < MAX_FILE; i++) {
+		data[i] = (uint8_t)(i*7 + (i >> 10));
+	}
+	CHECK_EQ(CSP_QUADSPI_Init(), HAL_OK);
+	test_quiet(true);
+	CHECK_EQ(stmlfs_mount(true), 0);
+	test_quiet(false);
+	for (int i = 0; i < 4; i++) {
+		sprintf(name, "f%u", (unsigned)sizes[i]);
+		write_file(name, sizes[i]);
+	}
+	CHECK_EQ(stmlfs_file_open(&a, "a", LFS_O_WRONLY | LFS_O_CREAT), 0);	// Blocks of a and b interleaved
+	CHECK_EQ(stmlfs_file_open(&b, "b", LFS_O_WRONLY | LFS_O_CREAT), 0);
+	for (uint32_t off = 0; off < 256*1024; off += 4096) {
+		CHECK_EQ(stmlfs_file_write(&a, data + off, 4096), 4096);
+		CHECK_EQ(stmlfs_file_write(&b, data + off, 4096), 4096);
+	}
+	CHECK_EQ(stmlfs_file_close(&a), 0);
+	CHECK_EQ(stmlfs_file_close(&b), 0);
+
+	#ifdef STMLFS_READAHEAD
+	printf("STMLFS_READAHEAD");
+	#else
+	printf("no readahead");
+	#endif
+	#ifdef LFS_CTZCACHE_SIZE
+	printf(", LFS_CTZCACHE_SIZE %d", LFS_CTZCACHE_SIZE);
+	#endif
+	printf(":\n");
+	for (int i = 0; i < 4; i++) {
+		sprintf(name, "f%u", (unsigned)sizes[i]);
+		double rate = read_rate(name, sizes[i], &commands);
+		printf("  %4uK file: %5.1f Mbyte/s, %5u read commands\n", (unsigned)(sizes[i]/1024), rate, (unsigned)commands);
+	}
+	double start = fake_time_us();
+	uint32_t before = fake_stat.commands;
+	read_file("a", 256*1024);
+	read_file("b", 256*1024);
+	printf("  2 x 256K interleaved: %5.1f Mbyte/s, %5u read commands\n", 512*1024/(fake_time_us() - start),
+			(unsigned)(fake_stat.commands - before));
+	CHECK_EQ(stmlfs_unmount(), 0);
+	CHECK_FAKE();
+
+	return test_done("bench_readahead");
+}
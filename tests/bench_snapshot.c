@@ -0,0 +1,124 @@
+/*
+ * bench_snapshot.c
+ *
+ *  lookahead_snapshot on a RAM image with 1000 files in 10 directories and the default 32 byte
+ *  lookahead. Measures the block reads of the first file write after a mount with and without a
+ *  snapshot, and per kind of session (read only, inline file write, file write that allocates) what
+ *  the unmount costs: block reads and programs of the superblock pair, and how often the pair is
+ *  erased over 100 sessions. A snapshot is only committed when the lookahead changed.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "lfs.h"
+#include "ramdisk.h"
+#include "test.h"
+
+#define FILES			1000
+#define SESSIONS		100
+
+static lfs_t lfs;
+static struct lfs_config cfg;
+static int (*ramdisk_prog)(const struct lfs_config *c, lfs_block_t block, lfs_off_t off, const void *buffer, lfs_size_t size);
+static int (*ramdisk_erase)(const struct lfs_config *c, lfs_block_t block);
+static uint32_t super_progs, super_erases;
+static uint8_t data[6000];
+
+static int count_prog(const struct lfs_config *c, lfs_block_t block, lfs_off_t off, const void *buffer, lfs_size_t size) {
+	super_progs += block < 2;
+	return ramdisk_prog(c, block, off, buffer, size);
+}
+
+static int count_erase(const struct lfs_config *c, lfs_block_t block) {
+	super_erases += block < 2;
+	return ramdisk_erase(c, block);
+}
+
+static void write_file(const char *name, lfs_size_t size) {
+	lfs_file_t file;
+
+	CHECK_EQ(lfs_file_open(&lfs, &file, name, LFS_O_WRONLY | LFS_O_CREAT | LFS_O_TRUNC), 0);
+	CHECK_EQ(lfs_file_write(&lfs, &file, data, size), size);
+	CHECK_EQ(lfs_file_close(&lfs, &file), 0);
+}
+
+static void read_file(const char *name) {
+	uint8_t buf[sizeof(data)];
+	lfs_file_t file;
+
+	CHECK_EQ(lfs_file_open(&lfs, &file, name, LFS_O_RDONLY), 0);
+	CHECK(lfs_file_read(&lfs, &file, buf, sizeof(buf)) > 0);
+	CHECK_EQ(lfs_file_close(&lfs, &file), 0);
+}
+
+// Reads of the first allocating write after a mount
+static uint32_t first_write(bool snapshot) {
+	uint32_t reads;
+
+	cfg.lookahead_snapshot = snapshot;
+	CHECK_EQ(lfs_mount(&lfs, &cfg), 0);
+	reads = ramdisk_stat.reads;
+	write_file("first", 3000);
+	reads = ramdisk_stat.reads - reads;
+	CHECK_EQ(lfs_unmount(&lfs), 0);
+	cfg.lookahead_snapshot = true;
+	return reads;
+}
+
+static void sessions(const char *kind, int what) {
+	uint32_t reads = 0, progs = super_progs, erases = super_erases;
+
+	for (int i = 0; i < SESSIONS; i++) {
+		CHECK_EQ(lfs_mount(&lfs, &cfg), 0);
+		if (what == 0) {
+			read_file("d3/f3");
+		} else if (what == 1) {
+			write_file("d5/status", 40 + i % 8);
+		} else {
+			write_file("d5/log", 3000 + i);
+		}
+		uint32_t r = ramdisk_stat.reads;
+		CHECK_EQ(lfs_unmount(&lfs), 0);
+		reads += ramdisk_stat.reads - r;
+	}
+	printf("  %-14s unmount: %6.1f block reads, %5.2f superblock programs, superblock erased %u times in %d sessions\n",
+			kind, (double)reads/SESSIONS, (double)(super_progs - progs)/SESSIONS, (unsigned)(super_erases - erases), SESSIONS);
+}
+
+int main(void) {
+	char name[32];
+
+	for (int i = 0; i < (int)sizeof(data); i++) {
+		data[i] = (uint8_t)(i*7);
+	}
+	ramdisk_init(&cfg, 32);
+	ramdisk_prog = cfg.prog;
+	ramdisk_erase = cfg.erase;
+	cfg.prog = count_prog;
+	cfg.erase = count_erase;
+	cfg.lookahead_snapshot = true;
+
+	CHECK_EQ(lfs_format(&lfs, &cfg), 0);
+	CHECK_EQ(lfs_mount(&lfs, &cfg), 0);
+	for (int d = 0; d < 10; d++) {
+		sprintf(name, "d%d", d);
+		CHECK_EQ(lfs_mkdir(&lfs, name), 0);
+	}
+	for (int i = 0; i < FILES; i++) {
+		sprintf(name, "d%d/f%d", i % 10, i);
+		write_file(name, (i*7919) % 5000 + 1);
+	}
+	CHECK_EQ(lfs_unmount(&lfs), 0);
+
+	uint32_t with = first_write(true);
+	uint32_t without = first_write(false);								// Leaves the snapshot stale
+	printf("lookahead_snapshot, %d files: first write after mount %u block reads, %u without the snapshot\n",
+			FILES, (unsigned)with, (unsigned)without);
+	first_write(true);													// Scans, saves a valid one again
+
+	sessions("read only", 0);
+	sessions("inline write", 1);
+	sessions("block write", 2);
+
+	return test_done("bench_snapshot");
+}
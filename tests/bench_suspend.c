@@ -0,0 +1,103 @@
+/*
+ * bench_suspend.c
+ *
+ *  Read latency while erasing, the SUSPEND_LATENCY_TEST of main.c on the flash model: the top 1Mbyte
+ *  is erased with 4K and 64K erases while a control loop reads 16 bytes once per ms. With
+ *  QSPI_SUSPEND_RESUME the read comes from QSPI_BusyCallback() and suspends the erase. Without it the
+ *  driver only returns when the erase is done, a read due during the erase waits for that, so its
+ *  latency is the rest of the erase plus the reads queued before it.
+ */
+
+#include <stdlib.h>
+#include "main.h"
+#include "fake_hal.h"
+#include "test.h"
+
+#define LATENCY_BINS		16										// 10us bins, last bin collects the rest
+#define MAX_READS			20000
+
+static double latency[MAX_READS];
+static uint32_t nreads;
+static uint32_t latency_tick;
+
+static void read_timed(double due) {
+	uint8_t data[16];
+
+	CHECK_EQ(CSP_QSPI_Read(data, 0, sizeof(data)), HAL_OK);
+	if (nreads < MAX_READS) {
+		latency[nreads++] = fake_time_us() - due;
+	}
+}
+
+#ifdef QSPI_SUSPEND_RESUME
+void QSPI_BusyCallback(void) {
+	if (HAL_GetTick() == latency_tick) return;
+	latency_tick = HAL_GetTick();
+	read_timed(fake_time_us());
+}
+#endif
+
+// Without suspend the reads due during the operation are served after it
+static void erase_timed(uint8_t (*erase)(uint32_t), uint32_t address) {
+	double start = fake_time_us();
+
+	CHECK_EQ(erase(address), HAL_OK);
+	#ifndef QSPI_SUSPEND_RESUME
+	double end = fake_time_us();
+	for (uint32_t tick = (uint32_t)(start/1000) + 1; tick*1000.0 < end; tick++) {
+		read_timed(tick*1000.0);
+	}
+	#else
+	(void)start;
+	#endif
+}
+
+static uint8_t erase_sector(uint32_t address) {
+	return CSP_QSPI_EraseSector(address, address);
+}
+
+static int cmp(const void *a, const void *b) {
+	double x = *(const double *)a, y = *(const double *)b;
+	return x < y ? -1 : x > y;
+}
+
+int test_main(int argc, char **argv) {
+	uint32_t hist[LATENCY_BINS] = { 0 };
+	double start;
+
+	(void)argc;
+	(void)argv;
+	CHECK_EQ(CSP_QUADSPI_Init(), HAL_OK);
+	latency_tick = HAL_GetTick();
+	start = fake_time_us();
+	for (uint32_t i = 0; i < 16; i++) {								// Erase the top 1Mbyte, 4K and 64K erases
+		uint32_t addr = QSPI_FlashInfo()->size - (i+1) * MEMORY_BLOCK_SIZE;
+		erase_timed(erase_sector, addr);
+		erase_timed(CSP_QSPI_EraseBlock, addr);
+	}
+	CHECK(nreads > 0);
+	CHECK_FAKE();
+
+	#ifdef QSPI_SUSPEND_RESUME
+	printf("QSPI_SUSPEND_RESUME: ");
+	#else
+	printf("no suspend:          ");
+	#endif
+	qsort(latency, nreads, sizeof(latency[0]), cmp);
+	printf("erases %.0f ms, %u reads, latency median %.0f us, 99%% %.0f us, max %.0f us\n",
+			(fake_time_us() - start)/1000, (unsigned)nreads, latency[nreads/2], latency[nreads*99/100],
+			latency[nreads - 1]);
+	for (uint32_t i = 0; i < nreads; i++) {
+		uint32_t us = (uint32_t)latency[i];
+		hist[(us/10 < LATENCY_BINS) ? us/10 : LATENCY_BINS-1]++;
+	}
+	for (int i = 0; i < LATENCY_BINS; i++) {
+		if (hist[i] && i < LATENCY_BINS-1) {
+			printf("  %3d..%3d us : %u\n", i*10, (i+1)*10-1, (unsigned)hist[i]);
+		} else if (hist[i]) {
+			printf("  %3d..    us : %u\n", i*10, (unsigned)hist[i]);
+		}
+	}
+
+	return test_done("bench_suspend");
+}
@@ -0,0 +1,52 @@
+/*
+ * bench_verify.c
+ *
+ *  Write throughput for the STMLFS_VERIFY policy the program is built with (bench_verify_off, _crc
+ *  and _full). 16 files of 32Kbyte are written in 512 byte writes on a freshly formatted flash. The
+ *  time is the simulated bus and flash time, the CPU time of lfs_crc and memcmp is not included.
+ */
+
+#include "main.h"
+#include "fake_hal.h"
+#include "test.h"
+
+#define FILES			16
+#define FILE_SIZE		32768
+#define CHUNK			512
+
+static const char *policy[] = { "off", "crc", "full" };
+
+int test_main(int argc, char **argv) {
+	static uint8_t data[CHUNK];
+	struct fake_stat before;
+	lfs_file_t file;
+	char name[16];
+	double start, us;
+
+	(void)argc;
+	(void)argv;
+	for (int i = 0; i < CHUNK; i++) {
+		data[i] = (uint8_t)(i*37);
+	}
+	CHECK_EQ(CSP_QUADSPI_Init(), HAL_OK);
+	CHECK_EQ(stmlfs_mount(true), 0);
+
+	before = fake_stat;
+	start = fake_time_us();
+	for (int f = 0; f < FILES; f++) {
+		sprintf(name, "file%d", f);
+		CHECK_EQ(stmlfs_file_open(&file, name, LFS_O_WRONLY | LFS_O_CREAT), 0);
+		for (int i = 0; i < FILE_SIZE/CHUNK; i++) {
+			CHECK_EQ(stmlfs_file_write(&file, data, CHUNK), CHUNK);
+		}
+		CHECK_EQ(stmlfs_file_close(&file), 0);
+	}
+	us = fake_time_us() - start;
+	CHECK_EQ(stmlfs_unmount(), 0);
+
+	printf("STMLFS_VERIFY_%-4s %d x %dK: %7.1f ms, %6.1f Kbyte/s, %5u read commands, %8llu bytes read, %5u page programs\n",
+			policy[STMLFS_VERIFY], FILES, FILE_SIZE/1024, us/1000, FILES*FILE_SIZE/1024.0/(us/1e6),
+			(unsigned)(fake_stat.reads - before.reads), (unsigned long long)(fake_stat.read_bytes - before.read_bytes),
+			(unsigned)(fake_stat.progs - before.progs));
+	return test_done("bench_verify");
+}
@@ -0,0 +1,158 @@
+/*
+ * fake_crc.c
+ *
+ *  STM32H7 CRC unit model, linked into the programs built with STMLFS_CRC_HW. The registers sit on a
+ *  read only page: reads return what the unit shows, every store faults. The fault handler decodes
+ *  the store width from the x86-64 instruction, lets it run with the page writable for a single
+ *  step and feeds the stored value to the unit, so 8 bit and 32 bit writes to DR are processed
+ *  like on the chip (x86-64 Linux only).
+ *
+ *  The unit computes the CRC MSB first over the data after the REV_IN bit reversal, INIT is loaded
+ *  by CR.RESET and DR reads the CRC after the REV_OUT reversal. A byte takes one HCLK (240MHz), the
+ *  simulated time advances by that for every byte fed in.
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <signal.h>
+#include <ucontext.h>
+#include <sys/mman.h>
+#include "main.h"
+#include "fake_hal.h"
+
+#define HCLK_MHZ				240.0
+#define EFLAGS_TF				0x100
+
+static CRC_TypeDef *regs;
+static uint32_t state;
+static uintptr_t store_addr;
+static int store_size;
+
+static uint32_t reverse(uint32_t value, int bits) {
+	uint32_t result = 0;
+	for (int i = 0; i < bits; i++) {
+		result = (result << 1) | ((value >> i) & 1);
+	}
+	return result;
+}
+
+// Bit reversal of the input by byte, half word or word (CR.REV_IN)
+static uint32_t reverse_in(uint32_t value, int size) {
+	int unit[4] = { 0, 8, 16, 32 };
+	int bits = unit[(regs->CR & CRC_CR_REV_IN) >> 5];
+	uint32_t result = 0;
+
+	if (bits == 0) {
+		return value;
+	}
+	if (bits > size*8) {
+		bits = size*8;
+	}
+	for (int i = 0; i < size*8; i += bits) {
+		uint32_t mask = bits == 32 ? 0xFFFFFFFF : (1U << bits) - 1;
+		result |= reverse((value >> i) & mask, bits) << i;
+	}
+	return result;
+}
+
+static void feed(uint32_t value, int size) {
+	uint32_t data = reverse_in(value, size);
+
+	for (int i = size*8 - 1; i >= 0; i--) {
+		uint32_t bit = ((state >> 31) ^ (data >> i)) & 1;
+		state = (state << 1) ^ (bit ? regs->POL : 0);
+	}
+	fake_advance(size/HCLK_MHZ);
+}
+
+static uint32_t output(void) {
+	return (regs->CR & CRC_CR_REV_OUT) ? reverse(state, 32) : state;
+}
+
+// Width of the store at ip: mov, or, and with register or immediate sources
+static int store_width(const uint8_t *ip) {
+	int size = 4;
+
+	for (;; ip++) {
+		if (*ip == 0x66) {
+			size = 2;
+		} else if ((*ip & 0xF0) == 0x40) {
+			if (*ip & 0x08) {
+				size = 8;
+			}
+		} else {
+			break;
+		}
+	}
+	switch (*ip) {
+	case 0x88: case 0xC6: case 0x80: case 0x08: case 0x20:
+		return 1;
+	case 0x89: case 0xC7: case 0x81: case 0x83: case 0x09: case 0x21:
+		return size;
+	default:
+		fprintf(stderr, "fake: CRC register store with opcode 0x%02X not decoded\n", *ip);
+		abort();
+	}
+}
+
+static void store_fault(int sig, siginfo_t *info, void *context) {
+	ucontext_t *uc = context;
+	uintptr_t addr = (uintptr_t)info->si_addr;
+
+	(void)sig;
+	if (addr < (uintptr_t)regs || addr >= (uintptr_t)regs + sizeof(*regs)) {
+		signal(SIGSEGV, SIG_DFL);									// A real crash
+		return;
+	}
+	store_addr = addr;
+	store_size = store_width((const uint8_t *)uc->uc_mcontext.gregs[REG_RIP]);
+	mprotect(regs, getpagesize(), PROT_READ | PROT_WRITE);
+	uc->uc_mcontext.gregs[REG_EFL] |= EFLAGS_TF;					// Trap after the store
+}
+
+static void store_done(int sig, siginfo_t *info, void *context) {
+	ucontext_t *uc = context;
+	uint32_t value = 0;
+
+	(void)sig;
+	(void)info;
+	uc->uc_mcontext.gregs[REG_EFL] &= ~EFLAGS_TF;
+	memcpy(&value, (void *)store_addr, store_size > 4 ? 4 : store_size);
+
+	if (store_addr == (uintptr_t)&regs->DR) {
+		feed(value, store_size);
+	} else if (store_addr == (uintptr_t)&regs->CR) {
+		if (value & CRC_CR_POLYSIZE) {
+			fprintf(stderr, "fake: CRC unit only modelled with a 32 bit polynomial\n");
+			abort();
+		}
+		if (value & CRC_CR_RESET) {
+			state = regs->INIT;
+			regs->CR = value & ~CRC_CR_RESET;						// Cleared by hardware
+		}
+	}
+	regs->DR = output();
+	mprotect(regs, getpagesize(), PROT_READ);
+}
+
+__attribute__((constructor)) static void fake_crc_install(void) {
+	struct sigaction sa = { 0 };
+
+	regs = mmap(NULL, getpagesize(), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (regs == MAP_FAILED) {
+		perror("fake: CRC unit");
+		exit(2);
+	}
+	regs->INIT = 0xFFFFFFFF;										// Reset values
+	regs->POL = 0x04C11DB7;
+	state = regs->INIT;
+	regs->DR = output();
+	fake_crc_regs = regs;
+
+	sa.sa_flags = SA_SIGINFO | SA_NODEFER;
+	sa.sa_sigaction = store_fault;
+	sigaction(SIGSEGV, &sa, NULL);
+	sa.sa_sigaction = store_done;
+	sigaction(SIGTRAP, &sa, NULL);
+	mprotect(regs, getpagesize(), PROT_READ);
+}
@@ -0,0 +1,126 @@
+/*
+ * fake_hal.c
+ *
+ *  Core side of the host model: simulated time, DWT, WFI/NOP, HAL_Delay/GetTick, the CRC unit
+ *  registers, the CubeMX QUADSPI init and the test entry point.
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <malloc.h>
+#include <sys/mman.h>
+#include <ucontext.h>
+#include "main.h"
+#include "fake_hal.h"
+
+#define TEST_STACK_SIZE			(8*1024*1024)
+
+uint32_t SystemCoreClock = FAKE_CORE_MHZ*1000000;
+QSPI_HandleTypeDef hqspi;
+CoreDebug_Type fake_coredebug;
+static DWT_Type fake_dwt_regs;
+static CRC_TypeDef fake_crc_plain;
+CRC_TypeDef *fake_crc_regs = &fake_crc_plain;
+
+static double now_us;
+
+double fake_time_us(void) {
+	return now_us;
+}
+
+void fake_advance(double us) {
+	now_us += us;
+}
+
+// Every DWT access is a load of a few core clocks, so spin loops on CYCCNT make progress
+DWT_Type *fake_dwt(void) {
+	now_us += 4.0/FAKE_CORE_MHZ;
+	fake_dwt_regs.CYCCNT = (uint32_t)(uint64_t)(now_us*FAKE_CORE_MHZ);
+	return &fake_dwt_regs;
+}
+
+void fake_nop(void) {
+	now_us += 1.0/FAKE_CORE_MHZ;
+}
+
+// Sleeps until the next QUADSPI interrupt, or the next SysTick when none is pending
+void fake_wfi(void) {
+	if (!fake_qspi_wait_irq()) {
+		now_us = (uint64_t)(now_us/1000 + 1)*1000.0;
+		fake_qspi_poll();
+	}
+}
+
+void fake_poll(void) {
+	fake_qspi_poll();
+}
+
+uint32_t HAL_GetTick(void) {
+	now_us += 0.01;
+	fake_qspi_poll();
+	return (uint32_t)(uint64_t)(now_us/1000);
+}
+
+void HAL_Delay(uint32_t Delay) {
+	now_us += (Delay + 1)*1000.0;									// HAL_Delay waits at least Delay+1 ticks
+	fake_qspi_poll();
+}
+
+void MX_QUADSPI_Init(void) {										// Same settings as Core/Src/quadspi.c
+	hqspi.Instance = QUADSPI;
+	hqspi.Init.ClockPrescaler = 1;
+	hqspi.Init.FifoThreshold = 32;
+	hqspi.Init.SampleShifting = QSPI_SAMPLE_SHIFTING_HALFCYCLE;
+	hqspi.Init.FlashSize = 23;
+	hqspi.Init.ChipSelectHighTime = QSPI_CS_HIGH_TIME_2_CYCLE;
+	hqspi.Init.ClockMode = QSPI_CLOCK_MODE_0;
+	hqspi.Init.FlashID = QSPI_FLASH_ID_1;
+	hqspi.Init.DualFlash = QSPI_DUALFLASH_DISABLE;
+	if (HAL_QSPI_Init(&hqspi) != HAL_OK) {
+		Error_Handler();
+	}
+}
+
+void Error_Handler(void) {
+	fprintf(stderr, "Error_Handler\n");
+	abort();
+}
+
+//-------------------------------------------------------------------------------------------------
+// The driver keeps buffer and littlefs directory addresses in uint32_t like on the target. The
+// Makefile links without PIE so data and the brk heap sit below 4Gbyte, malloc is kept off mmap and
+// the test runs on a MAP_32BIT stack.
+//-------------------------------------------------------------------------------------------------
+static ucontext_t main_context, test_context;
+static int test_argc, test_result;
+static char **test_argv;
+
+static void test_entry(void) {
+	test_result = test_main(test_argc, test_argv);
+}
+
+int main(int argc, char **argv) {
+	void *stack;
+	void *probe;
+
+	mallopt(M_MMAP_MAX, 0);
+	probe = malloc(16);
+	stack = mmap(NULL, TEST_STACK_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_32BIT, -1, 0);
+	if (stack == MAP_FAILED || (uintptr_t)probe >> 32 || (uintptr_t)&fake_dwt_regs >> 32) {
+		fprintf(stderr, "%s: needs memory below 4Gbyte (link with -no-pie)\n", argv[0]);
+		return 2;
+	}
+	free(probe);
+	setvbuf(stdout, NULL, _IOLBF, 0);
+	fake_reset(NULL);
+
+	test_argc = argc;
+	test_argv = argv;
+	getcontext(&test_context);
+	test_context.uc_stack.ss_sp = stack;
+	test_context.uc_stack.ss_size = TEST_STACK_SIZE;
+	test_context.uc_link = &main_context;
+	makecontext(&test_context, test_entry, 0);
+	swapcontext(&main_context, &test_context);
+	return test_result;
+}
@@ -0,0 +1,93 @@
+/*
+ * fake_hal.h
+ *
+ *  Host model of the parts of the STM32H743 the driver talks to: the QUADSPI peripheral and its HAL
+ *  state machine, MDMA transfers with the D-Cache in between, the memory mapped window, DWT, the CRC
+ *  unit and one or two W25Qxx dies with program/erase/suspend timing. Time is simulated, it advances
+ *  with bus clocks, flash busy times and HAL_Delay/WFI, so benchmark results do not depend on the host.
+ *
+ *  Protocol mistakes (wrong lines, dummy or mode clocks, address size, missing write enable, reading a
+ *  range being erased, DMA buffers the CPU still has cached lines of, ...) are counted, fake_errors()
+ *  returns the total and fake_report() names them. Where the real part would return garbage the model
+ *  does too, so data checks in the tests catch what the counters miss.
+ */
+
+#ifndef FAKE_HAL_H
+#define FAKE_HAL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+#define FAKE_CLOCK_MHZ			240.0								// QUADSPI kernel clock
+#define FAKE_CORE_MHZ			480									// SystemCoreClock, DWT->CYCCNT rate
+#define FAKE_POWERCUT_EXIT		77									// Exit status of a power cut child
+
+#define FAKE_DTR_ANY			0									// Both DDR hold timings read correctly
+#define FAKE_DTR_HALF_CLK		1									// Only QSPI_DDR_HHC_HALF_CLK_DELAY does
+#define FAKE_DTR_ANALOG			2									// Only QSPI_DDR_HHC_ANALOG_DELAY does
+#define FAKE_DTR_NONE			3									// DTR reads always fail
+
+struct fake_part {
+	uint32_t size;													// Bytes per die
+	uint32_t jedec;													// Manufacturer, type, capacity
+	const uint8_t *sfdp;											// 256 byte SFDP image, NULL reads 0xFF
+	bool addr4_opcodes;												// 0x0C/0x12/0x21/... accepted
+	bool qpi;														// 0x38 accepted
+	bool dtr;														// 0xED/0xEE accepted
+	int dtr_hold;													// FAKE_DTR_*
+	double prog_us;													// Page program, typical
+	double erase_us[3];												// 4K, 32K and 64K erase, typical
+	double slow[2];													// Busy time factor per die, 0 is 1.0
+};
+
+struct fake_stat {
+	uint32_t commands;												// HAL_QSPI_Command/AutoPolling/MemoryMapped
+	uint32_t reads;													// Array read commands
+	uint64_t read_bytes;
+	uint32_t progs;													// Page programs
+	uint32_t erases[4];												// 4K, 32K, 64K, chip
+	uint32_t suspends;
+	uint32_t resumes;
+	uint32_t mapped;												// Memory mapped mode entries
+	uint32_t dma;													// MDMA transfers
+	uint32_t bounce_invalidates;									// D-Cache invalidates of the DMA targets
+	uint64_t clocks;												// QUADSPI bus clocks
+	uint64_t command_clocks;										// Instruction, address, mode and dummy clocks
+	double busy_us;													// Time blocking auto polling waited for a busy die
+	double max_read_wait_us;										// Longest time a read waited on a busy die
+};
+
+extern struct fake_stat fake_stat;
+
+// Starts a new part, the flash reads all 0xFF. NULL is a W25Q64JV
+void fake_reset(const struct fake_part *part);
+const struct fake_part *fake_w25q64jv(void);
+// The bytes of one die, die 0 holds the even bytes in dual-flash mode
+uint8_t *fake_flash(int die);
+
+double fake_time_us(void);
+void fake_advance(double us);
+// Runs the QUADSPI interrupts that are due
+void fake_poll(void);
+
+// Kills the process (exit status FAKE_POWERCUT_EXIT) in the middle of the n-th program or erase from
+// now on, that operation is left half done. 0 disables
+void fake_powercut(uint32_t n);
+uint32_t fake_prog_erase_ops(void);
+// The dies ignore write enable (0x06) from now on and WEL stays clear, as with a die that does not
+// answer. Cleared by fake_reset
+void fake_ignore_wren(bool on);
+
+long fake_errors(void);
+void fake_report(FILE *f);
+void fake_clear_errors(void);
+
+// Between fake_hal.c and fake_qspi.c
+bool fake_qspi_wait_irq(void);										// Runs the next interrupt, false if none
+void fake_qspi_poll(void);
+
+// Implemented by each test, runs on a stack below 4Gbyte (the driver keeps addresses in uint32_t)
+int test_main(int argc, char **argv);
+
+#endif /* FAKE_HAL_H */
@@ -0,0 +1,1199 @@
+/*
+ * fake_qspi.c
+ *
+ *  QUADSPI peripheral, HAL QSPI state machine, MDMA/D-Cache and memory mapped window model with one
+ *  or two W25Qxx dies behind it (dual-flash mode when CR.DFM is set, even bytes on die 0).
+ *
+ *  Every command is checked against what the flash expects for its opcode in the current SPI/QPI and
+ *  3/4-byte address mode: instruction, address, mode and data lines, address size, mode plus dummy
+ *  clocks and DDR. Fast reads with mode bits (0xBB, 0xEB, 0xED and their 4-byte versions) need the
+ *  mode byte on the address lines with M5-4 != 10, undriven lines could put the flash in continuous
+ *  read mode. Flash data stays in MAP_SHARED memory so it survives the fork of a power cut test.
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "main.h"
+#include "fake_hal.h"
+
+#define MAPPED_WINDOW			0x10000000							// 256Mbyte QUADSPI window
+#define HAL_CALL_US				0.5									// Software cost of a HAL call
+#define IRQ_US					1.0									// Interrupt entry and exit
+#define TSUS_US					20.0								// Suspend latency, min. resume to suspend
+#define DCACHE_LINE				32
+
+QUADSPI_TypeDef fake_quadspi;
+struct fake_stat fake_stat;
+
+enum {
+	ERR_LINES, ERR_CLOCKS, ERR_MODE, ERR_ADDR, ERR_DDR, ERR_TIMING, ERR_UNSUPPORTED, ERR_QE, ERR_BUSY,
+	ERR_BUSY_READ, ERR_WEL, ERR_PAGE_WRAP, ERR_ALIGN, ERR_SUSPEND, ERR_SUSPEND_READ, ERR_POLL_TIMEOUT,
+	ERR_ODD, ERR_HAL, ERR_DMA_ALIGN, ERR_DMA_INVALIDATE, ERR_DMA_STALE, ERR_DMA_CLEAN, ERR_CACHE_ALIGN,
+	ERR_COUNT
+};
+static const char *const err_name[ERR_COUNT] = {
+	"wrong instruction/address/data lines", "wrong mode+dummy clocks", "mode bits not driven or continuous read",
+	"wrong address size", "DDR on a SDR command or SDR on a DDR command", "CR prescaler/sample shift wrong for the command",
+	"opcode not supported by the part or mode", "quad command with QE=0", "command to a busy die",
+	"read from a busy die", "program/erase without write enable", "page program wraps", "unaligned erase",
+	"suspend too soon after resume", "read of the range being changed while suspended", "status poll never matches",
+	"odd address or size in dual-flash mode", "HAL call in the wrong state", "DMA read target not cache line aligned",
+	"DMA read target not invalidated before the transfer", "DMA data not invalidated after the transfer",
+	"DMA program data not cleaned", "cache maintenance not line aligned",
+};
+static long errors[ERR_COUNT];
+
+static uint32_t last_instruction;										// For FAKE_TRACE
+
+static void fail(int err) {
+	errors[err]++;
+	if (getenv("FAKE_TRACE")) {
+		fprintf(stderr, "fake: %s (0x%02X at %.1f us)\n", err_name[err], (unsigned)last_instruction, fake_time_us());
+	}
+}
+
+//-------------------------------------------------------------------------------------------------
+// Flash dies
+//-------------------------------------------------------------------------------------------------
+enum { OP_NONE, OP_PROG, OP_ERASE };
+
+struct die {
+	uint8_t *mem;
+	bool wel, vsr, qe, qpi, ads, reset_enable;
+	uint8_t sr3, read_param;
+	int op;															// Program or erase in progress
+	uint32_t op_start, op_size;										// Die address range being changed
+	double busy_end;
+	bool suspended;
+	double settle;													// Suspend done at
+	double remaining;												// Busy time left while suspended
+	double resumed;
+};
+
+static struct fake_part part;
+static struct die die[2];
+static uint32_t die_alloc;											// Bytes mapped per die
+static uint32_t powercut, prog_erase_ops;
+static bool ignore_wren;
+
+static const struct fake_part w25q64jv = {
+	.size = 0x800000,
+	.jedec = 0xEF4017,
+	.qpi = true,
+	.dtr = true,
+	.dtr_hold = FAKE_DTR_ANY,
+	.prog_us = 400,
+	.erase_us = { 45000, 120000, 150000 },
+};
+
+const struct fake_part *fake_w25q64jv(void) {
+	return &w25q64jv;
+}
+
+static int dies(void) {
+	return (QUADSPI->CR & QUADSPI_CR_DFM) ? 2 : 1;
+}
+
+static double slow(int d) {
+	return part.slow[d] > 0 ? part.slow[d] : 1.0;
+}
+
+static void die_update(struct die *d) {
+	double now = fake_time_us();
+	if (d->op != OP_NONE && !d->suspended && now >= d->busy_end) {
+		d->op = OP_NONE;
+		d->wel = false;
+	}
+}
+
+static bool die_busy(struct die *d) {
+	die_update(d);
+	if (d->op == OP_NONE) {
+		return false;
+	}
+	return d->suspended ? fake_time_us() < d->settle : true;
+}
+
+static uint8_t die_status(struct die *d, int reg) {
+	bool busy = die_busy(d);
+
+	switch (reg) {
+	case 1: return (busy ? SR1_BUSY : 0) | (d->wel ? SR1_WEL : 0);
+	case 2: return (d->qe ? 0x02 : 0) | (d->op != OP_NONE && d->suspended && !busy ? SR2_SUS : 0);
+	default: return d->sr3;
+	}
+}
+
+// Time the status of any die changes next, 0 if it never does
+static double next_change(void) {
+	double t = 0;
+	for (int i = 0; i < dies(); i++) {
+		struct die *d = &die[i];
+		die_update(d);
+		double e = d->op == OP_NONE ? 0 : d->suspended ? (fake_time_us() < d->settle ? d->settle : 0) : d->busy_end;
+		if (e > 0 && (t == 0 || e < t)) {
+			t = e;
+		}
+	}
+	return t;
+}
+
+uint8_t *fake_flash(int d) {
+	return die[d].mem;
+}
+
+void fake_powercut(uint32_t n) {
+	powercut = n;
+}
+
+uint32_t fake_prog_erase_ops(void) {
+	return prog_erase_ops;
+}
+
+void fake_ignore_wren(bool on) {
+	ignore_wren = on;
+}
+
+// Counts program and erase operations, the one hit by the power cut is left half done
+static void prog_erase_op(uint8_t *mem, const uint8_t *data, uint32_t size) {
+	prog_erase_ops++;
+	if (powercut != 0 && --powercut == 0) {
+		for (uint32_t i = 0; i < size; i++) {
+			if (rand() & 1) {
+				mem[i] = data ? mem[i] & data[i] : 0xFF;
+			} else if (!data && (rand() & 1)) {
+				mem[i] |= (uint8_t)rand();							// Partly erased
+			}
+		}
+		_exit(FAKE_POWERCUT_EXIT);
+	}
+}
+
+//-------------------------------------------------------------------------------------------------
+// Opcodes
+//-------------------------------------------------------------------------------------------------
+enum { K_READ = 1, K_PROG, K_ERASE, K_RDREG, K_WRREG, K_ID, K_UID, K_SFDP, K_CMD };
+
+struct opcode {
+	uint8_t cmd, kind;
+	uint8_t addr_lines, data_lines;									// SPI mode
+	uint8_t clocks;													// Mode + dummy clocks in SPI mode
+	uint8_t flags;
+	uint32_t arg;													// Erase size or status register
+};
+#define F_ADDR4		0x01											// 4-byte address opcode
+#define F_MODE		0x02											// Mode bits after the address
+#define F_DTR		0x04
+#define F_QPI		0x08											// Also valid in QPI mode
+#define F_QPIONLY	0x10
+#define F_ADDR		0x20											// Has an address phase
+
+static const struct opcode opcodes[] = {
+	{ 0x03, K_READ, 1, 1, 0, F_ADDR, 0 },
+	{ 0x0B, K_READ, 1, 1, 8, F_ADDR | F_QPI, 0 },
+	{ 0x0C, K_READ, 1, 1, 8, F_ADDR | F_ADDR4 | F_QPI, 0 },
+	{ 0x3B, K_READ, 1, 2, 8, F_ADDR, 0 },
+	{ 0x3C, K_READ, 1, 2, 8, F_ADDR | F_ADDR4, 0 },
+	{ 0xBB, K_READ, 2, 2, 4, F_ADDR | F_MODE, 0 },
+	{ 0xBC, K_READ, 2, 2, 4, F_ADDR | F_MODE | F_ADDR4, 0 },
+	{ 0x6B, K_READ, 1, 4, 8, F_ADDR, 0 },
+	{ 0x6C, K_READ, 1, 4, 8, F_ADDR | F_ADDR4, 0 },
+	{ 0xEB, K_READ, 4, 4, 6, F_ADDR | F_MODE | F_QPI, 0 },
+	{ 0xEC, K_READ, 4, 4, 6, F_ADDR | F_MODE | F_QPI | F_ADDR4, 0 },
+	{ 0xED, K_READ, 4, 4, 8, F_ADDR | F_MODE | F_DTR, 0 },
+	{ 0xEE, K_READ, 4, 4, 8, F_ADDR | F_MODE | F_DTR | F_ADDR4, 0 },
+	{ 0x02, K_PROG, 1, 1, 0, F_ADDR | F_QPI, 0 },
+	{ 0x12, K_PROG, 1, 1, 0, F_ADDR | F_QPI | F_ADDR4, 0 },
+	{ 0x32, K_PROG, 1, 4, 0, F_ADDR, 0 },
+	{ 0x34, K_PROG, 1, 4, 0, F_ADDR | F_ADDR4, 0 },
+	{ 0x20, K_ERASE, 1, 0, 0, F_ADDR | F_QPI, 0x1000 },
+	{ 0x21, K_ERASE, 1, 0, 0, F_ADDR | F_QPI | F_ADDR4, 0x1000 },
+	{ 0x52, K_ERASE, 1, 0, 0, F_ADDR | F_QPI, 0x8000 },
+	{ 0x5C, K_ERASE, 1, 0, 0, F_ADDR | F_QPI | F_ADDR4, 0x8000 },
+	{ 0xD8, K_ERASE, 1, 0, 0, F_ADDR | F_QPI, 0x10000 },
+	{ 0xDC, K_ERASE, 1, 0, 0, F_ADDR | F_QPI | F_ADDR4, 0x10000 },
+	{ 0xC7, K_ERASE, 0, 0, 0, F_QPI, 0 },
+	{ 0x60, K_ERASE, 0, 0, 0, F_QPI, 0 },
+	{ 0x05, K_RDREG, 0, 1, 0, F_QPI, 1 },
+	{ 0x35, K_RDREG, 0, 1, 0, F_QPI, 2 },
+	{ 0x15, K_RDREG, 0, 1, 0, F_QPI, 3 },
+	{ 0x01, K_WRREG, 0, 1, 0, F_QPI, 1 },
+	{ 0x31, K_WRREG, 0, 1, 0, F_QPI, 2 },
+	{ 0x11, K_WRREG, 0, 1, 0, F_QPI, 3 },
+	{ 0xC0, K_WRREG, 0, 1, 0, F_QPI | F_QPIONLY, 0 },
+	{ 0x9F, K_ID, 0, 1, 0, F_QPI, 0 },
+	{ 0x4B, K_UID, 1, 1, 0, F_ADDR, 0 },
+	{ 0x5A, K_SFDP, 1, 1, 0, F_ADDR, 0 },
+	{ 0x06, K_CMD, 0, 0, 0, F_QPI, 0 },
+	{ 0x04, K_CMD, 0, 0, 0, F_QPI, 0 },
+	{ 0x50, K_CMD, 0, 0, 0, F_QPI, 0 },
+	{ 0x66, K_CMD, 0, 0, 0, F_QPI, 0 },
+	{ 0x99, K_CMD, 0, 0, 0, F_QPI, 0 },
+	{ 0x75, K_CMD, 0, 0, 0, F_QPI, 0 },
+	{ 0x7A, K_CMD, 0, 0, 0, F_QPI, 0 },
+	{ 0x38, K_CMD, 0, 0, 0, 0, 0 },
+	{ 0xFF, K_CMD, 0, 0, 0, F_QPI | F_QPIONLY, 0 },
+	{ 0xB7, K_CMD, 0, 0, 0, F_QPI, 0 },
+	{ 0xE9, K_CMD, 0, 0, 0, F_QPI, 0 },
+};
+
+static const struct opcode *find_opcode(uint32_t cmd) {
+	for (size_t i = 0; i < sizeof(opcodes)/sizeof(opcodes[0]); i++) {
+		if (opcodes[i].cmd == cmd) {
+			return &opcodes[i];
+		}
+	}
+	return NULL;
+}
+
+static bool supported(const struct opcode *op) {
+	if ((op->flags & F_ADDR4) && !part.addr4_opcodes) {
+		return false;
+	}
+	if ((op->flags & F_DTR) && !part.dtr) {
+		return false;
+	}
+	if ((op->cmd == 0x38 || op->cmd == 0xC0 || op->cmd == 0xFF) && !part.qpi) {
+		return false;
+	}
+	if ((op->cmd == 0xB7 || op->cmd == 0xE9) && part.size <= 0x1000000) {
+		return false;
+	}
+	return true;
+}
+
+static const int line_count[4] = { 0, 1, 2, 4 };
+#define LINES(mode, pos)		line_count[((mode) >> (pos)) & 3]
+
+//-------------------------------------------------------------------------------------------------
+// Command decoding
+//-------------------------------------------------------------------------------------------------
+struct decoded {
+	QSPI_CommandTypeDef cmd;
+	const struct opcode *op;
+	uint32_t address;												// As the flash sees it
+	bool ignored;													// The flash did not take the command
+	bool garbage;													// Data phase returns garbage
+	bool ddr;
+};
+
+static struct decoded pending;										// Command waiting for its data phase
+static bool pending_valid;
+
+static double bus_us(uint64_t clocks) {
+	uint32_t prescaler = (QUADSPI->CR & QUADSPI_CR_PRESCALER) >> QUADSPI_CR_PRESCALER_Pos;
+	fake_stat.clocks += clocks;
+	return clocks*(prescaler + 1)/FAKE_CLOCK_MHZ;
+}
+
+static uint32_t address_bits(const QSPI_CommandTypeDef *c) {
+	return c->AddressMode == QSPI_ADDRESS_NONE ? 0 : 8*(((c->AddressSize >> 12) & 3) + 1);
+}
+
+static uint32_t alternate_bits(const QSPI_CommandTypeDef *c) {
+	return c->AlternateByteMode == QSPI_ALTERNATE_BYTES_NONE ? 0 : 8*(((c->AlternateBytesSize >> 16) & 3) + 1);
+}
+
+static uint32_t command_clocks(const QSPI_CommandTypeDef *c) {
+	int ddr = c->DdrMode == QSPI_DDR_MODE_ENABLE ? 2 : 1;
+	uint32_t clocks = c->DummyCycles;
+
+	if (c->InstructionMode != QSPI_INSTRUCTION_NONE) {
+		clocks += 8/LINES(c->InstructionMode, 8);
+	}
+	if (c->AddressMode != QSPI_ADDRESS_NONE) {
+		clocks += address_bits(c)/LINES(c->AddressMode, 10)/ddr;
+	}
+	if (c->AlternateByteMode != QSPI_ALTERNATE_BYTES_NONE) {
+		clocks += alternate_bits(c)/LINES(c->AlternateByteMode, 14)/ddr;
+	}
+	return clocks;
+}
+
+// In dual-flash mode every clock moves the bits of both dies
+static uint32_t data_clocks(const QSPI_CommandTypeDef *c, uint32_t size) {
+	int ddr = c->DdrMode == QSPI_DDR_MODE_ENABLE ? 2 : 1;
+	return c->DataMode == QSPI_DATA_NONE ? 0 : (8*size/LINES(c->DataMode, 24)/dies() + ddr - 1)/ddr;
+}
+
+// Bus timing of the command against CR, RM0433: no sample shift in DDR mode. The board reads
+// SDR at 120MHz with the half cycle sample shift and DDR at up to 80MHz
+static bool timing_ok(bool ddr) {
+	uint32_t prescaler = (QUADSPI->CR & QUADSPI_CR_PRESCALER) >> QUADSPI_CR_PRESCALER_Pos;
+	bool sshift = (QUADSPI->CR & QUADSPI_CR_SSHIFT) != 0;
+
+	if (ddr) {
+		return !sshift && prescaler >= 2;
+	}
+	return prescaler >= 1 && (prescaler > 1 || sshift);
+}
+
+static void decode(const QSPI_CommandTypeDef *c, struct decoded *dc) {
+	last_instruction = c->Instruction;
+	struct die *d = &die[0];
+	const struct opcode *op = find_opcode(c->Instruction);
+	int lines = d->qpi ? 4 : 1;
+	bool ddr = c->DdrMode == QSPI_DDR_MODE_ENABLE;
+
+	memset(dc, 0, sizeof(*dc));
+	dc->cmd = *c;
+	dc->op = op;
+	dc->ddr = ddr;
+
+	if (c->InstructionMode == QSPI_INSTRUCTION_NONE) {
+		fail(ERR_LINES);
+		dc->ignored = true;
+		return;
+	}
+	if (LINES(c->InstructionMode, 8) != lines) {
+		// The flash sees too few or too many clocks, a QPI reset sent to a flash in SPI mode is the
+		// expected case: QSPI_ResetChip sends it in case only the MCU was reset
+		if (!(lines == 1 && (c->Instruction == RESET_ENABLE_CMD || c->Instruction == RESET_EXECUTE_CMD))) {
+			fail(ERR_LINES);
+		}
+		dc->ignored = true;
+		return;
+	}
+	if (op == NULL || !supported(op) || (d->qpi && !(op->flags & F_QPI)) || (!d->qpi && (op->flags & F_QPIONLY))) {
+		fail(ERR_UNSUPPORTED);
+		dc->ignored = true;
+		return;
+	}
+
+	// Address phase
+	if (op->flags & F_ADDR) {
+		int want_lines = d->qpi ? 4 : op->addr_lines;
+		uint32_t bits = address_bits(c);
+
+		if (c->AddressMode == QSPI_ADDRESS_NONE || LINES(c->AddressMode, 10) != want_lines) {
+			fail(ERR_LINES);
+			dc->garbage = true;
+		}
+		if (op->kind == K_UID || op->kind == K_SFDP) {				// Address and dummy bytes, any split
+			uint32_t want = op->kind == K_UID && d->ads ? 40 : 32;
+			if (bits + c->DummyCycles != want || c->AlternateByteMode != QSPI_ALTERNATE_BYTES_NONE) {
+				fail(ERR_CLOCKS);
+				dc->garbage = true;
+			}
+			dc->address = op->kind == K_SFDP ? (bits == 32 ? c->Address >> 8 : c->Address) & 0xFFFFFF : 0;
+		} else {
+			uint32_t want = (op->flags & F_ADDR4) || d->ads ? 32 : 24;
+			if (bits != want) {
+				fail(ERR_ADDR);
+				dc->garbage = true;
+			}
+			dc->address = want == 32 ? c->Address : c->Address & 0xFFFFFF;
+		}
+	} else if (c->AddressMode != QSPI_ADDRESS_NONE) {
+		fail(ERR_LINES);
+		dc->ignored = true;
+		return;
+	}
+
+	// Mode and dummy clocks
+	if (op->kind == K_READ) {
+		uint32_t want = op->clocks;
+		bool mode = (op->flags & F_MODE) || (d->qpi && (op->cmd == 0xEB || op->cmd == 0xEC));
+		uint32_t alt = 0;
+
+		if (d->qpi) {
+			static const uint8_t qpi_dummy[4] = { 2, 4, 6, 8 };
+			want = qpi_dummy[(d->read_param >> 4) & 3];
+		}
+		if (mode) {
+			uint32_t alines = c->AlternateByteMode == QSPI_ALTERNATE_BYTES_NONE ? 0 : LINES(c->AlternateByteMode, 14);
+			if (alines == 0 || alines != LINES(c->AddressMode, 10) || alternate_bits(c) != 8) {
+				fail(ERR_MODE);										// Undriven or misplaced mode bits
+				dc->garbage = true;
+			} else if ((c->AlternateBytes & 0x30) == 0x20) {
+				fail(ERR_MODE);										// Enters continuous read mode
+			}
+			if (alines) {
+				alt = alternate_bits(c)/alines/(ddr ? 2 : 1);
+			}
+		} else if (c->AlternateByteMode != QSPI_ALTERNATE_BYTES_NONE) {
+			fail(ERR_CLOCKS);
+			dc->garbage = true;
+		}
+		if (alt + c->DummyCycles != want) {
+			fail(ERR_CLOCKS);
+			dc->garbage = true;
+		}
+	} else if (op->kind != K_UID && op->kind != K_SFDP && (c->DummyCycles != 0 || c->AlternateByteMode != QSPI_ALTERNATE_BYTES_NONE)) {
+		fail(ERR_CLOCKS);
+		dc->ignored = true;
+		return;
+	}
+
+	// Data phase
+	if (op->kind == K_ERASE || op->kind == K_CMD) {
+		if (c->DataMode != QSPI_DATA_NONE) {
+			fail(ERR_LINES);
+			dc->ignored = true;
+			return;
+		}
+	} else if (c->DataMode != QSPI_DATA_NONE && LINES(c->DataMode, 24) != (d->qpi ? 4 : op->data_lines)) {
+		fail(ERR_LINES);
+		dc->garbage = true;
+	}
+
+	if (ddr != ((op->flags & F_DTR) != 0)) {
+		fail(ERR_DDR);
+		dc->garbage = true;
+	}
+	if (!timing_ok(ddr)) {
+		fail(ERR_TIMING);
+		dc->garbage = true;
+	}
+	if (!d->qpi && !d->qe && (op->addr_lines == 4 || op->data_lines == 4)) {
+		fail(ERR_QE);
+		dc->garbage = true;
+	}
+	if (ddr && part.dtr_hold != FAKE_DTR_ANY) {						// Only one hold timing samples right
+		bool half = c->DdrHoldHalfCycle == QSPI_DDR_HHC_HALF_CLK_DELAY;
+		if (part.dtr_hold == FAKE_DTR_NONE || half != (part.dtr_hold == FAKE_DTR_HALF_CLK)) {
+			dc->garbage = true;
+		}
+	}
+}
+
+//-------------------------------------------------------------------------------------------------
+// Command execution
+//-------------------------------------------------------------------------------------------------
+static uint32_t die_address(uint32_t address) {
+	return (address/dies()) % part.size;
+}
+
+static bool any_busy(void) {
+	for (int i = 0; i < dies(); i++) {
+		if (die_busy(&die[i])) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static void start_op(struct die *d, int i, int op, uint32_t start, uint32_t size, double us) {
+	d->op = op;
+	d->op_start = start;
+	d->op_size = size;
+	d->busy_end = fake_time_us() + us*slow(i);
+	d->suspended = false;
+}
+
+static void execute(struct decoded *dc) {
+	const struct opcode *op = dc->op;
+	uint32_t cmd = dc->cmd.Instruction;
+	bool was_reset_enable = die[0].reset_enable;
+	bool was_vsr = die[0].vsr;
+
+	for (int i = 0; i < dies(); i++) {
+		die[i].reset_enable = false;
+		die[i].vsr = false;
+	}
+	if (dc->ignored) {
+		return;
+	}
+
+	for (int i = 0; i < dies(); i++) {
+		struct die *d = &die[i];
+		bool busy = die_busy(d);
+
+		if (busy && cmd != 0x05 && cmd != 0x35 && cmd != 0x15 && cmd != 0x75 && cmd != 0x7A && cmd != 0x66 && cmd != 0x99) {
+			if (op->kind == K_READ) {
+				fail(ERR_BUSY_READ);
+				dc->garbage = true;
+			} else {
+				fail(ERR_BUSY);
+			}
+			continue;
+		}
+		if (d->op != OP_NONE && d->suspended && (op->kind == K_PROG || op->kind == K_ERASE)) {
+			fail(ERR_SUSPEND);
+			continue;
+		}
+		if (op->kind == K_WRREG && cmd != 0xC0 && !was_vsr && !d->wel) {
+			dc->ignored = true;										// The part drops it silently
+			continue;
+		}
+		if ((op->kind == K_PROG || op->kind == K_ERASE) && !d->wel) {
+			fail(ERR_WEL);
+			continue;
+		}
+
+		switch (op->kind) {
+		case K_ERASE: {
+			uint32_t size = op->arg ? op->arg : part.size;
+			uint32_t start = op->arg ? die_address(dc->address) : 0;
+			int type = op->arg == 0x1000 ? 0 : op->arg == 0x8000 ? 1 : op->arg == 0x10000 ? 2 : 3;
+
+			if (start % size != 0) {
+				fail(ERR_ALIGN);
+				start -= start % size;
+			}
+			if (i == 0) {
+				fake_stat.erases[type]++;
+			}
+			prog_erase_op(d->mem + start, NULL, size);
+			memset(d->mem + start, 0xFF, size);
+			start_op(d, i, OP_ERASE, start, size, type < 3 ? part.erase_us[type] : part.erase_us[2]*part.size/0x10000);
+			break;
+		}
+		case K_CMD:
+			switch (cmd) {
+			case 0x06: d->wel = !ignore_wren; break;
+			case 0x04: d->wel = false; break;
+			case 0x50: d->vsr = true; break;
+			case 0x66: d->reset_enable = true; break;
+			case 0x99:
+				if (was_reset_enable) {
+					d->op = OP_NONE;
+					d->wel = d->qpi = d->ads = d->qe = false;
+					d->read_param = 0;
+					fake_advance(30);								// tRST
+				}
+				break;
+			case 0x38:
+				if (!d->qe) {
+					fail(ERR_QE);
+				} else {
+					d->qpi = true;
+				}
+				break;
+			case 0xFF: d->qpi = false; break;
+			case 0xB7: d->ads = true; break;
+			case 0xE9: d->ads = false; break;
+			case 0x75:
+				if (d->op != OP_NONE && !d->suspended && busy) {
+					if (fake_time_us() - d->resumed < TSUS_US) {
+						fail(ERR_SUSPEND);
+					}
+					d->suspended = true;
+					d->settle = fake_time_us() + TSUS_US;
+					d->remaining = d->busy_end - fake_time_us();
+					if (i == 0) {
+						fake_stat.suspends++;
+					}
+				}
+				break;
+			case 0x7A:
+				if (d->op != OP_NONE && d->suspended) {
+					double now = fake_time_us();
+					d->suspended = false;
+					d->busy_end = (now > d->settle ? now : d->settle) + d->remaining;
+					d->resumed = now;
+					if (i == 0) {
+						fake_stat.resumes++;
+					}
+				}
+				break;
+			}
+			break;
+		default:
+			break;
+		}
+	}
+}
+
+// Data the flash sends for byte i of the data phase, also for the memory mapped window
+static uint8_t read_byte(const struct decoded *dc, uint32_t i) {
+	int n = dies();
+	struct die *d = &die[i % n];
+	uint32_t k = i/n;
+
+	switch (dc->op->kind) {
+	case K_READ: {
+		uint32_t a = (dc->address/n + k) % part.size;
+		if (d->op != OP_NONE && a >= d->op_start && a < d->op_start + d->op_size) {
+			return 0x5A;											// Erase/program suspended here
+		}
+		return d->mem[a];
+	}
+	case K_RDREG:
+		return die_status(d, dc->op->arg);
+	case K_ID:
+		return (uint8_t)(part.jedec >> (16 - 8*(k % 3)));
+	case K_UID:
+		return (uint8_t)(0xD1 + 17*k + i % n);
+	case K_SFDP:
+		return part.sfdp && dc->address + k < 256 ? part.sfdp[dc->address + k] : 0xFF;
+	default:
+		return 0xFF;
+	}
+}
+
+static void garble(uint8_t *data, uint32_t size) {
+	for (uint32_t i = 0; i < size; i++) {
+		data[i] = (uint8_t)((data[i] << 1) | (data[i] >> 7)) ^ 0xA5;
+	}
+}
+
+static void receive(struct decoded *dc, uint8_t *data, uint32_t size) {
+	if (dc->ignored) {
+		memset(data, 0xFF, size);									// Lines pulled high
+		return;
+	}
+	for (int j = 0; j < dies(); j++) {
+		die_update(&die[j]);
+	}
+	if (dc->op->kind == K_READ) {
+		fake_stat.reads++;
+		fake_stat.read_bytes += size;
+		int n = dies();
+		for (int j = 0; j < n; j++) {
+			struct die *d = &die[j];
+			uint32_t a = dc->address/n, end = a + (size + n - 1)/n;
+			if (d->op != OP_NONE && d->suspended && a < d->op_start + d->op_size && end > d->op_start) {
+				fail(ERR_SUSPEND_READ);
+			}
+		}
+	}
+	for (uint32_t i = 0; i < size; i++) {
+		data[i] = read_byte(dc, i);
+	}
+	if (dc->garbage) {
+		garble(data, size);
+	}
+}
+
+static void transmit(struct decoded *dc, const uint8_t *data, uint32_t size) {
+	int n = dies();
+
+	if (dc->ignored || dc->op->kind == K_READ) {
+		return;
+	}
+	for (int i = 0; i < n; i++) {
+		struct die *d = &die[i];
+		uint32_t count = (size + n - 1 - i)/n;
+
+		if (dc->op->kind == K_WRREG) {
+			uint8_t v = data[i];
+			switch (dc->cmd.Instruction) {
+			case 0x01: if (size > (uint32_t)n) d->qe = (data[n + i] & 0x02) != 0; break;
+			case 0x31: d->qe = (v & 0x02) != 0; break;
+			case 0x11: d->sr3 = v; break;
+			case 0xC0: d->read_param = v; break;
+			}
+			d->wel = false;
+			continue;
+		}
+		if (dc->op->kind != K_PROG || die_busy(d) || !d->wel || (d->op != OP_NONE && d->suspended)) {
+			continue;												// Counted by execute()
+		}
+
+		uint32_t a = die_address(dc->address);
+		uint32_t page = a & ~255UL;
+		uint8_t buf[256];
+		if ((a & 255) + count > 256) {
+			fail(ERR_PAGE_WRAP);
+		}
+		memcpy(buf, d->mem + page, 256);
+		for (uint32_t k = 0; k < count; k++) {
+			buf[(a + k) & 255] &= data[k*n + i];
+		}
+		if (i == 0) {
+			fake_stat.progs++;
+		}
+		prog_erase_op(d->mem + page, buf, 256);
+		memcpy(d->mem + page, buf, 256);
+		start_op(d, i, OP_PROG, page, 256, part.prog_us);
+	}
+}
+
+//-------------------------------------------------------------------------------------------------
+// Interrupts: one transfer or status poll at a time, like the HAL
+//-------------------------------------------------------------------------------------------------
+enum { EV_NONE, EV_RX_IT, EV_TX_IT, EV_RX_DMA, EV_TX_DMA, EV_MATCH };
+
+static struct {
+	int type;
+	double time;
+	uint8_t *data;
+	uint32_t size;
+} event;
+
+static struct {
+	uint8_t *buffer;
+	uint32_t size;
+	uint8_t *shadow;												// DMA data in SRAM, behind the D-Cache
+	uint32_t shadow_size;
+	bool pending;
+} dma_rx;
+static uintptr_t last_invalidate_start, last_invalidate_end;
+static uintptr_t last_clean_start, last_clean_end;
+
+static void set_state(HAL_QSPI_StateTypeDef state) {
+	hqspi.State = state;
+	if (state == HAL_QSPI_STATE_READY) {
+		QUADSPI->SR &= ~QUADSPI_SR_BUSY;
+	} else {
+		QUADSPI->SR |= QUADSPI_SR_BUSY;
+	}
+}
+
+static void dispatch(void) {
+	int type = event.type;
+
+	event.type = EV_NONE;
+	fake_advance(IRQ_US);
+	switch (type) {
+	case EV_RX_IT:
+		receive(&pending, event.data, event.size);
+		pending_valid = false;
+		set_state(HAL_QSPI_STATE_READY);
+		HAL_QSPI_RxCpltCallback(&hqspi);
+		break;
+	case EV_RX_DMA:
+		if (dma_rx.shadow_size < event.size) {
+			dma_rx.shadow = realloc(dma_rx.shadow, event.size);
+			dma_rx.shadow_size = event.size;
+		}
+		receive(&pending, dma_rx.shadow, event.size);
+		dma_rx.buffer = event.data;
+		dma_rx.size = event.size;
+		dma_rx.pending = true;
+		pending_valid = false;
+		set_state(HAL_QSPI_STATE_READY);
+		HAL_QSPI_RxCpltCallback(&hqspi);
+		break;
+	case EV_TX_IT:
+	case EV_TX_DMA:
+		transmit(&pending, event.data, event.size);
+		pending_valid = false;
+		set_state(HAL_QSPI_STATE_READY);
+		HAL_QSPI_TxCpltCallback(&hqspi);
+		break;
+	case EV_MATCH:
+		set_state(HAL_QSPI_STATE_READY);							// Automatic stop
+		HAL_QSPI_StatusMatchCallback(&hqspi);
+		break;
+	}
+}
+
+void fake_qspi_poll(void) {
+	if (event.type != EV_NONE && event.time != 0 && fake_time_us() >= event.time) {
+		dispatch();
+	}
+}
+
+bool fake_qspi_wait_irq(void) {
+	if (event.type == EV_NONE || event.time == 0) {
+		return false;
+	}
+	if (fake_time_us() < event.time) {
+		fake_advance(event.time - fake_time_us());
+	}
+	dispatch();
+	return true;
+}
+
+// The data of a finished DMA read only becomes visible through an invalidate of its cache lines
+static void check_dma_rx(void) {
+	if (dma_rx.pending) {
+		fail(ERR_DMA_STALE);
+		dma_rx.pending = false;
+	}
+}
+
+//-------------------------------------------------------------------------------------------------
+// Memory mapped window at QSPI_MAPPED_BASE. It holds what the cacheable window returns to the CPU,
+// lines are only refetched from the flash when they are invalidated
+//-------------------------------------------------------------------------------------------------
+static uint8_t *window;
+static struct decoded mapped_cmd;
+static bool mapped;
+
+static uint32_t window_size(void) {
+	uint32_t fsize = (QUADSPI->DCR & QUADSPI_DCR_FSIZE) >> QUADSPI_DCR_FSIZE_Pos;
+	uint64_t size = 2ULL << fsize;
+	return size > MAPPED_WINDOW ? MAPPED_WINDOW : (uint32_t)size;
+}
+
+static void window_refresh(uint32_t offset, uint32_t size, const struct decoded *dc) {
+	uint32_t limit = part.size*dies();
+
+	if (offset >= limit) {
+		return;
+	}
+	if (size > limit - offset) {
+		size = limit - offset;
+	}
+	mprotect(window, MAPPED_WINDOW, PROT_READ | PROT_WRITE);
+	for (uint32_t i = 0; i < size; i++) {
+		int n = dies();
+		uint32_t a = offset + i;
+		struct die *d = &die[a % n];
+		window[a] = d->mem[(a/n) % part.size];
+	}
+	if (dc && dc->garbage) {
+		garble(window + offset, size);
+	}
+	mprotect(window, MAPPED_WINDOW, mapped ? PROT_READ : PROT_NONE);
+	if (mapped && window_size() < MAPPED_WINDOW) {
+		mprotect(window + window_size(), MAPPED_WINDOW - window_size(), PROT_NONE);
+	}
+}
+
+static void window_protect(void) {
+	mprotect(window, MAPPED_WINDOW, PROT_NONE);
+	if (mapped) {
+		mprotect(window, window_size(), PROT_READ);
+	}
+}
+
+//-------------------------------------------------------------------------------------------------
+// D-Cache maintenance
+//-------------------------------------------------------------------------------------------------
+void SCB_CleanDCache_by_Addr(volatile void *addr, int32_t dsize) {
+	uintptr_t a = (uintptr_t)addr;
+
+	if (a % DCACHE_LINE || dsize % DCACHE_LINE) {
+		fail(ERR_CACHE_ALIGN);
+	}
+	last_clean_start = a;
+	last_clean_end = a + dsize;
+}
+
+void SCB_InvalidateDCache_by_Addr(volatile void *addr, int32_t dsize) {
+	uintptr_t a = (uintptr_t)addr;
+
+	if (a % DCACHE_LINE || dsize % DCACHE_LINE) {
+		fail(ERR_CACHE_ALIGN);									// Would drop CPU writes next to the range
+	}
+	last_invalidate_start = a;
+	last_invalidate_end = a + dsize;
+
+	if (dma_rx.pending) {
+		uintptr_t b = (uintptr_t)dma_rx.buffer;
+		if (a <= b && a + dsize >= b + dma_rx.size) {
+			memcpy(dma_rx.buffer, dma_rx.shadow, dma_rx.size);
+			dma_rx.pending = false;
+			fake_stat.bounce_invalidates++;
+		} else if (a < b + dma_rx.size && a + dsize > b) {
+			fail(ERR_DMA_STALE);
+			dma_rx.pending = false;
+		}
+	}
+	if (a >= QSPI_MAPPED_BASE && a < QSPI_MAPPED_BASE + MAPPED_WINDOW) {
+		window_refresh(a - QSPI_MAPPED_BASE, dsize, mapped ? &mapped_cmd : NULL);
+	}
+}
+
+//-------------------------------------------------------------------------------------------------
+// HAL QSPI
+//-------------------------------------------------------------------------------------------------
+static void hal_call(void) {
+	fake_advance(HAL_CALL_US);
+	fake_qspi_poll();
+}
+
+HAL_StatusTypeDef HAL_QSPI_Init(QSPI_HandleTypeDef *h) {
+	QUADSPI->CR = (h->Init.ClockPrescaler << QUADSPI_CR_PRESCALER_Pos) | h->Init.SampleShifting | h->Init.DualFlash;
+	QUADSPI->DCR = (h->Init.FlashSize << QUADSPI_DCR_FSIZE_Pos) | h->Init.ChipSelectHighTime;
+	set_state(HAL_QSPI_STATE_READY);
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_QSPI_DeInit(QSPI_HandleTypeDef *h) {
+	(void)h;
+	HAL_QSPI_Abort(&hqspi);
+	set_state(HAL_QSPI_STATE_RESET);
+	return HAL_OK;
+}
+
+HAL_QSPI_StateTypeDef HAL_QSPI_GetState(QSPI_HandleTypeDef *h) {
+	return h->State;
+}
+
+HAL_StatusTypeDef HAL_QSPI_Command(QSPI_HandleTypeDef *h, QSPI_CommandTypeDef *cmd, uint32_t Timeout) {
+	(void)Timeout;
+	hal_call();
+	if (h->State != HAL_QSPI_STATE_READY) {
+		return HAL_BUSY;
+	}
+	check_dma_rx();
+	fake_stat.commands++;
+	decode(cmd, &pending);
+	if (dies() == 2 && !pending.ignored && (pending.op->kind == K_READ || pending.op->kind == K_PROG)
+			&& ((pending.address | cmd->NbData) & 1)) {
+		fail(ERR_ODD);												// The dies would get different addresses
+	}
+	fake_stat.command_clocks += command_clocks(cmd);
+	fake_advance(bus_us(command_clocks(cmd)));
+	execute(&pending);
+	pending_valid = cmd->DataMode != QSPI_DATA_NONE;
+	return HAL_OK;
+}
+
+static bool data_phase_ok(QSPI_HandleTypeDef *h, bool tx) {
+	if (h->State != HAL_QSPI_STATE_READY || !pending_valid) {
+		fail(ERR_HAL);
+		return false;
+	}
+	bool is_tx = pending.op && (pending.op->kind == K_PROG || pending.op->kind == K_WRREG);
+	if (is_tx != tx && !pending.ignored) {
+		fail(ERR_HAL);
+	}
+	return true;
+}
+
+HAL_StatusTypeDef HAL_QSPI_Receive(QSPI_HandleTypeDef *h, uint8_t *pData, uint32_t Timeout) {
+	(void)Timeout;
+	hal_call();
+	if (!data_phase_ok(h, false)) {
+		return HAL_ERROR;
+	}
+	fake_advance(bus_us(data_clocks(&pending.cmd, pending.cmd.NbData)));
+	receive(&pending, pData, pending.cmd.NbData);
+	pending_valid = false;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_QSPI_Transmit(QSPI_HandleTypeDef *h, uint8_t *pData, uint32_t Timeout) {
+	(void)Timeout;
+	hal_call();
+	if (!data_phase_ok(h, true)) {
+		return HAL_ERROR;
+	}
+	fake_advance(bus_us(data_clocks(&pending.cmd, pending.cmd.NbData)));
+	transmit(&pending, pData, pending.cmd.NbData);
+	pending_valid = false;
+	return HAL_OK;
+}
+
+static HAL_StatusTypeDef start_transfer(QSPI_HandleTypeDef *h, uint8_t *pData, int type) {
+	bool tx = type == EV_TX_IT || type == EV_TX_DMA;
+
+	hal_call();
+	if (!data_phase_ok(h, tx)) {
+		return HAL_ERROR;
+	}
+	event.type = type;
+	event.time = fake_time_us() + bus_us(data_clocks(&pending.cmd, pending.cmd.NbData));
+	event.data = pData;
+	event.size = pending.cmd.NbData;
+	set_state(tx ? HAL_QSPI_STATE_BUSY_INDIRECT_TX : HAL_QSPI_STATE_BUSY_INDIRECT_RX);
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_QSPI_Receive_IT(QSPI_HandleTypeDef *h, uint8_t *pData) {
+	return start_transfer(h, pData, EV_RX_IT);
+}
+
+HAL_StatusTypeDef HAL_QSPI_Transmit_IT(QSPI_HandleTypeDef *h, uint8_t *pData) {
+	return start_transfer(h, pData, EV_TX_IT);
+}
+
+HAL_StatusTypeDef HAL_QSPI_Receive_DMA(QSPI_HandleTypeDef *h, uint8_t *pData) {
+	uintptr_t a = (uintptr_t)pData;
+	uintptr_t end = (a + pending.cmd.NbData + DCACHE_LINE - 1) & ~(uintptr_t)(DCACHE_LINE - 1);
+
+	if (a % DCACHE_LINE) {
+		fail(ERR_DMA_ALIGN);										// Lines shared with other data
+	}
+	if (last_invalidate_start > a || last_invalidate_end < end) {
+		fail(ERR_DMA_INVALIDATE);									// Dirty lines could be evicted on top
+	}
+	fake_stat.dma++;
+	return start_transfer(h, pData, EV_RX_DMA);
+}
+
+HAL_StatusTypeDef HAL_QSPI_Transmit_DMA(QSPI_HandleTypeDef *h, uint8_t *pData) {
+	uintptr_t a = (uintptr_t)pData;
+
+	if (last_clean_start > a || last_clean_end < a + pending.cmd.NbData) {
+		fail(ERR_DMA_CLEAN);										// MDMA would send stale SRAM data
+	}
+	fake_stat.dma++;
+	return start_transfer(h, pData, EV_TX_DMA);
+}
+
+static bool status_match(const QSPI_AutoPollingTypeDef *cfg, const struct decoded *dc) {
+	uint32_t status = 0;
+
+	for (uint32_t i = 0; i < cfg->StatusBytesSize; i++) {
+		status |= (uint32_t)read_byte(dc, i) << (8*i);
+	}
+	return cfg->MatchMode == QSPI_MATCH_MODE_AND ? (status & cfg->Mask) == cfg->Match : ((status ^ cfg->Match) & cfg->Mask) != cfg->Mask;
+}
+
+static HAL_StatusTypeDef start_polling(QSPI_HandleTypeDef *h, QSPI_CommandTypeDef *cmd, QSPI_AutoPollingTypeDef *cfg, double *match) {
+	struct decoded dc;
+
+	hal_call();
+	if (h->State != HAL_QSPI_STATE_READY) {
+		return HAL_BUSY;
+	}
+	check_dma_rx();
+	fake_stat.commands++;
+	decode(cmd, &dc);
+	execute(&dc);
+	if (dc.ignored || dc.op->kind != K_RDREG || cfg->StatusBytesSize != (uint32_t)dies() || cfg->AutomaticStop != QSPI_AUTOMATIC_STOP_ENABLE) {
+		fail(ERR_HAL);
+		return HAL_ERROR;
+	}
+
+	fake_stat.command_clocks += command_clocks(cmd);
+	double poll = bus_us(command_clocks(cmd) + data_clocks(cmd, cfg->StatusBytesSize) + cfg->Interval);
+	double t = fake_time_us() + poll;
+	double saved = fake_time_us();
+	for (;;) {
+		fake_advance(t - fake_time_us());
+		if (status_match(cfg, &dc)) {
+			break;
+		}
+		double next = next_change();
+		if (next == 0 || next - saved > HAL_QPSI_TIMEOUT_DEFAULT_VALUE*1000.0) {
+			fake_advance(-(fake_time_us() - saved));
+			fail(ERR_POLL_TIMEOUT);
+			return HAL_TIMEOUT;
+		}
+		t = next + poll;
+	}
+	*match = fake_time_us();
+	fake_advance(-(fake_time_us() - saved));
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_QSPI_AutoPolling(QSPI_HandleTypeDef *h, QSPI_CommandTypeDef *cmd, QSPI_AutoPollingTypeDef *cfg, uint32_t Timeout) {
+	double match;
+	HAL_StatusTypeDef ret = start_polling(h, cmd, cfg, &match);
+
+	(void)Timeout;
+	if (ret == HAL_OK) {
+		fake_stat.busy_us += match - fake_time_us();
+		fake_advance(match - fake_time_us());
+	} else if (ret == HAL_TIMEOUT) {
+		fake_advance(HAL_QPSI_TIMEOUT_DEFAULT_VALUE*1000.0);
+	}
+	return ret;
+}
+
+HAL_StatusTypeDef HAL_QSPI_AutoPolling_IT(QSPI_HandleTypeDef *h, QSPI_CommandTypeDef *cmd, QSPI_AutoPollingTypeDef *cfg) {
+	double match;
+	HAL_StatusTypeDef ret = start_polling(h, cmd, cfg, &match);
+
+	if (ret == HAL_OK) {
+		event.type = EV_MATCH;
+		event.time = match;
+		set_state(HAL_QSPI_STATE_BUSY_AUTO_POLLING);
+	} else if (ret == HAL_TIMEOUT) {
+		event.type = EV_MATCH;										// Never fires
+		event.time = 0;
+		set_state(HAL_QSPI_STATE_BUSY_AUTO_POLLING);
+		ret = HAL_OK;
+	}
+	return ret;
+}
+
+HAL_StatusTypeDef HAL_QSPI_MemoryMapped(QSPI_HandleTypeDef *h, QSPI_CommandTypeDef *cmd, QSPI_MemoryMappedTypeDef *cfg) {
+	(void)cfg;
+	hal_call();
+	if (h->State != HAL_QSPI_STATE_READY) {
+		return HAL_BUSY;
+	}
+	check_dma_rx();
+	fake_stat.commands++;
+	decode(cmd, &mapped_cmd);
+	if (mapped_cmd.ignored || mapped_cmd.op->kind != K_READ) {
+		fail(ERR_HAL);
+		return HAL_ERROR;
+	}
+	execute(&mapped_cmd);
+	if (mapped_cmd.garbage || any_busy()) {
+		if (any_busy()) {
+			fail(ERR_BUSY_READ);
+		}
+		mapped_cmd.garbage = true;
+		window_refresh(0, part.size*dies(), &mapped_cmd);			// Whatever gets fetched is wrong
+	}
+	mapped = true;
+	fake_stat.mapped++;
+	window_protect();
+	set_state(HAL_QSPI_STATE_BUSY_MEM_MAPPED);
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_QSPI_Abort(QSPI_HandleTypeDef *h) {
+	hal_call();
+	event.type = EV_NONE;
+	pending_valid = false;
+	if (mapped) {
+		mapped = false;
+		window_protect();
+	}
+	if (h->State != HAL_QSPI_STATE_RESET) {
+		set_state(HAL_QSPI_STATE_READY);
+	}
+	return HAL_OK;
+}
+
+__weak void HAL_QSPI_RxCpltCallback(QSPI_HandleTypeDef *h) { (void)h; }
+__weak void HAL_QSPI_TxCpltCallback(QSPI_HandleTypeDef *h) { (void)h; }
+__weak void HAL_QSPI_ErrorCallback(QSPI_HandleTypeDef *h) { (void)h; }
+__weak void HAL_QSPI_StatusMatchCallback(QSPI_HandleTypeDef *h) { (void)h; }
+
+//-------------------------------------------------------------------------------------------------
+// Setup and results
+//-------------------------------------------------------------------------------------------------
+void fake_reset(const struct fake_part *p) {
+	part = p ? *p : w25q64jv;
+	if (window == NULL) {
+		window = mmap((void *)QSPI_MAPPED_BASE, MAPPED_WINDOW, PROT_NONE,
+				MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE | MAP_NORESERVE, -1, 0);
+		if (window != (void *)QSPI_MAPPED_BASE) {
+			perror("fake: mapped window");
+			exit(2);
+		}
+	}
+	for (int i = 0; i < 2; i++) {
+		if (die[i].mem) {
+			munmap(die[i].mem, die_alloc);
+		}
+		memset(&die[i], 0, sizeof(die[i]));
+		die[i].mem = mmap(NULL, part.size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+		if (die[i].mem == MAP_FAILED) {
+			perror("fake: flash");
+			exit(2);
+		}
+		memset(die[i].mem, 0xFF, part.size);
+		die[i].resumed = -TSUS_US;
+	}
+	die_alloc = part.size;
+	memset(&fake_stat, 0, sizeof(fake_stat));
+	memset(&event, 0, sizeof(event));
+	pending_valid = false;
+	dma_rx.pending = false;
+	mapped = false;
+	powercut = 0;
+	prog_erase_ops = 0;
+	ignore_wren = false;
+	memset(&fake_quadspi, 0, sizeof(fake_quadspi));
+	set_state(HAL_QSPI_STATE_RESET);
+	mprotect(window, MAPPED_WINDOW, PROT_READ | PROT_WRITE);		// Blank like the flash
+	memset(window, 0xFF, MAPPED_WINDOW);
+	mprotect(window, MAPPED_WINDOW, PROT_NONE);
+	fake_clear_errors();
+}
+
+long fake_errors(void) {
+	long total = 0;
+	for (int i = 0; i < ERR_COUNT; i++) {
+		total += errors[i];
+	}
+	return total + dma_rx.pending;
+}
+
+void fake_clear_errors(void) {
+	memset(errors, 0, sizeof(errors));
+}
+
+void fake_report(FILE *f) {
+	for (int i = 0; i < ERR_COUNT; i++) {
+		if (errors[i]) {
+			fprintf(f, "  fake: %ld x %s\n", errors[i], err_name[i]);
+		}
+	}
+}
@@ -0,0 +1,273 @@
+/*
+ * stm32h7xx_hal.h
+ *
+ *  Host stand-in for the STM32H7 HAL, just what W25Qxx.c uses. Register layouts, bit positions and
+ *  the QSPI_* values are those of the real HAL and CMSIS headers, the functions and peripherals are
+ *  implemented by fake_hal.c (core, caches, CRC unit) and fake_qspi.c (QUADSPI and the flash).
+ */
+
+#ifndef FAKE_STM32H7XX_HAL_H
+#define FAKE_STM32H7XX_HAL_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define __IO					volatile
+#define __ALIGNED(x)			__attribute__((aligned(x)))
+#define __weak					__attribute__((weak))
+#define UNUSED(x)				((void)(x))
+
+typedef enum {
+	HAL_OK = 0x00,
+	HAL_ERROR = 0x01,
+	HAL_BUSY = 0x02,
+	HAL_TIMEOUT = 0x03
+} HAL_StatusTypeDef;
+
+#define HAL_MAX_DELAY			0xFFFFFFFFU
+
+#define MODIFY_REG(REG, CLEARMASK, SETMASK)	((REG) = (((REG) & (~(CLEARMASK))) | (SETMASK)))
+#define READ_BIT(REG, BIT)		((REG) & (BIT))
+#define POSITION_VAL(VAL)		((uint32_t)__builtin_ctz(VAL))
+
+//-------------------------------------------------------------------------------------------------
+// Core
+//-------------------------------------------------------------------------------------------------
+extern uint32_t SystemCoreClock;
+
+typedef struct {
+	__IO uint32_t DEMCR;
+} CoreDebug_Type;
+#define CoreDebug_DEMCR_TRCENA_Msk	(1UL << 24)
+
+typedef struct {
+	__IO uint32_t CTRL;
+	__IO uint32_t CYCCNT;
+	__IO uint32_t LAR;
+} DWT_Type;
+#define DWT_CTRL_CYCCNTENA_Msk	(1UL << 0)
+
+extern CoreDebug_Type fake_coredebug;
+DWT_Type *fake_dwt(void);											// CYCCNT follows the simulated time
+#define CoreDebug				(&fake_coredebug)
+#define DWT						(fake_dwt())
+
+void fake_nop(void);
+void fake_wfi(void);
+#define __NOP()					fake_nop()
+#define __WFI()					fake_wfi()						// Runs the next pending interrupt
+static inline uint32_t __get_PRIMASK(void) { return 0; }
+static inline void __set_PRIMASK(uint32_t primask) { (void)primask; }
+static inline void __disable_irq(void) { }
+static inline uint32_t __REV(uint32_t value) { return __builtin_bswap32(value); }
+static inline uint32_t __RBIT(uint32_t value) {
+	uint32_t result = 0;
+	for (int i = 0; i < 32; i++) {
+		result = (result << 1) | ((value >> i) & 1);
+	}
+	return result;
+}
+
+void SCB_CleanDCache_by_Addr(volatile void *addr, int32_t dsize);
+void SCB_InvalidateDCache_by_Addr(volatile void *addr, int32_t dsize);
+
+uint32_t HAL_GetTick(void);
+void HAL_Delay(uint32_t Delay);
+
+//-------------------------------------------------------------------------------------------------
+// CRC unit
+//-------------------------------------------------------------------------------------------------
+typedef struct {
+	__IO uint32_t DR;
+	__IO uint32_t IDR;
+	__IO uint32_t CR;
+	uint32_t RESERVED2;
+	__IO uint32_t INIT;
+	__IO uint32_t POL;
+} CRC_TypeDef;
+
+extern CRC_TypeDef *fake_crc_regs;
+#define CRC						fake_crc_regs
+#define CRC_CR_RESET			(1UL << 0)
+#define CRC_CR_POLYSIZE			(3UL << 3)
+#define CRC_CR_REV_IN_0			(1UL << 5)
+#define CRC_CR_REV_IN_1			(2UL << 5)
+#define CRC_CR_REV_IN			(3UL << 5)
+#define CRC_CR_REV_OUT			(1UL << 7)
+#define __HAL_RCC_CRC_CLK_ENABLE()	do { } while (0)
+
+//-------------------------------------------------------------------------------------------------
+// QUADSPI
+//-------------------------------------------------------------------------------------------------
+typedef struct {
+	__IO uint32_t CR;
+	__IO uint32_t DCR;
+	__IO uint32_t SR;
+	__IO uint32_t FCR;
+	__IO uint32_t DLR;
+	__IO uint32_t CCR;
+	__IO uint32_t AR;
+	__IO uint32_t ABR;
+	__IO uint32_t DR;
+	__IO uint32_t PSMKR;
+	__IO uint32_t PSMAR;
+	__IO uint32_t PIR;
+	__IO uint32_t LPTR;
+} QUADSPI_TypeDef;
+
+extern QUADSPI_TypeDef fake_quadspi;
+#define QUADSPI					(&fake_quadspi)
+#define QUADSPI_CR_SSHIFT		(1UL << 4)
+#define QUADSPI_CR_DFM			(1UL << 6)
+#define QUADSPI_CR_PRESCALER_Pos	24
+#define QUADSPI_CR_PRESCALER	(0xFFUL << QUADSPI_CR_PRESCALER_Pos)
+#define QUADSPI_DCR_CSHT		(7UL << 8)
+#define QUADSPI_DCR_FSIZE_Pos	16
+#define QUADSPI_DCR_FSIZE		(0x1FUL << QUADSPI_DCR_FSIZE_Pos)
+#define QUADSPI_SR_BUSY			(1UL << 5)
+
+typedef struct {
+	uint32_t ClockPrescaler;
+	uint32_t FifoThreshold;
+	uint32_t SampleShifting;
+	uint32_t FlashSize;
+	uint32_t ChipSelectHighTime;
+	uint32_t ClockMode;
+	uint32_t FlashID;
+	uint32_t DualFlash;
+} QSPI_InitTypeDef;
+
+typedef enum {
+	HAL_QSPI_STATE_RESET = 0x00,
+	HAL_QSPI_STATE_READY = 0x01,
+	HAL_QSPI_STATE_BUSY = 0x02,
+	HAL_QSPI_STATE_BUSY_INDIRECT_TX = 0x12,
+	HAL_QSPI_STATE_BUSY_INDIRECT_RX = 0x22,
+	HAL_QSPI_STATE_BUSY_AUTO_POLLING = 0x42,
+	HAL_QSPI_STATE_BUSY_MEM_MAPPED = 0x82,
+	HAL_QSPI_STATE_ABORT = 0x08,
+	HAL_QSPI_STATE_ERROR = 0x04
+} HAL_QSPI_StateTypeDef;
+
+typedef struct __QSPI_HandleTypeDef {
+	QUADSPI_TypeDef *Instance;
+	QSPI_InitTypeDef Init;
+	uint8_t *pTxBuffPtr;
+	__IO uint32_t TxXferSize;
+	__IO uint32_t TxXferCount;
+	uint8_t *pRxBuffPtr;
+	__IO uint32_t RxXferSize;
+	__IO uint32_t RxXferCount;
+	__IO HAL_QSPI_StateTypeDef State;
+	__IO uint32_t ErrorCode;
+	uint32_t Timeout;
+} QSPI_HandleTypeDef;
+
+typedef struct {
+	uint32_t Instruction;
+	uint32_t Address;
+	uint32_t AlternateBytes;
+	uint32_t AddressSize;
+	uint32_t AlternateBytesSize;
+	uint32_t DummyCycles;
+	uint32_t InstructionMode;
+	uint32_t AddressMode;
+	uint32_t AlternateByteMode;
+	uint32_t DataMode;
+	uint32_t NbData;
+	uint32_t DdrMode;
+	uint32_t DdrHoldHalfCycle;
+	uint32_t SIOOMode;
+} QSPI_CommandTypeDef;
+
+typedef struct {
+	uint32_t Match;
+	uint32_t Mask;
+	uint32_t Interval;
+	uint32_t StatusBytesSize;
+	uint32_t MatchMode;
+	uint32_t AutomaticStop;
+} QSPI_AutoPollingTypeDef;
+
+typedef struct {
+	uint32_t TimeOutPeriod;
+	uint32_t TimeOutActivation;
+} QSPI_MemoryMappedTypeDef;
+
+#define HAL_QPSI_TIMEOUT_DEFAULT_VALUE	5000U
+
+#define QSPI_SAMPLE_SHIFTING_NONE		0x00000000U
+#define QSPI_SAMPLE_SHIFTING_HALFCYCLE	QUADSPI_CR_SSHIFT
+
+#define QSPI_CS_HIGH_TIME_1_CYCLE		(0UL << 8)
+#define QSPI_CS_HIGH_TIME_2_CYCLE		(1UL << 8)
+#define QSPI_CS_HIGH_TIME_3_CYCLE		(2UL << 8)
+#define QSPI_CS_HIGH_TIME_4_CYCLE		(3UL << 8)
+#define QSPI_CS_HIGH_TIME_5_CYCLE		(4UL << 8)
+#define QSPI_CS_HIGH_TIME_6_CYCLE		(5UL << 8)
+#define QSPI_CS_HIGH_TIME_7_CYCLE		(6UL << 8)
+#define QSPI_CS_HIGH_TIME_8_CYCLE		(7UL << 8)
+
+#define QSPI_CLOCK_MODE_0				0x00000000U
+#define QSPI_FLASH_ID_1					0x00000000U
+#define QSPI_DUALFLASH_DISABLE			0x00000000U
+#define QSPI_DUALFLASH_ENABLE			QUADSPI_CR_DFM
+
+#define QSPI_INSTRUCTION_NONE			(0UL << 8)
+#define QSPI_INSTRUCTION_1_LINE			(1UL << 8)
+#define QSPI_INSTRUCTION_2_LINES		(2UL << 8)
+#define QSPI_INSTRUCTION_4_LINES		(3UL << 8)
+#define QSPI_ADDRESS_NONE				(0UL << 10)
+#define QSPI_ADDRESS_1_LINE				(1UL << 10)
+#define QSPI_ADDRESS_2_LINES			(2UL << 10)
+#define QSPI_ADDRESS_4_LINES			(3UL << 10)
+#define QSPI_ADDRESS_8_BITS				(0UL << 12)
+#define QSPI_ADDRESS_16_BITS			(1UL << 12)
+#define QSPI_ADDRESS_24_BITS			(2UL << 12)
+#define QSPI_ADDRESS_32_BITS			(3UL << 12)
+#define QSPI_ALTERNATE_BYTES_NONE		(0UL << 14)
+#define QSPI_ALTERNATE_BYTES_1_LINE		(1UL << 14)
+#define QSPI_ALTERNATE_BYTES_2_LINES	(2UL << 14)
+#define QSPI_ALTERNATE_BYTES_4_LINES	(3UL << 14)
+#define QSPI_ALTERNATE_BYTES_8_BITS		(0UL << 16)
+#define QSPI_ALTERNATE_BYTES_16_BITS	(1UL << 16)
+#define QSPI_ALTERNATE_BYTES_24_BITS	(2UL << 16)
+#define QSPI_ALTERNATE_BYTES_32_BITS	(3UL << 16)
+#define QSPI_DATA_NONE					(0UL << 24)
+#define QSPI_DATA_1_LINE				(1UL << 24)
+#define QSPI_DATA_2_LINES				(2UL << 24)
+#define QSPI_DATA_4_LINES				(3UL << 24)
+#define QSPI_DDR_MODE_DISABLE			0x00000000U
+#define QSPI_DDR_MODE_ENABLE			(1UL << 31)
+#define QSPI_DDR_HHC_ANALOG_DELAY		0x00000000U
+#define QSPI_DDR_HHC_HALF_CLK_DELAY		(1UL << 30)
+#define QSPI_SIOO_INST_EVERY_CMD		0x00000000U
+#define QSPI_SIOO_INST_ONLY_FIRST_CMD	(1UL << 28)
+
+#define QSPI_MATCH_MODE_AND				0x00000000U
+#define QSPI_MATCH_MODE_OR				(1UL << 23)
+#define QSPI_AUTOMATIC_STOP_DISABLE		0x00000000U
+#define QSPI_AUTOMATIC_STOP_ENABLE		(1UL << 22)
+#define QSPI_TIMEOUT_COUNTER_DISABLE	0x00000000U
+#define QSPI_TIMEOUT_COUNTER_ENABLE		(1UL << 3)
+
+HAL_StatusTypeDef HAL_QSPI_Init(QSPI_HandleTypeDef *hqspi);
+HAL_StatusTypeDef HAL_QSPI_DeInit(QSPI_HandleTypeDef *hqspi);
+HAL_StatusTypeDef HAL_QSPI_Command(QSPI_HandleTypeDef *hqspi, QSPI_CommandTypeDef *cmd, uint32_t Timeout);
+HAL_StatusTypeDef HAL_QSPI_Transmit(QSPI_HandleTypeDef *hqspi, uint8_t *pData, uint32_t Timeout);
+HAL_StatusTypeDef HAL_QSPI_Receive(QSPI_HandleTypeDef *hqspi, uint8_t *pData, uint32_t Timeout);
+HAL_StatusTypeDef HAL_QSPI_Transmit_IT(QSPI_HandleTypeDef *hqspi, uint8_t *pData);
+HAL_StatusTypeDef HAL_QSPI_Receive_IT(QSPI_HandleTypeDef *hqspi, uint8_t *pData);
+HAL_StatusTypeDef HAL_QSPI_Transmit_DMA(QSPI_HandleTypeDef *hqspi, uint8_t *pData);
+HAL_StatusTypeDef HAL_QSPI_Receive_DMA(QSPI_HandleTypeDef *hqspi, uint8_t *pData);
+HAL_StatusTypeDef HAL_QSPI_AutoPolling(QSPI_HandleTypeDef *hqspi, QSPI_CommandTypeDef *cmd, QSPI_AutoPollingTypeDef *cfg, uint32_t Timeout);
+HAL_StatusTypeDef HAL_QSPI_AutoPolling_IT(QSPI_HandleTypeDef *hqspi, QSPI_CommandTypeDef *cmd, QSPI_AutoPollingTypeDef *cfg);
+HAL_StatusTypeDef HAL_QSPI_MemoryMapped(QSPI_HandleTypeDef *hqspi, QSPI_CommandTypeDef *cmd, QSPI_MemoryMappedTypeDef *cfg);
+HAL_StatusTypeDef HAL_QSPI_Abort(QSPI_HandleTypeDef *hqspi);
+HAL_QSPI_StateTypeDef HAL_QSPI_GetState(QSPI_HandleTypeDef *hqspi);
+void HAL_QSPI_ErrorCallback(QSPI_HandleTypeDef *hqspi);
+void HAL_QSPI_RxCpltCallback(QSPI_HandleTypeDef *hqspi);
+void HAL_QSPI_TxCpltCallback(QSPI_HandleTypeDef *hqspi);
+void HAL_QSPI_StatusMatchCallback(QSPI_HandleTypeDef *hqspi);
+
+#endif /* FAKE_STM32H7XX_HAL_H */
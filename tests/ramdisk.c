@@ -0,0 +1,78 @@
+/*
+ * ramdisk.c
+ *
+ *  RAM block device for littlefs, counts reads, programs and erases. Programs AND into the flash
+ *  contents like NOR flash does.
+ */
+
+#include <stdlib.h>
+#include "ramdisk.h"
+
+struct ramdisk_stat ramdisk_stat;
+uint8_t ramdisk[RAMDISK_BLOCK_SIZE*RAMDISK_BLOCK_COUNT];
+
+static int ramdisk_read(const struct lfs_config *c, lfs_block_t block, lfs_off_t off, void *buffer, lfs_size_t size) {
+	(void)c;
+	ramdisk_stat.reads++;
+	ramdisk_stat.read_bytes += size;
+	memcpy(buffer, ramdisk + block*RAMDISK_BLOCK_SIZE + off, size);
+	return LFS_ERR_OK;
+}
+
+static int ramdisk_prog(const struct lfs_config *c, lfs_block_t block, lfs_off_t off, const void *buffer, lfs_size_t size) {
+	const uint8_t *data = buffer;
+	uint8_t *p = ramdisk + block*RAMDISK_BLOCK_SIZE + off;
+
+	(void)c;
+	ramdisk_stat.progs++;
+	for (lfs_size_t i = 0; i < size; i++) {
+		p[i] &= data[i];
+	}
+	return LFS_ERR_OK;
+}
+
+static int ramdisk_erase(const struct lfs_config *c, lfs_block_t block) {
+	(void)c;
+	ramdisk_stat.erases++;
+	memset(ramdisk + block*RAMDISK_BLOCK_SIZE, 0xFF, RAMDISK_BLOCK_SIZE);
+	return LFS_ERR_OK;
+}
+
+static int ramdisk_sync(const struct lfs_config *c) {
+	(void)c;
+	return LFS_ERR_OK;
+}
+
+void ramdisk_init(struct lfs_config *cfg, lfs_size_t lookahead_size) {
+	memset(ramdisk, 0xFF, sizeof(ramdisk));
+	memset(&ramdisk_stat, 0, sizeof(ramdisk_stat));
+	memset(cfg, 0, sizeof(*cfg));
+	cfg->read = ramdisk_read;
+	cfg->prog = ramdisk_prog;
+	cfg->erase = ramdisk_erase;
+	cfg->sync = ramdisk_sync;
+	cfg->read_size = 256;
+	cfg->prog_size = 256;
+	cfg->block_size = RAMDISK_BLOCK_SIZE;
+	cfg->block_count = RAMDISK_BLOCK_COUNT;
+	cfg->cache_size = RAMDISK_BLOCK_SIZE/4;
+	cfg->lookahead_size = lookahead_size;
+	cfg->block_cycles = 100;
+}
+
+// The driver provides lfs_crc (W25Qxx.c), littlefs alone needs its own
+uint32_t lfs_crc(uint32_t crc, const void *buffer, size_t size) {
+	static const uint32_t rtable[16] = {
+		0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac,
+		0x76dc4190, 0x6b6b51f4, 0x4db26158, 0x5005713c,
+		0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c,
+		0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c,
+	};
+	const uint8_t *data = buffer;
+
+	for (size_t i = 0; i < size; i++) {
+		crc = (crc >> 4) ^ rtable[(crc ^ (data[i] >> 0)) & 0xf];
+		crc = (crc >> 4) ^ rtable[(crc ^ (data[i] >> 4)) & 0xf];
+	}
+	return crc;
+}
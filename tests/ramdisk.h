@@ -0,0 +1,29 @@
+/*
+ * ramdisk.h
+ *
+ *  RAM block device for the tests of littlefs itself (lfs.c without the QSPI driver), with the
+ *  geometry of the W25Q64JV behind the driver: 256 byte pages in 4K blocks.
+ */
+
+#ifndef RAMDISK_H
+#define RAMDISK_H
+
+#include "lfs.h"
+
+#define RAMDISK_BLOCK_SIZE		4096
+#define RAMDISK_BLOCK_COUNT		2048								// 8Mbyte
+
+struct ramdisk_stat {
+	uint32_t reads;
+	uint64_t read_bytes;
+	uint32_t progs;
+	uint32_t erases;
+};
+
+extern struct ramdisk_stat ramdisk_stat;
+extern uint8_t ramdisk[RAMDISK_BLOCK_SIZE*RAMDISK_BLOCK_COUNT];
+
+// Blank device and a config like the driver's stmconfig, lookahead_size bytes of lookahead
+void ramdisk_init(struct lfs_config *cfg, lfs_size_t lookahead_size);
+
+#endif /* RAMDISK_H */
@@ -0,0 +1,71 @@
+/*
+ * test.h
+ *
+ *  Checks for the host tests, a failed CHECK prints the location and the test carries on so one run
+ *  shows every failure. Include fake_hal.h first in the driver tests, test_done() then also fails on
+ *  protocol errors counted by the QUADSPI model.
+ */
+
+#ifndef TEST_H
+#define TEST_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+static int test_failures;
+
+#define CHECK(cond)	do { \
+		if (!(cond)) { \
+			printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+			test_failures++; \
+		} \
+	} while (0)
+
+#define CHECK_EQ(a, b)	do { \
+		long long _a = (long long)(a), _b = (long long)(b); \
+		if (_a != _b) { \
+			printf("%s:%d: %s == %lld, expected %lld\n", __FILE__, __LINE__, #a, _a, _b); \
+			test_failures++; \
+		} \
+	} while (0)
+
+#ifdef FAKE_HAL_H
+// Fails on any protocol error the model counted since the last call
+#define CHECK_FAKE()	do { \
+		if (fake_errors() != 0) { \
+			printf("%s:%d: QUADSPI model errors\n", __FILE__, __LINE__); \
+			fake_report(stdout); \
+			fake_clear_errors(); \
+			test_failures++; \
+		} \
+	} while (0)
+#else
+#define CHECK_FAKE()	do { } while (0)
+#endif
+
+// Sends stdout to /dev/null and back, for the mount messages of the driver
+static inline void test_quiet(bool quiet) {
+	static int saved = -1;
+
+	fflush(stdout);
+	if (quiet && saved < 0) {
+		int null = open("/dev/null", O_WRONLY);
+		saved = dup(STDOUT_FILENO);
+		dup2(null, STDOUT_FILENO);
+		close(null);
+	} else if (!quiet && saved >= 0) {
+		dup2(saved, STDOUT_FILENO);
+		close(saved);
+		saved = -1;
+	}
+}
+
+static inline int test_done(const char *name) {
+	CHECK_FAKE();
+	printf("%s: %s\n", name, test_failures ? "FAILED" : "ok");
+	return test_failures != 0;
+}
+
+#endif /* TEST_H */
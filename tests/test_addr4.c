@@ -0,0 +1,151 @@
+/*
+ * test_addr4.c
+ *
+ *  A 32Mbyte part on the flash model (QSPI_SFDP, FS_SIZE 32Mbyte), which like the real parts takes
+ *  only the low 24 bits of a 3-byte address and so wraps at 16Mbyte. Run once with a 4-byte address
+ *  instruction table in the SFDP area (the 4-byte opcodes) and once without it, where the part only
+ *  accepts 3-byte opcodes and the driver has to enter 4-byte mode with 0xB7. Programs, reads and
+ *  erases on both sides of the 16Mbyte boundary and in the last sector, checking where the data
+ *  lands in the flash, then fills littlefs to within 300 blocks of the end and reads it back.
+ */
+
+#include "main.h"
+#include "fake_hal.h"
+#include "test.h"
+
+#define PART_SIZE		0x2000000
+#define FILES			130
+#define FILE_SIZE		(256*1024)
+
+extern struct lfs_config stmconfig;
+
+// W25Q64JV BFPT with the density of a 256Mbit part, 3 or 4 address bytes and 0xB7
+static const uint8_t bfpt[64] = {
+	0xe5, 0x20, 0xfb, 0xff, 0xff, 0xff, 0xff, 0x0f, 0x44, 0xeb, 0x08, 0x6b, 0x08, 0x3b, 0x42, 0xbb,
+	0xfe, 0xff, 0xff, 0xff, 0xff, 0xff, 0x00, 0x00, 0xff, 0xff, 0x40, 0xeb, 0x0c, 0x20, 0x0f, 0x52,
+	0x10, 0xd8, 0x00, 0x00, 0x36, 0x02, 0xa6, 0x00, 0x82, 0xea, 0x14, 0xc4, 0xe9, 0x63, 0x76, 0x33,
+	0x7a, 0x75, 0x7a, 0x75, 0xf7, 0xa2, 0xd5, 0x5c, 0x19, 0xf7, 0x4d, 0xff, 0xe9, 0x30, 0xf8, 0xa1,
+};
+static const uint8_t bait[8] = {									// 0x0C 0x3C 0xBC 0x6C 0xEC 0x12 0x34, 0x21 0x5C 0xDC
+	0xfe, 0x0e, 0x00, 0x00, 0x21, 0x5c, 0xdc, 0x00,
+};
+
+static uint8_t sfdp[256];
+static uint8_t data[FILE_SIZE];
+static uint8_t buf[FILE_SIZE];
+
+static void make_sfdp(bool opcodes) {
+	static const uint8_t head[24] = {
+		'S', 'F', 'D', 'P', 0x06, 0x01, 0x01, 0xff,
+		0x00, 0x06, 0x01, 0x10, 0x80, 0x00, 0x00, 0xff,				// BFPT at 0x80
+		0x84, 0x00, 0x01, 0x02, 0xc0, 0x00, 0x00, 0xff,				// 4BAIT at 0xC0
+	};
+
+	memset(sfdp, 0xff, sizeof(sfdp));
+	memcpy(sfdp, head, opcodes ? 24 : 16);
+	if (!opcodes) {
+		sfdp[6] = 0;
+	}
+	memcpy(sfdp + 0x80, bfpt, sizeof(bfpt));
+	memcpy(sfdp + 0xc0, bait, sizeof(bait));
+}
+
+// Page program and read back through the driver, and the bytes where the flash holds them
+static void check_block(lfs_block_t block, uint8_t seed) {
+	uint8_t *flash = fake_flash(0) + block*FS_SECTOR_SIZE;
+
+	for (int i = 0; i < FS_SECTOR_SIZE; i++) {
+		data[i] = (uint8_t)(i*7 + seed);
+	}
+	CHECK_EQ(stmlfs_hal_erase(&stmconfig, block), LFS_ERR_OK);
+	CHECK_EQ(stmlfs_hal_prog(&stmconfig, block, 0, data, FS_SECTOR_SIZE), LFS_ERR_OK);
+	CHECK_EQ(stmlfs_hal_sync(&stmconfig), LFS_ERR_OK);
+	CHECK(memcmp(flash, data, FS_SECTOR_SIZE) == 0);
+	memset(buf, 0, FS_SECTOR_SIZE);
+	CHECK_EQ(stmlfs_hal_read(&stmconfig, block, 0, buf, FS_SECTOR_SIZE), LFS_ERR_OK);
+	CHECK(memcmp(buf, data, FS_SECTOR_SIZE) == 0);
+}
+
+static void run(bool opcodes) {
+	struct fake_part part = *fake_w25q64jv();
+	const struct sfdp_flash_t *info;
+	struct littlfs_fsstat_t stat;
+	lfs_file_t file;
+	char name[16];
+	int files = 0;
+
+	printf("  %s:\n", opcodes ? "4-byte opcodes" : "4-byte mode (0xB7)");
+	make_sfdp(opcodes);
+	part.size = PART_SIZE;
+	part.jedec = 0xEF4019;
+	part.sfdp = sfdp;
+	part.addr4_opcodes = opcodes;
+	fake_reset(&part);
+	CHECK_EQ(CSP_QUADSPI_Init(), HAL_OK);
+	info = QSPI_FlashInfo();
+	CHECK_EQ(info->size, PART_SIZE);
+	CHECK_EQ(info->erase[0].cmd, opcodes ? 0x21 : 0x20);
+
+	// The sectors around 16Mbyte and the last one, nothing lands in the first 16Mbyte
+	lfs_block_t last = PART_SIZE/FS_SECTOR_SIZE - 1, wrap = 0x1000000/FS_SECTOR_SIZE;
+	test_quiet(true);
+	CHECK_EQ(stmlfs_mount(true), 0);
+	test_quiet(false);
+	CHECK_EQ(stmconfig.block_count, last + 1);
+	CHECK_EQ(stmlfs_unmount(), 0);
+	memset(fake_flash(0), 0xff, 0x10000);
+	check_block(wrap - 1, 1);
+	check_block(wrap, 2);
+	check_block(last, 3);
+	for (int i = 0; i < 0x10000; i++) {
+		if (fake_flash(0)[i] != 0xff) {
+			CHECK_EQ(i, -1);
+			break;
+		}
+	}
+	CHECK_EQ(stmlfs_hal_erase(&stmconfig, wrap), LFS_ERR_OK);		// Not the sector at 0
+	CHECK_EQ(fake_flash(0)[wrap*FS_SECTOR_SIZE], 0xff);
+	CHECK_EQ(fake_flash(0)[(wrap - 1)*FS_SECTOR_SIZE], 1);
+	CHECK_FAKE();
+
+	// littlefs over the whole part
+	for (int i = 0; i < FILE_SIZE; i++) {
+		data[i] = (uint8_t)(i*13 + (i >> 12));
+	}
+	test_quiet(true);
+	CHECK_EQ(stmlfs_mount(true), 0);
+	test_quiet(false);
+	do {
+		sprintf(name, "f%d", files);
+		data[0] = files++;
+		CHECK_EQ(stmlfs_file_open(&file, name, LFS_O_WRONLY | LFS_O_CREAT), 0);
+		CHECK_EQ(stmlfs_file_write(&file, data, FILE_SIZE), FILE_SIZE);
+		CHECK_EQ(stmlfs_file_close(&file), 0);
+		CHECK_EQ(stmlfs_fsstat(&stat), 0);
+	} while (stat.blocks_used < stat.block_count - 300 && files < FILES);
+	CHECK(stat.blocks_used >= stat.block_count - 300);
+	CHECK_EQ(stmlfs_unmount(), 0);
+	test_quiet(true);
+	CHECK_EQ(stmlfs_mount(false), 0);
+	test_quiet(false);
+	for (int f = 0; f < files; f++) {
+		sprintf(name, "f%d", f);
+		data[0] = f;
+		CHECK_EQ(stmlfs_file_open(&file, name, LFS_O_RDONLY), 0);
+		CHECK_EQ(stmlfs_file_read(&file, buf, FILE_SIZE), FILE_SIZE);
+		CHECK(memcmp(buf, data, FILE_SIZE) == 0);
+		CHECK_EQ(stmlfs_file_close(&file), 0);
+	}
+	CHECK_EQ(stmlfs_unmount(), 0);
+	CHECK_FAKE();
+	printf("    %d files, %u of %u blocks used\n", files, (unsigned)stat.blocks_used, (unsigned)stat.block_count);
+}
+
+int test_main(int argc, char **argv) {
+	(void)argc;
+	(void)argv;
+	run(true);
+	run(false);
+
+	return test_done("test_addr4");
+}
@@ -0,0 +1,181 @@
+/*
+ * test_async.c
+ *
+ *  QSPI_ASYNC: the request state machine driven from the QUADSPI interrupts of the model. A request
+ *  returns at once, a second one gets HAL_BUSY, the callback runs once with the context and the
+ *  status, and the main loop sleeps in WFI meanwhile. Programs cross page boundaries one page at a
+ *  time, with a status match on WEL before and on Busy after each page. When the dies ignore the
+ *  write enable, programs and erases fail with HAL_ERROR after QSPI_ASYNC_WEL_TIMEOUT_MS and send
+ *  nothing. Built with QSPI_MEMMAPPED_READ as well, where littlefs reads leave
+ *  the QUADSPI in memory mapped mode: a request must leave it first, and the window must show the
+ *  new contents after an async program or erase.
+ */
+
+#include "main.h"
+#include "fake_hal.h"
+#include "test.h"
+
+#define AREA			0x4000
+
+extern struct lfs_config stmconfig;
+
+static uint8_t pattern[AREA];
+static uint8_t data[AREA];
+static uint32_t done_calls;
+static uint8_t done_status;
+static void *done_context;
+
+static void done(uint8_t status, void *context) {
+	done_calls++;
+	done_status = status;
+	done_context = context;
+}
+
+// Sleeps until the request completes, returns the number of WFI wakeups
+static uint32_t wait_done(void) {
+	uint32_t wakeups = 0;
+
+	while (CSP_QSPI_AsyncBusy()) {
+		__WFI();
+		wakeups++;
+	}
+	return wakeups;
+}
+
+static void check_done(void *context) {
+	CHECK_EQ(done_calls, 1);
+	CHECK_EQ(done_status, HAL_OK);
+	CHECK(done_context == context);
+	done_calls = 0;
+	CHECK_FAKE();
+}
+
+int test_main(int argc, char **argv) {
+	uint32_t progs;
+	double start;
+
+	(void)argc;
+	(void)argv;
+	for (uint32_t i = 0; i < AREA; i++) {
+		pattern[i] = (uint8_t)(i*5 + (i >> 8));
+	}
+	CHECK_EQ(CSP_QUADSPI_Init(), HAL_OK);
+	CHECK(!CSP_QSPI_AsyncBusy());
+
+	// Program across pages from an unaligned start, per page a write enable, a page program and two
+	// status matches
+	progs = fake_stat.progs;
+	CHECK_EQ(CSP_QSPI_WriteAsync(pattern + 0x10, 0x1010, 1000, done, pattern), HAL_OK);
+	CHECK(CSP_QSPI_AsyncBusy());
+	CHECK_EQ(CSP_QSPI_ReadAsync(data, 0, 16, done, NULL), HAL_BUSY);
+	CHECK_EQ(CSP_QSPI_EraseSectorAsync(0, done, NULL), HAL_BUSY);
+	CHECK(wait_done() >= 8);
+	check_done(pattern);
+	CHECK_EQ(fake_stat.progs - progs, 4);
+	CHECK(memcmp(fake_flash(0) + 0x1010, pattern + 0x10, 1000) == 0);
+	CHECK_EQ(fake_flash(0)[0x100F], 0xFF);
+	CHECK_EQ(fake_flash(0)[0x1010 + 1000], 0xFF);
+
+	// Read back in one interrupt driven transfer
+	memset(data, 0, sizeof(data));
+	CHECK_EQ(CSP_QSPI_ReadAsync(data, 0x1010, 1000, done, data), HAL_OK);
+	CHECK(CSP_QSPI_AsyncBusy());
+	wait_done();
+	check_done(data);
+	CHECK(memcmp(data, pattern + 0x10, 1000) == 0);
+
+	// An erase completes on the status match, the CPU sleeps through it
+	start = fake_time_us();
+	CHECK_EQ(CSP_QSPI_EraseSectorAsync(0x1234, done, NULL), HAL_OK);
+	CHECK(fake_time_us() - start < 100);
+	wait_done();
+	check_done(NULL);
+	CHECK(fake_time_us() - start >= fake_w25q64jv()->erase_us[0]);
+	for (uint32_t i = 0x1000; i < 0x2000; i++) {
+		if (fake_flash(0)[i] != 0xFF) {
+			CHECK(fake_flash(0)[i] == 0xFF);
+			break;
+		}
+	}
+
+	// Nothing to program is refused, no callback
+	CHECK_EQ(CSP_QSPI_WriteAsync(pattern, 0, 0, done, NULL), HAL_ERROR);
+	CHECK(!CSP_QSPI_AsyncBusy());
+	CHECK_EQ(done_calls, 0);
+
+	// WEL never sets: the main loop fails the request, the QUADSPI interrupt never waits for it
+	uint32_t erases = fake_stat.erases[0];
+	progs = fake_stat.progs;
+	fake_ignore_wren(true);
+	start = fake_time_us();
+	CHECK_EQ(CSP_QSPI_WriteAsync(pattern, 0x3000, 300, done, pattern), HAL_OK);
+	wait_done();
+	CHECK_EQ(done_calls, 1);
+	CHECK_EQ(done_status, HAL_ERROR);
+	CHECK(done_context == pattern);
+	CHECK(fake_time_us() - start < (QSPI_ASYNC_WEL_TIMEOUT_MS + 2)*1000.0);
+	done_calls = 0;
+	CHECK_EQ(CSP_QSPI_EraseSectorAsync(0x1000, done, NULL), HAL_OK);
+	wait_done();
+	CHECK_EQ(done_calls, 1);
+	CHECK_EQ(done_status, HAL_ERROR);
+	done_calls = 0;
+	CHECK_EQ(fake_stat.progs, progs);
+	CHECK_EQ(fake_stat.erases[0], erases);
+	CHECK_EQ(fake_flash(0)[0x3000], 0xFF);
+	CHECK(fake_errors() > 0);										// Status polls that never matched
+	fake_clear_errors();
+
+	// The next request runs
+	fake_ignore_wren(false);
+	CHECK_EQ(CSP_QSPI_WriteAsync(pattern, 0x3000, 300, done, pattern), HAL_OK);
+	wait_done();
+	check_done(pattern);
+	CHECK(memcmp(fake_flash(0) + 0x3000, pattern, 300) == 0);
+
+	// After littlefs reads: requests start, and later reads see what they changed
+	test_quiet(true);
+	CHECK_EQ(stmlfs_mount(true), 0);
+	test_quiet(false);
+	lfs_block_t block = stmconfig.block_count - 1;
+	uint32_t address = block*FS_SECTOR_SIZE;
+
+	CHECK_EQ(stmlfs_hal_read(&stmconfig, block, 0, data, FS_SECTOR_SIZE), LFS_ERR_OK);
+	CHECK_EQ(data[0], 0xFF);
+	CHECK_EQ(CSP_QSPI_WriteAsync(pattern, address, FS_SECTOR_SIZE, done, NULL), HAL_OK);
+	wait_done();
+	check_done(NULL);
+	CHECK_EQ(stmlfs_hal_read(&stmconfig, block, 0, data, FS_SECTOR_SIZE), LFS_ERR_OK);
+	CHECK(memcmp(data, pattern, FS_SECTOR_SIZE) == 0);
+
+	memset(data, 0, sizeof(data));
+	CHECK_EQ(CSP_QSPI_ReadAsync(data, address + 100, 200, done, NULL), HAL_OK);
+	wait_done();
+	check_done(NULL);
+	CHECK(memcmp(data, pattern + 100, 200) == 0);
+
+	CHECK_EQ(stmlfs_hal_read(&stmconfig, block, 0, data, 64), LFS_ERR_OK);
+	CHECK_EQ(CSP_QSPI_EraseSectorAsync(address, done, NULL), HAL_OK);
+	wait_done();
+	check_done(NULL);
+	CHECK_EQ(stmlfs_hal_read(&stmconfig, block, 0, data, FS_SECTOR_SIZE), LFS_ERR_OK);
+	for (uint32_t i = 0; i < FS_SECTOR_SIZE; i++) {
+		if (data[i] != 0xFF) {
+			CHECK(data[i] == 0xFF);
+			break;
+		}
+	}
+
+	// littlefs still works on top
+	lfs_file_t file;
+	CHECK_EQ(stmlfs_file_open(&file, "async.bin", LFS_O_WRONLY | LFS_O_CREAT), 0);
+	CHECK_EQ(stmlfs_file_write(&file, pattern, 3000), 3000);
+	CHECK_EQ(stmlfs_file_close(&file), 0);
+	CHECK_EQ(stmlfs_file_open(&file, "async.bin", LFS_O_RDONLY), 0);
+	CHECK_EQ(stmlfs_file_read(&file, data, 3000), 3000);
+	CHECK(memcmp(data, pattern, 3000) == 0);
+	CHECK_EQ(stmlfs_file_close(&file), 0);
+	CHECK_EQ(stmlfs_unmount(), 0);
+
+	return test_done("test_async");
+}
@@ -0,0 +1,116 @@
+/*
+ * test_bcache.c
+ *
+ *  STMLFS_BCACHE on the flash model: progs stay in the cache until sync, reads of cached lines do
+ *  not reach the flash, erases drop the lines, and the write back programs in address order with
+ *  the CRC read back STMLFS_VERIFY_FULL is replaced by. A page whose cells do not take the data
+ *  (bits already programmed to 0 under it) fails the sync with LFS_ERR_CORRUPT, and later reads of
+ *  it return what the flash holds, not the data that was meant to be there. Then files written in
+ *  turns with syncs read back intact after a remount.
+ */
+
+#include "main.h"
+#include "fake_hal.h"
+#include "test.h"
+
+extern struct lfs_config stmconfig;
+
+static uint8_t pattern[FS_SECTOR_SIZE];
+static uint8_t data[FS_SECTOR_SIZE];
+
+int test_main(int argc, char **argv) {
+	struct stmlfs_cachestat_t cs;
+	uint32_t reads, progs;
+
+	(void)argc;
+	(void)argv;
+	CHECK_EQ(STMLFS_VERIFY, STMLFS_VERIFY_CRC);
+	CHECK(stmconfig.no_validate);
+	for (uint32_t i = 0; i < sizeof(pattern); i++) {
+		pattern[i] = (uint8_t)(i*3 + (i >> 8) + 1);
+	}
+	CHECK_EQ(CSP_QUADSPI_Init(), HAL_OK);
+	test_quiet(true);
+	CHECK_EQ(stmlfs_mount(true), 0);
+	test_quiet(false);
+
+	lfs_block_t block = stmconfig.block_count - 1;
+	uint32_t address = block*FS_SECTOR_SIZE;
+	uint8_t *flash = fake_flash(0) + address;
+
+	// Progs stay in RAM, reads come from the cache
+	CHECK_EQ(stmlfs_hal_erase(&stmconfig, block), LFS_ERR_OK);
+	progs = fake_stat.progs;
+	CHECK_EQ(stmlfs_hal_prog(&stmconfig, block, 0, pattern, 2048), LFS_ERR_OK);
+	CHECK_EQ(fake_stat.progs, progs);
+	CHECK_EQ(flash[0], 0xFF);
+	reads = fake_stat.reads;
+	CHECK_EQ(stmlfs_hal_read(&stmconfig, block, 256, data, 1024), LFS_ERR_OK);
+	CHECK(memcmp(data, pattern + 256, 1024) == 0);
+	CHECK_EQ(fake_stat.reads, reads);
+
+	// Sync programs the pages and reads them back
+	CHECK_EQ(stmlfs_hal_sync(&stmconfig), LFS_ERR_OK);
+	CHECK_EQ(fake_stat.progs - progs, 8);
+	CHECK(fake_stat.reads > reads);
+	CHECK(memcmp(flash, pattern, 2048) == 0);
+	CHECK_EQ(stmlfs_hal_sync(&stmconfig), LFS_ERR_OK);					// Nothing dirty left
+	CHECK_EQ(fake_stat.progs - progs, 8);
+
+	// An erase drops the cached lines
+	CHECK_EQ(stmlfs_hal_erase(&stmconfig, block), LFS_ERR_OK);
+	CHECK_EQ(stmlfs_hal_read(&stmconfig, block, 0, data, 1024), LFS_ERR_OK);
+	CHECK_EQ(data[0], 0xFF);
+	CHECK_EQ(data[1023], 0xFF);
+
+	// A failed write back leaves the lines with what the flash holds
+	CHECK_EQ(stmlfs_hal_erase(&stmconfig, block), LFS_ERR_OK);
+	CHECK_EQ(stmlfs_hal_prog(&stmconfig, block, 1024, pattern, 2048), LFS_ERR_OK);
+	flash[1024 + 300] = 0x00;											// Cells that can not return to 1
+	CHECK_EQ(stmlfs_hal_sync(&stmconfig), LFS_ERR_CORRUPT);
+	CHECK_EQ(stmlfs_hal_read(&stmconfig, block, 1024, data, 1024), LFS_ERR_OK);
+	CHECK_EQ(data[300], 0x00);
+	CHECK(memcmp(data, pattern, 300) == 0);
+	CHECK_EQ(stmlfs_hal_read(&stmconfig, block, 2048, data, 1024), LFS_ERR_OK);
+	CHECK(memcmp(data, pattern + 1024, 1024) == 0);
+	CHECK_EQ(stmlfs_hal_sync(&stmconfig), LFS_ERR_OK);					// Not retried
+	CHECK_EQ(stmlfs_hal_erase(&stmconfig, block), LFS_ERR_OK);
+	CHECK_FAKE();
+
+	// Four files written in turns, read back after a remount
+	lfs_file_t file[4];
+	char name[16];
+	for (int f = 0; f < 4; f++) {
+		sprintf(name, "log%d", f);
+		CHECK_EQ(stmlfs_file_open(&file[f], name, LFS_O_WRONLY | LFS_O_CREAT), 0);
+	}
+	for (int i = 0; i < 400; i++) {
+		CHECK_EQ(stmlfs_file_write(&file[i % 4], pattern + (i*37) % 1024, 64), 64);
+		if (i % 8 == 7) {
+			CHECK_EQ(stmlfs_fflush(&file[i % 4]), 0);
+		}
+	}
+	for (int f = 0; f < 4; f++) {
+		CHECK_EQ(stmlfs_file_close(&file[f]), 0);
+	}
+	CHECK_EQ(stmlfs_unmount(), 0);
+	test_quiet(true);
+	CHECK_EQ(stmlfs_mount(false), 0);
+	test_quiet(false);
+	for (int f = 0; f < 4; f++) {
+		sprintf(name, "log%d", f);
+		CHECK_EQ(stmlfs_file_open(&file[f], name, LFS_O_RDONLY), 0);
+		for (int i = f; i < 400; i += 4) {
+			CHECK_EQ(stmlfs_file_read(&file[f], data, 64), 64);
+			CHECK(memcmp(data, pattern + (i*37) % 1024, 64) == 0);
+		}
+		CHECK_EQ(stmlfs_file_close(&file[f]), 0);
+	}
+	stmlfs_cachestat(&cs);
+	CHECK(cs.bc_hits > 0);
+	CHECK(cs.bc_writebacks > 0);
+	CHECK_EQ(stmlfs_unmount(), 0);
+	CHECK_FAKE();
+
+	return test_done("test_bcache");
+}
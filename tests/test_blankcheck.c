@@ -0,0 +1,164 @@
+/*
+ * test_blankcheck.c
+ *
+ *  STMLFS_BLANKCHECK: a littlefs erase of a sector that reads all 0xFF is skipped, any programmed
+ *  bit, also in the last word, gets the sector erased. Built for indirect reads and for reads from
+ *  the memory mapped window, where a check after a program must not see stale window lines. Every
+ *  littlefs erase must end up issued, skipped as known erased or skipped as blank, and the files
+ *  must read back after a remount.
+ */
+
+#include "main.h"
+#include "fake_hal.h"
+#include "test.h"
+
+extern struct lfs_config stmconfig;
+
+static int (*lfs_erase)(const struct lfs_config *c, lfs_block_t block);
+static uint32_t erase_calls;
+
+static int count_erase(const struct lfs_config *c, lfs_block_t block) {
+	erase_calls++;
+	return lfs_erase(c, block);
+}
+
+static bool sector_blank(lfs_block_t block) {
+	const uint8_t *p = fake_flash(0) + block*FS_SECTOR_SIZE;
+	for (uint32_t i = 0; i < FS_SECTOR_SIZE; i++) {
+		if (p[i] != 0xFF) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// littlefs erase of a sector with one word programmed at off
+static void erase_used(lfs_block_t block, uint32_t off, uint32_t word) {
+	struct stmlfs_erasestat_t before, after;
+	uint32_t erases;
+
+	CHECK_EQ(stmlfs_hal_prog(&stmconfig, block, off, &word, 4), LFS_ERR_OK);
+	CHECK(!sector_blank(block));
+	stmlfs_erasestat(&before);
+	erases = fake_stat.erases[0];
+	CHECK_EQ(stmlfs_hal_erase(&stmconfig, block), LFS_ERR_OK);
+	stmlfs_erasestat(&after);
+	CHECK_EQ(fake_stat.erases[0], erases + 1);
+	CHECK_EQ(after.sector_erases, before.sector_erases + 1);
+	CHECK_EQ(after.blank, before.blank);
+	CHECK(sector_blank(block));
+	CHECK_FAKE();
+}
+
+int test_main(int argc, char **argv) {
+	struct stmlfs_erasestat_t stat, before;
+	uint32_t erases, reads;
+	uint64_t read_bytes;
+
+	(void)argc;
+	(void)argv;
+	CHECK_EQ(CSP_QUADSPI_Init(), HAL_OK);
+
+	// A format of a blank part erases nothing
+	test_quiet(true);
+	CHECK_EQ(stmlfs_mount(true), 0);
+	test_quiet(false);
+	stmlfs_erasestat(&stat);
+	CHECK(stat.blank >= 2);
+	CHECK_EQ(stat.sector_erases, 0);
+	CHECK_EQ(fake_stat.erases[0] + fake_stat.erases[1] + fake_stat.erases[2], 0);
+	CHECK_FAKE();
+
+	// A blank sector reads all of it, then it is known erased and not read again
+	stmlfs_erasestat(&before);
+	reads = fake_stat.reads;
+	read_bytes = fake_stat.read_bytes;
+	CHECK_EQ(stmlfs_hal_erase(&stmconfig, 100), LFS_ERR_OK);
+	stmlfs_erasestat(&stat);
+	CHECK_EQ(stat.blank, before.blank + 1);
+	CHECK_EQ(fake_stat.erases[0], 0);
+	#ifndef QSPI_MEMMAPPED_READ
+	CHECK_EQ(fake_stat.read_bytes - read_bytes, FS_SECTOR_SIZE);
+	#endif
+	reads = fake_stat.reads;
+	read_bytes = fake_stat.read_bytes;
+	CHECK_EQ(stmlfs_hal_erase(&stmconfig, 100), LFS_ERR_OK);
+	stmlfs_erasestat(&before);
+	CHECK_EQ(before.skipped, stat.skipped + 1);
+	CHECK_EQ(before.blank, stat.blank);
+	CHECK_EQ(fake_stat.reads, reads);
+	CHECK_EQ(fake_stat.read_bytes, read_bytes);
+	CHECK_FAKE();
+
+	// Programmed sectors are erased: first word, last word, a single bit in the middle
+	erase_used(100, 0, 0x12345678);
+	erase_used(101, FS_SECTOR_SIZE - 4, 0x7FFFFFFF);
+	erase_used(102, FS_SECTOR_SIZE/2, 0xFFFFFEFF);
+
+	// A used sector costs one page read, the check stops at the first programmed word
+	CHECK_EQ(stmlfs_hal_prog(&stmconfig, 103, 0, "used", 4), LFS_ERR_OK);
+	read_bytes = fake_stat.read_bytes;
+	erases = fake_stat.erases[0];
+	CHECK_EQ(stmlfs_hal_erase(&stmconfig, 103), LFS_ERR_OK);
+	CHECK_EQ(fake_stat.erases[0], erases + 1);
+	#ifndef QSPI_MEMMAPPED_READ
+	CHECK_EQ(fake_stat.read_bytes - read_bytes, FS_PAGE_SIZE);
+	#endif
+	CHECK(sector_blank(103));
+	CHECK_FAKE();
+	CHECK_EQ(stmlfs_unmount(), 0);
+
+	// littlefs on top: files written, rewritten and removed, every erase accounted for
+	lfs_file_t file;
+	uint8_t data[5000], back[5000];
+	char name[16];
+
+	lfs_erase = stmconfig.erase;
+	stmconfig.erase = count_erase;
+	stmlfs_erasestat(&before);
+	test_quiet(true);
+	CHECK_EQ(stmlfs_mount(false), 0);
+	test_quiet(false);
+	for (int round = 0; round < 6; round++) {
+		for (int f = 0; f < 8; f++) {
+			for (int i = 0; i < (int)sizeof(data); i++) {
+				data[i] = (uint8_t)(i*3 + f*11 + round);
+			}
+			sprintf(name, "f%d", f);
+			CHECK_EQ(stmlfs_file_open(&file, name, LFS_O_WRONLY | LFS_O_CREAT | LFS_O_TRUNC), 0);
+			CHECK_EQ(stmlfs_file_write(&file, data, 1000 + f*500), 1000 + f*500);
+			CHECK_EQ(stmlfs_file_close(&file), 0);
+		}
+		sprintf(name, "f%d", round);
+		CHECK_EQ(stmlfs_remove(name), 0);
+	}
+	CHECK_EQ(stmlfs_unmount(), 0);
+	test_quiet(true);
+	CHECK_EQ(stmlfs_mount(false), 0);
+	test_quiet(false);
+	for (int f = 6; f < 8; f++) {
+		for (int i = 0; i < (int)sizeof(data); i++) {
+			data[i] = (uint8_t)(i*3 + f*11 + 5);
+		}
+		sprintf(name, "f%d", f);
+		CHECK_EQ(stmlfs_file_open(&file, name, LFS_O_RDONLY), 0);
+		CHECK_EQ(stmlfs_file_read(&file, back, sizeof(back)), 1000 + f*500);
+		CHECK(memcmp(back, data, 1000 + f*500) == 0);
+		CHECK_EQ(stmlfs_file_close(&file), 0);
+	}
+	CHECK_EQ(stmlfs_unmount(), 0);
+	stmconfig.erase = lfs_erase;
+
+	stmlfs_erasestat(&stat);
+	CHECK(erase_calls > 0);
+	CHECK(stat.blank > before.blank);
+	CHECK(stat.sector_erases > before.sector_erases);
+	CHECK_EQ(erase_calls, (stat.sector_erases - before.sector_erases) + (stat.skipped - before.skipped) +
+			(stat.blank - before.blank));
+	CHECK_EQ(fake_stat.erases[0], stat.sector_erases);
+	printf("  %u littlefs erases: %u issued, %u blank, %u known erased\n", (unsigned)erase_calls,
+			(unsigned)(stat.sector_erases - before.sector_erases), (unsigned)(stat.blank - before.blank),
+			(unsigned)(stat.skipped - before.skipped));
+
+	return test_done("test_blankcheck");
+}
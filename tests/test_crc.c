@@ -0,0 +1,67 @@
+/*
+ * test_crc.c
+ *
+ *  lfs_crc of the STMLFS_CRC backend the program is built with (test_crc_nibble, _slice8, _hw)
+ *  against a bitwise reference of the littlefs CRC-32: every length up to 80 at every alignment,
+ *  running CRCs split at every point, then a littlefs format, write and remount on top.
+ */
+
+#include "main.h"
+#include "fake_hal.h"
+#include "test.h"
+
+static const char *backend[] = { "nibble", "slice8", "hw" };
+
+// Reflected 0x04C11DB7, no final xor, like lfs_crc
+static uint32_t crc_ref(uint32_t crc, const uint8_t *data, size_t size) {
+	for (size_t i = 0; i < size; i++) {
+		crc ^= data[i];
+		for (int j = 0; j < 8; j++) {
+			crc = (crc >> 1) ^ ((crc & 1) ? 0xEDB88320 : 0);
+		}
+	}
+	return crc;
+}
+
+int test_main(int argc, char **argv) {
+	static uint8_t data[4096 + 8];
+	uint32_t seed = 1;
+	lfs_file_t file;
+
+	(void)argc;
+	(void)argv;
+	for (size_t i = 0; i < sizeof(data); i++) {
+		seed = seed*1103515245 + 12345;
+		data[i] = (uint8_t)(seed >> 16);
+	}
+	printf("STMLFS_CRC_%s\n", backend[STMLFS_CRC]);
+
+	CHECK_EQ(lfs_crc(0xFFFFFFFF, "123456789", 9) ^ 0xFFFFFFFF, 0xCBF43926);	// CRC-32 check value
+	for (int align = 0; align < 8; align++) {
+		for (size_t size = 0; size <= 80; size++) {
+			CHECK_EQ(lfs_crc(0xFFFFFFFF, data + align, size), crc_ref(0xFFFFFFFF, data + align, size));
+			CHECK_EQ(lfs_crc(0x12345678, data + align, size), crc_ref(0x12345678, data + align, size));
+		}
+	}
+	for (size_t split = 0; split <= 64; split++) {
+		uint32_t crc = lfs_crc(0xFFFFFFFF, data + 3, split);
+		CHECK_EQ(lfs_crc(crc, data + 3 + split, 64 - split), crc_ref(0xFFFFFFFF, data + 3, 64));
+	}
+	CHECK_EQ(lfs_crc(0xFFFFFFFF, data + 1, 4096), crc_ref(0xFFFFFFFF, data + 1, 4096));
+
+	CHECK_EQ(CSP_QUADSPI_Init(), HAL_OK);
+	CHECK_EQ(stmlfs_mount(true), 0);
+	CHECK_EQ(stmlfs_file_open(&file, "crc", LFS_O_WRONLY | LFS_O_CREAT), 0);
+	CHECK_EQ(stmlfs_file_write(&file, data, 3000), 3000);
+	CHECK_EQ(stmlfs_file_close(&file), 0);
+	CHECK_EQ(stmlfs_unmount(), 0);
+	CHECK_EQ(stmlfs_mount(false), 0);
+	memset(data + 4096, 0, 8);
+	CHECK_EQ(stmlfs_file_open(&file, "crc", LFS_O_RDONLY), 0);
+	CHECK_EQ(stmlfs_file_read(&file, data + 4096, 8), 8);
+	CHECK(memcmp(data + 4096, data, 8) == 0);
+	CHECK_EQ(stmlfs_file_close(&file), 0);
+	CHECK_EQ(stmlfs_unmount(), 0);
+
+	return test_done("test_crc");
+}
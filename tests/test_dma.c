@@ -0,0 +1,123 @@
+/*
+ * test_dma.c
+ *
+ *  QSPI_USE_DMA: reads and programs of every alignment through MDMA with the D-Cache model in
+ *  between. Data lands in SRAM behind the cache, so a read only returns the right bytes when the
+ *  driver invalidated exactly the cache lines of the target after the transfer, and a program only
+ *  sends the right bytes when the source was cleaned first. Buffers that share a cache line with
+ *  other data must go through the bounce buffer, the guard bytes around them must survive.
+ */
+
+#include "main.h"
+#include "fake_hal.h"
+#include "test.h"
+
+#define GUARD			64
+#define AREA			0x10000
+
+static uint8_t pattern[AREA];
+static uint8_t space[GUARD + QSPI_DMA_BUFSIZE*3 + GUARD] __ALIGNED(32);
+static uint8_t source[AREA/2 + 32] __ALIGNED(32);
+
+static void read_check(uint32_t address, uint32_t offset, uint32_t size) {
+	uint8_t *buf = space + GUARD + offset;
+
+	memset(space, 0xCC, sizeof(space));
+	CHECK_EQ(CSP_QSPI_Read(buf, address, size), HAL_OK);
+	CHECK(memcmp(buf, pattern + address, size) == 0);
+	for (uint8_t *p = space; p < buf; p++) {
+		if (*p != 0xCC) {
+			printf("  guard before the %u byte read at +%u overwritten\n", (unsigned)size, (unsigned)offset);
+			CHECK(*p == 0xCC);
+			break;
+		}
+	}
+	for (uint8_t *p = buf + size; p < space + sizeof(space); p++) {
+		if (*p != 0xCC) {
+			printf("  guard after the %u byte read at +%u overwritten\n", (unsigned)size, (unsigned)offset);
+			CHECK(*p == 0xCC);
+			break;
+		}
+	}
+}
+
+int test_main(int argc, char **argv) {
+	static const uint32_t sizes[] = { 1, 31, 32, 33, 64, 100, 256, 1000, 1024, QSPI_DMA_BUFSIZE + 32, QSPI_DMA_BUFSIZE*2 + 7 };
+	static const uint32_t offsets[] = { 0, 1, 4, 31, 32 };
+	uint32_t dma, bounced;
+
+	(void)argc;
+	(void)argv;
+	for (uint32_t i = 0; i < AREA; i++) {
+		pattern[i] = (uint8_t)(i*7 + (i >> 8));
+	}
+	CHECK_EQ(CSP_QUADSPI_Init(), HAL_OK);
+	CHECK_EQ(CSP_QSPI_EraseSector(0, AREA - 1), HAL_OK);
+
+	// Programs from a buffer that is not line aligned, the clean covers it rounded out
+	memcpy(source + 5, pattern, AREA/2);
+	CHECK_EQ(CSP_QSPI_WriteMemory(source + 5, 0, AREA/2), HAL_OK);
+	CHECK_EQ(CSP_QSPI_WriteMemory(pattern + AREA/2, AREA/2, AREA/2), HAL_OK);
+	CHECK(fake_stat.dma >= AREA/256);
+	CHECK(memcmp(fake_flash(0), pattern, AREA) == 0);
+	CHECK_FAKE();
+
+	// Aligned reads go straight to the target, all others through the bounce buffer
+	for (size_t s = 0; s < sizeof(sizes)/sizeof(sizes[0]); s++) {
+		for (size_t o = 0; o < sizeof(offsets)/sizeof(offsets[0]); o++) {
+			dma = fake_stat.dma;
+			bounced = fake_stat.bounce_invalidates;
+			read_check(0x123, offsets[o], sizes[s]);
+			read_check(sizes[s] + 0x20, offsets[o], sizes[s]);
+			if (sizes[s] < QSPI_DMA_MIN_SIZE) {
+				CHECK_EQ(fake_stat.dma, dma);
+			} else {
+				CHECK(fake_stat.dma > dma);
+				CHECK(fake_stat.bounce_invalidates > bounced);
+			}
+			CHECK_FAKE();
+		}
+	}
+
+	// littlefs on top, with its unaligned cache buffers
+	lfs_file_t file;
+	uint8_t data[3000];
+	for (int i = 0; i < (int)sizeof(data); i++) {
+		data[i] = (uint8_t)(i ^ 0x5A);
+	}
+	CHECK_EQ(stmlfs_mount(true), 0);
+	CHECK_EQ(stmlfs_file_open(&file, "dma.bin", LFS_O_WRONLY | LFS_O_CREAT), 0);
+	CHECK_EQ(stmlfs_file_write(&file, data, sizeof(data)), sizeof(data));
+	CHECK_EQ(stmlfs_file_close(&file), 0);
+	CHECK_EQ(stmlfs_unmount(), 0);
+	CHECK_EQ(stmlfs_mount(false), 0);
+	memset(space, 0, sizeof(space));
+	CHECK_EQ(stmlfs_file_open(&file, "dma.bin", LFS_O_RDONLY), 0);
+	CHECK_EQ(stmlfs_file_read(&file, space + 3, sizeof(data)), sizeof(data));
+	CHECK(memcmp(space + 3, data, sizeof(data)) == 0);
+	CHECK_EQ(stmlfs_file_close(&file), 0);
+	CHECK_EQ(stmlfs_unmount(), 0);
+	CHECK_FAKE();
+
+	// The model itself: a DMA read the CPU never invalidated after the transfer is caught
+	QSPI_CommandTypeDef cmd = { 0 };
+	cmd.InstructionMode = QSPI_INSTRUCTION_1_LINE;
+	cmd.Instruction = QUAD_OUT_FAST_READ_CMD;
+	cmd.AddressMode = QSPI_ADDRESS_1_LINE;
+	cmd.AddressSize = QSPI_ADDRESS_24_BITS;
+	cmd.DataMode = QSPI_DATA_4_LINES;
+	cmd.DummyCycles = 8;
+	cmd.NbData = 64;
+	SCB_InvalidateDCache_by_Addr(space, 64);
+	CHECK_EQ(HAL_QSPI_Command(&hqspi, &cmd, HAL_QPSI_TIMEOUT_DEFAULT_VALUE), HAL_OK);
+	CHECK_EQ(HAL_QSPI_Receive_DMA(&hqspi, space), HAL_OK);
+	while (HAL_QSPI_GetState(&hqspi) != HAL_QSPI_STATE_READY) {
+		__WFI();
+	}
+	CHECK_EQ(HAL_QSPI_Command(&hqspi, &cmd, HAL_QPSI_TIMEOUT_DEFAULT_VALUE), HAL_OK);
+	CHECK(fake_errors() == 1);
+	fake_clear_errors();
+	HAL_QSPI_Abort(&hqspi);
+
+	return test_done("test_dma");
+}
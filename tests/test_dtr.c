@@ -0,0 +1,108 @@
+/*
+ * test_dtr.c
+ *
+ *  QSPI_DTR_READ on the flash model, also with the reads from the memory mapped window
+ *  (test_dtr_mapped). Parts on which both DDR hold timings, only the half clock delay, only the
+ *  analog delay or neither read correctly: init and mount calibrate, files read back, and a 64Kbyte
+ *  read takes the DTR clocks when a timing matched and the SDR clocks when none did or block 0 was
+ *  blank. The model fails any command sent with the wrong prescaler or sample shift for its mode. A
+ *  QUADSPI stuck busy fails the read after QSPI_DTR_BUSY_US instead of hanging.
+ */
+
+#include "main.h"
+#include "fake_hal.h"
+#include "test.h"
+
+#define FILES			4
+#define FILE_SIZE		50000
+#define READ_SIZE		0x10000
+
+extern struct lfs_config stmconfig;
+
+static uint8_t data[FILE_SIZE];
+static uint8_t buf[READ_SIZE];
+
+// Bus clocks of a 64Kbyte read, DTR moves a byte per clock on 4 lines, SDR takes 2
+static bool reads_dtr(void) {
+	uint64_t clocks = fake_stat.clocks;
+
+	CHECK_EQ(CSP_QSPI_Read(buf, 0x10000, READ_SIZE), HAL_OK);
+	clocks = fake_stat.clocks - clocks;
+	CHECK(clocks > READ_SIZE && clocks < READ_SIZE*2 + 1000);
+	return clocks < READ_SIZE*3/2;
+}
+
+static void run(const char *what, int hold, bool dtr) {
+	struct fake_part part = *fake_w25q64jv();
+	lfs_file_t file;
+	char name[16];
+
+	printf("  %s\n", what);
+	part.dtr_hold = hold;
+	fake_reset(&part);
+	CHECK_EQ(CSP_QUADSPI_Init(), HAL_OK);
+	CHECK(!reads_dtr());											// Block 0 is blank
+	test_quiet(true);
+	CHECK_EQ(stmlfs_mount(true), 0);
+	test_quiet(false);
+	CHECK_EQ(reads_dtr(), dtr);
+	for (int f = 0; f < FILES; f++) {
+		sprintf(name, "f%d", f);
+		data[0] = f;
+		CHECK_EQ(stmlfs_file_open(&file, name, LFS_O_WRONLY | LFS_O_CREAT), 0);
+		CHECK_EQ(stmlfs_file_write(&file, data, FILE_SIZE), FILE_SIZE);
+		CHECK_EQ(stmlfs_file_close(&file), 0);
+	}
+	CHECK_EQ(stmlfs_unmount(), 0);
+
+	// A new init calibrates on the formatted block 0
+	CHECK_EQ(CSP_QUADSPI_Init(), HAL_OK);
+	CHECK_EQ(reads_dtr(), dtr);
+	test_quiet(true);
+	CHECK_EQ(stmlfs_mount(false), 0);
+	test_quiet(false);
+	for (int f = 0; f < FILES; f++) {
+		sprintf(name, "f%d", f);
+		data[0] = f;
+		CHECK_EQ(stmlfs_file_open(&file, name, LFS_O_RDONLY), 0);
+		CHECK_EQ(stmlfs_file_read(&file, buf, FILE_SIZE), FILE_SIZE);
+		CHECK(memcmp(buf, data, FILE_SIZE) == 0);
+		CHECK_EQ(stmlfs_file_close(&file), 0);
+	}
+	CHECK_EQ(reads_dtr(), dtr);
+	CHECK_EQ(stmlfs_unmount(), 0);
+	CHECK_FAKE();
+}
+
+int test_main(int argc, char **argv) {
+	(void)argc;
+	(void)argv;
+	for (int i = 0; i < FILE_SIZE; i++) {
+		data[i] = (uint8_t)(i*29 + (i >> 9));
+	}
+	run("both hold timings", FAKE_DTR_ANY, true);
+	run("half clock delay only", FAKE_DTR_HALF_CLK, true);
+	run("analog delay only", FAKE_DTR_ANALOG, true);
+	run("no DTR timing", FAKE_DTR_NONE, false);
+
+	// BUSY stuck after a failed transfer: the read fails within QSPI_DTR_BUSY_US and leaves CR alone
+	printf("  BUSY stuck\n");
+	fake_reset(NULL);
+	CHECK_EQ(CSP_QUADSPI_Init(), HAL_OK);
+	test_quiet(true);
+	CHECK_EQ(stmlfs_mount(true), 0);
+	test_quiet(false);
+	CHECK(reads_dtr());
+	uint32_t cr = QUADSPI->CR;
+	QUADSPI->SR |= QUADSPI_SR_BUSY;
+	double start = fake_time_us();
+	CHECK_EQ(CSP_QSPI_Read(buf, 0x10000, 256), HAL_ERROR);
+	CHECK(fake_time_us() - start < QSPI_DTR_BUSY_US + 5);
+	CHECK_EQ(QUADSPI->CR, cr);
+	QUADSPI->SR &= ~QUADSPI_SR_BUSY;
+	CHECK(reads_dtr());
+	CHECK_EQ(stmlfs_unmount(), 0);
+	CHECK_FAKE();
+
+	return test_done("test_dtr");
+}
@@ -0,0 +1,108 @@
+/*
+ * test_dual.c
+ *
+ *  QSPI_DUAL_FLASH on the flash model with two W25Q64JV dies, FLASH2 the slower part (busy times
+ *  1.25 times those of FLASH1: 0.5 ms page program, 56 ms sector erase). The geometry doubles, a
+ *  sector programmed through the driver holds its even bytes in FLASH1 and its odd bytes in FLASH2
+ *  at half the address, an erase clears the sector on both dies, and every command waits for the
+ *  slower die. Then files written through littlefs read back after a remount. The model counts
+ *  commands sent to a busy die, programs and erases without WEL, odd addresses or sizes, page
+ *  wraps and misaligned erases.
+ */
+
+#include "main.h"
+#include "fake_hal.h"
+#include "test.h"
+
+#define FILES			8
+#define FILE_SIZE		100000
+
+extern struct lfs_config stmconfig;
+
+static uint8_t data[FILE_SIZE];
+static uint8_t buf[FILE_SIZE];
+
+int test_main(int argc, char **argv) {
+	struct fake_part part = *fake_w25q64jv();
+	lfs_file_t file;
+	char name[16];
+
+	(void)argc;
+	(void)argv;
+	CHECK_EQ(QSPI_DIES, 2);
+	CHECK_EQ(FS_SECTOR_SIZE, 8192);
+	CHECK_EQ(FS_PAGE_SIZE, 512);
+	part.slow[1] = 1.25;
+	fake_reset(&part);
+	CHECK_EQ(CSP_QUADSPI_Init(), HAL_OK);
+	test_quiet(true);
+	CHECK_EQ(stmlfs_mount(true), 0);
+	test_quiet(false);
+	CHECK_EQ(stmconfig.block_size, 8192);
+	CHECK_EQ(stmconfig.block_count, 2048);
+	CHECK_EQ(stmlfs_unmount(), 0);
+
+	// Even bytes on FLASH1, odd bytes on FLASH2, both at half the address
+	lfs_block_t block = 1000;
+	uint32_t address = block*FS_SECTOR_SIZE/2;
+	for (int i = 0; i < FS_SECTOR_SIZE; i++) {
+		data[i] = (uint8_t)(i*7 + (i >> 9) + 1);
+	}
+	CHECK_EQ(stmlfs_hal_erase(&stmconfig, block), LFS_ERR_OK);
+	CHECK_EQ(stmlfs_hal_prog(&stmconfig, block, 0, data, FS_SECTOR_SIZE), LFS_ERR_OK);
+	CHECK_EQ(stmlfs_hal_sync(&stmconfig), LFS_ERR_OK);
+	for (int i = 0; i < FS_SECTOR_SIZE; i++) {
+		if (fake_flash(i & 1)[address + i/2] != data[i]) {
+			CHECK_EQ(i, -1);
+			break;
+		}
+	}
+	CHECK_EQ(fake_flash(0)[address - 1], 0xff);
+	CHECK_EQ(fake_flash(1)[address + FS_SECTOR_SIZE/2], 0xff);
+	CHECK_EQ(stmlfs_hal_read(&stmconfig, block, 0, buf, FS_SECTOR_SIZE), LFS_ERR_OK);
+	CHECK(memcmp(buf, data, FS_SECTOR_SIZE) == 0);
+	CHECK_EQ(stmlfs_hal_read(&stmconfig, block, 1000, buf, 2000), LFS_ERR_OK);
+	CHECK(memcmp(buf, data + 1000, 2000) == 0);
+
+	// The erase and its status poll cover both dies, the read after it waits for FLASH2
+	double start = fake_time_us();
+	CHECK_EQ(stmlfs_hal_erase(&stmconfig, block), LFS_ERR_OK);
+	CHECK(fake_time_us() - start >= 45000*1.25);
+	CHECK_EQ(fake_flash(0)[address], 0xff);
+	CHECK_EQ(fake_flash(1)[address + FS_SECTOR_SIZE/2 - 1], 0xff);
+	CHECK_EQ(stmlfs_hal_read(&stmconfig, block, 0, buf, FS_SECTOR_SIZE), LFS_ERR_OK);
+	CHECK_EQ(buf[0], 0xff);
+	CHECK_EQ(buf[FS_SECTOR_SIZE - 1], 0xff);
+	CHECK_FAKE();
+
+	// littlefs, files read back after a remount
+	for (int i = 0; i < FILE_SIZE; i++) {
+		data[i] = (uint8_t)(i*13 + (i >> 11));
+	}
+	test_quiet(true);
+	CHECK_EQ(stmlfs_mount(true), 0);
+	test_quiet(false);
+	for (int f = 0; f < FILES; f++) {
+		sprintf(name, "f%d", f);
+		data[0] = f;
+		CHECK_EQ(stmlfs_file_open(&file, name, LFS_O_WRONLY | LFS_O_CREAT), 0);
+		CHECK_EQ(stmlfs_file_write(&file, data, FILE_SIZE - 333*f), FILE_SIZE - 333*f);
+		CHECK_EQ(stmlfs_file_close(&file), 0);
+	}
+	CHECK_EQ(stmlfs_unmount(), 0);
+	test_quiet(true);
+	CHECK_EQ(stmlfs_mount(false), 0);
+	test_quiet(false);
+	for (int f = 0; f < FILES; f++) {
+		sprintf(name, "f%d", f);
+		data[0] = f;
+		CHECK_EQ(stmlfs_file_open(&file, name, LFS_O_RDONLY), 0);
+		CHECK_EQ(stmlfs_file_read(&file, buf, FILE_SIZE), FILE_SIZE - 333*f);
+		CHECK(memcmp(buf, data, FILE_SIZE - 333*f) == 0);
+		CHECK_EQ(stmlfs_file_close(&file), 0);
+	}
+	CHECK_EQ(stmlfs_unmount(), 0);
+	CHECK_FAKE();
+
+	return test_done("test_dual");
+}
@@ -0,0 +1,162 @@
+/*
+ * test_gcstep.c
+ *
+ *  lfs_fs_gcstep with bounded_commit on a RAM image with a 2Kbyte metadata_max, counting the erases
+ *  per block. A directory filled beyond half gets its spare block erased once: commits elsewhere
+ *  restart the walk over all metadata pairs, which must not erase that spare again until the pair
+ *  has been compacted into it. The files read back after a remount. A pair lfs_fs_gcstep compacts
+ *  while a file in it is open is left erased, the next sync of the file appends to it. Without any
+ *  lfs_fs_gcstep a directory rewritten over and over is still relocated, no block takes more than
+ *  two cycles of block_cycles erases.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lfs.h"
+#include "ramdisk.h"
+#include "test.h"
+
+static lfs_t lfs;
+static struct lfs_config cfg;
+static int (*ramdisk_erase)(const struct lfs_config *c, lfs_block_t block);
+static uint32_t erases[RAMDISK_BLOCK_COUNT];
+
+static int count_erase(const struct lfs_config *c, lfs_block_t block) {
+	erases[block]++;
+	return ramdisk_erase(c, block);
+}
+
+static void write_file(const char *name) {
+	lfs_file_t file;
+
+	CHECK_EQ(lfs_file_open(&lfs, &file, name, LFS_O_WRONLY | LFS_O_CREAT | LFS_O_TRUNC), 0);
+	CHECK_EQ(lfs_file_write(&lfs, &file, name, strlen(name)), (lfs_ssize_t)strlen(name));
+	CHECK_EQ(lfs_file_close(&lfs, &file), 0);
+}
+
+// The metadata pair of a directory as fetched, pair[1] is the spare block
+static lfs_mdir_t dir_pair(const char *path) {
+	lfs_dir_t dir;
+
+	CHECK_EQ(lfs_dir_open(&lfs, &dir, path), 0);
+	CHECK_EQ(lfs_dir_close(&lfs, &dir), 0);
+	return dir.m;
+}
+
+// Steps until there is nothing left to do, returns the metadata pairs looked at
+static uint32_t gc_all(void) {
+	uint32_t checked = 0;
+	int res, steps = 0;
+
+	while ((res = lfs_fs_gcstep(&lfs)) != LFS_GC_DONE && steps++ < 1000) {
+		CHECK(res >= 0);
+		checked += res == LFS_GC_CHECKED || res == LFS_GC_COMPACTED;
+	}
+	CHECK_EQ(res, LFS_GC_DONE);
+	return checked;
+}
+
+int main(void) {
+	struct lfs_info info;
+	lfs_mdir_t half;
+	char name[32];
+
+	ramdisk_init(&cfg, 32);
+	ramdisk_erase = cfg.erase;
+	cfg.erase = count_erase;
+	cfg.metadata_max = 2048;
+	cfg.bounded_commit = true;
+	CHECK_EQ(lfs_format(&lfs, &cfg), 0);
+	CHECK_EQ(lfs_mount(&lfs, &cfg), 0);
+	CHECK_EQ(lfs_mkdir(&lfs, "half"), 0);
+	CHECK_EQ(lfs_mkdir(&lfs, "log"), 0);
+	write_file("half/a");
+	write_file("half/b");
+	half = dir_pair("half");
+	CHECK(half.off > cfg.metadata_max/2 && half.off < cfg.metadata_max - cfg.metadata_max/8);
+
+	// The first walk erases the spare of "half"
+	uint32_t before = erases[half.pair[1]];
+	CHECK(gc_all() >= 3);
+	CHECK_EQ(erases[half.pair[1]] - before, 1);
+
+	// Commits to "log" restart the walk, the spare is still erased
+	for (int i = 0; i < 8; i++) {
+		sprintf(name, "log/f%d", i);
+		write_file(name);
+		CHECK(gc_all() >= 3);
+		CHECK_EQ(erases[half.pair[1]] - before, 1);
+	}
+
+	// A compaction of "half" programs the spare, the old block is the one to erase next
+	for (int i = 0; i < 3; i++) {
+		sprintf(name, "half/c%d", i);
+		write_file(name);
+		gc_all();
+	}
+	lfs_mdir_t now = dir_pair("half");
+	CHECK_EQ(now.pair[0], half.pair[1]);
+	CHECK_EQ(lfs_unmount(&lfs), 0);
+
+	CHECK_EQ(lfs_mount(&lfs, &cfg), 0);
+	CHECK_EQ(lfs_stat(&lfs, "half/a", &info), 0);
+	CHECK_EQ(lfs_stat(&lfs, "half/c2", &info), 0);
+	for (int i = 0; i < 8; i++) {
+		sprintf(name, "log/f%d", i);
+		CHECK_EQ(lfs_stat(&lfs, name, &info), 0);
+	}
+	CHECK_EQ(lfs_unmount(&lfs), 0);
+
+	// A sync after a gcstep compaction appends instead of compacting again
+	lfs_file_t file;
+	cfg.compact_thresh = cfg.block_size*5/8;
+	CHECK_EQ(lfs_mount(&lfs, &cfg), 0);
+	CHECK_EQ(lfs_file_open(&lfs, &file, "log/open", LFS_O_WRONLY | LFS_O_CREAT | LFS_O_APPEND), 0);
+	for (int i = 0; i < 8 && file.m.off <= cfg.metadata_max*5/8; i++) {
+		CHECK_EQ(lfs_file_write(&lfs, &file, "0123456789abcdef", 16), 16);
+		CHECK_EQ(lfs_file_sync(&lfs, &file), 0);
+	}
+	CHECK(file.m.off > cfg.metadata_max*5/8);
+	lfs_block_t block = file.m.pair[0];
+	gc_all();
+	CHECK(file.m.pair[0] != block);
+	lfs_off_t off = file.m.off;
+	block = file.m.pair[0];
+	uint32_t erased = erases[file.m.pair[0]] + erases[file.m.pair[1]];
+	CHECK_EQ(lfs_file_write(&lfs, &file, "0123456789abcdef", 16), 16);
+	CHECK_EQ(lfs_file_sync(&lfs, &file), 0);
+	CHECK_EQ(file.m.pair[0], block);
+	CHECK(file.m.off > off);
+	CHECK_EQ(erases[file.m.pair[0]] + erases[file.m.pair[1]], erased);
+	CHECK_EQ(lfs_file_close(&lfs, &file), 0);
+	CHECK_EQ(lfs_unmount(&lfs), 0);
+
+	// Without lfs_fs_gcstep a commit relocates a pair a whole cycle past its relocation point, the
+	// erases of a directory rewritten over and over spread over new blocks
+	cfg.block_cycles = 10;
+	CHECK_EQ(lfs_mount(&lfs, &cfg), 0);
+	CHECK_EQ(lfs_mkdir(&lfs, "hot"), 0);
+	lfs_mdir_t hot = dir_pair("hot");
+	uint32_t start = ramdisk_stat.erases;
+	memset(erases, 0, sizeof(erases));
+	for (int i = 0; i < 100000 && ramdisk_stat.erases - start < 300; i++) {
+		write_file("hot/x");
+	}
+	CHECK(ramdisk_stat.erases - start >= 300);
+	uint32_t most = 0;
+	for (int i = 0; i < RAMDISK_BLOCK_COUNT; i++) {
+		most = erases[i] > most ? erases[i] : most;
+	}
+	CHECK(most <= 2*((uint32_t)cfg.block_cycles + 1) + 1);			// Two cycles, then relocated
+	lfs_mdir_t now_hot = dir_pair("hot");
+	CHECK(now_hot.pair[0] != hot.pair[0] && now_hot.pair[0] != hot.pair[1]);
+	printf("  %u erases without gcstep, at most %u per block\n", (unsigned)(ramdisk_stat.erases - start), (unsigned)most);
+	CHECK_EQ(lfs_unmount(&lfs), 0);
+	CHECK_EQ(lfs_mount(&lfs, &cfg), 0);
+	CHECK_EQ(lfs_stat(&lfs, "hot/x", &info), 0);
+	CHECK_EQ(lfs_stat(&lfs, "half/c2", &info), 0);
+	CHECK_EQ(lfs_unmount(&lfs), 0);
+
+	return test_done("test_gcstep");
+}
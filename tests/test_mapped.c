@@ -0,0 +1,110 @@
+/*
+ * test_mapped.c
+ *
+ *  QSPI_MEMMAPPED_READ: littlefs reads come from the memory mapped window, progs and erases leave
+ *  it. The window model only refetches cache lines that were invalidated, so data written or erased
+ *  while a stale line stays cached reads back wrong. A run of reads must not leave mapped mode,
+ *  a run of progs must not re-enter it.
+ */
+
+#include "main.h"
+#include "fake_hal.h"
+#include "test.h"
+
+#define FILES			8
+
+static uint8_t data[FILES][6000];
+static lfs_size_t sizes[FILES];
+static uint8_t buf[6000];
+
+static void fill(int f, int round) {
+	for (size_t i = 0; i < sizeof(data[f]); i++) {
+		data[f][i] = (uint8_t)(i*13 + f*31 + round*7);
+	}
+}
+
+static void write_file(int f, lfs_size_t size) {
+	lfs_file_t file;
+	char name[16];
+
+	sizes[f] = size;
+	sprintf(name, "f%d", f);
+	CHECK_EQ(stmlfs_file_open(&file, name, LFS_O_WRONLY | LFS_O_CREAT | LFS_O_TRUNC), 0);
+	CHECK_EQ(stmlfs_file_write(&file, data[f], size), size);
+	CHECK_EQ(stmlfs_file_close(&file), 0);
+}
+
+static void read_file(int f) {
+	lfs_file_t file;
+	lfs_size_t size = sizes[f];
+	char name[16];
+
+	sprintf(name, "f%d", f);
+	memset(buf, 0, sizeof(buf));
+	CHECK_EQ(stmlfs_file_open(&file, name, LFS_O_RDONLY), 0);
+	CHECK_EQ(stmlfs_file_read(&file, buf, sizeof(buf)), size);
+	CHECK(memcmp(buf, data[f], size) == 0);
+	CHECK_EQ(stmlfs_file_close(&file), 0);
+}
+
+int test_main(int argc, char **argv) {
+	uint32_t commands, mapped;
+
+	(void)argc;
+	(void)argv;
+	CHECK_EQ(CSP_QUADSPI_Init(), HAL_OK);
+	CHECK_EQ(stmlfs_mount(true), 0);
+	for (int f = 0; f < FILES; f++) {
+		fill(f, 0);
+		write_file(f, 1000 + f*600);
+	}
+	CHECK_EQ(stmlfs_unmount(), 0);
+	CHECK_EQ(HAL_QSPI_GetState(&hqspi), HAL_QSPI_STATE_READY);		// Unmount leaves indirect mode
+	CHECK_FAKE();
+
+	// Mount and read everything: one switch to mapped mode, no other command
+	CHECK_EQ(stmlfs_mount(false), 0);
+	commands = fake_stat.commands;
+	mapped = fake_stat.mapped;
+	for (int f = 0; f < FILES; f++) {
+		read_file(f);
+	}
+	CHECK(fake_stat.mapped - mapped <= 1);
+	CHECK_EQ(fake_stat.commands - commands, fake_stat.mapped - mapped);
+	CHECK_FAKE();
+
+	// Rewrites and removes between reads, every read must see the new contents
+	for (int round = 1; round <= 6; round++) {
+		for (int f = round % 2; f < FILES; f += 2) {
+			fill(f, round);
+			write_file(f, 500 + (f*round*701) % 5000);
+			read_file(f);
+			read_file((f + 1) % FILES);
+		}
+		CHECK_FAKE();
+	}
+	CHECK_EQ(stmlfs_remove("f0"), 0);
+	CHECK_EQ(stmlfs_trim(), 0);										// Erases of free blocks
+	fill(0, 9);
+	write_file(0, 4000);
+	read_file(0);
+	CHECK_EQ(stmlfs_unmount(), 0);
+	CHECK_FAKE();
+
+	// The model itself: a program without a D-Cache invalidate leaves the old line in the window
+	static uint8_t page[256] __ALIGNED(32);
+	memset(page, 0x42, sizeof(page));
+	CHECK_EQ(CSP_QSPI_EraseSector(0x7F0000, 0x7F0FFF), HAL_OK);
+	CHECK_EQ(CSP_QSPI_EnableMemoryMappedMode(), HAL_OK);
+	SCB_InvalidateDCache_by_Addr((void *)(QSPI_MAPPED_BASE + 0x7F0000), 256);
+	CHECK_EQ(*(volatile uint8_t *)(QSPI_MAPPED_BASE + 0x7F0000), 0xFF);
+	CHECK_EQ(HAL_QSPI_Abort(&hqspi), HAL_OK);
+	CHECK_EQ(CSP_QSPI_WriteMemory(page, 0x7F0000, sizeof(page)), HAL_OK);
+	CHECK_EQ(CSP_QSPI_EnableMemoryMappedMode(), HAL_OK);
+	CHECK_EQ(*(volatile uint8_t *)(QSPI_MAPPED_BASE + 0x7F0000), 0xFF);
+	SCB_InvalidateDCache_by_Addr((void *)(QSPI_MAPPED_BASE + 0x7F0000), 256);
+	CHECK_EQ(*(volatile uint8_t *)(QSPI_MAPPED_BASE + 0x7F0000), 0x42);
+	CHECK_EQ(HAL_QSPI_Abort(&hqspi), HAL_OK);
+
+	return test_done("test_mapped");
+}
@@ -0,0 +1,137 @@
+/*
+ * test_preerase.c
+ *
+ *  stmlfs_preerase and stmlfs_trim under power cuts. Each boot runs in a forked child so the driver
+ *  starts with the RAM state of a reset, the flash contents live in shared memory and survive. A
+ *  logging workload with pre-erases between the writes is cut in the middle of its n-th program or
+ *  erase for a growing n, the cut operation is left half done. The next boot must mount, find every
+ *  file complete in its old or new version (or empty when the cut write created it), and keep
+ *  writing and pre-erasing without errors.
+ */
+
+#include <unistd.h>
+#include <sys/wait.h>
+#include "main.h"
+#include "fake_hal.h"
+#include "test.h"
+
+#define FILES			6
+#define RECORD			700
+
+struct header {
+	uint32_t file, version, size, crc;
+};
+
+static uint8_t buf[RECORD*8 + sizeof(struct header)];
+
+static uint32_t fill(uint8_t *data, uint32_t file, uint32_t version, uint32_t size) {
+	for (uint32_t i = 0; i < size; i++) {
+		data[i] = (uint8_t)(file*17 + version*5 + i);
+	}
+	return lfs_crc(0xFFFFFFFF, data, size);
+}
+
+static void write_file(uint32_t f, uint32_t version) {
+	struct header h = { f, version, RECORD*(1 + (f + version) % 8), 0 };
+	lfs_file_t file;
+	char name[16];
+
+	h.crc = fill(buf + sizeof(h), f, version, h.size);
+	memcpy(buf, &h, sizeof(h));
+	sprintf(name, "log%u", (unsigned)f);
+	CHECK_EQ(stmlfs_file_open(&file, name, LFS_O_WRONLY | LFS_O_CREAT | LFS_O_TRUNC), 0);
+	CHECK_EQ(stmlfs_file_write(&file, buf, sizeof(h) + h.size), sizeof(h) + h.size);
+	CHECK_EQ(stmlfs_file_close(&file), 0);
+}
+
+// Every file that exists is complete: its header matches its size and its data its CRC
+static uint32_t check_files(void) {
+	uint32_t newest = 0;
+
+	for (uint32_t f = 0; f < FILES; f++) {
+		struct header h;
+		lfs_file_t file;
+		char name[16];
+		int n;
+
+		sprintf(name, "log%u", (unsigned)f);
+		if (stmlfs_file_open(&file, name, LFS_O_RDONLY) != 0) {
+			continue;
+		}
+		n = stmlfs_file_read(&file, buf, sizeof(buf));
+		CHECK_EQ(stmlfs_file_close(&file), 0);
+		if (n == 0) {
+			continue;												// Created, cut before the first close
+		}
+		memcpy(&h, buf, sizeof(h));
+		CHECK(n >= (int)sizeof(h) && h.file == f && h.size == (uint32_t)n - sizeof(h));
+		if (n >= (int)sizeof(h) && h.size == (uint32_t)n - sizeof(h)) {
+			CHECK_EQ(lfs_crc(0xFFFFFFFF, buf + sizeof(h), h.size), h.crc);
+			newest = h.version > newest ? h.version : newest;
+		}
+	}
+	return newest;
+}
+
+static void workload(uint32_t version) {
+	for (int i = 0; i < 24; i++) {
+		write_file((version + i) % FILES, version + i);
+		CHECK(stmlfs_preerase(i % 3) >= 0);
+		if (i == 12) {
+			CHECK_EQ(stmlfs_remove("log5"), 0);
+			CHECK_EQ(stmlfs_trim(), 0);
+		}
+	}
+}
+
+// One boot in a child process, returns its exit status
+static int boot(uint32_t cut_after, bool format) {
+	pid_t pid = fork();
+	int status;
+
+	if (pid == 0) {
+		uint32_t version;
+		int err;
+
+		fake_powercut(cut_after);
+		CHECK_EQ(CSP_QUADSPI_Init(), HAL_OK);
+		test_quiet(true);
+		err = stmlfs_mount(format);
+		test_quiet(false);
+		CHECK_EQ(err, 0);
+		version = check_files() + 1;
+		workload(version);
+		CHECK_EQ(check_files(), version + 23);
+		CHECK_EQ(stmlfs_unmount(), 0);
+		CHECK_FAKE();
+		fflush(stdout);
+		_exit(test_failures != 0);
+	}
+	waitpid(pid, &status, 0);
+	return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+int test_main(int argc, char **argv) {
+	int cuts = 0, status;
+
+	(void)argc;
+	(void)argv;
+	CHECK_EQ(boot(0, true), 0);
+	for (uint32_t n = 1; ; n += 7) {
+		status = boot(n, false);
+		if (status == 0) {
+			break;													// The workload ended before the cut
+		}
+		CHECK_EQ(status, FAKE_POWERCUT_EXIT);
+		status = boot(0, false);									// Recovery boot, no cut
+		CHECK_EQ(status, 0);
+		if (status != 0) {
+			printf("  after a power cut in program/erase %u\n", (unsigned)n);
+			break;
+		}
+		cuts++;
+	}
+	CHECK(cuts > 20);
+	printf("%d power cuts\n", cuts);
+	return test_done("test_preerase");
+}
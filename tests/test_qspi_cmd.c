@@ -0,0 +1,58 @@
+/*
+ * test_qspi_cmd.c
+ *
+ *  qspi_cmd_read and qspi_cmd_clocks for the 9 read commands the driver sends, against the W25Q64JV
+ *  and W25Q256JV datasheets: instruction, address, mode and data lines, address bytes, mode and
+ *  dummy clocks, DTR, and the clocks from chip select low to the last byte of a 256 and a 1 byte
+ *  read. The descriptors are those sfdp_parse returns for the W25Q64JV tables (0xBB with 2 mode
+ *  and 2 wait clocks) and the driver defaults for DTR and QPI mode.
+ */
+
+#include <stdio.h>
+#include "qspi_cmd.h"
+#include "test.h"
+
+static const struct {
+	const char *name;
+	struct sfdp_read_t read;
+	enum sfdp_readmode mode;
+	uint8_t address_bytes;
+	struct qspi_cmd_t want;
+	uint32_t clocks256, clocks1;
+} reads[] = {
+	//                                                    instr lines addr  mode dummy data dtr
+	{ "0x0B 1-1-1", { 0x0B, 8, 0 }, SFDP_READ_111, 3,     { 0x0B, 1, 1, 3, 0, 8, 1, false }, 8+24+8+2048, 8+24+8+8 },
+	{ "0x3B 1-1-2", { 0x3B, 8, 0 }, SFDP_READ_112, 3,     { 0x3B, 1, 1, 3, 0, 8, 2, false }, 8+24+8+1024, 8+24+8+4 },
+	{ "0xBB 1-2-2", { 0xBB, 4, 2 }, SFDP_READ_122, 3,     { 0xBB, 1, 2, 3, 4, 0, 2, false }, 8+12+4+1024, 8+12+4+4 },
+	{ "0x6B 1-1-4", { 0x6B, 8, 0 }, SFDP_READ_114, 3,     { 0x6B, 1, 1, 3, 0, 8, 4, false }, 8+24+8+512, 8+24+8+2 },
+	{ "0xEB 1-4-4", { 0xEB, 6, 2 }, SFDP_READ_144, 3,     { 0xEB, 1, 4, 3, 2, 4, 4, false }, 8+6+6+512, 8+6+6+2 },
+	{ "0xED 1-4-4 DTR", { 0xED, 8, 1 }, SFDP_READ_144_DTR, 3, { 0xED, 1, 4, 3, 1, 7, 4, true }, 8+3+8+256, 8+3+8+1 },
+	{ "0xEB 4-4-4 QPI", { 0xEB, 6, 2 }, SFDP_READ_444, 3, { 0xEB, 4, 4, 3, 2, 4, 4, false }, 2+6+6+512, 2+6+6+2 },
+	{ "0xEC 1-4-4 4-byte", { 0xEC, 6, 2 }, SFDP_READ_144, 4, { 0xEC, 1, 4, 4, 2, 4, 4, false }, 8+8+6+512, 8+8+6+2 },
+	{ "0xEE 1-4-4 DTR 4-byte", { 0xEE, 8, 1 }, SFDP_READ_144_DTR, 4, { 0xEE, 1, 4, 4, 1, 7, 4, true }, 8+4+8+256, 8+4+8+1 },
+};
+
+int main(void) {
+	struct qspi_cmd_t cmd;
+
+	for (unsigned i = 0; i < sizeof(reads)/sizeof(reads[0]); i++) {
+		int failures = test_failures;
+
+		qspi_cmd_read(&cmd, &reads[i].read, reads[i].mode, reads[i].address_bytes);
+		CHECK_EQ(cmd.instruction, reads[i].want.instruction);
+		CHECK_EQ(cmd.instruction_lines, reads[i].want.instruction_lines);
+		CHECK_EQ(cmd.address_lines, reads[i].want.address_lines);
+		CHECK_EQ(cmd.address_bytes, reads[i].want.address_bytes);
+		CHECK_EQ(cmd.mode, reads[i].want.mode);
+		CHECK_EQ(cmd.dummy, reads[i].want.dummy);
+		CHECK_EQ(cmd.data_lines, reads[i].want.data_lines);
+		CHECK_EQ(cmd.dtr, reads[i].want.dtr);
+		CHECK_EQ(qspi_cmd_clocks(&cmd, 256), reads[i].clocks256);
+		CHECK_EQ(qspi_cmd_clocks(&cmd, 1), reads[i].clocks1);
+		if (test_failures != failures) {
+			printf("  in %s\n", reads[i].name);
+		}
+	}
+
+	return test_done("test_qspi_cmd");
+}
@@ -0,0 +1,153 @@
+/*
+ * test_sfdp.c
+ *
+ *  sfdp_parse against captured and constructed SFDP areas: the W25Q64JV dump shown in README.md,
+ *  the same BFPT patched into a 32Mbyte part with 4-byte addressing and a 4-byte address
+ *  instruction table, plus a vendor table that must be skipped. Checks density, page size, erase
+ *  types with opcodes and times, read modes with their mode and dummy clocks, the 4-byte opcodes,
+ *  and the errors for a missing signature, a BFPT outside the buffer and unusable geometry.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "sfdp.h"
+#include "test.h"
+
+// W25Q64JV, as read by QSPI_ReadSFDP, the rows at 0x10-0x7F and 0xC0-0xFF read 0xFF
+static const uint8_t w25q64jv_head[16] = {
+	'S', 'F', 'D', 'P', 0x05, 0x01, 0x00, 0xff, 0x00, 0x05, 0x01, 0x10, 0x80, 0x00, 0x00, 0xff,
+};
+static const uint8_t w25q64jv_bfpt[64] = {
+	0xe5, 0x20, 0xf9, 0xff, 0xff, 0xff, 0xff, 0x03, 0x44, 0xeb, 0x08, 0x6b, 0x08, 0x3b, 0x42, 0xbb,
+	0xfe, 0xff, 0xff, 0xff, 0xff, 0xff, 0x00, 0x00, 0xff, 0xff, 0x40, 0xeb, 0x0c, 0x20, 0x0f, 0x52,
+	0x10, 0xd8, 0x00, 0x00, 0x36, 0x02, 0xa6, 0x00, 0x82, 0xea, 0x14, 0xc4, 0xe9, 0x63, 0x76, 0x33,
+	0x7a, 0x75, 0x7a, 0x75, 0xf7, 0xa2, 0xd5, 0x5c, 0x19, 0xf7, 0x4d, 0xff, 0xe9, 0x30, 0xf8, 0x80,
+};
+
+static uint8_t sfdp[256];
+
+static void w25q64jv(void) {
+	memset(sfdp, 0xff, sizeof(sfdp));
+	memcpy(sfdp, w25q64jv_head, sizeof(w25q64jv_head));
+	memcpy(sfdp + 0x80, w25q64jv_bfpt, sizeof(w25q64jv_bfpt));
+}
+
+static void put_dword(uint8_t *p, uint32_t dw) {
+	p[0] = dw;
+	p[1] = dw >> 8;
+	p[2] = dw >> 16;
+	p[3] = dw >> 24;
+}
+
+// 32Mbyte (W25Q256 class): 3 or 4 address bytes, 0xB7 or the 4-byte opcodes, 4BAIT at 0xC0 and a
+// vendor table at 0xD0 listed before it
+static void w25q256(void) {
+	static const uint8_t headers[16] = {
+		0x00, 0x00, 0x01, 0x02, 0xd0, 0x00, 0x00, 0xef,				// Vendor table, ID 0xEF00
+		0x84, 0x00, 0x01, 0x02, 0xc0, 0x00, 0x00, 0xff,				// 4BAIT, ID 0xFF84, 2 DWORDs
+	};
+
+	w25q64jv();
+	sfdp[6] = 2;													// 3 parameter headers
+	memcpy(sfdp + 0x10, headers, sizeof(headers));
+	sfdp[0x80 + 2] |= 0x02;											// DWORD1 bits 18:17 = 01, 3 or 4 bytes
+	put_dword(sfdp + 0x80 + 4, 0x0fffffff);							// DWORD2, 256Mbit
+	sfdp[0x80 + 63] = 0xa1;											// DWORD16 bits 31:24, 0xB7 and 4-byte opcodes
+	put_dword(sfdp + 0xc0, 0x0efe);									// 0x0C 0x3C 0xBC 0x6C 0xEC 0x12 0x34, erase types 1-3
+	put_dword(sfdp + 0xc4, 0x00dc5c21);
+	put_dword(sfdp + 0xd0, 0);
+}
+
+static void check_read(const struct sfdp_flash_t *flash, enum sfdp_readmode mode, uint8_t cmd, uint8_t dummy, uint8_t mclk) {
+	CHECK_EQ(flash->read[mode].cmd, cmd);
+	CHECK_EQ(flash->read[mode].dummy, dummy);
+	CHECK_EQ(flash->read[mode].mode, mclk);
+}
+
+static void check_erase(const struct sfdp_flash_t *flash, int i, uint32_t size, uint8_t cmd, uint8_t cmd4, uint32_t typ_ms) {
+	CHECK_EQ(flash->erase[i].size, size);
+	CHECK_EQ(flash->erase[i].cmd, cmd);
+	CHECK_EQ(flash->erase[i].cmd4, cmd4);
+	CHECK_EQ(flash->erase[i].typ_ms, typ_ms);
+	CHECK_EQ(flash->erase[i].max_ms, typ_ms*14);					// DWORD10 bits 3:0 = 6
+}
+
+int main(void) {
+	struct sfdp_flash_t flash;
+
+	// The README dump
+	w25q64jv();
+	CHECK_EQ(sfdp_parse(sfdp, sizeof(sfdp), &flash), SFDP_OK);
+	CHECK_EQ(flash.major, 1);
+	CHECK_EQ(flash.minor, 5);
+	CHECK_EQ(flash.size, 8*1024*1024);
+	CHECK_EQ(flash.page_size, 256);
+	CHECK_EQ(flash.addr_bytes, SFDP_ADDR_3);
+	CHECK_EQ(flash.enter4, 0);
+	CHECK_EQ(flash.cmds4, 0);
+	CHECK(flash.dtr);
+	check_read(&flash, SFDP_READ_111, 0x0b, 8, 0);
+	check_read(&flash, SFDP_READ_112, 0x3b, 8, 0);
+	check_read(&flash, SFDP_READ_122, 0xbb, 4, 2);
+	check_read(&flash, SFDP_READ_114, 0x6b, 8, 0);
+	check_read(&flash, SFDP_READ_144, 0xeb, 6, 2);
+	check_read(&flash, SFDP_READ_222, 0, 0, 0);
+	check_read(&flash, SFDP_READ_444, 0xeb, 2, 2);
+	check_erase(&flash, 0, 4096, 0x20, 0, 64);
+	check_erase(&flash, 1, 32768, 0x52, 0, 128);
+	check_erase(&flash, 2, 65536, 0xd8, 0, 160);
+	CHECK_EQ(flash.erase[3].size, 0);
+	CHECK_EQ(flash.prog_typ_us, 704);
+	CHECK_EQ(flash.prog_max_us, 704*6);
+	CHECK_EQ(sfdp_fastest_read(&flash), SFDP_READ_144);
+	CHECK(sfdp_erase_find(&flash, 32768) == &flash.erase[1]);
+	CHECK(sfdp_erase_find(&flash, 8192) == NULL);
+
+	// A 32Mbyte part with the 4-byte address instruction table
+	w25q256();
+	CHECK_EQ(sfdp_parse(sfdp, sizeof(sfdp), &flash), SFDP_OK);
+	CHECK_EQ(flash.size, 32*1024*1024);
+	CHECK_EQ(flash.addr_bytes, SFDP_ADDR_3OR4);
+	CHECK_EQ(flash.enter4, SFDP_ENTER4_B7 | SFDP_ENTER4_OPCODES);
+	CHECK_EQ(flash.cmds4 & 0xff, SFDP_4B_FAST_READ_111 | SFDP_4B_READ_112 | SFDP_4B_READ_122 | SFDP_4B_READ_114
+			| SFDP_4B_READ_144 | SFDP_4B_PROG_111 | SFDP_4B_PROG_114);
+	CHECK_EQ(flash.cmds4 & SFDP_4B_DTR_READ_144, 0);
+	check_erase(&flash, 0, 4096, 0x20, 0x21, 64);
+	check_erase(&flash, 1, 32768, 0x52, 0x5c, 128);
+	check_erase(&flash, 2, 65536, 0xd8, 0xdc, 160);
+	check_read(&flash, SFDP_READ_144, 0xeb, 6, 2);
+
+	// The 4BAIT outside the buffer is ignored, the BFPT still parses
+	CHECK_EQ(sfdp_parse(sfdp, 0xc0, &flash), SFDP_OK);
+	CHECK_EQ(flash.size, 32*1024*1024);
+	CHECK_EQ(flash.cmds4, 0);
+	CHECK_EQ(flash.erase[0].cmd4, 0);
+
+	// A higher BFPT minor revision is preferred
+	w25q64jv();
+	sfdp[6] = 1;
+	memcpy(sfdp + 0x10, (const uint8_t[8]){ 0x00, 0x06, 0x01, 0x09, 0xc0, 0x00, 0x00, 0xff }, 8);
+	memcpy(sfdp + 0xc0, w25q64jv_bfpt, 36);							// 9 DWORDs, JESD216 rev 1.0
+	CHECK_EQ(sfdp_parse(sfdp, sizeof(sfdp), &flash), SFDP_OK);
+	CHECK_EQ(flash.minor, 6);
+	CHECK_EQ(flash.size, 8*1024*1024);
+	CHECK_EQ(flash.page_size, 256);
+	CHECK_EQ(flash.prog_typ_us, 0);
+	CHECK_EQ(flash.erase[0].typ_ms, 0);
+
+	// Errors
+	w25q64jv();
+	sfdp[0] = 'X';
+	CHECK_EQ(sfdp_parse(sfdp, sizeof(sfdp), &flash), SFDP_ERR_SIGNATURE);
+	w25q64jv();
+	CHECK_EQ(sfdp_parse(sfdp, 0x80, &flash), SFDP_ERR_TABLE);
+	CHECK_EQ(sfdp_parse(sfdp, 8, &flash), SFDP_ERR_SIGNATURE);
+	sfdp[0x80 + 28] = 0x08;											// Erase type 1 of 256 bytes
+	sfdp[0x80 + 40] = 0x92;											// Page of 512 bytes, larger than it
+	CHECK_EQ(sfdp_parse(sfdp, sizeof(sfdp), &flash), SFDP_ERR_GEOMETRY);
+	w25q64jv();
+	put_dword(sfdp + 0x80 + 4, 0x80000040);							// 2^64 bits
+	CHECK_EQ(sfdp_parse(sfdp, sizeof(sfdp), &flash), SFDP_ERR_GEOMETRY);
+
+	return test_done("test_sfdp");
+}
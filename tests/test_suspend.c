@@ -0,0 +1,131 @@
+/*
+ * test_suspend.c
+ *
+ *  QSPI_SUSPEND_RESUME: reads issued from QSPI_BusyCallback() while a 4K, 32K or 64K erase or a page
+ *  program runs. A read outside the range being changed suspends the operation, returns the right
+ *  data and resumes it, the model fails a read of a busy die, a suspend sooner than tSUS after a
+ *  resume and a read of the suspended range. A read of the range being changed waits for the
+ *  operation instead. Reads on every status poll must not starve the erase.
+ */
+
+#include "main.h"
+#include "fake_hal.h"
+#include "test.h"
+
+#define DATA			0x10000											// Pattern read by the callback
+#define TARGET			0x40000											// Erased and programmed
+#define READ_SIZE		64
+
+static uint8_t pattern[DATA];
+static uint8_t source[0x2000];
+static uint32_t read_address;
+static bool active, read_target;
+static uint32_t callbacks, reads, bad;
+
+void QSPI_BusyCallback(void) {
+	uint8_t data[READ_SIZE];
+
+	callbacks++;
+	if (!active) {
+		return;
+	}
+	if (read_target) {													// Once, it waits for the operation
+		read_target = false;
+		if (CSP_QSPI_Read(data, TARGET, sizeof(data)) != HAL_OK) {
+			bad++;
+		}
+		for (int i = 0; i < READ_SIZE; i++) {
+			if (data[i] != 0xFF) {
+				bad++;
+				break;
+			}
+		}
+		return;
+	}
+	read_address = (read_address + 0x1234) % (DATA - READ_SIZE);
+	if (CSP_QSPI_Read(data, read_address, sizeof(data)) != HAL_OK || memcmp(data, pattern + read_address, sizeof(data))) {
+		bad++;
+	}
+	reads++;
+}
+
+static void erase_check(const char *name, uint8_t (*erase)(uint32_t), uint32_t size, double typical_us) {
+	uint32_t suspends;
+	double start;
+
+	CHECK_EQ(CSP_QSPI_WriteMemory(source, TARGET, sizeof(source)), HAL_OK);
+	suspends = fake_stat.suspends;
+	reads = 0;
+	start = fake_time_us();
+	CHECK_EQ(erase(TARGET), HAL_OK);
+	printf("  %s erase: %u reads, %u suspends, %.1f ms\n", name, (unsigned)reads,
+			(unsigned)(fake_stat.suspends - suspends), (fake_time_us() - start)/1000);
+	CHECK(reads > 100);
+	CHECK(reads - (fake_stat.suspends - suspends) <= 1);				// The erase can end before the last one
+	CHECK_EQ(fake_stat.resumes, fake_stat.suspends);
+	CHECK(fake_time_us() - start < typical_us*4);						// Progress between the suspends
+	for (uint32_t i = 0; i < size; i++) {
+		if (fake_flash(0)[TARGET + i] != 0xFF) {
+			CHECK(fake_flash(0)[TARGET + i] == 0xFF);
+			break;
+		}
+	}
+	CHECK_EQ(bad, 0);
+	CHECK_FAKE();
+}
+
+static uint8_t erase_sector(uint32_t address) {
+	return CSP_QSPI_EraseSector(address, address);
+}
+
+int test_main(int argc, char **argv) {
+	const struct fake_part *part = fake_w25q64jv();
+
+	(void)argc;
+	(void)argv;
+	for (uint32_t i = 0; i < DATA; i++) {
+		pattern[i] = (uint8_t)(i*13 + (i >> 9));
+	}
+	for (uint32_t i = 0; i < sizeof(source); i++) {
+		source[i] = (uint8_t)(i ^ 0xA5);
+	}
+	CHECK_EQ(CSP_QUADSPI_Init(), HAL_OK);
+	CHECK_EQ(CSP_QSPI_WriteMemory(pattern, 0, DATA), HAL_OK);
+	CHECK_FAKE();
+	active = true;
+
+	// Reads on every status poll, spaced by tSUS after each resume
+	erase_check("4K", erase_sector, 0x1000, part->erase_us[0]);
+	erase_check("32K", CSP_QSPI_EraseBlock32, 0x8000, part->erase_us[1]);
+	erase_check("64K", CSP_QSPI_EraseBlock, 0x10000, part->erase_us[2]);
+
+	// Page programs are suspended too, the data still lands
+	uint32_t suspends = fake_stat.suspends;
+	reads = 0;
+	CHECK_EQ(CSP_QSPI_WriteMemory(source, TARGET, sizeof(source)), HAL_OK);
+	CHECK(reads > 0);
+	CHECK(fake_stat.suspends > suspends);
+	CHECK(memcmp(fake_flash(0) + TARGET, source, sizeof(source)) == 0);
+	CHECK_EQ(bad, 0);
+	CHECK_FAKE();
+
+	// A read of the sector being erased waits for the erase, no suspend
+	suspends = fake_stat.suspends;
+	read_target = true;
+	CHECK_EQ(CSP_QSPI_EraseSector(TARGET, TARGET), HAL_OK);
+	CHECK(!read_target);
+	CHECK_EQ(fake_stat.suspends, suspends);
+	CHECK_EQ(bad, 0);
+	CHECK_FAKE();
+
+	// Reads outside an operation go straight to the flash
+	uint8_t data[READ_SIZE];
+	suspends = fake_stat.suspends;
+	callbacks = 0;
+	CHECK_EQ(CSP_QSPI_Read(data, 0x100, sizeof(data)), HAL_OK);
+	CHECK(memcmp(data, pattern + 0x100, sizeof(data)) == 0);
+	CHECK_EQ(fake_stat.suspends, suspends);
+	CHECK_EQ(callbacks, 0);
+
+	return test_done("test_suspend");
+}
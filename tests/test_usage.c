@@ -0,0 +1,177 @@
+/*
+ * test_usage.c
+ *
+ *  LFS_USAGE_COUNTER: 3000 random creates, overwrites, appends with and without a sync in between,
+ *  writes in the middle, truncates, removes, renames, directory creates and removes and writes
+ *  through two handles of one file, on a RAM image. After every operation lfs_fs_usagecheck()
+ *  compares the count against a traversal, every 500 operations the filesystem is remounted. Run
+ *  without and with lookahead_snapshot, which saves the count at unmount, and checks that
+ *  lfs_fs_size does not read the flash once the count is known.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lfs.h"
+#include "ramdisk.h"
+#include "test.h"
+
+#define OPERATIONS		3000
+
+static lfs_t lfs;
+static struct lfs_config cfg;
+static uint8_t data[70000];
+static uint32_t seed = 7;
+
+static uint32_t next_random(void) {
+	seed ^= seed << 13;
+	seed ^= seed >> 17;
+	seed ^= seed << 5;
+	return seed;
+}
+
+// Errors an operation on a random path may return
+static void check_err(int err, int allowed1, int allowed2) {
+	if (err < 0 && err != allowed1 && err != allowed2) {
+		CHECK_EQ(err, 0);
+	}
+}
+
+static void operation(void) {
+	char path[32], other[32], dir[8];
+	lfs_file_t file, file2;
+	int err;
+
+	if (next_random() % 4) {
+		sprintf(path, "/d%u/f%u", (unsigned)(1 + next_random() % 3), (unsigned)(next_random() % 25));
+	} else {
+		sprintf(path, "/f%u", (unsigned)(next_random() % 25));
+	}
+	sprintf(other, "/d%u/f%u", (unsigned)(1 + next_random() % 3), (unsigned)(next_random() % 25));
+	sprintf(dir, "/d%u", (unsigned)(1 + next_random() % 3));
+
+	switch (next_random() % 12) {
+	case 0: case 1: case 2:												// Create or overwrite
+		err = lfs_file_open(&lfs, &file, path, LFS_O_WRONLY | LFS_O_CREAT | LFS_O_TRUNC);
+		check_err(err, LFS_ERR_NOENT, 0);
+		if (err == 0) {
+			lfs_size_t size = next_random() % (next_random() % 3 ? 9000 : sizeof(data));
+			CHECK_EQ(lfs_file_write(&lfs, &file, data, size), size);
+			CHECK_EQ(lfs_file_close(&lfs, &file), 0);
+		}
+		break;
+	case 3: case 4:														// Append, sometimes with a sync in between
+		err = lfs_file_open(&lfs, &file, path, LFS_O_WRONLY | LFS_O_CREAT | LFS_O_APPEND);
+		check_err(err, LFS_ERR_NOENT, 0);
+		if (err == 0) {
+			lfs_size_t size = next_random() % 12000;
+			CHECK_EQ(lfs_file_write(&lfs, &file, data, size), size);
+			if (next_random() % 2) {
+				CHECK_EQ(lfs_file_sync(&lfs, &file), 0);
+			}
+			size = next_random() % 3000;
+			CHECK_EQ(lfs_file_write(&lfs, &file, data, size), size);
+			CHECK_EQ(lfs_file_close(&lfs, &file), 0);
+		}
+		break;
+	case 5:																// Write in the middle
+		err = lfs_file_open(&lfs, &file, path, LFS_O_RDWR);
+		check_err(err, LFS_ERR_NOENT, 0);
+		if (err == 0) {
+			lfs_soff_t size = lfs_file_size(&lfs, &file);
+			if (size > 0) {
+				lfs_size_t n = next_random() % 5000;
+				CHECK(lfs_file_seek(&lfs, &file, next_random() % size, LFS_SEEK_SET) >= 0);
+				CHECK_EQ(lfs_file_write(&lfs, &file, data, n), n);
+			}
+			CHECK_EQ(lfs_file_close(&lfs, &file), 0);
+		}
+		break;
+	case 6:																// Shrink or grow
+		err = lfs_file_open(&lfs, &file, path, LFS_O_RDWR);
+		check_err(err, LFS_ERR_NOENT, 0);
+		if (err == 0) {
+			lfs_soff_t size = lfs_file_size(&lfs, &file);
+			size = (next_random() % 2) ? (size ? next_random() % size : 0) : size + next_random() % 8000;
+			CHECK_EQ(lfs_file_truncate(&lfs, &file, size), 0);
+			CHECK_EQ(lfs_file_close(&lfs, &file), 0);
+		}
+		break;
+	case 7:
+		check_err(lfs_remove(&lfs, path), LFS_ERR_NOENT, 0);
+		break;
+	case 8:
+		check_err(lfs_rename(&lfs, path, other), LFS_ERR_NOENT, 0);
+		break;
+	case 9:
+		check_err(lfs_mkdir(&lfs, dir), LFS_ERR_EXIST, 0);
+		break;
+	case 10:															// A directory and its files
+		for (int i = 0; i < 25; i++) {
+			sprintf(path, "%s/f%d", dir, i);
+			check_err(lfs_remove(&lfs, path), LFS_ERR_NOENT, 0);
+		}
+		check_err(lfs_remove(&lfs, dir), LFS_ERR_NOENT, 0);
+		break;
+	case 11:															// Two handles on one file
+		err = lfs_file_open(&lfs, &file, path, LFS_O_RDWR | LFS_O_CREAT);
+		check_err(err, LFS_ERR_NOENT, 0);
+		if (err == 0) {
+			lfs_size_t n1 = next_random() % 20000, n2 = next_random() % 20000;
+			CHECK_EQ(lfs_file_open(&lfs, &file2, path, LFS_O_RDWR), 0);
+			CHECK_EQ(lfs_file_write(&lfs, &file, data, n1), n1);
+			CHECK(lfs_file_seek(&lfs, &file2, 0, LFS_SEEK_END) >= 0);
+			CHECK_EQ(lfs_file_write(&lfs, &file2, data, n2), n2);
+			CHECK_EQ(lfs_file_close(&lfs, &file), 0);
+			CHECK_EQ(lfs_file_close(&lfs, &file2), 0);
+		}
+		break;
+	}
+}
+
+static void run(bool snapshot) {
+	uint32_t reads, mismatches = 0;
+	lfs_ssize_t size;
+
+	ramdisk_init(&cfg, 32);
+	cfg.lookahead_snapshot = snapshot;
+	CHECK_EQ(lfs_format(&lfs, &cfg), 0);
+	CHECK_EQ(lfs_mount(&lfs, &cfg), 0);
+	CHECK(lfs_fs_size(&lfs) > 0);
+	for (int i = 0; i < OPERATIONS; i++) {
+		operation();
+		mismatches += lfs_fs_usagecheck(&lfs) != 0;
+		if (i % 500 == 499) {
+			CHECK_EQ(lfs_unmount(&lfs), 0);
+			CHECK_EQ(lfs_mount(&lfs, &cfg), 0);
+			reads = ramdisk_stat.reads;
+			size = lfs_fs_size(&lfs);
+			CHECK(size > 0);
+			if (snapshot) {
+				CHECK_EQ(ramdisk_stat.reads, reads);						// Count restored from the snapshot
+			}
+			mismatches += lfs_fs_usagecheck(&lfs) != 0;
+		}
+	}
+	CHECK_EQ(mismatches, 0);
+
+	size = lfs_fs_size(&lfs);
+	reads = ramdisk_stat.reads;
+	for (int i = 0; i < 100; i++) {
+		CHECK_EQ(lfs_fs_size(&lfs), size);
+	}
+	CHECK_EQ(ramdisk_stat.reads, reads);
+	printf("  %s: %d operations, %d blocks used, %u count mismatches\n",
+			snapshot ? "lookahead_snapshot" : "no snapshot", OPERATIONS, (int)size, (unsigned)mismatches);
+	CHECK_EQ(lfs_unmount(&lfs), 0);
+}
+
+int main(void) {
+	for (uint32_t i = 0; i < sizeof(data); i++) {
+		data[i] = (uint8_t)next_random();
+	}
+	run(false);
+	run(true);
+
+	return test_done("test_usage");
+}